@@ -1,22 +1,35 @@
 #pragma once
 
 #include "common.h"
+#include "alloc/numa.h"
+#include "alloc/trace.h"
 
 namespace wjp{
 
+// chunk的来源，缺省（空指针）为malloc64/free。free时给回分配时的字节数。
+// NumaChunkPool借它把Arena的chunk放到指定的NUMA节点上。
+struct ChunkSource{
+    char* (*alloc)(void* ctx, ub8 bytes);
+    void  (*free)(void* ctx, char* p, ub8 bytes);
+    void* ctx;
+};
+
 class Arena{
 public:
     static const int kSmallShift = 3; // 判断是否单独分配chunk的启发式线索
     
-    // Arena的chunk默认大小为4页，需根据具体应用调整。
-    Arena(ub4 chunkCapacity = 4*kPageSize): chunkCapacity(chunkCapacity){}
+    // Arena的chunk默认大小为4页，需根据具体应用调整。source须比Arena活得长。
+    Arena(ub4 chunkCapacity = 4*kPageSize, const ChunkSource* source = nullptr): chunkCapacity(chunkCapacity), source(source){
+        WJP_ALLOC_TRACE_EVENT(kArenaCreate, this, nullptr, chunkCapacity);
+    }
 
     // Arena不存在free接口，内存在Arena对象析构时统一回收。
     ~Arena(){
+        WJP_ALLOC_TRACE_EVENT(kArenaDestroy, this, nullptr, 0);
         while (currentChunk){
             auto tofree=currentChunk;
             currentChunk = currentChunk->next;
-            std::free(tofree);
+            freeChunkMemory(tofree);
         }
     }
 
@@ -25,36 +38,10 @@ public:
     // 2. 溢出时，对大型对象独立分配等尺寸chunk，链入链表第二位。
     // 3. 对其他对象分配常规尺寸chunk，把对象放入新chunk开头，并将新chunk替换为链表头。
     char* alloc(ub4 size){
-        if (!size) return nullptr;
-        size = ALIGN(size);
-        if (!currentChunk || currentSize + size > chunkCapacity){
-            if (size < (chunkCapacity >> kSmallShift)){
-                if (auto p = malloc64(chunkCapacity)){
-                    chunk* new_chunk = new(p) chunk;
-                    new_chunk->next  = currentChunk;
-                    currentChunk     = new_chunk;
-                    currentSize      = size + kChunkSize;
-                    return p + kChunkSize;
-                }else return nullptr;
-            }else{
-                if (!currentChunk){
-                    if (auto p = malloc64(chunkCapacity)){
-                        currentChunk    = new(p) chunk;
-                        currentSize     = kChunkSize;
-                    }else return nullptr;
-                }
-                if (auto p = malloc64(size + kChunkSize)){
-                    chunk* new_chunk    = new(p) chunk;
-                    new_chunk->next     = currentChunk->next;
-                    currentChunk->next  = new_chunk;
-                    return p + kChunkSize;
-                }else return nullptr;
-            }
-        }else{
-            auto p = currentPointer();
-            currentSize += size;
-            return p;
-        }
+        WJP_PROFILE_SCOPE("Arena::alloc");
+        char* p = allocate(size);
+        WJP_ALLOC_TRACE_EVENT(kArenaAlloc, this, p, size);
+        return p;
     }
 
     // 空间增长规则如下：
@@ -70,11 +57,12 @@ public:
         if (oldptr + oldlen == currentPointer()){
             if (currentSize + newlen - oldlen <= chunkCapacity){
                 currentSize += newlen - oldlen;
+                WJP_ALLOC_TRACE_EVENT(kArenaExtend, this, oldptr, newlen - oldlen);
                 return oldptr;
             }
         }
         if (char* newptr = alloc(newlen)){
-            if (oldlen) std::memcpy(newptr, oldptr, oldlen);
+            if (oldlen) cpuKernels().copy(newptr, oldptr, oldlen);
             return newptr;
         }else return nullptr;
     }
@@ -87,13 +75,60 @@ private:
 
     struct chunk{
         chunk* next = 0;
+        ub8    bytes = 0; // 整个chunk的字节数，归还给source时要用
     };
 
     static const ub8 kChunkSize = ALIGN(sizeof(chunk)); 
 
-    ub4         currentSize = 0;
-    chunk*      currentChunk = 0;
-    ub4         chunkCapacity; 
+    char* newChunkMemory(ub8 bytes){
+        return source ? source->alloc(source->ctx, bytes) : malloc64((ub4)bytes);
+    }
+
+    void freeChunkMemory(chunk* c){
+        if (source) source->free(source->ctx, (char*)c, c->bytes);
+        else std::free(c);
+    }
+
+    char* allocate(ub4 size){
+        if (!size) return nullptr;
+        size = ALIGN(size);
+        if (!currentChunk || currentSize + size > chunkCapacity){
+            if (size < (chunkCapacity >> kSmallShift)){
+                if (auto p = newChunkMemory(chunkCapacity)){
+                    chunk* new_chunk = new(p) chunk;
+                    new_chunk->next  = currentChunk;
+                    new_chunk->bytes = chunkCapacity;
+                    currentChunk     = new_chunk;
+                    currentSize      = size + kChunkSize;
+                    return p + kChunkSize;
+                }else return nullptr;
+            }else{
+                if (!currentChunk){
+                    if (auto p = newChunkMemory(chunkCapacity)){
+                        currentChunk        = new(p) chunk;
+                        currentChunk->bytes = chunkCapacity;
+                        currentSize         = kChunkSize;
+                    }else return nullptr;
+                }
+                if (auto p = newChunkMemory(size + kChunkSize)){
+                    chunk* new_chunk    = new(p) chunk;
+                    new_chunk->next     = currentChunk->next;
+                    new_chunk->bytes    = size + kChunkSize;
+                    currentChunk->next  = new_chunk;
+                    return p + kChunkSize;
+                }else return nullptr;
+            }
+        }else{
+            auto p = currentPointer();
+            currentSize += size;
+            return p;
+        }
+    }
+
+    ub4                 currentSize = 0;
+    chunk*              currentChunk = 0;
+    ub4                 chunkCapacity; 
+    const ChunkSource*  source;
 };
 
 
@@ -115,18 +150,25 @@ protected:
 public:
     static const int kSmallShift = 3; // 判断是否单独分配chunk的启发式线索
     
-    // 
+    // 5级页表的机器上缓冲区地址可能超过48位，此时高16位无法借用，直接报错。
     UserBufferArena(char* userBuffer, ub2 userBufferSize, ub4 chunkCapacity = 4*kPageSize) : chunkCapacity(chunkCapacity)
     {
+        if (!fitsIn48(userBuffer)) throw std::runtime_error("user buffer address exceeds 48 bits");
         currentChunk = (chunk*) userBuffer;
         currentChunk = assign16(currentChunk, userBufferSize);
+        WJP_ALLOC_TRACE_EVENT(kArenaCreate, this, nullptr, chunkCapacity);
+        WJP_ALLOC_TRACE_EVENT(kArenaUserBuffer, this, userBuffer, userBufferSize);
     }   
 
     // 使用与Arena一致的构造函数，则UserBufferArena的行为会与Arena一致。
-    UserBufferArena(ub4 chunkCapacity = 4*kPageSize): chunkCapacity(chunkCapacity){}
+    UserBufferArena(ub4 chunkCapacity = 4*kPageSize): chunkCapacity(chunkCapacity){
+        WJP_ALLOC_TRACE_EVENT(kArenaCreate, this, nullptr, chunkCapacity);
+    }
 
-    // 用户缓冲区无需free，因此和Arena的析构恰好一致。
+    // 用户缓冲区无需free；仍在用user buffer时currentChunk带着标记，不能当chunk链表遍历。
     ~UserBufferArena(){
+        WJP_ALLOC_TRACE_EVENT(kArenaDestroy, this, nullptr, 0);
+        if (userBufferCapacity()) return;
         while (currentChunk){
             auto tofree=currentChunk;
             currentChunk = currentChunk->next;
@@ -141,6 +183,51 @@ public:
     //    使之处于Arena初始态并继续以Arena::alloc初次分配的方式处理此次分配。
     //    用户缓冲就此舍弃。
     char* alloc(ub4 size){
+        WJP_PROFILE_SCOPE("UserBufferArena::alloc");
+        char* p = allocate(size);
+        WJP_ALLOC_TRACE_EVENT(kArenaAlloc, this, p, size);
+        return p;
+    }
+
+    // 空间增长规则如下：
+    // 1. 禁止缩小。
+    // 2. 传入的旧指针若为nullptr，则视为一次新的alloc。
+    // 3. 传入的旧指针若为最近分配的那个，则尝试直接利用后续空间。
+    //    但这里需要注意根据是否在用user buffer决定capacity值。
+    // 4. 后续空间不足或并非最近分配的指针，则重新alloc并简单复制。
+    char* grow(char* oldptr, ub4 oldlen, ub4 newlen){
+        if (!oldptr) return alloc(newlen);
+        if (!newlen) return nullptr;
+        if (newlen <= oldlen) return oldptr;
+        oldlen = ALIGN(oldlen), newlen = ALIGN(newlen);
+        if (oldptr + oldlen == currentPointer()){
+            auto ubcap = userBufferCapacity();
+            ub4 currentCapacity = ubcap ? ubcap : chunkCapacity;
+            if (currentSize + newlen - oldlen <= currentCapacity){
+                currentSize += newlen - oldlen;
+                WJP_ALLOC_TRACE_EVENT(kArenaExtend, this, oldptr, newlen - oldlen);
+                return oldptr;
+            }
+        }
+        if (char* newptr = alloc(newlen)){
+            if (oldlen) cpuKernels().copy(newptr, oldptr, oldlen);
+            return newptr;
+        }else return nullptr;
+    }
+
+private:
+    UserBufferArena(const UserBufferArena&) = delete;
+    UserBufferArena& operator=(const UserBufferArena&) = delete;
+
+    inline char* currentPointer(){ return (char*)currentChunk + currentSize; }
+
+    struct chunk{
+        chunk* next = 0;
+    };
+
+    static const ub8 kChunkSize = ALIGN(sizeof(chunk)); 
+
+    char* allocate(ub4 size){
         if (!size) return nullptr;
         size = ALIGN(size);
         // 先检验是否在使用user buffer。
@@ -185,49 +272,205 @@ public:
             return p;
         }
     }
+    
+    ub4         currentSize = 0; 
+    // currentChunk指向user buffer时，前16位存其大小，顺便用于标识目前正在
+    // 使用user buffer；当它指向Arena构造的chunk时，行为与Arena中一致。
+    chunk*      currentChunk = 0; 
+    ub4         chunkCapacity; 
+};
 
-    // 空间增长规则如下：
-    // 1. 禁止缩小。
-    // 2. 传入的旧指针若为nullptr，则视为一次新的alloc。
-    // 3. 传入的旧指针若为最近分配的那个，则尝试直接利用后续空间。
-    //    但这里需要注意根据是否在用user buffer决定capacity值。
-    // 4. 后续空间不足或并非最近分配的指针，则重新alloc并简单复制。
-    char* grow(char* oldptr, ub4 oldlen, ub4 newlen){
-        if (!oldptr) return alloc(newlen);
-        if (!newlen) return nullptr;
-        if (newlen <= oldlen) return oldptr;
-        oldlen = ALIGN(oldlen), newlen = ALIGN(newlen);
-        if (oldptr + oldlen == currentPointer()){
-            auto ubcap = userBufferCapacity();
-            ub4 currentCapacity = ubcap ? ubcap : chunkCapacity;
-            if (currentSize + newlen - oldlen <= currentCapacity){
-                currentSize += newlen - oldlen;
-                return oldptr;
+
+// 多线程共享的Arena，供无锁结构（如跳表）的节点分配。
+// 1. 常规分配：对当前chunk的已用量做fetch_add，不加锁；越界则说明chunk用完，
+//    加锁换一个新chunk后重试。多个线程同时越界时只有一个会真正换chunk，
+//    旧chunk尾部的零头直接丢弃。
+// 2. 大型对象与Arena一样单独分配等尺寸chunk，这条路径加锁。
+// 3. 没有grow：并发下“最近分配的那个”没有意义。
+class ConcurrentArena{
+public:
+    static const int kSmallShift = 3;
+
+    ConcurrentArena(ub4 chunkCapacity = 4*kPageSize, const ChunkSource* source = nullptr)
+        : chunkCapacity(chunkCapacity), source(source){}
+
+    ~ConcurrentArena(){
+        while (chunks){
+            auto tofree = chunks;
+            chunks = chunks->next;
+            if (source) source->free(source->ctx, (char*)tofree, tofree->bytes);
+            else std::free(tofree);
+        }
+    }
+
+    char* alloc(ub4 size){
+        WJP_PROFILE_SCOPE("ConcurrentArena::alloc");
+        if (!size) return nullptr;
+        size = ALIGN(size);
+        if (size >= (chunkCapacity >> kSmallShift)){
+            std::lock_guard<std::mutex> guard(lock);
+            chunk* c = newChunk(size + kChunkSize);
+            return c ? (char*)c + kChunkSize : nullptr;
+        }
+        for (;;){
+            chunk* c = current.load(std::memory_order_acquire);
+            if (c){
+                ub8 offset = c->used.fetch_add(size, std::memory_order_relaxed);
+                if (offset + size <= chunkCapacity) return (char*)c + offset;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            if (current.load(std::memory_order_relaxed) == c){
+                chunk* n = newChunk(chunkCapacity);
+                if (!n) return nullptr;
+                current.store(n, std::memory_order_release);
             }
         }
-        if (char* newptr = alloc(newlen)){
-            if (oldlen) std::memcpy(newptr, oldptr, oldlen);
-            return newptr;
-        }else return nullptr;
     }
 
-private:
-    UserBufferArena(const UserBufferArena&) = delete;
-    UserBufferArena& operator=(const UserBufferArena&) = delete;
+    // 向系统申请的总字节数，含chunk尾部的零头。
+    ub8 memoryUsage() const { return allocated.load(std::memory_order_relaxed); }
 
-    inline char* currentPointer(){ return (char*)currentChunk + currentSize; }
+private:
+    ConcurrentArena(const ConcurrentArena&) = delete;
+    ConcurrentArena& operator=(const ConcurrentArena&) = delete;
 
     struct chunk{
-        chunk* next = 0;
+        chunk*           next = 0;
+        std::atomic<ub8> used{0};
+        ub8              bytes = 0;
     };
 
-    static const ub8 kChunkSize = ALIGN(sizeof(chunk)); 
-    
-    ub4         currentSize = 0; 
-    // currentChunk指向user buffer时，前16位存其大小，顺便用于标识目前正在
-    // 使用user buffer；当它指向Arena构造的chunk时，行为与Arena中一致。
-    chunk*      currentChunk = 0; 
-    ub4         chunkCapacity; 
+    static const ub8 kChunkSize = ALIGN(sizeof(chunk));
+
+    // 调用者持锁。
+    chunk* newChunk(ub8 bytes){
+        auto p = source ? source->alloc(source->ctx, bytes) : malloc64((ub4)bytes);
+        if (!p) return nullptr;
+        chunk* c = new(p) chunk;
+        c->bytes = bytes;
+        c->used.store(kChunkSize, std::memory_order_relaxed);
+        c->next = chunks;
+        chunks = c;
+        allocated.fetch_add(bytes, std::memory_order_relaxed);
+        return c;
+    }
+
+    std::atomic<chunk*> current{nullptr};
+    std::atomic<ub8>    allocated{0};
+    std::mutex          lock;
+    chunk*              chunks = 0;
+    ub4                 chunkCapacity;
+    const ChunkSource*  source;
+};
+
+
+// 按NUMA节点缓存chunk的池，通过source()接到Arena/ConcurrentArena上：
+//   NumaChunkPool pool;
+//   Arena arena(4*kPageSize, pool.source());
+// 1. 本地模式下chunk绑定在申请线程所在的节点上；交错模式下按页交错落在所有节点上，
+//    给各节点线程共享的只读为主的表用。
+// 2. chunk都是mmap来的整页，在第一次写之前就mbind好。
+// 3. 归还的chunk按实际所在节点（get_mempolicy查询）挂回该节点的缓存，下次同节点、
+//    同尺寸的申请直接复用，免去mmap与缺页；每个节点缓存超过上限的部分直接munmap。
+// 多线程安全，每个节点一把锁。
+class NumaChunkPool{
+public:
+    explicit NumaChunkPool(bool interleave = false, ub8 maxCachedBytesPerNode = 64 << 20)
+        : interleave(interleave), maxCached(maxCachedBytesPerNode), nodes(numaNodeCount()),
+          caches(new NodeCache[nodes]){
+        src.alloc = allocChunk;
+        src.free = freeChunk;
+        src.ctx = this;
+    }
+
+    ~NumaChunkPool(){
+        for (ub4 n = 0; n < nodes; n++){
+            for (FreeChunk* c = caches[n].head; c;){
+                FreeChunk* next = c->next;
+                numaFreePages((char*)c, c->bytes);
+                c = next;
+            }
+        }
+    }
+
+    const ChunkSource* source() const { return &src; }
+
+    char* alloc(ub8 bytes){
+        bytes = pageRound(bytes);
+        ub4 node = interleave ? 0 : currentNumaNode() % nodes;
+        NodeCache& cache = caches[node];
+        {
+            std::lock_guard<std::mutex> guard(cache.lock);
+            for (FreeChunk** p = &cache.head; *p; p = &(*p)->next){
+                if ((*p)->bytes == bytes){
+                    FreeChunk* c = *p;
+                    *p = c->next;
+                    cache.bytes -= bytes;
+                    return (char*)c;
+                }
+            }
+        }
+        return numaAllocPages(bytes, interleave ? NumaPlacement::interleave() : NumaPlacement::bind(node));
+    }
+
+    void free(char* p, ub8 bytes){
+        bytes = pageRound(bytes);
+        ub4 node = 0;
+        if (!interleave){
+            sb4 n = numaNodeOf(p);
+            node = n < 0 ? 0 : (ub4)n % nodes;
+        }
+        NodeCache& cache = caches[node];
+        {
+            std::lock_guard<std::mutex> guard(cache.lock);
+            if (cache.bytes + bytes <= maxCached){
+                auto c = (FreeChunk*)p;
+                c->next = cache.head;
+                c->bytes = bytes;
+                cache.head = c;
+                cache.bytes += bytes;
+                return;
+            }
+        }
+        numaFreePages(p, bytes);
+    }
+
+    // 各节点缓存着的字节数之和。
+    ub8 cachedBytes(){
+        ub8 total = 0;
+        for (ub4 n = 0; n < nodes; n++){
+            std::lock_guard<std::mutex> guard(caches[n].lock);
+            total += caches[n].bytes;
+        }
+        return total;
+    }
+
+private:
+    NumaChunkPool(const NumaChunkPool&) = delete;
+    NumaChunkPool& operator=(const NumaChunkPool&) = delete;
+
+    struct FreeChunk{
+        FreeChunk* next;
+        ub8        bytes;
+    };
+
+    struct NodeCache{
+        std::mutex lock;
+        FreeChunk* head = nullptr;
+        ub8        bytes = 0;
+    };
+
+    static ub8 pageRound(ub8 bytes){ return (bytes + kPageSize - 1) & ~(ub8)(kPageSize - 1); }
+
+    static char* allocChunk(void* ctx, ub8 bytes){ return ((NumaChunkPool*)ctx)->alloc(bytes); }
+
+    static void freeChunk(void* ctx, char* p, ub8 bytes){ ((NumaChunkPool*)ctx)->free(p, bytes); }
+
+    bool                         interleave;
+    ub8                          maxCached;
+    ub4                          nodes;
+    std::unique_ptr<NodeCache[]> caches;
+    ChunkSource                  src;
 };
 
 
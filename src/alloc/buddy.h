@@ -1,6 +1,12 @@
 #pragma once
 
 #include "common.h"
+#include "alloc/numa.h"
+#include "alloc/trace.h"
+
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 namespace wjp{
 
@@ -15,16 +21,18 @@ public:
     ub1     first   : 1; // first node in list
     ub1     last    : 1; // last node in list
     ub1     left    : 1; // left buddy
-    ub1     magic3  : 4; 
+    ub1     used    : 1; // handed out to the user by alloc
+    ub1     magic3  : 3; 
     static const ub1 kMagicNumber1 = 0x0a;
     static const ub1 kMagicNumber2 = 0x0b;
-    static const ub1 kMagicNumber3 = 0x0c;
+    static const ub1 kMagicNumber3 = 0x04;
 
     void init(ub1 order, char* startaddr){
         this->order = order;
         this->free = 1;
         this->first = 0;
         this->last = 0;
+        this->used = 0;
         this->left = isLeftBuddy(startaddr) ? 1 : 0;
         this->magic1 = kMagicNumber1;
         this->magic2 = kMagicNumber2;
@@ -58,15 +66,21 @@ public:
         return buddy;
     }
 
+    // 先写好后半块的块头再缩小自己：任何时刻从区域开头按块长逐块走下去，
+    // 碰到的块头都是有效的，持久模式的恢复依赖这一点。
     BuddyBlock* split(char* startaddr){
         assert(free == 0);
+        BuddyBlock* secondhalf = (BuddyBlock*)((char*)this + (blockSize() >> 1));
+        secondhalf->init(order - 1, startaddr);
         order--;
         left = isLeftBuddy(startaddr) ? 1 : 0;
-        BuddyBlock* secondhalf = (BuddyBlock*)((char*)this + blockSize());
-        secondhalf->init(order, startaddr);
         return secondhalf;
     }
 
+    bool valid() const {
+        return magic1 == kMagicNumber1 && magic2 == kMagicNumber2 && magic3 == kMagicNumber3;
+    }
+
     // merge with right buddy
     void grow(char* startaddr){
         assert(free == 0);
@@ -85,50 +99,319 @@ public:
     static const int kMaxOrder = 10;
     static const int kMaxPagesPerBlock = (1 << kMaxOrder);
 
-    BuddySystem(ub4 maxpages){
-        startaddr = (char*) malloc64(maxpages << kPageSizeOrder);
-        if (!startaddr) throw std::runtime_error("malloc64 error");
+    // 整个区域按页对齐，allocPages给出的块可直接用于O_DIRECT。
+    // 给出placement时区域改由numaAllocPages分配，在format第一次写之前就绑好节点；
+    // 否则物理页落在构造线程所在的节点上。
+    BuddySystem(ub4 maxpages, NumaPlacement placement = NumaPlacement::none()){
+        if (placement.policy != NumaPolicy::kDefault){
+            numaBytes = (ub8)maxpages << kPageSizeOrder;
+            startaddr = numaAllocPages(numaBytes, placement);
+        }else startaddr = mallocPage((ub8)maxpages << kPageSizeOrder);
+        if (!startaddr) throw std::runtime_error("mallocPage error");
+        pinnedStorage.assign(maxpages, ub1(kNotPinned));
+        pinned = pinnedStorage.data();
+        format(maxpages);
+        WJP_ALLOC_TRACE_EVENT(kBuddyCreate, this, startaddr, maxpages);
+    }
+
+    // 持久模式：区域是mmap进来的文件，块链接本来就是相对startaddr的页号，
+    // 文件映射到哪个地址都能直接用。文件布局：
+    //   [superblock 1页][pinned表，每页一字节，按页取整][区域maxpages页]
+    // 1. 文件不存在或为空时按maxpages新建；已存在时maxpages传0即沿用文件里的值。
+    // 2. 正常析构会把各阶空闲链表头写进superblock并标记clean，下次打开直接映射即用。
+    // 3. 非正常退出（进程崩溃）后打开，按块长从头走一遍区域、重建空闲链表，
+    //    走的过程不信任任何链表指针，只看块头：used为1或在pinned表里的是用户的块，
+    //    其余都是空闲块。分配、释放中途崩溃的，效果是这次操作没发生。
+    // 4. 掉电或内核崩溃时，只有sync()之后的状态落了盘；两次sync之间崩溃，
+    //    恢复时若发现块头损坏会抛异常，而不是给出一个可能重复分配的区域。
+    // 分配到的块要挂到用户自己的持久结构上才算数，根可以记在setRoot里；
+    // 分配返回后、挂上之前崩溃，这块会泄漏。
+    BuddySystem(const std::string& path, ub4 maxpages){
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) throw std::runtime_error("open error: " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0){
+            ::close(fd);
+            throw std::runtime_error("fstat error: " + path);
+        }
+        // magic为0说明上次格式化没做完，当新文件重来
+        bool fresh = st.st_size == 0;
+        if (!fresh){
+            Superblock sb;
+            if (pread(fd, &sb, sizeof(sb), 0) != (ssize_t)sizeof(sb)){
+                ::close(fd);
+                throw std::runtime_error("buddy: short region file: " + path);
+            }
+            if (sb.magic == 0){
+                fresh = true;
+            }else if (sb.magic != kSuperMagic || sb.version != kVersion){
+                ::close(fd);
+                throw std::runtime_error("buddy: not a buddy region file: " + path);
+            }else{
+                maxpages = sb.maxpages;
+            }
+        }
+        if (!maxpages){
+            ::close(fd);
+            throw std::runtime_error("buddy: maxpages required for a new region file");
+        }
+        ub8 pinnedPages = ((ub8)maxpages + kPageSize - 1) >> kPageSizeOrder;
+        mapsize = (1 + pinnedPages + maxpages) << kPageSizeOrder;
+        if (fresh || (ub8)st.st_size < mapsize){
+            // 预先分配而不是ftruncate出空洞，免得写映射时磁盘满触发SIGBUS
+            if (posix_fallocate(fd, 0, mapsize) != 0){
+                ::close(fd);
+                throw std::runtime_error("posix_fallocate error: " + path);
+            }
+        }
+        void* p = mmap(nullptr, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED){
+            ::close(fd);
+            throw std::runtime_error("mmap error: " + path);
+        }
+        mapaddr = (char*)p;
+        super = (Superblock*)mapaddr;
+        pinned = (ub1*)(mapaddr + kPageSize);
+        startaddr = mapaddr + ((1 + pinnedPages) << kPageSizeOrder);
+
+        try{
+            attach(fresh, maxpages);
+        }catch (...){
+            munmap(mapaddr, mapsize);
+            ::close(fd);
+            throw;
+        }
+        WJP_ALLOC_TRACE_EVENT(kBuddyCreate, this, startaddr, maxpages);
+    }
+
+    ~BuddySystem(){
+        WJP_ALLOC_TRACE_EVENT(kBuddyDestroy, this, startaddr, 0);
+        if (mapaddr){
+            // 析构里不抛异常，msync失败只是没标上clean，下次打开走恢复
+            for (size_t i = 0; i < bank.size(); i++){
+                super->heads[i] = bank[i] ? (ub8)bank[i]->offsetInPages(startaddr) + 1 : 0;
+            }
+            if (msync(mapaddr, mapsize, MS_SYNC) == 0){
+                super->clean = 1;
+                msync(mapaddr, kPageSize, MS_SYNC);
+            }
+            munmap(mapaddr, mapsize);
+            ::close(fd);
+        }else if (numaBytes){
+            numaFreePages(startaddr, numaBytes);
+        }else{
+            std::free(startaddr);
+        }
+    }
+
+    char* alloc(ub4 size){
+        WJP_PROFILE_SCOPE("BuddySystem::alloc");
+        char* p = allocBlock(size);
+        WJP_ALLOC_TRACE_EVENT(kBuddyAlloc, this, p, size);
+        return p;
+    }
+
+    void free(char* ptr){
+        WJP_PROFILE_SCOPE("BuddySystem::free");
+        WJP_ALLOC_TRACE_EVENT(kBuddyFree, this, ptr, 0);
+        BuddyBlock* block = (BuddyBlock*)(ptr - 8);
+        block->used = 0; // 第一步就收回
+        release(block);
+    }
+
+    // 按整页分配，返回的地址就是块首，页对齐且整块都归用户。
+    // 块头被用户数据覆盖，块的阶记录在区域外的pinned表里，必须用freePages归还。
+    char* allocPages(ub8 size){
+        WJP_PROFILE_SCOPE("BuddySystem::allocPages");
+        char* p = allocPageBlock(size);
+        WJP_ALLOC_TRACE_EVENT(kBuddyAllocPages, this, p, size);
+        return p;
+    }
+
+    void freePages(char* ptr){
+        WJP_PROFILE_SCOPE("BuddySystem::freePages");
+        WJP_ALLOC_TRACE_EVENT(kBuddyFreePages, this, ptr, 0);
+        ub4 page = (ub4)((ptr - startaddr) >> kPageSizeOrder);
+        assert(pinned[page] != kNotPinned);
+        BuddyBlock* block = (BuddyBlock*)ptr;
+        block->init(pinned[page], startaddr);
+        block->free = 0;
+        pinned[page] = kNotPinned;
+        release(block);
+    }
+
+    // 整个区域，供io_uring注册固定缓冲区等用途。
+    char* regionAddress() const { return startaddr; }
+
+    ub8 regionSize() const { return endaddr - startaddr; }
+
+    bool contains(const char* ptr) const { return ptr >= startaddr && ptr < endaddr; }
+
+    // 以下供持久模式使用。区域里的结构之间只能存偏移，不能存指针。
+    bool persistent() const { return mapaddr != nullptr; }
+
+    ub8 toOffset(const char* ptr) const { return ptr - startaddr; }
+
+    char* fromOffset(ub8 offset) const { return startaddr + offset; }
+
+    // 用户数据的根，记在superblock里随文件持久化；0表示没有。
+    ub8 root() const { return super ? super->root : 0; }
+
+    void setRoot(ub8 offset){
+        if (!super) throw std::runtime_error("buddy: setRoot on a non-persistent region");
+        super->root = offset;
+    }
+
+    // 把映射的脏页刷到盘上，掉电后至少能回到这一刻的状态。
+    void sync(){
+        if (mapaddr && msync(mapaddr, mapsize, MS_SYNC) != 0) throw std::runtime_error("msync error");
+    }
+
+    // 抹掉region文件的clean标记，下次打开走恢复，等同于上次sync之后崩溃。
+    // 供测试和基准模拟掉电；调用时文件不能正被打开。
+    static void markUnclean(const std::string& path){
+        int f = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (f < 0) throw std::runtime_error("open error: " + path);
+        ub8 zero = 0;
+        ssize_t n = pwrite(f, &zero, sizeof(zero), offsetof(Superblock, clean));
+        ::close(f);
+        if (n != sizeof(zero)) throw std::runtime_error("pwrite error: " + path);
+    }
+
+private:
+    BuddySystem(const BuddySystem&) = delete;
+    BuddySystem& operator=(const BuddySystem&) = delete;
+
+    static const ub1 kNotPinned = 0xff;
+    static const ub8 kSuperMagic = UB8(0x57504a42, 0x55444459); // "YDDUBJPW"
+    static const ub4 kVersion = 1;
+
+    struct Superblock{
+        ub8 magic;
+        ub4 version;
+        ub4 maxpages;
+        ub8 root;
+        ub8 clean;
+        ub8 heads[kMaxOrder + 1]; // 各阶空闲链表头的页号加一，0为空；只在clean时有效
+    };
+
+    // 映射之后：新文件格式化，旧文件按clean标记决定直接装载链表头还是走恢复。
+    void attach(bool fresh, ub4 maxpages){
+        if (fresh){
+            std::memset(pinned, kNotPinned, maxpages);
+            format(maxpages);
+            super->maxpages = maxpages;
+            super->version = kVersion;
+            super->root = 0;
+            super->clean = 0;
+            sync();
+            super->magic = kSuperMagic; // 最后写magic：格式化到一半崩溃的文件不会被当成有效区域
+            sync();
+        }else{
+            endaddr = startaddr + ((ub8)maxpages << kPageSizeOrder);
+            bank.assign(maxOrderFor(maxpages) + 1, nullptr);
+            if (super->clean){
+                for (size_t i = 0; i < bank.size(); i++){
+                    bank[i] = super->heads[i] ? (BuddyBlock*)(startaddr + ((super->heads[i] - 1) << kPageSizeOrder)) : nullptr;
+                }
+            }else{
+                recover(maxpages);
+            }
+            super->clean = 0;
+            msync(mapaddr, kPageSize, MS_SYNC);
+        }
+    }
+
+    static ub4 maxOrderFor(ub4 maxpages){
         ub4 maxorder = kMaxOrder;
         while (!(maxpages >> maxorder)) maxorder--;
+        return maxorder;
+    }
+
+    // 把整个区域切成尽量大的块挂进空闲链表。
+    void format(ub4 maxpages){
+        ub4 maxorder = maxOrderFor(maxpages);
+        endaddr = startaddr + ((ub8)maxpages << kPageSizeOrder);
         bank.assign(maxorder + 1, nullptr); // 0, 1, ... maxorder
         for (int curorder = maxorder, pages = maxpages; curorder >= 0; curorder--){
             ub4 nrblocks = pages >> curorder;
             if (nrblocks == 0) continue;
-            char* addr = startaddr + ((maxpages - pages) << kPageSizeOrder);
+            char* addr = startaddr + ((ub8)(maxpages - pages) << kPageSizeOrder);
             for (ub4 i = 0; i < nrblocks; i++, addr += (1 << curorder) << kPageSizeOrder){
                 emplace(addr, (ub1)curorder);
             }
             pages -= nrblocks << curorder;
         }
+    }
 
+    // 崩溃后的恢复：按块长从头走一遍，空闲块先全部摘下（链表指针不可信），
+    // 再按地址顺序逐个release，互为buddy的空闲块顺带合并。
+    void recover(ub4 maxpages){
+        ub4 maxorder = (ub4)bank.size() - 1;
+        std::vector<BuddyBlock*> freeBlocks;
+        for (ub4 page = 0; page < maxpages; ){
+            ub4 order;
+            if (pinned[page] != kNotPinned){
+                order = pinned[page];
+            }else{
+                BuddyBlock* block = (BuddyBlock*)(startaddr + ((ub8)page << kPageSizeOrder));
+                if (!block->valid()) throw std::runtime_error("buddy: corrupted block header during recovery");
+                order = block->order;
+                if (order <= maxorder && !block->used){
+                    block->init((ub1)order, startaddr);
+                    block->free = 0;
+                    freeBlocks.push_back(block);
+                }
+            }
+            if (order > maxorder || (page & ((1u << order) - 1)) || page + (1u << order) > maxpages){
+                throw std::runtime_error("buddy: corrupted block order during recovery");
+            }
+            page += 1u << order;
+        }
+        for (auto block : freeBlocks) release(block);
     }
 
-    char* alloc(ub4 size){
+    char* allocBlock(ub4 size){
         size += 8; // 8 bytes for meta data
         ub4 pages = size >> kPageSizeOrder;
         if (size > (pages << kPageSizeOrder)) pages++;
         if (pages > kMaxPagesPerBlock) return nullptr;
         auto minorder = decideOrder(pages);
-        for (int order = minorder; order <= kMaxOrder; order++){
+        for (int order = minorder; order < (int)bank.size(); order++){
             auto block = pop((ub1)order);
             if (block){
                 if (order > minorder) shrink(block, minorder);
+                block->used = 1; // 最后一步才归用户
                 return block->userAddress();
             }
         }
         return nullptr;
     }
 
-    void free(char* ptr){
-        BuddyBlock* block = (BuddyBlock*)(ptr - 8);
-        while (block->order < kMaxOrder){
+    char* allocPageBlock(ub8 size){
+        ub8 pages = (size + kPageSize - 1) >> kPageSizeOrder;
+        if (!pages || pages > kMaxPagesPerBlock) return nullptr;
+        auto minorder = decideOrder((ub4)pages);
+        for (int order = minorder; order < (int)bank.size(); order++){
+            auto block = pop((ub1)order);
+            if (block){
+                if (order > minorder) shrink(block, minorder);
+                pinned[block->offsetInPages(startaddr)] = minorder;
+                return (char*)block;
+            }
+        }
+        return nullptr;
+    }
+
+    void release(BuddyBlock* block){
+        while (block->order + 1 < (int)bank.size()){
             auto buddy = getBuddy(block);
             if (buddy) block = merge(block, buddy);
             else break;
         }
         push(block);
     }
-private:
+
     // 合并互为buddy的A、B，返回合并后的块
     BuddyBlock* merge(BuddyBlock* A, BuddyBlock* B){
         assert(A->order == B->order && A->order < kMaxOrder && A->left != B->left);
@@ -165,8 +448,10 @@ private:
         if (!first){
             block->last = 1;
         }else{
+            block->last = 0;
             block->next = first->offsetInPages(startaddr);
             first->prev = block->offsetInPages(startaddr);
+            first->first = 0;
         }
     }
 
@@ -190,7 +475,11 @@ private:
     }
 
     BuddyBlock* getBuddy(BuddyBlock* me){
-        BuddyBlock* buddy = me->myBuddy();
+        BuddyBlock* buddy = me->myBuddy(startaddr);
+        // a tail block may have its buddy outside the region
+        if ((char*)buddy < startaddr || (char*)buddy + me->blockSize() > endaddr) return nullptr;
+        // allocPages给出的块头是用户数据，不可信
+        if (pinned[buddy->offsetInPages(startaddr)] != kNotPinned) return nullptr;
         if (buddy->order == me->order && buddy->free){
             erase(buddy);
             return buddy;
@@ -207,9 +496,75 @@ private:
     }
 
     std::vector<BuddyBlock*> bank;
+    std::vector<ub1> pinnedStorage;
+    ub1*  pinned; // 每页一项，allocPages分出的块首页记其阶；持久模式下在文件里
     char* startaddr;
+    char* endaddr;
+    ub8   numaBytes = 0; // 区域由numaAllocPages分配时的长度
+    // 持久模式
+    int         fd = -1;
+    char*       mapaddr = nullptr;
+    ub8         mapsize = 0;
+    Superblock* super = nullptr;
 };
 
 
+// 每个NUMA节点一个BuddySystem，区域绑定在本节点上，各带一把锁。
+// alloc从调用线程所在节点分配，本节点用完再按节点号顺序去别的节点借；
+// free按地址找回所属节点，哪个线程释放都可以。
+class NumaBuddySystem{
+public:
+    explicit NumaBuddySystem(ub4 pagesPerNode)
+        : heaps([pagesPerNode](ub4 node){ return std::unique_ptr<Heap>(new Heap(pagesPerNode, node)); }){}
+
+    char* alloc(ub4 size){ return allocOn(currentNumaNode(), size); }
+
+    char* allocOn(ub4 node, ub4 size){
+        Heap& local = heaps.at(node);
+        if (char* p = local.alloc(size)) return p;
+        for (ub4 n = 0; n < heaps.nodes(); n++){
+            if (!heaps.online(n) || &heaps.at(n) == &local) continue;
+            if (char* p = heaps.at(n).alloc(size)) return p;
+        }
+        return nullptr;
+    }
+
+    void free(char* ptr){
+        if (!ptr) return;
+        for (ub4 n = 0; n < heaps.nodes(); n++){
+            if (!heaps.online(n)) continue;
+            Heap& h = heaps.at(n);
+            if (h.buddy.contains(ptr)){
+                std::lock_guard<std::mutex> guard(h.lock);
+                h.buddy.free(ptr);
+                return;
+            }
+        }
+        throw std::runtime_error("buddy: free of a pointer outside every node region");
+    }
+
+    // 节点上的BuddySystem本身，调用方自己负责加锁；取区域地址等只读用途不必。
+    BuddySystem& node(ub4 n){ return heaps.at(n).buddy; }
+
+    ub4 nodes() const { return heaps.nodes(); }
+
+private:
+    NumaBuddySystem(const NumaBuddySystem&) = delete;
+    NumaBuddySystem& operator=(const NumaBuddySystem&) = delete;
+
+    struct Heap{
+        Heap(ub4 pages, ub4 node) : buddy(pages, NumaPlacement::bind(node)){}
+
+        char* alloc(ub4 size){
+            std::lock_guard<std::mutex> guard(lock);
+            return buddy.alloc(size);
+        }
+
+        std::mutex  lock;
+        BuddySystem buddy;
+    };
+
+    PerNumaNode<Heap> heaps;
+};
 
 }
\ No newline at end of file
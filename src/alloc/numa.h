@@ -0,0 +1,167 @@
+#pragma once
+
+#include "common.h"
+
+#include <fstream>
+
+namespace wjp{
+
+// NUMA放置的底层工具：直接用mbind/get_mempolicy/getcpu系统调用，不依赖libnuma。
+// 匿名内存在第一次写时才分配物理页，落在写它的线程所在的节点上（first touch）。
+// 想让内存落在指定节点，必须在mmap之后、第一次写之前mbind；malloc来的内存可能与别的
+// 分配共用页，无法可靠绑定，所以这里的分配都走mmap。
+// 系统调用不可用（非Linux、容器禁用了mbind）时退化为first touch，不报错。
+// 节点号不超过63，掩码用一个ub8。
+enum class NumaPolicy{
+    kDefault,    // 不干预，first touch
+    kBind,       // 只在node上分配
+    kPreferred,  // 优先node，不够时去别的节点
+    kInterleave, // 按页轮流落在所有节点上，供各节点线程共享的只读为主的表
+};
+
+struct NumaPlacement{
+    NumaPolicy policy;
+    ub4        node;
+
+    static NumaPlacement none(){ return NumaPlacement{NumaPolicy::kDefault, 0}; }
+    static NumaPlacement bind(ub4 node){ return NumaPlacement{NumaPolicy::kBind, node}; }
+    static NumaPlacement preferred(ub4 node){ return NumaPlacement{NumaPolicy::kPreferred, node}; }
+    static NumaPlacement interleave(){ return NumaPlacement{NumaPolicy::kInterleave, 0}; }
+};
+
+static const ub4 kMaxNumaNodes = 64;
+
+// 在线节点的掩码，解析/sys/devices/system/node/online（形如"0-1,3"），进程内只读一次。
+inline ub8 numaOnlineNodes(){
+    static const ub8 mask = []{
+        ub8 m = 0;
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string s;
+        if (in && std::getline(in, s)){
+            size_t i = 0;
+            while (i < s.size()){
+                ub4 lo = 0, hi;
+                while (i < s.size() && s[i] >= '0' && s[i] <= '9') lo = lo * 10 + (s[i++] - '0');
+                hi = lo;
+                if (i < s.size() && s[i] == '-'){
+                    hi = 0;
+                    for (i++; i < s.size() && s[i] >= '0' && s[i] <= '9'; i++) hi = hi * 10 + (s[i] - '0');
+                }
+                for (ub4 n = lo; n <= hi && n < kMaxNumaNodes; n++) m |= (ub8)1 << n;
+                while (i < s.size() && (s[i] < '0' || s[i] > '9')) i++;
+            }
+        }
+        return m ? m : 1;
+    }();
+    return mask;
+}
+
+// 最大节点号加一，按节点建数组时用它作长度。
+inline ub4 numaNodeCount(){ return 64 - __builtin_clzll(numaOnlineNodes()); }
+
+// 调用线程当前所在的节点。getcpu是真系统调用，这里每个线程缓存结果，
+// 每kRefresh次才重新问一次，线程被迁移后最多晚这么多次才察觉。
+inline ub4 currentNumaNode(){
+#ifdef __linux__
+    static const ub4 kRefresh = 1024;
+    static thread_local ub4 node = 0;
+    static thread_local ub4 countdown = 0;
+    if (countdown--) return node;
+    countdown = kRefresh - 1;
+    unsigned cpu = 0, n = 0;
+    if (syscall(SYS_getcpu, &cpu, &n, nullptr) == 0 && n < kMaxNumaNodes) node = n;
+    return node;
+#else
+    return 0;
+#endif
+}
+
+// 对[addr, addr + len)设置放置策略，addr须页对齐。只影响之后才分配的物理页。
+inline bool numaApply(void* addr, size_t len, NumaPlacement placement){
+#ifdef __linux__
+    // 与<numaif.h>中的取值一致
+    static const int kMpolPreferred = 1, kMpolBind = 2, kMpolInterleave = 3;
+    ub8 mask;
+    int mode;
+    switch (placement.policy){
+    case NumaPolicy::kDefault:
+        return true;
+    case NumaPolicy::kBind:
+        mode = kMpolBind;
+        mask = (ub8)1 << (placement.node % kMaxNumaNodes);
+        break;
+    case NumaPolicy::kPreferred:
+        mode = kMpolPreferred;
+        mask = (ub8)1 << (placement.node % kMaxNumaNodes);
+        break;
+    default:
+        mode = kMpolInterleave;
+        mask = numaOnlineNodes();
+        break;
+    }
+    return syscall(SYS_mbind, addr, len, mode, &mask, (unsigned long)kMaxNumaNodes + 1, 0) == 0;
+#else
+    (void)addr; (void)len; (void)placement;
+    return false;
+#endif
+}
+
+// 按页分配并在第一次写之前设好策略；长度向上取整到页，须用numaFreePages归还。
+inline char* numaAllocPages(size_t len, NumaPlacement placement){
+    len = (len + kPageSize - 1) & ~(size_t)(kPageSize - 1);
+    void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    numaApply(p, len, placement);
+    return (char*)p;
+}
+
+inline void numaFreePages(char* p, size_t len){
+    if (!p) return;
+    len = (len + kPageSize - 1) & ~(size_t)(kPageSize - 1);
+    munmap(p, len);
+}
+
+// addr所在页实际落在哪个节点，页尚未分配或查询失败时返回-1。供测量和校验用。
+inline sb4 numaNodeOf(const void* addr){
+#ifdef __linux__
+    static const int kMpolFNode = 1, kMpolFAddr = 2;
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, nullptr, 0UL, addr, kMpolFNode | kMpolFAddr) != 0) return -1;
+    return node;
+#else
+    (void)addr;
+    return -1;
+#endif
+}
+
+// 每个在线节点一份的对象，按调用线程所在节点取用；make(node)返回std::unique_ptr<T>。
+// 节点号不在线时退到编号最小的在线节点。
+template < typename T >
+class PerNumaNode{
+public:
+    template < typename Factory >
+    explicit PerNumaNode(Factory make) : count(numaNodeCount()), first(__builtin_ctzll(numaOnlineNodes())){
+        items.resize(count);
+        for (ub4 n = 0; n < count; n++){
+            if (numaOnlineNodes() >> n & 1) items[n] = make(n);
+        }
+    }
+
+    T& local(){ return at(currentNumaNode()); }
+
+    T& at(ub4 node){ return *items[node < count && items[node] ? node : first]; }
+
+    bool online(ub4 node) const { return node < count && items[node]; }
+
+    ub4 nodes() const { return count; }
+
+private:
+    PerNumaNode(const PerNumaNode&) = delete;
+    PerNumaNode& operator=(const PerNumaNode&) = delete;
+
+    ub4                             count;
+    ub4                             first;
+    std::vector<std::unique_ptr<T>> items;
+};
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "common.h"
+
+namespace wjp{
+
+// 定长对象池。与Arena一样按chunk向系统申请内存，但对象可单独free，
+// 空闲对象以侵入式单链表串起来，alloc/free都是O(1)，内存占用只增不减，
+// 在Slab析构时统一归还。非线程安全。
+class Slab{
+public:
+    // objectSize至少8字节并按8对齐；chunk头占一个cache line，
+    // 因此objectSize为64的倍数时对象恰好落在cache line开头。
+    Slab(ub4 objectSize, ub4 chunkCapacity = 16*kPageSize)
+        : objectSize(ALIGN(objectSize < sizeof(freenode) ? sizeof(freenode) : objectSize)),
+          chunkCapacity(chunkCapacity)
+    {
+        if (this->objectSize + kChunkSize > chunkCapacity) this->chunkCapacity = this->objectSize + kChunkSize;
+    }
+
+    ~Slab(){
+        while (currentChunk){
+            auto tofree = currentChunk;
+            currentChunk = currentChunk->next;
+            std::free(tofree);
+        }
+    }
+
+    // 分配规则：
+    // 1. 空闲链表非空则取链表头。
+    // 2. 否则在当前chunk尾部切一个对象。
+    // 3. 当前chunk用尽则新建chunk并链入链表头。
+    char* alloc(){
+        if (freelist){
+            auto p = freelist;
+            freelist = freelist->next;
+            live++;
+            return (char*)p;
+        }
+        if (!currentChunk || currentSize + objectSize > chunkCapacity){
+            auto p = malloc64(chunkCapacity);
+            if (!p) return nullptr;
+            chunk* new_chunk = new(p) chunk;
+            new_chunk->next  = currentChunk;
+            currentChunk     = new_chunk;
+            currentSize      = kChunkSize;
+            nrchunks++;
+        }
+        auto p = (char*)currentChunk + currentSize;
+        currentSize += objectSize;
+        live++;
+        return p;
+    }
+
+    void free(char* ptr){
+        if (!ptr) return;
+        auto node = (freenode*)ptr;
+        node->next = freelist;
+        freelist = node;
+        live--;
+    }
+
+    ub4 size() const { return objectSize; }
+
+    ub8 liveObjects() const { return live; }
+
+    ub8 memoryUsage() const { return nrchunks * chunkCapacity; }
+
+private:
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    struct chunk{
+        chunk* next = 0;
+    };
+
+    struct freenode{
+        freenode* next;
+    };
+
+    static const ub4 kChunkSize = 64;
+
+    ub4         objectSize;
+    ub4         chunkCapacity;
+    ub4         currentSize = 0;
+    chunk*      currentChunk = 0;
+    freenode*   freelist = 0;
+    ub8         live = 0;
+    ub8         nrchunks = 0;
+};
+
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "common.h"
+
+namespace wjp{
+
+// 分配轨迹：记录Arena、UserBufferArena、BuddySystem在真实负载下的每一次操作，
+// 交给tools/alloc_replay在各分配器与系统malloc上重放，比较吞吐、峰值RSS与碎片。
+// 1. 埋点只通过WJP_ALLOC_TRACE_EVENT宏使用，未定义WJP_ALLOC_TRACE时宏展开为空；
+//    定义了但没有start时，每次埋点只多一次relaxed读。
+// 2. 事件先写进线程自己的暂存区，满kStageEvents个、线程退出或flushThread时
+//    加锁整批并入全局：进一个只保留最近事件的环形缓冲区，start时给了路径的还追加到文件。
+// 3. 时间戳是rdtsc周期数，只用于排序与算间隔；owner与ptr是原地址，
+//    重放时按出现顺序换成编号，地址被复用不影响。
+// 文件格式：[FileHeader][AllocEvent]...，按线程整批写入，批与批之间不保证时间有序。
+enum class AllocOp : ub1{
+    kArenaCreate = 1,  // size为chunkCapacity
+    kArenaUserBuffer,  // 紧跟在UserBufferArena的kArenaCreate之后，ptr、size为用户缓冲区
+    kArenaDestroy,
+    kArenaAlloc,       // grow另找空间时也经由alloc记录
+    kArenaExtend,      // grow在原地延长，ptr为原指针，size为增加的字节数
+    kBuddyCreate,      // size为页数
+    kBuddyDestroy,
+    kBuddyAlloc,
+    kBuddyFree,
+    kBuddyAllocPages,
+    kBuddyFreePages,
+};
+
+struct AllocEvent{
+    ub8 time;
+    ub8 ptr;      // 分配失败时为0
+    ub8 owner;    // 分配器对象的地址
+    ub4 size;     // 请求的字节数，free时为0
+    ub2 thread;   // 进程内线程的顺序号
+    ub1 op;
+    ub1 reserved;
+};
+
+static_assert(sizeof(AllocEvent) == 32, "AllocEvent must stay two per cache line");
+
+class AllocTrace{
+public:
+    static const ub4 kStageEvents = 256;
+    static const ub8 kFileMagic = UB8(0x57504a41, 0x4c4c4f43); // "COLLAJPW"
+    static const ub4 kFileVersion = 1;
+
+    struct FileHeader{
+        ub8 magic;
+        ub4 version;
+        ub4 eventSize;
+    };
+
+    // 进程内唯一的实例。环境变量WJP_ALLOC_TRACE为文件路径时，第一次埋点即开始记录。
+    static AllocTrace& instance(){
+        static AllocTrace trace;
+        return trace;
+    }
+
+    // 开始记录。path非空则新建文件写入；ringCapacity为内存中保留的最近事件数，取整到2的幂。
+    void start(const char* path = nullptr, ub4 ringCapacity = 1 << 16){
+        std::lock_guard<std::mutex> guard(lock);
+        closeFile();
+        if (path){
+            file = std::fopen(path, "wb");
+            if (!file) throw std::runtime_error(std::string("alloc trace: open error: ") + path);
+            FileHeader header{kFileMagic, kFileVersion, (ub4)sizeof(AllocEvent)};
+            if (std::fwrite(&header, sizeof(header), 1, file) != 1){
+                closeFile();
+                throw std::runtime_error(std::string("alloc trace: write error: ") + path);
+            }
+        }
+        ub4 cap = 1;
+        while (cap < ringCapacity) cap <<= 1;
+        ring.assign(cap, AllocEvent{});
+        recorded = 0;
+        enabled.store(true, std::memory_order_release);
+    }
+
+    // 停止记录并并入调用线程的暂存区。文件保持打开，其他线程之后退出时
+    // 暂存区里的事件仍会写进去；需要确定的文件内容时先让各线程flushThread再close。
+    void stop(){
+        enabled.store(false, std::memory_order_release);
+        flushThread();
+    }
+
+    void close(){
+        stop();
+        std::lock_guard<std::mutex> guard(lock);
+        closeFile();
+    }
+
+    bool active() const { return enabled.load(std::memory_order_relaxed); }
+
+    inline void record(AllocOp op, const void* owner, const void* ptr, ub8 size){
+        Stage& stage = threadStage();
+        AllocEvent& e = stage.events[stage.count];
+        e.time = rdtsc();
+        e.ptr = (ub8)ptr;
+        e.owner = (ub8)owner;
+        e.size = (ub4)size;
+        e.thread = stage.thread;
+        e.op = (ub1)op;
+        e.reserved = 0;
+        if (++stage.count == kStageEvents) merge(stage);
+    }
+
+    // 把调用线程暂存的事件并入全局。
+    void flushThread(){
+        Stage& stage = threadStage();
+        if (stage.count) merge(stage);
+    }
+
+    // 环形缓冲区里最近的事件，按并入顺序从旧到新。
+    std::vector<AllocEvent> snapshot(){
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<AllocEvent> out;
+        ub8 cap = ring.size();
+        ub8 begin = recorded > cap ? recorded - cap : 0;
+        out.reserve(recorded - begin);
+        for (ub8 i = begin; i < recorded; i++) out.push_back(ring[i & (cap - 1)]);
+        return out;
+    }
+
+    // 自start以来并入全局的事件总数，含已被环形缓冲区覆盖掉的。
+    ub8 eventCount(){
+        std::lock_guard<std::mutex> guard(lock);
+        return recorded;
+    }
+
+    // 读回轨迹文件。文件末尾不完整的事件（进程被杀时写了一半）丢弃。
+    static std::vector<AllocEvent> load(const std::string& path){
+        FILE* in = std::fopen(path.c_str(), "rb");
+        if (!in) throw std::runtime_error("alloc trace: open error: " + path);
+        FileHeader header;
+        if (std::fread(&header, sizeof(header), 1, in) != 1 || header.magic != kFileMagic
+            || header.version != kFileVersion || header.eventSize != sizeof(AllocEvent)){
+            std::fclose(in);
+            throw std::runtime_error("alloc trace: not a trace file: " + path);
+        }
+        std::vector<AllocEvent> events;
+        AllocEvent batch[kStageEvents];
+        size_t n;
+        while ((n = std::fread(batch, sizeof(AllocEvent), kStageEvents, in)) > 0){
+            events.insert(events.end(), batch, batch + n);
+        }
+        std::fclose(in);
+        return events;
+    }
+
+private:
+    AllocTrace(){
+        if (const char* path = std::getenv("WJP_ALLOC_TRACE")) start(path);
+    }
+
+    ~AllocTrace(){
+        enabled.store(false, std::memory_order_relaxed);
+        closeFile();
+    }
+
+    AllocTrace(const AllocTrace&) = delete;
+    AllocTrace& operator=(const AllocTrace&) = delete;
+
+    struct Stage{
+        AllocEvent events[kStageEvents];
+        ub4        count = 0;
+        ub2        thread;
+
+        Stage() : thread((ub2)nextThread().fetch_add(1, std::memory_order_relaxed)){}
+
+        ~Stage(){ if (count) AllocTrace::instance().merge(*this); }
+    };
+
+    static std::atomic<ub4>& nextThread(){
+        static std::atomic<ub4> next{0};
+        return next;
+    }
+
+    static Stage& threadStage(){
+        static thread_local Stage stage;
+        return stage;
+    }
+
+    void merge(Stage& stage){
+        std::lock_guard<std::mutex> guard(lock);
+        if (!ring.empty()){
+            ub8 mask = ring.size() - 1;
+            for (ub4 i = 0; i < stage.count; i++) ring[(recorded + i) & mask] = stage.events[i];
+            recorded += stage.count;
+        }
+        if (file && std::fwrite(stage.events, sizeof(AllocEvent), stage.count, file) != stage.count){
+            // 写不进去（如磁盘满）就不再写文件，不让埋点把业务线程带崩
+            closeFile();
+        }
+        stage.count = 0;
+    }
+
+    void closeFile(){
+        if (file){
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    std::atomic<bool>       enabled{false};
+    std::mutex              lock;
+    std::vector<AllocEvent> ring;
+    ub8                     recorded = 0;
+    FILE*                   file = nullptr;
+};
+
+#ifdef WJP_ALLOC_TRACE
+#define WJP_ALLOC_TRACE_EVENT(op, owner, ptr, size) \
+    do{ \
+        auto& wjpAllocTrace = ::wjp::AllocTrace::instance(); \
+        if (wjpAllocTrace.active()) wjpAllocTrace.record(::wjp::AllocOp::op, owner, ptr, size); \
+    }while(0)
+#else
+#define WJP_ALLOC_TRACE_EVENT(op, owner, ptr, size) do{}while(0)
+#endif
+
+}
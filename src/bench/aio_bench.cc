@@ -0,0 +1,74 @@
+#include "bench/bench.h"
+#include "io/aio.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 负载：64MB文件上的4KB随机读，O_DIRECT绕过页缓存，在途深度kDepth。
+// 对照是工作线程里逐个阻塞pread。
+static const ub4 kDepth = 64;
+static const ub8 kFileBlocks = 16384;
+
+static int dataFile(){
+    static int fd = -1;
+    if (fd < 0){
+        const char* path = "/tmp/wjp_bench_aio";
+        int w = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        std::vector<char> block(kPageSize, 'x');
+        for (ub8 i = 0; i < kFileBlocks; i++){
+            if (::write(w, block.data(), block.size()) != (ssize_t)block.size()) throw std::runtime_error("cannot fill bench file");
+        }
+        ::fsync(w);
+        ::close(w);
+        fd = ::open(path, O_RDONLY | O_DIRECT);
+        if (fd < 0) fd = ::open(path, O_RDONLY);
+        ::unlink(path);
+    }
+    return fd;
+}
+
+static void countDone(void* ctx, sb4 result){
+    if (result < 0) std::abort();
+    ++*(ub8*)ctx;
+}
+
+static ub8 engineRead(AioEngine& engine, ub8 n){
+    int fd = dataFile();
+    Random rnd;
+    std::vector<char*> bufs;
+    for (ub4 i = 0; i < kDepth; i++) bufs.push_back(engine.allocBuffer(kPageSize));
+    ub8 done = 0;
+    for (ub8 i = 0; i < n; i++){
+        engine.read(fd, bufs[i % kDepth], kPageSize, rnd.uniform(kFileBlocks) * kPageSize, countDone, &done);
+        if (i % kDepth == kDepth - 1) engine.submit();
+    }
+    engine.drain();
+    for (auto b : bufs) engine.freeBuffer(b);
+    doNotOptimize(done);
+    return n;
+}
+
+static ub8 uringRead(ub8 n){
+    static AioEngine engine(kDepth, 1024, true);
+    return engineRead(engine, n);
+}
+
+static ub8 poolRead(ub8 n){
+    static AioEngine engine(kDepth, 1024, false);
+    return engineRead(engine, n);
+}
+
+static ub8 blockingRead(ub8 n){
+    int fd = dataFile();
+    Random rnd;
+    char* buf = mallocPage(kPageSize);
+    for (ub8 i = 0; i < n; i++){
+        if (::pread(fd, buf, kPageSize, rnd.uniform(kFileBlocks) * kPageSize) != kPageSize) std::abort();
+    }
+    std::free(buf);
+    return n;
+}
+
+BENCH(uringRead, "aio/random_read_4k", "wjp::AioEngine(io_uring)", 1 << 15, kPageSize);
+BENCH(poolRead, "aio/random_read_4k", "wjp::AioEngine(threads)", 1 << 15, kPageSize);
+BENCH(blockingRead, "aio/random_read_4k", "pread", 1 << 15, kPageSize);
@@ -0,0 +1,195 @@
+#include "bench/bench.h"
+#include "alloc/arena.h"
+#include "alloc/buddy.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 链接jemalloc时（cmake -DBENCH_JEMALLOC=ON），malloc对照组即为jemalloc。
+#ifdef WJP_BENCH_JEMALLOC
+#define MALLOC_IMPL "jemalloc"
+#else
+#define MALLOC_IMPL "malloc"
+#endif
+
+// 尺寸分布：小对象固定32字节；混合分布以小对象为主，偶有大对象，模拟消息负载。
+static inline ub4 mixedSize(Random& rnd){
+    ub4 r = rnd.uniform(100);
+    if (r < 70) return 8 + rnd.uniform(120);
+    if (r < 95) return 128 + rnd.uniform(896);
+    return 1024 + rnd.uniform(7168);
+}
+
+static ub8 arenaSmall(ub8 n){
+    Arena arena;
+    for (ub8 i = 0; i < n; i++) doNotOptimize(arena.alloc(32));
+    return n;
+}
+
+static ub8 mallocSmall(ub8 n){
+    std::vector<void*> ptrs(n);
+    for (ub8 i = 0; i < n; i++) ptrs[i] = std::malloc(32);
+    for (ub8 i = 0; i < n; i++) std::free(ptrs[i]);
+    return n;
+}
+
+static ub8 arenaMixed(ub8 n){
+    Random rnd;
+    Arena arena;
+    for (ub8 i = 0; i < n; i++) doNotOptimize(arena.alloc(mixedSize(rnd)));
+    return n;
+}
+
+static ub8 userBufferArenaMixed(ub8 n){
+    Random rnd;
+    char buffer[8192];
+    UserBufferArena arena(buffer, sizeof(buffer));
+    for (ub8 i = 0; i < n; i++) doNotOptimize(arena.alloc(mixedSize(rnd)));
+    return n;
+}
+
+static ub8 mallocMixed(ub8 n){
+    Random rnd;
+    std::vector<void*> ptrs(n);
+    for (ub8 i = 0; i < n; i++) ptrs[i] = std::malloc(mixedSize(rnd));
+    for (ub8 i = 0; i < n; i++) std::free(ptrs[i]);
+    return n;
+}
+
+// 典型的缓冲区增长：反复对最近一次分配追加16~64字节。
+static ub8 arenaGrow(ub8 n){
+    Random rnd;
+    Arena arena;
+    char* p = nullptr;
+    ub4 len = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub4 newlen = len + 16 + rnd.uniform(48);
+        if (newlen > 4096) newlen = 16, p = nullptr;
+        p = arena.grow(p, len, newlen);
+        len = newlen;
+        doNotOptimize(p);
+    }
+    return n;
+}
+
+static ub8 reallocGrow(ub8 n){
+    Random rnd;
+    std::vector<void*> done;
+    void* p = nullptr;
+    ub4 len = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub4 newlen = len + 16 + rnd.uniform(48);
+        if (newlen > 4096){
+            done.push_back(p);
+            newlen = 16, p = nullptr;
+        }
+        p = std::realloc(p, newlen);
+        len = newlen;
+        doNotOptimize(p);
+    }
+    done.push_back(p);
+    for (auto q : done) std::free(q);
+    return n;
+}
+
+// 随机alloc/free混合，保持至多kLive个存活块，尺寸1~16页。
+static const ub4 kLive = 64;
+
+static inline ub4 pageSize(Random& rnd){
+    return (1 + rnd.uniform(16)) * kPageSize - 64;
+}
+
+static ub8 buddyChurn(ub8 n){
+    Random rnd;
+    BuddySystem buddy(4096);
+    std::vector<char*> live;
+    live.reserve(kLive);
+    for (ub8 i = 0; i < n; i++){
+        if (live.size() < kLive && (live.empty() || rnd.uniform(2))){
+            if (char* p = buddy.alloc(pageSize(rnd))) live.push_back(p);
+        }else{
+            ub4 k = rnd.uniform(live.size());
+            buddy.free(live[k]);
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    for (auto p : live) buddy.free(p);
+    return n;
+}
+
+static ub8 mallocChurn(ub8 n){
+    Random rnd;
+    std::vector<char*> live;
+    live.reserve(kLive);
+    for (ub8 i = 0; i < n; i++){
+        if (live.size() < kLive && (live.empty() || rnd.uniform(2))){
+            if (char* p = (char*)std::malloc(pageSize(rnd))) live.push_back(p);
+        }else{
+            ub4 k = rnd.uniform(live.size());
+            std::free(live[k]);
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+    for (auto p : live) std::free(p);
+    return n;
+}
+
+// 重启：256MB的持久区域里有2万个存活块，比较正常关闭后重新映射、崩溃后恢复，
+// 以及没有持久区域时把同样的块重新分配一遍。
+static const ub4 kRegionPages = 1 << 16;
+static const ub4 kRegionLive = 20000;
+static const char* kRegionPath = "/tmp/wjp_bench_buddy.dat";
+
+static void prepareRegion(){
+    static bool prepared = false;
+    if (prepared) return;
+    unlink(kRegionPath);
+    BuddySystem buddy(kRegionPath, kRegionPages);
+    Random rnd;
+    for (ub4 i = 0; i < kRegionLive; i++) buddy.alloc((1 + rnd.uniform(4)) * kPageSize - 64);
+    prepared = true;
+}
+
+static ub8 regionRemap(ub8 n){
+    prepareRegion();
+    for (ub8 i = 0; i < n; i++){
+        BuddySystem buddy(kRegionPath, 0);
+        doNotOptimize(buddy.regionAddress());
+    }
+    return n;
+}
+
+static ub8 regionRecover(ub8 n){
+    prepareRegion();
+    for (ub8 i = 0; i < n; i++){
+        BuddySystem::markUnclean(kRegionPath);
+        BuddySystem buddy(kRegionPath, 0);
+        doNotOptimize(buddy.regionAddress());
+    }
+    return n;
+}
+
+static ub8 regionRebuild(ub8 n){
+    for (ub8 i = 0; i < n; i++){
+        BuddySystem buddy(kRegionPages);
+        Random rnd;
+        for (ub4 j = 0; j < kRegionLive; j++) buddy.alloc((1 + rnd.uniform(4)) * kPageSize - 64);
+        doNotOptimize(buddy.regionAddress());
+    }
+    return n;
+}
+
+BENCH(arenaSmall, "alloc/small32", "wjp::Arena", 1 << 20);
+BENCH(mallocSmall, "alloc/small32", MALLOC_IMPL, 1 << 20);
+BENCH(arenaMixed, "alloc/mixed", "wjp::Arena", 1 << 18);
+BENCH(userBufferArenaMixed, "alloc/mixed", "wjp::UserBufferArena", 1 << 18);
+BENCH(mallocMixed, "alloc/mixed", MALLOC_IMPL, 1 << 18);
+BENCH(arenaGrow, "alloc/grow", "wjp::Arena", 1 << 20);
+BENCH(reallocGrow, "alloc/grow", MALLOC_IMPL, 1 << 20);
+BENCH(buddyChurn, "alloc/page_churn", "wjp::BuddySystem", 1 << 20);
+BENCH(mallocChurn, "alloc/page_churn", MALLOC_IMPL, 1 << 20);
+BENCH(regionRemap, "alloc/region_reopen", "wjp::BuddySystem(file) clean", 1 << 6);
+BENCH(regionRecover, "alloc/region_reopen", "wjp::BuddySystem(file) recover", 1 << 4);
+BENCH(regionRebuild, "alloc/region_reopen", "wjp::BuddySystem rebuild", 1 << 4);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <string>
+#include <algorithm>
+
+namespace wjp{
+namespace bench{
+
+// 固定种子的xorshift64*，每次运行的输入序列完全一致，结果才能跨提交比较。
+struct Random{
+    explicit Random(ub8 seed = UB8(0x9e3779b9, 0x7f4a7c15)) : state(seed ? seed : 1){}
+
+    inline ub8 next(){
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * UB8(0x2545f491, 0x4f6cdd1d);
+    }
+
+    // [0, n)
+    inline ub4 uniform(ub4 n){ return (ub4)(((next() >> 32) * n) >> 32); }
+
+    ub8 state;
+};
+
+// 阻止编译器把被测代码当作死代码消除。
+template < typename T >
+static inline void doNotOptimize(const T& value){
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T* sink; sink = &value;
+#endif
+}
+
+static inline void clobberMemory(){
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : : "memory");
+#endif
+}
+
+// 每个用例接收规模n，返回实际完成的操作数，由Runner负责计时。
+// 同一group内的不同impl互为对照，例如Arena对照malloc。
+typedef ub8 (*BenchFn)(ub8 n);
+
+struct Case{
+    const char* group;
+    const char* impl;
+    BenchFn     fn;
+    ub8         n;
+    ub8         bytesPerOp; // 非0时额外输出吞吐量（MB/s）
+};
+
+inline std::vector<Case>& registry(){
+    static std::vector<Case> cases;
+    return cases;
+}
+
+struct Registrar{
+    Registrar(const char* group, const char* impl, BenchFn fn, ub8 n, ub8 bytesPerOp = 0){
+        registry().push_back(Case{group, impl, fn, n, bytesPerOp});
+    }
+};
+
+#define WJP_BENCH_CAT2(a, b) a##b
+#define WJP_BENCH_CAT(a, b) WJP_BENCH_CAT2(a, b)
+
+// 注册一个用例：BENCH(fn, "hashmap/insert", "wjp::Hashmap", 1 << 20)
+#define BENCH(fn, group, impl, ...) \
+    static ::wjp::bench::Registrar WJP_BENCH_CAT(benchRegistrar_, __LINE__)(group, impl, fn, __VA_ARGS__)
+
+static inline ub8 nowNanos(){
+    return (ub8)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+}
@@ -0,0 +1,129 @@
+#include "bench/bench.h"
+#include "util/btree.h"
+
+#include <map>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 有序索引：随机ub8键插入、点查、lowerBound后扫100个，以及从有序数据整体建树。
+// 对照是std::map。
+static const ub8 kTableSize = 1 << 20;
+
+static const std::vector<ub8>& randomKeys(){
+    static std::vector<ub8> keys;
+    if (keys.empty()){
+        Random rnd;
+        keys.resize(kTableSize);
+        for (auto& k : keys) k = rnd.next();
+    }
+    return keys;
+}
+
+static BTree<ub8>& filledTree(){
+    static BTree<ub8> tree;
+    if (!tree.size()){
+        for (auto k : randomKeys()) tree.insert(k, k);
+    }
+    return tree;
+}
+
+static std::map<ub8, ub8>& filledMap(){
+    static std::map<ub8, ub8> map;
+    if (map.empty()){
+        for (auto k : randomKeys()) map.emplace(k, k);
+    }
+    return map;
+}
+
+static ub8 btreeInsert(ub8 n){
+    BTree<ub8> tree;
+    Random rnd;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = rnd.next();
+        tree.insert(k, k);
+    }
+    doNotOptimize(tree.size());
+    return n;
+}
+
+static ub8 mapInsert(ub8 n){
+    std::map<ub8, ub8> map;
+    Random rnd;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = rnd.next();
+        map.emplace(k, k);
+    }
+    doNotOptimize(map.size());
+    return n;
+}
+
+static ub8 btreeFind(ub8 n){
+    auto& tree = filledTree();
+    auto& keys = randomKeys();
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++) acc += *tree.find(keys[(i * 7919) % kTableSize]);
+    doNotOptimize(acc);
+    return n;
+}
+
+static ub8 mapFind(ub8 n){
+    auto& map = filledMap();
+    auto& keys = randomKeys();
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++) acc += map.find(keys[(i * 7919) % kTableSize])->second;
+    doNotOptimize(acc);
+    return n;
+}
+
+static ub8 btreeRange(ub8 n){
+    auto& tree = filledTree();
+    Random rnd;
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++){
+        auto it = tree.lowerBound(rnd.next());
+        for (ub4 j = 0; j < 100 && it.valid(); j++, it.next()) acc += it.value();
+    }
+    doNotOptimize(acc);
+    return n;
+}
+
+static ub8 mapRange(ub8 n){
+    auto& map = filledMap();
+    Random rnd;
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++){
+        auto it = map.lower_bound(rnd.next());
+        for (ub4 j = 0; j < 100 && it != map.end(); j++, ++it) acc += it->second;
+    }
+    doNotOptimize(acc);
+    return n;
+}
+
+static ub8 btreeBulkLoad(ub8 n){
+    static std::vector<ub8> sorted;
+    if (sorted.size() != n){
+        sorted.resize(n);
+        for (ub8 i = 0; i < n; i++) sorted[i] = i * 3;
+    }
+    BTree<ub8> tree;
+    tree.bulkLoad(sorted.data(), sorted.data(), n);
+    doNotOptimize(tree.size());
+    return n;
+}
+
+static ub8 btreeSequentialInsert(ub8 n){
+    BTree<ub8> tree;
+    for (ub8 i = 0; i < n; i++) tree.insert(i * 3, i);
+    doNotOptimize(tree.size());
+    return n;
+}
+
+BENCH(btreeInsert, "btree/insert_random", "wjp::BTree", 1 << 20);
+BENCH(mapInsert, "btree/insert_random", "std::map", 1 << 20);
+BENCH(btreeFind, "btree/find", "wjp::BTree", 1 << 20);
+BENCH(mapFind, "btree/find", "std::map", 1 << 20);
+BENCH(btreeRange, "btree/lower_bound_scan100", "wjp::BTree", 1 << 16);
+BENCH(mapRange, "btree/lower_bound_scan100", "std::map", 1 << 16);
+BENCH(btreeBulkLoad, "btree/build_sorted", "wjp::BTree::bulkLoad", 1 << 20);
+BENCH(btreeSequentialInsert, "btree/build_sorted", "wjp::BTree::insert", 1 << 20);
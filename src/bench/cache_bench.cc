@@ -0,0 +1,109 @@
+#include "bench/bench.h"
+#include "util/cache.h"
+
+#include <list>
+#include <thread>
+#include <unordered_map>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 读多写少的热点读路径：1M个key按近似幂律访问，未命中则回填，预算约装下1/8的key。
+// 对照是现在的写法：Hashmap式的索引外挂LRU链表，每次命中都在全局锁下把节点挪到表头。
+static const ub8 kKeys = 1 << 20;
+static const ub4 kValueSize = 64;
+static const ub8 kCapacity = (kKeys / 8) * (kValueSize + 64);
+
+// 均匀数的上界本身再取两层均匀数：第x个key的概率约正比于ln²(kKeys/x)，小编号的热、长尾很长。
+static inline ub8 skewedKey(Random& rnd){
+    ub8 a = rnd.uniform(rnd.uniform(rnd.uniform(kKeys) + 1) + 1);
+    return a * UB8(0x9e3779b9, 0x7f4a7c15);
+}
+
+struct Value{
+    char bytes[kValueSize];
+};
+
+class LruCache{
+public:
+    explicit LruCache(ub8 capacity) : capacity(capacity){}
+
+    bool get(ub8 key, Value* value){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it == index.end()) return false;
+        order.splice(order.begin(), order, it->second);
+        *value = it->second->second;
+        return true;
+    }
+
+    void put(ub8 key, const Value& value, ub4 charge){
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it != index.end()){
+            it->second->second = value;
+            order.splice(order.begin(), order, it->second);
+            return;
+        }
+        while (usage + charge > capacity && !order.empty()){
+            index.erase(order.back().first);
+            order.pop_back();
+            usage -= charge;
+        }
+        order.emplace_front(key, value);
+        index[key] = order.begin();
+        usage += charge;
+    }
+
+private:
+    ub8 capacity;
+    ub8 usage = 0;
+    std::mutex lock;
+    std::list<std::pair<ub8, Value>> order;
+    std::unordered_map<ub8, std::list<std::pair<ub8, Value>>::iterator> index;
+};
+
+template < typename Cache >
+static void workload(Cache& cache, ub8 n, ub8 seed, ub8 charge){
+    Random rnd(seed);
+    Value v = {{0}};
+    ub8 hits = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = skewedKey(rnd);
+        if (cache.get(k, &v)) hits++;
+        else cache.put(k, v, (ub4)charge);
+    }
+    doNotOptimize(hits);
+}
+
+static ub8 s3fifo(ub8 n){
+    S3FifoCache<ub8, Value> cache(kCapacity);
+    workload(cache, n, 1, kValueSize);
+    return n;
+}
+
+static ub8 lru(ub8 n){
+    LruCache cache(kCapacity);
+    workload(cache, n, 1, kValueSize + 64);
+    return n;
+}
+
+template < typename Cache >
+static ub8 threads4(ub8 n, ub8 charge){
+    Cache cache(kCapacity);
+    std::vector<std::thread> threads;
+    for (ub4 t = 0; t < 4; t++){
+        threads.emplace_back([&cache, n, t, charge]{ workload(cache, n / 4, t + 1, charge); });
+    }
+    for (auto& t : threads) t.join();
+    return n;
+}
+
+static ub8 s3fifo4(ub8 n){ return threads4<S3FifoCache<ub8, Value>>(n, kValueSize); }
+
+static ub8 lru4(ub8 n){ return threads4<LruCache>(n, kValueSize + 64); }
+
+BENCH(s3fifo, "cache/get_or_fill", "wjp::S3FifoCache", 1 << 21);
+BENCH(lru, "cache/get_or_fill", "unordered_map+LRU list", 1 << 21);
+BENCH(s3fifo4, "cache/get_or_fill_4threads", "wjp::S3FifoCache", 1 << 21);
+BENCH(lru4, "cache/get_or_fill_4threads", "unordered_map+LRU list", 1 << 21);
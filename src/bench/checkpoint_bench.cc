@@ -0,0 +1,45 @@
+#include "bench/bench.h"
+#include "stream/checkpoint.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 负载：n个条目的状态表，两次检查点之间改动1%的条目。
+// 对照是每次都写全量，相当于原先锁表遍历的写出量。结果按条目数计。
+typedef Hashmap<ub8, ub8> StateMap;
+
+static const char* kDir = "/tmp/wjp_bench_checkpoint";
+
+static StateMap& state(ub8 n){
+    static StateMap* map = nullptr;
+    if (!map){
+        map = new StateMap;
+        for (ub8 i = 0; i < n; i++) (*map)[i] = i;
+    }
+    return *map;
+}
+
+template < bool Full >
+static ub8 checkpoint(ub8 n){
+    StateMap& map = state(n);
+    ub8 entries = 0;
+    {
+        Checkpointer<StateMap> cp(map, kDir);
+        cp.begin(true);
+        cp.finish();
+        Random rnd;
+        for (int round = 0; round < 4; round++){
+            for (ub8 i = 0; i < n / 100; i++) map[rnd.uniform(n)] += 1;
+            cp.begin(Full);
+            // 与处理交错：每走64个桶处理一批更新
+            while (!cp.step(64)) map[rnd.uniform(n)] += 1;
+            entries += n;
+        }
+    }
+    std::string cmd = std::string("rm -rf ") + kDir;
+    if (std::system(cmd.c_str())) throw std::runtime_error("cannot clean checkpoint dir");
+    return entries;
+}
+
+BENCH(checkpoint<false>, "checkpoint/1pct_dirty", "wjp::Checkpointer(incremental)", 1 << 20);
+BENCH(checkpoint<true>, "checkpoint/1pct_dirty", "wjp::Checkpointer(full)", 1 << 20);
@@ -0,0 +1,145 @@
+#include "bench/bench.h"
+#include "util/codec.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 负载：1M个递增的序号/时间戳，相邻差多在几十以内，偶有上千的跳跃，如WAL的LSN、事件时间。
+// 对照是现在的做法：原样存ub8（编码解码都是memcpy）。bytesPerOp按原始的8字节计。
+static const ub8 kValues = 1 << 20;
+
+static const std::vector<ub8>& sequence(){
+    static std::vector<ub8> seq;
+    if (seq.empty()){
+        Random rnd;
+        seq.resize(kValues);
+        ub8 cur = UB8(0x17, 0x2a4f3c00);
+        for (auto& v : seq) v = cur += rnd.uniform(100) ? rnd.uniform(64) : rnd.uniform(5000);
+    }
+    return seq;
+}
+
+static std::vector<ub1>& scratch(){
+    static std::vector<ub1> buf(kValues * kMaxVarintBytes + 16);
+    return buf;
+}
+
+static ub8 rawEncode(ub8 n){
+    std::memcpy(scratch().data(), sequence().data(), n * 8);
+    doNotOptimize(scratch()[n]);
+    return n;
+}
+
+static ub8 rawDecode(ub8 n){
+    static std::vector<ub8> out(kValues);
+    std::memcpy(out.data(), scratch().data(), n * 8);
+    doNotOptimize(out[n - 1]);
+    return n;
+}
+
+// 差值LEB128：zigzag后逐个putVarint
+static ub8 varintEncode(ub8 n){
+    auto& seq = sequence();
+    ub1* p = scratch().data();
+    ub8 prev = 0;
+    for (ub8 i = 0; i < n; i++){
+        p = putVarint(p, zigzagEncode((sb8)(seq[i] - prev)));
+        prev = seq[i];
+    }
+    doNotOptimize(p);
+    return n;
+}
+
+static ub8 varintDecode(ub8 n){
+    static std::vector<ub8> out(kValues);
+    static size_t bytes = 0;
+    if (!bytes){
+        varintEncode(n);
+        ub8 prev = 0;
+        for (ub8 i = 0; i < n; i++){
+            bytes += varintSize(zigzagEncode((sb8)(sequence()[i] - prev)));
+            prev = sequence()[i];
+        }
+    }
+    const ub1* p = scratch().data();
+    const ub1* end = p + bytes;
+    ub8 prev = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub8 d = 0;
+        p = getVarint(p, end, &d);
+        out[i] = prev += (ub8)zigzagDecode(d);
+    }
+    doNotOptimize(out[n - 1]);
+    return n;
+}
+
+static std::vector<ub1>& svbBuffer(){
+    static std::vector<ub1> buf;
+    if (buf.empty()){
+        auto& seq = sequence();
+        buf.resize(streamVByteDeltaSize(seq.data() + 1, kValues - 1, seq[0]));
+        streamVByteEncodeDelta(seq.data() + 1, kValues - 1, buf.data(), seq[0]);
+    }
+    return buf;
+}
+
+static ub8 svbEncode(ub8 n){
+    auto& seq = sequence();
+    ub1* end = streamVByteEncodeDelta(seq.data() + 1, n - 1, scratch().data(), seq[0]);
+    doNotOptimize(end);
+    return n;
+}
+
+static ub8 svbDecode(ub8 n){
+    static std::vector<ub8> out(kValues);
+    auto& buf = svbBuffer();
+    out[0] = sequence()[0];
+    auto p = streamVByteDecodeDelta(buf.data(), buf.data() + buf.size(), out.data() + 1, n - 1, out[0]);
+    doNotOptimize(p);
+    return n;
+}
+
+static ub8 forEncodeRaw(ub8 n){
+    ub1* end = forEncode(sequence().data(), n, scratch().data());
+    doNotOptimize(end);
+    return n;
+}
+
+static ub8 forDecodeRaw(ub8 n){
+    static std::vector<ub8> out(kValues);
+    static std::vector<ub1> buf;
+    if (buf.empty()){
+        buf.resize(forSize(sequence().data(), n));
+        forEncode(sequence().data(), n, buf.data());
+    }
+    auto p = forDecode(buf.data(), buf.data() + buf.size(), out.data(), n);
+    doNotOptimize(p);
+    return n;
+}
+
+static ub8 sequenceEncode(ub8 n){
+    Arena arena(1 << 20);
+    CodedBlock block = encodeSequence(arena, sequence().data(), (ub4)n);
+    doNotOptimize(block.size);
+    return n;
+}
+
+static ub8 sequenceDecode(ub8 n){
+    static Arena arena(1 << 20);
+    static CodedBlock block = encodeSequence(arena, sequence().data(), (ub4)n);
+    static std::vector<ub8> out(kValues);
+    bool ok = decodeSequence(block.data, block.size, out.data());
+    doNotOptimize(ok);
+    return n;
+}
+
+BENCH(rawEncode, "codec/encode_seq_1M", "raw ub8 memcpy", kValues, 8);
+BENCH(varintEncode, "codec/encode_seq_1M", "zigzag delta LEB128", kValues, 8);
+BENCH(svbEncode, "codec/encode_seq_1M", "wjp Stream VByte delta", kValues, 8);
+BENCH(forEncodeRaw, "codec/encode_seq_1M", "wjp FOR", kValues, 8);
+BENCH(sequenceEncode, "codec/encode_seq_1M", "wjp::encodeSequence", kValues, 8);
+BENCH(rawDecode, "codec/decode_seq_1M", "raw ub8 memcpy", kValues, 8);
+BENCH(varintDecode, "codec/decode_seq_1M", "zigzag delta LEB128", kValues, 8);
+BENCH(svbDecode, "codec/decode_seq_1M", "wjp Stream VByte delta", kValues, 8);
+BENCH(forDecodeRaw, "codec/decode_seq_1M", "wjp FOR", kValues, 8);
+BENCH(sequenceDecode, "codec/decode_seq_1M", "wjp::decodeSequence", kValues, 8);
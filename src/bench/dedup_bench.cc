@@ -0,0 +1,59 @@
+#include "bench/bench.h"
+#include "stream/dedup.h"
+
+#include <unordered_set>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 负载：kProducers个producer轮流发送，序号基本递增，约2%重投、约2%窗口内乱序。
+static const ub4 kProducers = 1 << 16;
+
+struct Delivery{
+    ub8 producer;
+    ub8 seq;
+};
+
+static std::vector<Delivery> deliveries(ub8 n){
+    Random rnd;
+    std::vector<ub8> next(kProducers, 1);
+    std::vector<Delivery> out(n);
+    for (ub8 i = 0; i < n; i++){
+        ub8 p = rnd.uniform(kProducers);
+        ub4 r = rnd.uniform(100);
+        ub8 seq = next[p];
+        if (r < 2 && seq > 1) seq -= 1;                         // 重投
+        else if (r < 4 && seq > 32) seq -= 1 + rnd.uniform(31); // 乱序
+        else next[p]++;
+        out[i] = Delivery{p, seq};
+    }
+    return out;
+}
+
+static ub8 dedupStore(ub8 n){
+    static std::vector<Delivery> input = deliveries(n);
+    DedupStore<> store(kProducers);
+    ub8 dup = 0;
+    for (ub8 i = 0; i < n; i++) dup += store.checkAndInsert(input[i].producer, input[i].seq, i) != kDedupFresh;
+    doNotOptimize(dup);
+    return n;
+}
+
+struct DeliveryHash{
+    size_t operator()(const std::pair<ub8, ub8>& d) const {
+        return std::hash<ub8>()(d.first * UB8(0x9e3779b9, 0x7f4a7c15) ^ d.second);
+    }
+};
+
+// 对照：现在的做法，记住每一条(producer, seq)，内存无上限。
+static ub8 exactSet(ub8 n){
+    static std::vector<Delivery> input = deliveries(n);
+    std::unordered_set<std::pair<ub8, ub8>, DeliveryHash> seen;
+    ub8 dup = 0;
+    for (ub8 i = 0; i < n; i++) dup += !seen.insert(std::make_pair(input[i].producer, input[i].seq)).second;
+    doNotOptimize(dup);
+    return n;
+}
+
+BENCH(dedupStore, "dedup/check_insert", "wjp::DedupStore", 1 << 21);
+BENCH(exactSet, "dedup/check_insert", "std::unordered_set", 1 << 21);
@@ -0,0 +1,123 @@
+#include "bench/bench.h"
+#include "thread/epoch.h"
+
+#include <pthread.h>
+#include <thread>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 读多写少的共享表：1024个槽，每槽一个堆上的值，读者随机读槽，后台一个写者
+// 不停地整体替换某个槽的值。对照是pthread_rwlock保护的同一张表。
+static const ub4 kSlots = 1024;
+
+struct Value{
+    ub8 a, b;
+};
+
+struct SharedTable{
+    std::atomic<Value*> slots[kSlots];
+
+    SharedTable(){
+        for (ub4 i = 0; i < kSlots; i++) slots[i].store(new Value{i, i}, std::memory_order_relaxed);
+    }
+};
+
+// 后台写者，bench期间一直在改表
+template < typename Domain >
+struct Writer{
+    SharedTable table;
+    Domain domain;
+    std::atomic<bool> stop{false};
+    std::thread thread;
+
+    Writer() : thread([this]{
+        Random rnd;
+        while (!stop.load(std::memory_order_relaxed)){
+            ub8 x = rnd.next();
+            Value* v = new Value{x, x};
+            Value* old = table.slots[x % kSlots].exchange(v, std::memory_order_acq_rel);
+            domain.retire(old, deleteBatch<Value>);
+            std::this_thread::yield();
+        }
+    }){}
+
+    ~Writer(){
+        stop = true;
+        thread.join();
+    }
+};
+
+static ub8 epochRead(ub8 n){
+    static Writer<EpochDomain> w;
+    Random rnd;
+    ub8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        auto guard = w.domain.pin();
+        Value* v = w.table.slots[rnd.next() % kSlots].load(std::memory_order_acquire);
+        sum += v->a ^ v->b;
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 hazardRead(ub8 n){
+    static Writer<HazardDomain> w;
+    Random rnd;
+    ub8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        Value* v = w.domain.protect(0, w.table.slots[rnd.next() % kSlots]);
+        sum += v->a ^ v->b;
+    }
+    w.domain.clear(0);
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 rwlockRead(ub8 n){
+    static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+    static Value table[kSlots];
+    static std::atomic<bool> stop{false};
+    static std::thread writer([]{
+        Random rnd;
+        while (!stop.load(std::memory_order_relaxed)){
+            ub8 x = rnd.next();
+            pthread_rwlock_wrlock(&lock);
+            table[x % kSlots] = Value{x, x};
+            pthread_rwlock_unlock(&lock);
+            std::this_thread::yield();
+        }
+    });
+    static struct Joiner{ ~Joiner(){ stop = true; writer.join(); } } joiner;
+    Random rnd;
+    ub8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        pthread_rwlock_rdlock(&lock);
+        const Value& v = table[rnd.next() % kSlots];
+        sum += v.a ^ v.b;
+        pthread_rwlock_unlock(&lock);
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+// 只有retire、没有并发读者时的回收开销
+static ub8 epochRetire(ub8 n){
+    static EpochDomain domain;
+    for (ub8 i = 0; i < n; i++) domain.retire(new Value{i, i}, deleteBatch<Value>);
+    domain.flush();
+    return n;
+}
+
+static ub8 hazardRetire(ub8 n){
+    static HazardDomain domain;
+    for (ub8 i = 0; i < n; i++) domain.retire(new Value{i, i}, deleteBatch<Value>);
+    domain.flush();
+    return n;
+}
+
+BENCH(epochRead, "epoch/read_mostly", "wjp::EpochDomain", 1 << 22);
+BENCH(hazardRead, "epoch/read_mostly", "wjp::HazardDomain", 1 << 22);
+BENCH(rwlockRead, "epoch/read_mostly", "pthread_rwlock", 1 << 22);
+BENCH(epochRetire, "epoch/retire", "wjp::EpochDomain", 1 << 20);
+BENCH(hazardRetire, "epoch/retire", "wjp::HazardDomain", 1 << 20);
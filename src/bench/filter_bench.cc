@@ -0,0 +1,93 @@
+#include "bench/bench.h"
+#include "util/bloom.h"
+#include "util/cuckoo.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 典型负载：表里kKeys个key，90%的查询未命中。对照是直接查Hashmap。
+static const ub8 kKeys = 1 << 20;
+
+static inline ub8 key(ub8 i){ return i * UB8(0x9e3779b9, 0x7f4a7c15) + 1; }
+
+static inline ub8 probe(Random& rnd){
+    return rnd.uniform(10) ? key(kKeys + rnd.uniform(kKeys)) : key(rnd.uniform(kKeys));
+}
+
+static BloomFilter<>& bloom(){
+    static BloomFilter<>* filter = nullptr;
+    if (!filter){
+        filter = new BloomFilter<>(kKeys, 0.01);
+        for (ub8 i = 0; i < kKeys; i++){ ub8 k = key(i); filter->add(&k, sizeof(k)); }
+    }
+    return *filter;
+}
+
+static CuckooFilter<>& cuckoo(){
+    static CuckooFilter<>* filter = nullptr;
+    if (!filter){
+        filter = new CuckooFilter<>(kKeys);
+        for (ub8 i = 0; i < kKeys; i++){ ub8 k = key(i); filter->add(&k, sizeof(k)); }
+    }
+    return *filter;
+}
+
+static Hashmap<ub8, ub8>& table(){
+    static Hashmap<ub8, ub8>* map = nullptr;
+    if (!map){
+        map = new Hashmap<ub8, ub8>;
+        for (ub8 i = 0; i < kKeys; i++) (*map)[key(i)] = i;
+    }
+    return *map;
+}
+
+static ub8 bloomLookup(ub8 n){
+    Random rnd;
+    auto& filter = bloom();
+    ub8 hits = 0;
+    for (ub8 i = 0; i < n; i++){ ub8 k = probe(rnd); hits += filter.contains(&k, sizeof(k)); }
+    doNotOptimize(hits);
+    return n;
+}
+
+static ub8 cuckooLookup(ub8 n){
+    Random rnd;
+    auto& filter = cuckoo();
+    ub8 hits = 0;
+    for (ub8 i = 0; i < n; i++){ ub8 k = probe(rnd); hits += filter.contains(&k, sizeof(k)); }
+    doNotOptimize(hits);
+    return n;
+}
+
+static ub8 hashmapLookup(ub8 n){
+    Random rnd;
+    auto& map = table();
+    ub8 hits = 0;
+    for (ub8 i = 0; i < n; i++) hits += map.find(probe(rnd)) != nullptr;
+    doNotOptimize(hits);
+    return n;
+}
+
+// 批量接口：先算出一批哈希，再交给containsBatch预取并测试。
+template < typename Filter, Filter& (*get)() >
+static ub8 batchLookup(ub8 n){
+    static const ub4 kBatch = 256;
+    Random rnd;
+    auto& filter = get();
+    ub8 hashes[kBatch];
+    bool out[kBatch];
+    ub8 hits = 0;
+    for (ub8 i = 0; i < n; i += kBatch){
+        for (ub4 j = 0; j < kBatch; j++){ ub8 k = probe(rnd); hashes[j] = filter.hash(&k, sizeof(k)); }
+        filter.containsBatch(hashes, kBatch, out);
+        for (ub4 j = 0; j < kBatch; j++) hits += out[j];
+    }
+    doNotOptimize(hits);
+    return n;
+}
+
+BENCH(bloomLookup, "filter/lookup_miss90", "wjp::BloomFilter", 1 << 21);
+BENCH(cuckooLookup, "filter/lookup_miss90", "wjp::CuckooFilter", 1 << 21);
+BENCH(hashmapLookup, "filter/lookup_miss90", "wjp::Hashmap", 1 << 21);
+BENCH((batchLookup<BloomFilter<>, bloom>), "filter/lookup_miss90_batch", "wjp::BloomFilter", 1 << 21);
+BENCH((batchLookup<CuckooFilter<>, cuckoo>), "filter/lookup_miss90_batch", "wjp::CuckooFilter", 1 << 21);
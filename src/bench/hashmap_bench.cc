@@ -0,0 +1,89 @@
+#include "bench/bench.h"
+#include "util/hashmap.h"
+
+#include <unordered_map>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+static const ub8 kKeys = 1 << 16;
+
+// 插入集合为key(0..kKeys)，未命中的查询取key(kKeys..2*kKeys)，两者不相交。
+static inline ub8 key(ub8 i){ return i * UB8(0x9e3779b9, 0x7f4a7c15) + 1; }
+
+template < typename Map >
+static void fill(Map& map, ub8 n){
+    for (ub8 i = 0; i < n; i++) map[key(i)] = i;
+}
+
+static ub8 hashmapInsert(ub8 n){
+    Hashmap<ub8, ub8> map;
+    fill(map, n);
+    return n;
+}
+
+static ub8 unorderedInsert(ub8 n){
+    std::unordered_map<ub8, ub8> map;
+    fill(map, n);
+    return n;
+}
+
+// hitPercent%的查询命中。
+template < int hitPercent >
+static ub8 hashmapLookup(ub8 n){
+    static Hashmap<ub8, ub8>* map = nullptr;
+    if (!map){
+        map = new Hashmap<ub8, ub8>;
+        fill(*map, kKeys);
+    }
+    Random rnd;
+    ub8 found = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = rnd.uniform(100) < (ub4)hitPercent ? key(rnd.uniform(kKeys)) : key(kKeys + rnd.uniform(kKeys));
+        found += map->find(k) != nullptr;
+    }
+    doNotOptimize(found);
+    return n;
+}
+
+template < int hitPercent >
+static ub8 unorderedLookup(ub8 n){
+    static std::unordered_map<ub8, ub8>* map = nullptr;
+    if (!map){
+        map = new std::unordered_map<ub8, ub8>;
+        fill(*map, kKeys);
+    }
+    Random rnd;
+    ub8 found = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = rnd.uniform(100) < (ub4)hitPercent ? key(rnd.uniform(kKeys)) : key(kKeys + rnd.uniform(kKeys));
+        found += map->find(k) != map->end();
+    }
+    doNotOptimize(found);
+    return n;
+}
+
+static ub8 hashmapErase(ub8 n){
+    Hashmap<ub8, ub8> map;
+    fill(map, n);
+    for (ub8 i = 0; i < n; i++) std::free(map.erase(key(i)));
+    return 2 * n;
+}
+
+static ub8 unorderedErase(ub8 n){
+    std::unordered_map<ub8, ub8> map;
+    fill(map, n);
+    for (ub8 i = 0; i < n; i++) map.erase(key(i));
+    return 2 * n;
+}
+
+BENCH(hashmapInsert, "hashmap/insert", "wjp::Hashmap", kKeys);
+BENCH(unorderedInsert, "hashmap/insert", "std::unordered_map", kKeys);
+BENCH(hashmapLookup<100>, "hashmap/lookup_hit100", "wjp::Hashmap", 1 << 20);
+BENCH(unorderedLookup<100>, "hashmap/lookup_hit100", "std::unordered_map", 1 << 20);
+BENCH(hashmapLookup<50>, "hashmap/lookup_hit50", "wjp::Hashmap", 1 << 20);
+BENCH(unorderedLookup<50>, "hashmap/lookup_hit50", "std::unordered_map", 1 << 20);
+BENCH(hashmapLookup<0>, "hashmap/lookup_hit0", "wjp::Hashmap", 1 << 20);
+BENCH(unorderedLookup<0>, "hashmap/lookup_hit0", "std::unordered_map", 1 << 20);
+BENCH(hashmapErase, "hashmap/insert_erase", "wjp::Hashmap", kKeys);
+BENCH(unorderedErase, "hashmap/insert_erase", "std::unordered_map", kKeys);
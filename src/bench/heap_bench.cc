@@ -0,0 +1,64 @@
+#include "bench/bench.h"
+#include "util/priorityq.h"
+
+#include <queue>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 两者都是小顶堆：BinaryHeap以less为准把最小值放在堆顶，priority_queue则需greater。
+typedef BinaryHeap<std::less<ub8>, ub8> Heap;
+typedef std::priority_queue<ub8, std::vector<ub8>, std::greater<ub8>> StdHeap;
+
+static ub8 heapPushPop(ub8 n){
+    Random rnd;
+    Heap heap;
+    for (ub8 i = 0; i < n; i++) heap.push(rnd.next());
+    ub8 sum = 0;
+    while (!heap.empty()) sum += heap.pop();
+    doNotOptimize(sum);
+    return 2 * n;
+}
+
+static ub8 stdPushPop(ub8 n){
+    Random rnd;
+    StdHeap heap;
+    for (ub8 i = 0; i < n; i++) heap.push(rnd.next());
+    ub8 sum = 0;
+    while (!heap.empty()) sum += heap.top(), heap.pop();
+    doNotOptimize(sum);
+    return 2 * n;
+}
+
+// 稳态的定时器式负载：堆大小固定，弹出最早的截止时间，再压入一个更晚的。
+static const ub8 kChurnSize = 1 << 14;
+
+static ub8 heapChurn(ub8 n){
+    Random rnd;
+    std::vector<ub8> init(kChurnSize);
+    for (auto& v : init) v = rnd.uniform(1 << 20);
+    Heap heap(std::move(init));
+    for (ub8 i = 0; i < n; i++){
+        ub8 t = heap.pop();
+        heap.push(t + rnd.uniform(1 << 20));
+    }
+    return n;
+}
+
+static ub8 stdChurn(ub8 n){
+    Random rnd;
+    std::vector<ub8> init(kChurnSize);
+    for (auto& v : init) v = rnd.uniform(1 << 20);
+    StdHeap heap(std::greater<ub8>(), std::move(init));
+    for (ub8 i = 0; i < n; i++){
+        ub8 t = heap.top();
+        heap.pop();
+        heap.push(t + rnd.uniform(1 << 20));
+    }
+    return n;
+}
+
+BENCH(heapPushPop, "heap/push_pop", "wjp::BinaryHeap", 1 << 18);
+BENCH(stdPushPop, "heap/push_pop", "std::priority_queue", 1 << 18);
+BENCH(heapChurn, "heap/churn", "wjp::BinaryHeap", 1 << 20);
+BENCH(stdChurn, "heap/churn", "std::priority_queue", 1 << 20);
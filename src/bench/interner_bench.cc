@@ -0,0 +1,142 @@
+#include "bench/bench.h"
+#include "util/interner.h"
+
+#include <thread>
+#include <unordered_map>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 摄入路径上的短字符串：从4096个topic名里按随机顺序取，绝大多数是重复的。
+// 对照是现在的写法：每条消息各自持有一份std::string，按内容比较、用unordered_map计数。
+static const ub4 kDistinct = 4096;
+
+static const std::vector<std::string>& names(){
+    static std::vector<std::string> v;
+    if (v.empty()){
+        for (ub4 i = 0; i < kDistinct; i++) v.push_back("cluster-a/topic/" + std::to_string(i * 2654435761u));
+    }
+    return v;
+}
+
+static ub8 internerIntern(ub8 n){
+    auto& v = names();
+    StringInterner<> in;
+    Random rnd;
+    ub8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        auto& s = v[rnd.uniform(kDistinct)];
+        sum += in.intern(s.data(), (ub4)s.size());
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 internerBulk(ub8 n){
+    auto& v = names();
+    StringInterner<> in;
+    Random rnd;
+    static const ub4 kBatch = 256;
+    const char* strs[kBatch];
+    ub4 lens[kBatch];
+    StringInterner<>::Symbol out[kBatch];
+    ub8 sum = 0;
+    for (ub8 i = 0; i < n; i += kBatch){
+        ub4 m = (ub4)std::min<ub8>(kBatch, n - i);
+        for (ub4 j = 0; j < m; j++){
+            auto& s = v[rnd.uniform(kDistinct)];
+            strs[j] = s.data();
+            lens[j] = (ub4)s.size();
+        }
+        in.internBulk(strs, lens, m, out);
+        sum += out[0];
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 stringCopy(ub8 n){
+    auto& v = names();
+    std::unordered_map<std::string, ub4> seen;
+    Random rnd;
+    ub8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        std::string s = v[rnd.uniform(kDistinct)];
+        sum += seen.emplace(std::move(s), (ub4)seen.size()).first->second;
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+// 4个线程共用一个池
+static ub8 concurrentIntern4(ub8 n){
+    auto& v = names();
+    ConcurrentInterner<> in;
+    std::vector<std::thread> threads;
+    for (ub4 t = 0; t < 4; t++){
+        threads.emplace_back([&in, &v, n, t]{
+            Random rnd(t + 1);
+            ub8 sum = 0;
+            for (ub8 i = t; i < n; i += 4){
+                auto& s = v[rnd.uniform(kDistinct)];
+                sum += in.intern(s.data(), (ub4)s.size());
+            }
+            doNotOptimize(sum);
+        });
+    }
+    for (auto& t : threads) t.join();
+    return n;
+}
+
+static ub8 mutexMap4(ub8 n){
+    auto& v = names();
+    std::unordered_map<std::string, ub4> seen;
+    std::mutex lock;
+    std::vector<std::thread> threads;
+    for (ub4 t = 0; t < 4; t++){
+        threads.emplace_back([&seen, &lock, &v, n, t]{
+            Random rnd(t + 1);
+            ub8 sum = 0;
+            for (ub8 i = t; i < n; i += 4){
+                std::string s = v[rnd.uniform(kDistinct)];
+                std::lock_guard<std::mutex> guard(lock);
+                sum += seen.emplace(std::move(s), (ub4)seen.size()).first->second;
+            }
+            doNotOptimize(sum);
+        });
+    }
+    for (auto& t : threads) t.join();
+    return n;
+}
+
+// 驻留之后的相等比较：符号号比整数，对照按内容比字符串。
+static ub8 symbolEqual(ub8 n){
+    auto& v = names();
+    static StringInterner<> in;
+    static std::vector<StringInterner<>::Symbol> syms;
+    if (syms.empty()){
+        for (auto& s : v) syms.push_back(in.intern(s));
+    }
+    Random rnd;
+    ub8 eq = 0;
+    for (ub8 i = 0; i < n; i++) eq += syms[rnd.uniform(kDistinct)] == syms[rnd.uniform(kDistinct)];
+    doNotOptimize(eq);
+    return n;
+}
+
+static ub8 stringEqual(ub8 n){
+    auto& v = names();
+    Random rnd;
+    ub8 eq = 0;
+    for (ub8 i = 0; i < n; i++) eq += v[rnd.uniform(kDistinct)] == v[rnd.uniform(kDistinct)];
+    doNotOptimize(eq);
+    return n;
+}
+
+BENCH(internerIntern, "interner/intern", "wjp::StringInterner", 1 << 20);
+BENCH(internerBulk, "interner/intern", "wjp::StringInterner bulk", 1 << 20);
+BENCH(stringCopy, "interner/intern", "std::string+unordered_map", 1 << 20);
+BENCH(concurrentIntern4, "interner/intern_4threads", "wjp::ConcurrentInterner", 1 << 20);
+BENCH(mutexMap4, "interner/intern_4threads", "unordered_map+mutex", 1 << 20);
+BENCH(symbolEqual, "interner/equal", "symbol", 1 << 22);
+BENCH(stringEqual, "interner/equal", "std::string", 1 << 22);
@@ -0,0 +1,98 @@
+#include "bench/bench.h"
+#include "io/iobuf.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 消息转发：收到16个1KB的负载片段，加上32字节头组成消息，转发前再前插一层16字节的
+// 路由头，最后导出iovec。对照是现在的做法：std::string逐段拼接，加头时整体复制。
+static const ub4 kPieces = 16;
+static const ub4 kPieceSize = 1024;
+static const ub4 kMessageBytes = kPieces * kPieceSize;
+
+static const char* payload(){
+    static std::vector<char> data;
+    if (data.empty()){
+        data.resize(kPieceSize);
+        Random rnd;
+        for (auto& c : data) c = (char)rnd.next();
+    }
+    return data.data();
+}
+
+static ub8 iobufForward(ub8 n){
+    const char* piece = payload();
+    char header[32] = {0}, route[16] = {0};
+    struct iovec iov[64];
+    ub8 bytes = 0;
+    for (ub8 i = 0; i < n; i++){
+        IOBuf msg;
+        for (ub4 j = 0; j < kPieces; j++) msg.append(piece, kPieceSize);
+        msg.prepend(header, sizeof(header));
+        IOBuf forwarded = msg.clone();
+        forwarded.prepend(route, sizeof(route));
+        ub4 k = forwarded.fillIovec(iov, 64);
+        for (ub4 j = 0; j < k; j++) bytes += iov[j].iov_len;
+    }
+    doNotOptimize(bytes);
+    return n;
+}
+
+// 负载来自外部缓冲区时直接挂上，不复制
+static ub8 iobufForwardExternal(ub8 n){
+    const char* piece = payload();
+    char header[32] = {0}, route[16] = {0};
+    struct iovec iov[64];
+    ub8 bytes = 0;
+    for (ub8 i = 0; i < n; i++){
+        IOBuf msg;
+        msg.append(header, sizeof(header));
+        for (ub4 j = 0; j < kPieces; j++) msg.appendExternal(piece, kPieceSize);
+        IOBuf forwarded = msg.clone();
+        forwarded.prepend(route, sizeof(route));
+        ub4 k = forwarded.fillIovec(iov, 64);
+        for (ub4 j = 0; j < k; j++) bytes += iov[j].iov_len;
+    }
+    doNotOptimize(bytes);
+    return n;
+}
+
+static ub8 stringForward(ub8 n){
+    const char* piece = payload();
+    char header[32] = {0}, route[16] = {0};
+    ub8 bytes = 0;
+    for (ub8 i = 0; i < n; i++){
+        std::string msg;
+        for (ub4 j = 0; j < kPieces; j++) msg.append(piece, kPieceSize);
+        msg.insert(0, header, sizeof(header));
+        std::string forwarded = msg;
+        forwarded.insert(0, route, sizeof(route));
+        bytes += forwarded.size();
+    }
+    doNotOptimize(bytes);
+    return n;
+}
+
+static ub8 iobufBuddyForward(ub8 n){
+    static BuddySystem buddy(1024);
+    const char* piece = payload();
+    char header[32] = {0}, route[16] = {0};
+    struct iovec iov[64];
+    ub8 bytes = 0;
+    for (ub8 i = 0; i < n; i++){
+        IOBuf msg(buddySegments(buddy));
+        for (ub4 j = 0; j < kPieces; j++) msg.append(piece, kPieceSize);
+        msg.prepend(header, sizeof(header));
+        IOBuf forwarded = msg.clone();
+        forwarded.prepend(route, sizeof(route));
+        ub4 k = forwarded.fillIovec(iov, 64);
+        for (ub4 j = 0; j < k; j++) bytes += iov[j].iov_len;
+    }
+    doNotOptimize(bytes);
+    return n;
+}
+
+BENCH(iobufForward, "iobuf/forward_16KB", "wjp::IOBuf(heap)", 1 << 16, kMessageBytes);
+BENCH(iobufBuddyForward, "iobuf/forward_16KB", "wjp::IOBuf(buddy)", 1 << 16, kMessageBytes);
+BENCH(iobufForwardExternal, "iobuf/forward_16KB", "wjp::IOBuf(external)", 1 << 16, kMessageBytes);
+BENCH(stringForward, "iobuf/forward_16KB", "std::string", 1 << 16, kMessageBytes);
@@ -0,0 +1,112 @@
+#include "bench/bench.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 分派后的内核对照其标量实现，验证分派确实带来收益。
+static const ub4 kBufSize = 4096;
+
+static ub1* buffer(){
+    static ub1* buf = nullptr;
+    if (!buf){
+        buf = (ub1*)malloc64(2 * kBufSize);
+        Random rnd;
+        for (ub4 i = 0; i < 2 * kBufSize; i++) buf[i] = (ub1)rnd.next();
+    }
+    return buf;
+}
+
+static ub8 crc32cDispatched(ub8 n){
+    auto crc = cpuKernels().crc32c;
+    ub4 c = 0;
+    for (ub8 i = 0; i < n; i++) c = crc(c, buffer(), kBufSize);
+    doNotOptimize(c);
+    return n;
+}
+
+static ub8 crc32cTableDriven(ub8 n){
+    ub4 c = 0;
+    for (ub8 i = 0; i < n; i++) c = crc32cScalar(c, buffer(), kBufSize);
+    doNotOptimize(c);
+    return n;
+}
+
+static ub8 copyDispatched(ub8 n){
+    auto copy = cpuKernels().copy;
+    for (ub8 i = 0; i < n; i++){
+        copy(buffer() + kBufSize, buffer(), kBufSize);
+        clobberMemory();
+    }
+    return n;
+}
+
+static ub8 copyMemcpy(ub8 n){
+    for (ub8 i = 0; i < n; i++){
+        std::memcpy(buffer() + kBufSize, buffer(), kBufSize);
+        clobberMemory();
+    }
+    return n;
+}
+
+// 15个有序键里找lower_bound，B+树节点内查找的规模
+static const ub8* sortedKeys(){
+    static ub8 keys[15];
+    for (ub4 i = 0; i < 15; i++) keys[i] = (ub8)(i + 1) << 40;
+    return keys;
+}
+
+static ub8 countLessDispatched(ub8 n){
+    auto countLess = cpuKernels().countLess64;
+    const ub8* keys = sortedKeys();
+    Random rnd;
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++) acc += countLess(keys, 15, rnd.next() >> 20);
+    doNotOptimize(acc);
+    return n;
+}
+
+static ub8 countLessScalar(ub8 n){
+    const ub8* keys = sortedKeys();
+    Random rnd;
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++) acc += countLess64Scalar(keys, 15, rnd.next() >> 20);
+    doNotOptimize(acc);
+    return n;
+}
+
+static ub8 countLessStdLowerBound(ub8 n){
+    const ub8* keys = sortedKeys();
+    Random rnd;
+    ub8 acc = 0;
+    for (ub8 i = 0; i < n; i++) acc += std::lower_bound(keys, keys + 15, rnd.next() >> 20) - keys;
+    doNotOptimize(acc);
+    return n;
+}
+
+// 4KB寄存器逐字节取max，HyperLogLog合并的规模
+static ub8 maxBytesDispatched(ub8 n){
+    auto maxBytes = cpuKernels().maxBytes;
+    for (ub8 i = 0; i < n; i++){
+        maxBytes(buffer() + kBufSize, buffer(), kBufSize);
+        clobberMemory();
+    }
+    return n;
+}
+
+static ub8 maxBytesScalarOnly(ub8 n){
+    for (ub8 i = 0; i < n; i++){
+        maxBytesScalar(buffer() + kBufSize, buffer(), kBufSize);
+        clobberMemory();
+    }
+    return n;
+}
+
+BENCH(crc32cDispatched, "kernel/crc32c_4KB", "dispatched", 1 << 14, kBufSize);
+BENCH(crc32cTableDriven, "kernel/crc32c_4KB", "scalar", 1 << 12, kBufSize);
+BENCH(copyDispatched, "kernel/copy_4KB", "dispatched", 1 << 16, kBufSize);
+BENCH(copyMemcpy, "kernel/copy_4KB", "memcpy", 1 << 16, kBufSize);
+BENCH(countLessDispatched, "kernel/count_less64_15", "dispatched", 1 << 22);
+BENCH(countLessScalar, "kernel/count_less64_15", "scalar", 1 << 22);
+BENCH(countLessStdLowerBound, "kernel/count_less64_15", "std::lower_bound", 1 << 22);
+BENCH(maxBytesDispatched, "kernel/max_bytes_4KB", "dispatched", 1 << 16, kBufSize);
+BENCH(maxBytesScalarOnly, "kernel/max_bytes_4KB", "scalar", 1 << 16, kBufSize);
@@ -0,0 +1,83 @@
+#include "bench/bench.h"
+
+#include <cstdio>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 用法：bench [--filter=子串] [--reps=N] [--scale=F] [--format=json|csv] [--tag=提交号]
+// 每个用例一行结果，json为JSON Lines，便于按提交归档、比较回归。
+struct Options{
+    std::string filter;
+    std::string format = "json";
+    std::string tag;
+    int         reps = 5;
+    double      scale = 1.0;
+};
+
+static bool startsWith(const char* arg, const char* prefix, const char** value){
+    size_t len = std::strlen(prefix);
+    if (std::strncmp(arg, prefix, len)) return false;
+    *value = arg + len;
+    return true;
+}
+
+static Options parse(int argc, char** argv){
+    Options opt;
+    for (int i = 1; i < argc; i++){
+        const char* v;
+        if (startsWith(argv[i], "--filter=", &v)) opt.filter = v;
+        else if (startsWith(argv[i], "--format=", &v)) opt.format = v;
+        else if (startsWith(argv[i], "--tag=", &v)) opt.tag = v;
+        else if (startsWith(argv[i], "--reps=", &v)) opt.reps = std::max(1, std::atoi(v));
+        else if (startsWith(argv[i], "--scale=", &v)) opt.scale = std::atof(v);
+        else throw std::invalid_argument(std::string("unknown option ") + argv[i]);
+    }
+    if (opt.format != "json" && opt.format != "csv") throw std::invalid_argument("format must be json or csv");
+    if (opt.scale <= 0) throw std::invalid_argument("scale must be positive");
+    return opt;
+}
+
+int main(int argc, char** argv){
+    Options opt;
+    try{
+        opt = parse(argc, argv);
+    }catch(const std::exception& e){
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    // 各翻译单元的注册顺序不确定，按group排序让同组对照结果相邻、输出顺序稳定。
+    auto cases = registry();
+    std::stable_sort(cases.begin(), cases.end(), [](const Case& a, const Case& b){
+        return std::strcmp(a.group, b.group) < 0;
+    });
+    if (opt.format == "csv") std::printf("tag,group,impl,n,reps,ops,ns_per_op_min,ns_per_op_median,mops,mb_per_s\n");
+    for (auto& c : cases){
+        std::string name = std::string(c.group) + "/" + c.impl;
+        if (!opt.filter.empty() && name.find(opt.filter) == std::string::npos) continue;
+        ub8 n = std::max<ub8>(1, (ub8)(c.n * opt.scale));
+        std::vector<double> perop;
+        ub8 ops = c.fn(n); // 预热一轮不计入结果，静态数据在此期间建好
+        for (int r = 0; r < opt.reps; r++){
+            ub8 start = nowNanos();
+            ops = c.fn(n);
+            ub8 elapsed = nowNanos() - start;
+            perop.push_back(ops ? (double)elapsed / ops : 0);
+        }
+        std::sort(perop.begin(), perop.end());
+        double best = perop.front(), median = perop[perop.size() / 2];
+        double mops = median > 0 ? 1e3 / median : 0;
+        double mbps = (c.bytesPerOp && median > 0) ? c.bytesPerOp * 1e3 / median : 0;
+        if (opt.format == "csv"){
+            std::printf("%s,%s,%s,%llu,%d,%llu,%.3f,%.3f,%.3f,%.1f\n", opt.tag.c_str(), c.group, c.impl,
+                (unsigned long long)n, opt.reps, (unsigned long long)ops, best, median, mops, mbps);
+        }else{
+            std::printf("{\"tag\":\"%s\",\"group\":\"%s\",\"impl\":\"%s\",\"n\":%llu,\"reps\":%d,\"ops\":%llu,"
+                "\"ns_per_op_min\":%.3f,\"ns_per_op_median\":%.3f,\"mops\":%.3f,\"mb_per_s\":%.1f}\n",
+                opt.tag.c_str(), c.group, c.impl, (unsigned long long)n, opt.reps, (unsigned long long)ops,
+                best, median, mops, mbps);
+        }
+        std::fflush(stdout);
+    }
+    return 0;
+}
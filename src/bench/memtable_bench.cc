@@ -0,0 +1,130 @@
+#include "bench/bench.h"
+#include "stream/memtable.h"
+
+#include <map>
+#include <thread>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 写入缓冲的插入与有序扫描：16字节随机key、32字节value。
+// 对照是现在的写法：std::map<std::string, std::string>外面套一把锁。
+static const ub4 kKeySize = 16;
+static const ub4 kValueSize = 32;
+
+static void makeKey(Random& rnd, char* key){
+    ub8 a = rnd.next(), b = rnd.next();
+    std::memcpy(key, &a, 8);
+    std::memcpy(key + 8, &b, 8);
+}
+
+static ub8 memtableInsert(ub8 n){
+    Memtable table;
+    Random rnd;
+    char key[kKeySize], value[kValueSize] = {0};
+    for (ub8 i = 0; i < n; i++){
+        makeKey(rnd, key);
+        table.add(i, key, kKeySize, value, kValueSize);
+    }
+    doNotOptimize(table.size());
+    return n;
+}
+
+static ub8 mapInsert(ub8 n){
+    std::map<std::string, std::string> table;
+    std::mutex lock;
+    Random rnd;
+    char key[kKeySize], value[kValueSize] = {0};
+    for (ub8 i = 0; i < n; i++){
+        makeKey(rnd, key);
+        std::lock_guard<std::mutex> guard(lock);
+        table[std::string(key, kKeySize)] = std::string(value, kValueSize);
+    }
+    doNotOptimize(table.size());
+    return n;
+}
+
+// 4个线程并发写同一张表
+static ub8 memtableInsert4(ub8 n){
+    Memtable table;
+    std::vector<std::thread> threads;
+    for (ub4 t = 0; t < 4; t++){
+        threads.emplace_back([&table, n, t]{
+            Random rnd(t + 1);
+            char key[kKeySize], value[kValueSize] = {0};
+            for (ub8 i = t; i < n; i += 4){
+                makeKey(rnd, key);
+                table.add(i, key, kKeySize, value, kValueSize);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    doNotOptimize(table.size());
+    return n;
+}
+
+static ub8 mapInsert4(ub8 n){
+    std::map<std::string, std::string> table;
+    std::mutex lock;
+    std::vector<std::thread> threads;
+    for (ub4 t = 0; t < 4; t++){
+        threads.emplace_back([&table, &lock, n, t]{
+            Random rnd(t + 1);
+            char key[kKeySize], value[kValueSize] = {0};
+            for (ub8 i = t; i < n; i += 4){
+                makeKey(rnd, key);
+                std::lock_guard<std::mutex> guard(lock);
+                table[std::string(key, kKeySize)] = std::string(value, kValueSize);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    doNotOptimize(table.size());
+    return n;
+}
+
+static ub8 memtableGet(ub8 n){
+    static Memtable table;
+    static ub8 filled = 0;
+    if (!filled){
+        Random rnd;
+        char key[kKeySize], value[kValueSize] = {0};
+        for (filled = 0; filled < (1 << 20); filled++){
+            makeKey(rnd, key);
+            table.add(filled, key, kKeySize, value, kValueSize);
+        }
+    }
+    Random rnd;
+    char key[kKeySize];
+    std::string value;
+    ub8 hits = 0;
+    for (ub8 i = 0; i < n; i++){
+        makeKey(rnd, key);
+        hits += table.get(key, kKeySize, &value);
+    }
+    doNotOptimize(hits);
+    return n;
+}
+
+static ub8 memtableScan(ub8 n){
+    static Memtable table;
+    if (!table.size()){
+        Random rnd;
+        char key[kKeySize], value[kValueSize] = {0};
+        for (ub8 i = 0; i < n; i++){
+            makeKey(rnd, key);
+            table.add(i, key, kKeySize, value, kValueSize);
+        }
+    }
+    ub8 bytes = 0;
+    for (Memtable::Iterator it(&table); it.valid(); it.next()) bytes += it.entry().valueLen();
+    doNotOptimize(bytes);
+    return n;
+}
+
+BENCH(memtableInsert, "memtable/insert", "wjp::Memtable", 1 << 18);
+BENCH(mapInsert, "memtable/insert", "std::map+mutex", 1 << 18);
+BENCH(memtableInsert4, "memtable/insert_4threads", "wjp::Memtable", 1 << 18);
+BENCH(mapInsert4, "memtable/insert_4threads", "std::map+mutex", 1 << 18);
+BENCH(memtableGet, "memtable/get", "wjp::Memtable", 1 << 18);
+BENCH(memtableScan, "memtable/scan", "wjp::Memtable", 1 << 18, kKeySize + kValueSize);
@@ -0,0 +1,87 @@
+#include "bench/bench.h"
+#include "alloc/arena.h"
+#include "alloc/buddy.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 本地与远端内存的访问代价：在绑定到本节点、绑定到下一个节点、跨节点交错的64MB区域上
+// 做随机指针追逐，每步一次cache miss，测的是访存延迟。只有一个节点的机器上"远端"
+// 就是本地，三者应当相同。
+static const ub8 kChaseBytes = 64 << 20;
+static const ub8 kSlots = kChaseBytes / kCacheLineSize;
+
+// 各区域的slot按同一个随机环串起来，每个slot占一条cache line。
+static ub8* chaseRegion(NumaPlacement placement){
+    auto region = (ub8*)numaAllocPages(kChaseBytes, placement);
+    if (!region) throw std::runtime_error("numaAllocPages error");
+    std::vector<ub4> order(kSlots);
+    for (ub4 i = 0; i < kSlots; i++) order[i] = i;
+    Random rnd;
+    for (ub4 i = kSlots - 1; i > 0; i--) std::swap(order[i], order[rnd.uniform(i + 1)]);
+    const ub4 stride = kCacheLineSize / sizeof(ub8);
+    for (ub4 i = 0; i < kSlots; i++) region[(ub8)order[i] * stride] = (ub8)order[(i + 1) % kSlots] * stride;
+    return region;
+}
+
+static ub8 chase(ub8* region, ub8 n){
+    ub8 pos = 0;
+    for (ub8 i = 0; i < n; i++) pos = region[pos];
+    doNotOptimize(pos);
+    return n;
+}
+
+static ub8 chaseLocal(ub8 n){
+    static ub8* region = chaseRegion(NumaPlacement::bind(currentNumaNode()));
+    return chase(region, n);
+}
+
+static ub8 chaseRemote(ub8 n){
+    static ub8* region = chaseRegion(NumaPlacement::bind((currentNumaNode() + 1) % numaNodeCount()));
+    return chase(region, n);
+}
+
+static ub8 chaseInterleave(ub8 n){
+    static ub8* region = chaseRegion(NumaPlacement::interleave());
+    return chase(region, n);
+}
+
+// Arena填满64B的小对象：chunk来自NumaChunkPool（绑定本节点、复用已缓存的chunk）
+// 与来自malloc64。
+static ub8 arenaPool(ub8 n){
+    static NumaChunkPool pool;
+    Arena arena(16*kPageSize, pool.source());
+    for (ub8 i = 0; i < n; i++) std::memset(arena.alloc(64), 0, 64);
+    return n;
+}
+
+static ub8 arenaMalloc(ub8 n){
+    Arena arena(16*kPageSize);
+    for (ub8 i = 0; i < n; i++) std::memset(arena.alloc(64), 0, 64);
+    return n;
+}
+
+// 按节点路由的BuddySystem与单个加锁的BuddySystem，单线程下测路由本身的开销。
+static ub8 numaBuddy(ub8 n){
+    static NumaBuddySystem buddy(4096);
+    for (ub8 i = 0; i < n; i++) buddy.free(buddy.alloc(1000));
+    return n;
+}
+
+static ub8 lockedBuddy(ub8 n){
+    static BuddySystem buddy(4096);
+    static std::mutex lock;
+    for (ub8 i = 0; i < n; i++){
+        std::lock_guard<std::mutex> guard(lock);
+        buddy.free(buddy.alloc(1000));
+    }
+    return n;
+}
+
+BENCH(chaseLocal, "numa/chase_64MB", "bind local node", 1 << 21);
+BENCH(chaseRemote, "numa/chase_64MB", "bind next node", 1 << 21);
+BENCH(chaseInterleave, "numa/chase_64MB", "interleave", 1 << 21);
+BENCH(arenaPool, "numa/arena_fill", "NumaChunkPool", 1 << 20, 64);
+BENCH(arenaMalloc, "numa/arena_fill", "malloc64", 1 << 20, 64);
+BENCH(numaBuddy, "numa/buddy_alloc_free", "NumaBuddySystem", 1 << 20);
+BENCH(lockedBuddy, "numa/buddy_alloc_free", "BuddySystem+mutex", 1 << 20);
@@ -0,0 +1,88 @@
+#include "bench/bench.h"
+#include "util/perfecthash.h"
+#include "util/hashmap.h"
+
+#include <unordered_map>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 命令名分派：固定的32个命令，查询里3/4命中。
+// 对照是现在的写法：先siphash成64位再查Hashmap，以及unordered_map<std::string, int>。
+static constexpr std::string_view kNames[] = {
+    "get", "set", "del", "incr", "decr", "mget", "mset", "expire",
+    "ttl", "keys", "scan", "ping", "echo", "quit", "select", "flushdb",
+    "flushall", "hget", "hset", "hdel", "hgetall", "lpush", "rpush", "lpop",
+    "rpop", "lrange", "sadd", "srem", "smembers", "zadd", "zrange", "subscribe",
+};
+static const ub4 kCount = sizeof(kNames) / sizeof(kNames[0]);
+
+static constexpr auto kCommands = makePerfectHash(kNames);
+
+static const std::vector<std::string>& queries(){
+    static std::vector<std::string> q;
+    if (q.empty()){
+        Random rnd;
+        for (ub4 i = 0; i < 4096; i++){
+            std::string name(kNames[rnd.uniform(kCount)]);
+            if (rnd.uniform(4) == 0) name += "x";
+            q.push_back(name);
+        }
+    }
+    return q;
+}
+
+static ub8 staticPerfect(ub8 n){
+    auto& q = queries();
+    sb8 sum = 0;
+    for (ub8 i = 0; i < n; i++) sum += kCommands.find(q[i & 4095]);
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 runtimePerfect(ub8 n){
+    static PerfectHash table(std::vector<std::string>(kNames, kNames + kCount));
+    auto& q = queries();
+    sb8 sum = 0;
+    for (ub8 i = 0; i < n; i++) sum += table.find(q[i & 4095]);
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 siphashHashmap(ub8 n){
+    static Hashmap<ub8, sb4>* map = nullptr;
+    SipHash sip;
+    if (!map){
+        map = new Hashmap<ub8, sb4>;
+        for (ub4 i = 0; i < kCount; i++) (*map)[sip((const ub1*)kNames[i].data(), (ub4)kNames[i].size())] = i;
+    }
+    auto& q = queries();
+    sb8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        auto& s = q[i & 4095];
+        auto e = map->find(sip((const ub1*)s.data(), (ub4)s.size()));
+        sum += e ? e->value : -1;
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 unorderedMap(ub8 n){
+    static std::unordered_map<std::string, sb4> map;
+    if (map.empty()){
+        for (ub4 i = 0; i < kCount; i++) map[std::string(kNames[i])] = i;
+    }
+    auto& q = queries();
+    sb8 sum = 0;
+    for (ub8 i = 0; i < n; i++){
+        auto it = map.find(q[i & 4095]);
+        sum += it != map.end() ? it->second : -1;
+    }
+    doNotOptimize(sum);
+    return n;
+}
+
+BENCH(staticPerfect, "perfecthash/lookup_32", "wjp::StaticPerfectHash", 1 << 22);
+BENCH(runtimePerfect, "perfecthash/lookup_32", "wjp::PerfectHash", 1 << 22);
+BENCH(siphashHashmap, "perfecthash/lookup_32", "siphash+wjp::Hashmap", 1 << 22);
+BENCH(unorderedMap, "perfecthash/lookup_32", "std::unordered_map", 1 << 22);
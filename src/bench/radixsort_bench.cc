@@ -0,0 +1,172 @@
+#include "bench/bench.h"
+#include "util/radixsort.h"
+
+#include <algorithm>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 批量排序与分区：每轮把同一份随机输入复制进工作数组再排，复制计入耗时，各实现相同。
+// 对照是现在的写法：std::sort，以及按键逐个push_back到各分区的vector。
+// 并行版用默认线程数的Scheduler；单核机器上与单线程版相当。
+static const ub8 kBatch = 1 << 22;
+
+static const std::vector<ub8>& randomKeys(){
+    static std::vector<ub8> keys;
+    if (keys.empty()){
+        Random rnd;
+        keys.resize(kBatch);
+        for (auto& k : keys) k = (ub8)rnd.next() << 32 | rnd.next();
+    }
+    return keys;
+}
+
+static Scheduler& scheduler(){
+    static Scheduler sched;
+    return sched;
+}
+
+struct Row{
+    ub8 key;
+    ub8 value;
+};
+
+struct RowKey{
+    ub8 operator()(const Row& r) const { return r.key; }
+};
+
+// 16字节定长键（如大端编码的复合主键），记录共32字节
+struct KeyRecord{
+    ub1 key[16];
+    ub8 payload[2];
+};
+
+static ub8 stdSortU64(ub8 n){
+    static std::vector<ub8> work;
+    work.assign(randomKeys().begin(), randomKeys().begin() + n);
+    std::sort(work.begin(), work.end());
+    doNotOptimize(work[n / 2]);
+    return n;
+}
+
+static ub8 radixSortU64(ub8 n){
+    static std::vector<ub8> work;
+    static RadixSorter<ub8> sorter;
+    work.assign(randomKeys().begin(), randomKeys().begin() + n);
+    sorter.sort(work.data(), n);
+    doNotOptimize(work[n / 2]);
+    return n;
+}
+
+static ub8 radixSortU64Parallel(ub8 n){
+    static std::vector<ub8> work;
+    static RadixSorter<ub8> sorter(&scheduler());
+    work.assign(randomKeys().begin(), randomKeys().begin() + n);
+    sorter.sort(work.data(), n);
+    doNotOptimize(work[n / 2]);
+    return n;
+}
+
+// 32位键，高位只用到20位：高字节那一趟被跳过
+static ub8 stdSortU32(ub8 n){
+    static std::vector<ub4> work(kBatch);
+    auto& keys = randomKeys();
+    for (ub8 i = 0; i < n; i++) work[i] = (ub4)keys[i] & 0xfffff;
+    std::sort(work.begin(), work.begin() + n);
+    doNotOptimize(work[n / 2]);
+    return n;
+}
+
+static ub8 radixSortU32(ub8 n){
+    static std::vector<ub4> work(kBatch);
+    static RadixSorter<ub4> sorter;
+    auto& keys = randomKeys();
+    for (ub8 i = 0; i < n; i++) work[i] = (ub4)keys[i] & 0xfffff;
+    sorter.sort(work.data(), n);
+    doNotOptimize(work[n / 2]);
+    return n;
+}
+
+static void fillRows(std::vector<Row>& rows, ub8 n){
+    auto& keys = randomKeys();
+    rows.resize(n);
+    for (ub8 i = 0; i < n; i++) rows[i] = Row{keys[i], i};
+}
+
+static ub8 stdStableSortRows(ub8 n){
+    static std::vector<Row> rows;
+    fillRows(rows, n);
+    std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b){ return a.key < b.key; });
+    doNotOptimize(rows[n / 2].value);
+    return n;
+}
+
+static ub8 radixSortRows(ub8 n){
+    static std::vector<Row> rows;
+    static RadixSorter<Row, RowKey> sorter;
+    fillRows(rows, n);
+    sorter.sort(rows.data(), n);
+    doNotOptimize(rows[n / 2].value);
+    return n;
+}
+
+static void fillRecords(std::vector<KeyRecord>& recs, ub8 n){
+    auto& keys = randomKeys();
+    recs.resize(n);
+    for (ub8 i = 0; i < n; i++){
+        std::memset(recs[i].key, 0, 6); // 前缀相同，如同一张表的表号
+        std::memcpy(recs[i].key + 6, &keys[i], 8);
+        std::memset(recs[i].key + 14, 0, 2);
+        recs[i].payload[0] = recs[i].payload[1] = i;
+    }
+}
+
+static ub8 stdSortBytes(ub8 n){
+    static std::vector<KeyRecord> recs;
+    fillRecords(recs, n);
+    std::sort(recs.begin(), recs.end(), [](const KeyRecord& a, const KeyRecord& b){
+        return std::memcmp(a.key, b.key, sizeof(a.key)) < 0;
+    });
+    doNotOptimize(recs[n / 2].payload[0]);
+    return n;
+}
+
+static ub8 radixSortBytes(ub8 n){
+    static std::vector<KeyRecord> recs;
+    static ByteRadixSorter<KeyRecord> sorter(0, 16);
+    fillRecords(recs, n);
+    sorter.sort(recs.data(), n);
+    doNotOptimize(recs[n / 2].payload[0]);
+    return n;
+}
+
+// 哈希分区：分成64个区，之后各区各建一张表
+static ub8 vectorPartition(ub8 n){
+    static std::vector<ub8> parts[64];
+    SipHash sip;
+    for (auto& p : parts) p.clear();
+    auto& keys = randomKeys();
+    for (ub8 i = 0; i < n; i++) parts[sip((const ub1*)&keys[i], 8) >> 58].push_back(keys[i]);
+    doNotOptimize(parts[0].size());
+    return n;
+}
+
+static ub8 hashPartition(ub8 n){
+    static std::vector<ub8> out(kBatch);
+    static HashPartitioner<ub8> partitioner;
+    auto& offsets = partitioner.partition(randomKeys().data(), n, out.data(), 6);
+    doNotOptimize(offsets[1]);
+    return n;
+}
+
+BENCH(stdSortU64, "radixsort/u64_4M", "std::sort", kBatch, 8);
+BENCH(radixSortU64, "radixsort/u64_4M", "wjp::RadixSorter", kBatch, 8);
+BENCH(radixSortU64Parallel, "radixsort/u64_4M", "wjp::RadixSorter+Scheduler", kBatch, 8);
+BENCH(stdSortU32, "radixsort/u32_20bit_4M", "std::sort", kBatch, 4);
+BENCH(radixSortU32, "radixsort/u32_20bit_4M", "wjp::RadixSorter", kBatch, 4);
+BENCH(stdStableSortRows, "radixsort/row16_4M", "std::stable_sort", kBatch, 16);
+BENCH(radixSortRows, "radixsort/row16_4M", "wjp::RadixSorter", kBatch, 16);
+BENCH(stdSortBytes, "radixsort/key16_1M", "std::sort memcmp", 1 << 20, 32);
+BENCH(radixSortBytes, "radixsort/key16_1M", "wjp::ByteRadixSorter", 1 << 20, 32);
+BENCH(vectorPartition, "radixsort/hash_partition_64", "siphash+vector push_back", kBatch, 8);
+BENCH(hashPartition, "radixsort/hash_partition_64", "wjp::HashPartitioner", kBatch, 8);
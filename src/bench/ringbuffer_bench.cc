@@ -0,0 +1,167 @@
+#include "bench/bench.h"
+#include "util/ringbuffer.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 对照组：各流水线现在用的mutex + condvar + std::deque。
+template < typename T >
+class LockedQueue{
+public:
+    explicit LockedQueue(ub4 capacity) : cap(capacity){}
+
+    bool push(const T& value){
+        std::unique_lock<std::mutex> guard(lock);
+        if (items.size() >= cap) return false;
+        items.push_back(value);
+        guard.unlock();
+        nonEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& out){
+        std::unique_lock<std::mutex> guard(lock);
+        if (items.empty()) return false;
+        out = items.front();
+        items.pop_front();
+        return true;
+    }
+
+    ub4 push_n(const T* in, ub4 n){
+        std::unique_lock<std::mutex> guard(lock);
+        ub4 k = 0;
+        for (; k < n && items.size() < cap; k++) items.push_back(in[k]);
+        guard.unlock();
+        if (k) nonEmpty.notify_all();
+        return k;
+    }
+
+    ub4 pop_n(T* out, ub4 n){
+        std::unique_lock<std::mutex> guard(lock);
+        ub4 k = 0;
+        for (; k < n && !items.empty(); k++){
+            out[k] = items.front();
+            items.pop_front();
+        }
+        return k;
+    }
+
+    // 阻塞式出队，用于延迟测试。
+    void waitPop(T& out){
+        std::unique_lock<std::mutex> guard(lock);
+        nonEmpty.wait(guard, [this]{ return !items.empty(); });
+        out = items.front();
+        items.pop_front();
+    }
+
+private:
+    std::mutex              lock;
+    std::condition_variable nonEmpty;
+    std::deque<T>           items;
+    ub4                     cap;
+};
+
+static const ub4 kQueueCapacity = 1024;
+
+// 满/空时让出CPU，核数少于线程数时也能推进。
+static inline void backoff(){ std::this_thread::yield(); }
+
+// P个生产者、C个消费者，共传递n个元素；batch为0时逐个收发。
+template < typename Queue, int P, int C, int batch >
+static ub8 transfer(ub8 n){
+    Queue queue(kQueueCapacity);
+    ub8 perProducer = n / P;
+    ub8 total = perProducer * P;
+    std::atomic<ub8> consumed(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < P; p++){
+        threads.emplace_back([&]{
+            ub8 buf[batch ? batch : 1];
+            for (ub8 i = 0; i < perProducer;){
+                if (batch){
+                    ub4 k = 0;
+                    for (; k < (ub4)batch && i + k < perProducer; k++) buf[k] = i + k;
+                    ub4 done = queue.push_n(buf, k);
+                    if (done) i += done; else backoff();
+                }else{
+                    if (queue.push(i)) i++; else backoff();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < C; c++){
+        threads.emplace_back([&]{
+            ub8 buf[batch ? batch : 1];
+            ub8 sum = 0;
+            while (consumed.load(std::memory_order_relaxed) < total){
+                ub4 k = batch ? queue.pop_n(buf, batch) : (queue.pop(buf[0]) ? 1 : 0);
+                if (!k){ backoff(); continue; }
+                for (ub4 i = 0; i < k; i++) sum += buf[i];
+                consumed.fetch_add(k, std::memory_order_relaxed);
+            }
+            doNotOptimize(sum);
+        });
+    }
+    for (auto& t : threads) t.join();
+    return total;
+}
+
+// 往返延迟：两个线程经一对队列互相传球，每次往返计一次操作。
+template < typename Queue >
+static ub8 pingPong(ub8 n){
+    Queue ping(kQueueCapacity), pong(kQueueCapacity);
+    std::thread echo([&]{
+        ub8 v;
+        for (ub8 i = 0; i < n; i++){
+            while (!ping.pop(v)) backoff();
+            while (!pong.push(v)) backoff();
+        }
+    });
+    ub8 v;
+    for (ub8 i = 0; i < n; i++){
+        while (!ping.push(i)) backoff();
+        while (!pong.pop(v)) backoff();
+    }
+    echo.join();
+    return n;
+}
+
+static ub8 pingPongLocked(ub8 n){
+    LockedQueue<ub8> ping(kQueueCapacity), pong(kQueueCapacity);
+    std::thread echo([&]{
+        ub8 v;
+        for (ub8 i = 0; i < n; i++){
+            ping.waitPop(v);
+            pong.push(v);
+        }
+    });
+    ub8 v;
+    for (ub8 i = 0; i < n; i++){
+        ping.push(i);
+        pong.waitPop(v);
+    }
+    echo.join();
+    return n;
+}
+
+static const ub8 kItems = 1 << 20;
+
+BENCH((transfer<SpscRing<ub8>, 1, 1, 0>), "ring/1p1c", "wjp::SpscRing", kItems);
+BENCH((transfer<MpmcRing<ub8>, 1, 1, 0>), "ring/1p1c", "wjp::MpmcRing", kItems);
+BENCH((transfer<LockedQueue<ub8>, 1, 1, 0>), "ring/1p1c", "mutex+deque", kItems);
+BENCH((transfer<SpscRing<ub8>, 1, 1, 16>), "ring/1p1c_batch16", "wjp::SpscRing", kItems);
+BENCH((transfer<MpmcRing<ub8>, 1, 1, 16>), "ring/1p1c_batch16", "wjp::MpmcRing", kItems);
+BENCH((transfer<LockedQueue<ub8>, 1, 1, 16>), "ring/1p1c_batch16", "mutex+deque", kItems);
+BENCH((transfer<MpmcRing<ub8>, 2, 2, 0>), "ring/2p2c", "wjp::MpmcRing", kItems);
+BENCH((transfer<LockedQueue<ub8>, 2, 2, 0>), "ring/2p2c", "mutex+deque", kItems);
+BENCH((transfer<MpmcRing<ub8>, 4, 4, 0>), "ring/4p4c", "wjp::MpmcRing", kItems);
+BENCH((transfer<LockedQueue<ub8>, 4, 4, 0>), "ring/4p4c", "mutex+deque", kItems);
+BENCH((transfer<MpmcRing<ub8>, 4, 4, 16>), "ring/4p4c_batch16", "wjp::MpmcRing", kItems);
+BENCH((transfer<LockedQueue<ub8>, 4, 4, 16>), "ring/4p4c_batch16", "mutex+deque", kItems);
+BENCH(pingPong<SpscRing<ub8>>, "ring/pingpong_rtt", "wjp::SpscRing", 1 << 15);
+BENCH(pingPong<MpmcRing<ub8>>, "ring/pingpong_rtt", "wjp::MpmcRing", 1 << 15);
+BENCH(pingPongLocked, "ring/pingpong_rtt", "mutex+condvar", 1 << 15);
@@ -0,0 +1,69 @@
+#include "bench/bench.h"
+#include "thread/scheduler.h"
+
+#include <thread>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 扩展性：对n个ub8求和（带一点计算量），线程数1/2/4/8。
+// 对照是现在的做法：按线程数平均切块，各起一个std::thread再join。
+static std::vector<ub8>& input(ub8 n){
+    static std::vector<ub8> data;
+    if (data.size() != n){
+        data.resize(n);
+        Random rnd;
+        for (auto& x : data) x = rnd.next();
+    }
+    return data;
+}
+
+static inline ub8 work(const ub8* data, ub8 lo, ub8 hi){
+    ub8 acc = 0;
+    for (ub8 i = lo; i < hi; i++) acc += (data[i] * UB8(0x9e3779b9, 0x7f4a7c15)) >> 17;
+    return acc;
+}
+
+template < ub4 Threads >
+static ub8 schedulerSum(ub8 n){
+    static Scheduler sched(Threads);
+    const ub8* data = input(n).data();
+    ub8 sum = sched.parallelReduce<ub8>(0, n, 1 << 14, 0,
+        [data](ub8 lo, ub8 hi){ return work(data, lo, hi); },
+        [](ub8 a, ub8 b){ return a + b; });
+    doNotOptimize(sum);
+    return n;
+}
+
+template < ub4 Threads >
+static ub8 threadFanout(ub8 n){
+    const ub8* data = input(n).data();
+    std::vector<ub8> partial(Threads);
+    std::vector<std::thread> threads;
+    for (ub4 t = 0; t < Threads; t++){
+        threads.emplace_back([&, t]{ partial[t] = work(data, n * t / Threads, n * (t + 1) / Threads); });
+    }
+    for (auto& t : threads) t.join();
+    ub8 sum = 0;
+    for (auto p : partial) sum += p;
+    doNotOptimize(sum);
+    return n;
+}
+
+// 细粒度任务的开销：grain为1的parallelFor，每个下标一个任务。
+static ub8 spawnWait(ub8 n){
+    static Scheduler sched(4);
+    std::atomic<ub8> calls{0};
+    sched.parallelFor(0, n, 1, [&calls](ub8 lo, ub8 hi){ calls.fetch_add(hi - lo, std::memory_order_relaxed); });
+    doNotOptimize(calls);
+    return n;
+}
+
+BENCH(schedulerSum<1>, "scheduler/parallel_sum", "wjp::Scheduler(1)", 1 << 24, 8);
+BENCH(schedulerSum<2>, "scheduler/parallel_sum", "wjp::Scheduler(2)", 1 << 24, 8);
+BENCH(schedulerSum<4>, "scheduler/parallel_sum", "wjp::Scheduler(4)", 1 << 24, 8);
+BENCH(schedulerSum<8>, "scheduler/parallel_sum", "wjp::Scheduler(8)", 1 << 24, 8);
+BENCH(threadFanout<1>, "scheduler/parallel_sum", "std::thread(1)", 1 << 24, 8);
+BENCH(threadFanout<4>, "scheduler/parallel_sum", "std::thread(4)", 1 << 24, 8);
+BENCH(threadFanout<8>, "scheduler/parallel_sum", "std::thread(8)", 1 << 24, 8);
+BENCH(spawnWait, "scheduler/parallel_for_grain1", "wjp::Scheduler(4)", 1 << 20);
@@ -0,0 +1,45 @@
+#include "bench/bench.h"
+#include "util/siphash.h"
+
+#include <string>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+static const ub1* kKey = (const ub1*)"1234567812345678";
+
+template < ub4 len >
+static ub8 siphashLen(ub8 n){
+    ub1 buf[len];
+    for (ub4 i = 0; i < len; i++) buf[i] = (ub1)i;
+    ub8 h = 0;
+    for (ub8 i = 0; i < n; i++){
+        buf[0] = (ub1)i;
+        h ^= siphash(buf, len, kKey);
+    }
+    doNotOptimize(h);
+    return n;
+}
+
+// 对照：libstdc++的std::hash<std::string>（MurmurHash2变体，无密钥，不抗哈希洪水）。
+template < ub4 len >
+static ub8 stdHashLen(ub8 n){
+    std::string s(len, 'x');
+    std::hash<std::string> hasher;
+    ub8 h = 0;
+    for (ub8 i = 0; i < n; i++){
+        s[0] = (char)i;
+        h ^= hasher(s);
+    }
+    doNotOptimize(h);
+    return n;
+}
+
+BENCH(siphashLen<8>, "siphash/8B", "wjp::siphash", 1 << 22, 8);
+BENCH(stdHashLen<8>, "siphash/8B", "std::hash", 1 << 22, 8);
+BENCH(siphashLen<16>, "siphash/16B", "wjp::siphash", 1 << 22, 16);
+BENCH(stdHashLen<16>, "siphash/16B", "std::hash", 1 << 22, 16);
+BENCH(siphashLen<64>, "siphash/64B", "wjp::siphash", 1 << 21, 64);
+BENCH(stdHashLen<64>, "siphash/64B", "std::hash", 1 << 21, 64);
+BENCH(siphashLen<1024>, "siphash/1KB", "wjp::siphash", 1 << 17, 1024);
+BENCH(stdHashLen<1024>, "siphash/1KB", "std::hash", 1 << 17, 1024);
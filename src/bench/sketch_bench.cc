@@ -0,0 +1,105 @@
+#include "bench/bench.h"
+#include "util/sketch.h"
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 流上的去重计数与频次统计：key取自1M个不同值，按近似幂律重复出现。
+// 对照是现在的写法：以key为键的精确Hashmap。
+static const ub8 kKeys = 1 << 20;
+
+static inline ub8 skewedKey(Random& rnd){
+    return rnd.uniform(rnd.uniform((ub4)kKeys) + 1) * UB8(0x9e3779b9, 0x7f4a7c15);
+}
+
+static ub8 hllAdd(ub8 n){
+    HyperLogLog<> hll(14);
+    Random rnd;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = skewedKey(rnd);
+        hll.add(&k, sizeof(k));
+    }
+    doNotOptimize(hll.estimate());
+    return n;
+}
+
+static ub8 hashmapDistinct(ub8 n){
+    Hashmap<ub8, ub1> seen;
+    Random rnd;
+    for (ub8 i = 0; i < n; i++) seen[skewedKey(rnd)] = 1;
+    doNotOptimize(seen.size());
+    return n;
+}
+
+static ub8 countMinAdd(ub8 n){
+    CountMinSketch<> cms(1 << 14, 4);
+    Random rnd;
+    ub8 heavy = 0;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = skewedKey(rnd);
+        heavy += cms.add(&k, sizeof(k)) > 1000;
+    }
+    doNotOptimize(heavy);
+    return n;
+}
+
+// 哈希已在上游算好（如驻留池里存着），整批更新
+static ub8 countMinBatch(ub8 n){
+    CountMinSketch<> cms(1 << 14, 4);
+    Random rnd;
+    static const ub4 kBatch = 256;
+    ub8 hashes[kBatch];
+    for (ub8 i = 0; i < n; i += kBatch){
+        ub4 m = (ub4)std::min<ub8>(kBatch, n - i);
+        for (ub4 j = 0; j < m; j++) hashes[j] = skewedKey(rnd);
+        cms.addBatch(hashes, m);
+    }
+    doNotOptimize(cms.totalCount());
+    return n;
+}
+
+static ub8 countSketchAdd(ub8 n){
+    CountSketch<> cs(1 << 14, 5);
+    Random rnd;
+    for (ub8 i = 0; i < n; i++){
+        ub8 k = skewedKey(rnd);
+        cs.add(&k, sizeof(k));
+    }
+    doNotOptimize(cs.width());
+    return n;
+}
+
+static ub8 hashmapCount(ub8 n){
+    Hashmap<ub8, ub4> counts;
+    Random rnd;
+    ub8 heavy = 0;
+    for (ub8 i = 0; i < n; i++) heavy += ++counts[skewedKey(rnd)] > 1000;
+    doNotOptimize(heavy);
+    return n;
+}
+
+// 各worker的HLL汇总：稠密寄存器逐字节取max
+static ub8 hllMerge(ub8 n){
+    static HyperLogLog<>* parts = nullptr;
+    if (!parts){
+        parts = (HyperLogLog<>*)malloc(sizeof(HyperLogLog<>) * 2);
+        for (ub4 w = 0; w < 2; w++){
+            new(&parts[w]) HyperLogLog<>(14);
+            Random rnd(w + 1);
+            for (ub8 i = 0; i < kKeys; i++){
+                ub8 k = skewedKey(rnd);
+                parts[w].add(&k, sizeof(k));
+            }
+        }
+    }
+    for (ub8 i = 0; i < n; i++) parts[0].merge(parts[1]);
+    return n;
+}
+
+BENCH(hllAdd, "sketch/distinct", "wjp::HyperLogLog p=14", 1 << 22);
+BENCH(hashmapDistinct, "sketch/distinct", "wjp::Hashmap exact", 1 << 22);
+BENCH(countMinAdd, "sketch/frequency", "wjp::CountMinSketch 16Kx4", 1 << 22);
+BENCH(countMinBatch, "sketch/frequency", "wjp::CountMinSketch 16Kx4 batch", 1 << 22);
+BENCH(countSketchAdd, "sketch/frequency", "wjp::CountSketch 16Kx5", 1 << 22);
+BENCH(hashmapCount, "sketch/frequency", "wjp::Hashmap exact", 1 << 22);
+BENCH(hllMerge, "sketch/hll_merge_16KB", "wjp::HyperLogLog", 1 << 14, 1 << 14);
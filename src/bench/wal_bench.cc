@@ -0,0 +1,61 @@
+#include "bench/bench.h"
+#include "io/wal.h"
+
+#include <thread>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 负载：kWriters个生产者各自提交128字节的提交记录，每条都要等到落盘才返回。
+// 对照是每条记录各自write + fdatasync。日志目录建在/tmp下，跑完删除。
+static const ub4 kWriters = 8;
+static const ub4 kRecordSize = 128;
+
+static std::string freshDir(const char* name){
+    std::string dir = std::string("/tmp/wjp_bench_") + name;
+    std::string cmd = "rm -rf " + dir;
+    if (std::system(cmd.c_str())) throw std::runtime_error("cannot clean " + dir);
+    return dir;
+}
+
+static ub8 walGroupCommit(ub8 n){
+    std::string dir = freshDir("wal");
+    {
+        Wal wal(dir);
+        std::vector<std::thread> writers;
+        for (ub4 t = 0; t < kWriters; t++){
+            writers.emplace_back([&wal, n]{
+                char record[kRecordSize] = {};
+                for (ub8 i = 0; i < n / kWriters; i++) wal.appendDurable(record, sizeof(record));
+            });
+        }
+        for (auto& w : writers) w.join();
+    }
+    freshDir("wal");
+    return n / kWriters * kWriters;
+}
+
+static ub8 writeEachSync(ub8 n){
+    std::string dir = freshDir("sync");
+    ::mkdir(dir.c_str(), 0755);
+    int fd = ::open((dir + "/log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) throw std::runtime_error("cannot open log");
+    std::mutex lock;
+    std::vector<std::thread> writers;
+    for (ub4 t = 0; t < kWriters; t++){
+        writers.emplace_back([&, n]{
+            char record[kRecordSize] = {};
+            for (ub8 i = 0; i < n / kWriters; i++){
+                std::lock_guard<std::mutex> guard(lock);
+                if (::write(fd, record, sizeof(record)) != sizeof(record) || ::fdatasync(fd)) std::abort();
+            }
+        });
+    }
+    for (auto& w : writers) w.join();
+    ::close(fd);
+    freshDir("sync");
+    return n / kWriters * kWriters;
+}
+
+BENCH(walGroupCommit, "wal/append_durable", "wjp::Wal", 1 << 14, kRecordSize);
+BENCH(writeEachSync, "wal/append_durable", "write+fdatasync", 1 << 14, kRecordSize);
@@ -0,0 +1,110 @@
+#include "bench/bench.h"
+#include "stream/window.h"
+#include "util/priorityq.h"
+
+#include <map>
+
+using namespace wjp;
+using namespace wjp::bench;
+
+// 负载：kKeys个key均匀分布，事件时间每条加1，约5%在kDisorder之内乱序；
+// 每kWatermarkEvery条推进一次水位线（当前时间减kDisorder）。
+// 窗口长1 << 15，滑动窗口每1 << 13滑一次，即每个事件属于4个窗口。
+static const ub4 kKeys = 1 << 14;
+static const ub8 kWindow = 1 << 15;
+static const ub8 kSlide = 1 << 13;
+static const ub8 kDisorder = 256;
+static const ub4 kWatermarkEvery = 1024;
+
+struct Event{
+    ub4 key;
+    ub4 value;
+    ub8 time;
+};
+
+static const std::vector<Event>& events(ub8 n){
+    static std::vector<Event> out;
+    if (out.empty()){
+        Random rnd;
+        out.resize(n);
+        for (ub8 i = 0; i < n; i++){
+            ub8 t = i + kDisorder;
+            if (rnd.uniform(100) < 5) t -= rnd.uniform(kDisorder);
+            out[i] = Event{rnd.uniform(kKeys), rnd.uniform(1000), t};
+        }
+    }
+    return out;
+}
+
+template < typename Agg >
+static ub8 runPanes(ub8 n, ub8 slide){
+    auto& input = events(n);
+    WindowAggregator<ub4, Agg> agg(kWindow, slide);
+    ub8 sum = 0;
+    auto emit = [&](const ub4&, const typename Agg::Output& v, ub8, ub8){ sum += (ub8)v; };
+    for (ub8 i = 0; i < n; i++){
+        agg.add(input[i].key, input[i].time, input[i].value);
+        if (i % kWatermarkEvery == 0) agg.advanceWatermark(i, emit);
+    }
+    agg.flush(emit);
+    doNotOptimize(sum);
+    return n;
+}
+
+// 对照：现在的做法，每个窗口一张Hashmap，事件逐个更新它所属的每个窗口；
+// 窗口的结束时间进最小堆，水位线越过时遍历输出并整表释放。
+template < typename Agg >
+static ub8 runPerWindow(ub8 n, ub8 slide){
+    typedef Hashmap<ub4, typename Agg::State> Table;
+    auto& input = events(n);
+    std::map<ub8, Table*> windows;
+    BinaryHeap<std::less<ub8>, ub8> deadlines;
+    ub8 pending = 0, sum = 0;
+    auto advance = [&](ub8 wm){
+        while (pending && deadlines.top() <= wm){
+            ub8 start = deadlines.pop() - kWindow;
+            pending--;
+            Table* t = windows[start];
+            for (auto it = t->begin(); it != t->end(); ++it) sum += (ub8)Agg::result(it->value);
+            delete t;
+            windows.erase(start);
+        }
+    };
+    ub8 wm = 0;
+    for (ub8 i = 0; i < n; i++){
+        const Event& e = input[i];
+        if (e.time >= wm){
+            ub8 first = e.time < kWindow ? 0 : (e.time - kWindow) / slide * slide + slide;
+            for (ub8 s = first; s <= e.time; s += slide){
+                Table*& t = windows[s];
+                if (!t){
+                    t = new Table;
+                    deadlines.push(s + kWindow);
+                    pending++;
+                }
+                bool existing;
+                auto entry = t->findOrCreateNew(e.key, &existing);
+                if (!existing) Agg::init(entry->value);
+                Agg::add(entry->value, e.value);
+            }
+        }
+        if (i % kWatermarkEvery == 0 && i > wm) advance(wm = i);
+    }
+    advance(~(ub8)0);
+    doNotOptimize(sum);
+    return n;
+}
+
+static ub8 panesTumblingSum(ub8 n){ return runPanes<SumAggregator<ub8>>(n, kWindow); }
+static ub8 perWindowTumblingSum(ub8 n){ return runPerWindow<SumAggregator<ub8>>(n, kWindow); }
+static ub8 panesSlidingSum(ub8 n){ return runPanes<SumAggregator<ub8>>(n, kSlide); }
+static ub8 perWindowSlidingSum(ub8 n){ return runPerWindow<SumAggregator<ub8>>(n, kSlide); }
+static ub8 panesSlidingMean(ub8 n){ return runPanes<MeanAggregator<ub4>>(n, kSlide); }
+static ub8 perWindowSlidingMean(ub8 n){ return runPerWindow<MeanAggregator<ub4>>(n, kSlide); }
+
+BENCH(panesTumblingSum, "window/tumbling_sum", "wjp::WindowAggregator", 1 << 22);
+BENCH(perWindowTumblingSum, "window/tumbling_sum", "Hashmap per window+BinaryHeap", 1 << 22);
+BENCH(panesSlidingSum, "window/sliding4_sum", "wjp::WindowAggregator", 1 << 22);
+BENCH(perWindowSlidingSum, "window/sliding4_sum", "Hashmap per window+BinaryHeap", 1 << 22);
+BENCH(panesSlidingMean, "window/sliding4_mean", "wjp::WindowAggregator", 1 << 22);
+BENCH(perWindowSlidingMean, "window/sliding4_mean", "Hashmap per window+BinaryHeap", 1 << 22);
@@ -4,11 +4,16 @@
 #include <cstring>
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <stdexcept>
+#include <string>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 typedef int64_t  sb8;
@@ -26,6 +31,14 @@ namespace wjp{
     // 全局常量
     const static int kPageSize = 4096;
     const static int kPageSizeOrder = 12;
+    const static int kCacheLineSize = 64;
+
+    // 不小于x的最小的2的幂，x为0时返回1。
+    static inline ub4 roundUpPowerOf2(ub4 x){
+        ub4 cap = 1;
+        while (cap < x) cap <<= 1;
+        return cap;
+    }
 
 
 }
\ No newline at end of file
@@ -0,0 +1,398 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/buddy.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+namespace wjp{
+
+// 完成回调：result为传输的字节数，出错时为-errno，与io_uring的cqe.res一致。
+// 回调在调用poll/wait的线程里执行，可以在回调里继续提交新的请求；
+// 回调里槽位用满时，提交只收割不回调，新完成的回调由外层接着执行，不会重入。
+typedef void (*IoCallback)(void* ctx, sb4 result);
+
+// 异步文件I/O引擎，供日志、快照文件使用。
+// 1. 首选io_uring：直接走系统调用，不依赖liburing；请求先攒在SQ里，
+//    submit一次io_uring_enter批量提交。内核不支持或被禁用时退回线程池，接口不变。
+// 2. 缓冲区来自内部的BuddySystem，按页对齐，可配合O_DIRECT；整块区域启动时
+//    注册为io_uring固定缓冲区，落在其中的读写用READ_FIXED/WRITE_FIXED，省去每次的页钉。
+//    区域外的缓冲区同样可用，只是走普通读写。
+// 3. 回调只是函数指针加上下文，存放在定长槽位里，没有额外分配。
+// 4. 引擎本身不是线程安全的，由一个线程负责提交和收割；线程池只在内部使用。
+class AioEngine{
+public:
+    // depth为同时在途请求数上限；bufferPages为缓冲区总页数；
+    // useUring为false时强制使用线程池，便于对照和测试。
+    AioEngine(ub4 depth = 256, ub4 bufferPages = 1024, bool useUring = true, ub4 fallbackThreads = 4)
+        : buffers(bufferPages)
+    {
+        if (useUring) setupUring(depth);
+        if (ringFd < 0) startPool(fallbackThreads);
+        slots.resize(depth);
+        freeSlots.reserve(depth);
+        for (ub4 i = depth; i > 0; i--) freeSlots.push_back(i - 1);
+    }
+
+    ~AioEngine(){
+        drain();
+        if (ringFd >= 0){
+            ::munmap(sqes, sqesSize);
+            if (cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+            ::munmap(sqRing, sqRingSize);
+            ::close(ringFd);
+        }else{
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            workCv.notify_all();
+            for (auto& w : workers) w.join();
+        }
+    }
+
+    bool usingUring() const { return ringFd >= 0; }
+
+    bool fixedBuffers() const { return registered; }
+
+    // 页对齐的I/O缓冲区，大小向上取整到页，最多BuddySystem::kMaxPagesPerBlock页。
+    char* allocBuffer(ub8 size){ return buffers.allocPages(size); }
+
+    void freeBuffer(char* buf){ buffers.freePages(buf); }
+
+    // 以下三个接口只是排队，真正交给内核要等submit，或在poll/wait时顺带提交。
+    // 在途请求达到depth时会先收割已完成的请求腾出槽位。
+    void read(int fd, char* buf, ub4 len, ub8 offset, IoCallback cb, void* ctx){
+        enqueue(kRead, fd, buf, len, offset, false, cb, ctx);
+    }
+
+    void write(int fd, const char* buf, ub4 len, ub8 offset, IoCallback cb, void* ctx){
+        enqueue(kWrite, fd, (char*)buf, len, offset, false, cb, ctx);
+    }
+
+    // barrier为true时，等之前提交的请求全部完成后才执行，用于“写完再落盘”。
+    void fsync(int fd, IoCallback cb, void* ctx, bool barrier = true){
+        enqueue(kFsync, fd, nullptr, 0, 0, barrier, cb, ctx);
+    }
+
+    // 提交排队中的请求，返回提交个数。
+    ub4 submit(){
+        if (ringFd >= 0) return enter(0);
+        ub4 n = (ub4)queued.size();
+        if (n){
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                for (auto& op : queued) work.push_back(op);
+            }
+            queued.clear();
+            workCv.notify_all();
+        }
+        return n;
+    }
+
+    // 不阻塞，收割已完成的请求并执行回调，返回完成个数。
+    ub4 poll(){
+        submit();
+        return reap();
+    }
+
+    // 阻塞直到至少minComplete个请求完成（在途不足时以在途数为准）。
+    // 线程池模式下每轮先提交：上一轮回调里新排队的请求也要交给工作线程，
+    // 等待的个数只按已交出去的算，否则会等一个没人执行的请求。
+    ub4 wait(ub4 minComplete = 1){
+        ub4 done = 0;
+        while (done < minComplete && inflight()){
+            if (ringFd >= 0){
+                enter(std::min(minComplete - done, inflight()));
+            }else{
+                submit();
+                waitPool(std::min(minComplete - done, inflight() - (ub4)queued.size()));
+            }
+            done += reap();
+        }
+        return done;
+    }
+
+    // 等待所有在途请求完成。
+    void drain(){
+        while (inflight()) wait(inflight());
+    }
+
+    ub4 inflight() const { return (ub4)(slots.size() - freeSlots.size()); }
+
+private:
+    AioEngine(const AioEngine&) = delete;
+    AioEngine& operator=(const AioEngine&) = delete;
+
+    enum OpCode : ub1 { kRead, kWrite, kFsync };
+
+    struct Slot{
+        IoCallback cb;
+        void*      ctx;
+    };
+
+    struct Done{
+        Slot slot;
+        sb4  result;
+    };
+
+    struct Op{
+        OpCode op;
+        bool   barrier;
+        int    fd;
+        char*  buf;
+        ub4    len;
+        ub4    slot;
+        ub8    offset;
+    };
+
+    void enqueue(OpCode op, int fd, char* buf, ub4 len, ub8 offset, bool barrier, IoCallback cb, void* ctx){
+        while (freeSlots.empty()){
+            if (!dispatching){
+                wait(1);
+                continue;
+            }
+            // 回调里等槽位：只把完成的请求收进ready，回调留给外层的reap
+            if (ringFd >= 0) enter(1);
+            else{
+                submit();
+                waitPool(1);
+            }
+            harvest();
+        }
+        ub4 slot = freeSlots.back();
+        freeSlots.pop_back();
+        slots[slot] = Slot{cb, ctx};
+        Op o{op, barrier, fd, buf, len, slot, offset};
+        if (ringFd >= 0) prepare(o);
+        else queued.push_back(o);
+    }
+
+    // 完成的请求先归还槽位、记进ready，回调稍后统一执行。
+    void finish(ub4 slot, sb4 result){
+        ready.push_back(Done{slots[slot], result});
+        freeSlots.push_back(slot);
+    }
+
+    ub4 harvest(){
+        return ringFd >= 0 ? harvestUring() : harvestPool();
+    }
+
+    // 收割并执行回调，返回收割个数。回调里再进来时只收割，
+    // ready里的回调由最外层按完成顺序逐个执行，每个请求恰好一次。
+    ub4 reap(){
+        ub4 n = harvest();
+        if (dispatching) return n;
+        dispatching = true;
+        try{
+            while (!ready.empty()){
+                Done d = ready.front();
+                ready.pop_front();
+                if (d.slot.cb) d.slot.cb(d.slot.ctx, d.result);
+            }
+        }catch (...){
+            dispatching = false;
+            throw;
+        }
+        dispatching = false;
+        return n;
+    }
+
+    // ---- io_uring ----
+
+    static inline ub4 loadAcquire(const ub4* p){ return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+
+    static inline void storeRelease(ub4* p, ub4 v){ __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+    void setupUring(ub4 depth){
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int fd = (int)::syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0) return;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(ub4);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        sqRing = (char*)::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED){
+            ::close(fd);
+            return;
+        }
+        cqRing = sqRing;
+        if (!single){
+            cqRing = (char*)::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED){
+                ::munmap(sqRing, sqRingSize);
+                ::close(fd);
+                return;
+            }
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED){
+            if (cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+            ::munmap(sqRing, sqRingSize);
+            ::close(fd);
+            return;
+        }
+        sqHead  = (ub4*)(sqRing + params.sq_off.head);
+        sqTail  = (ub4*)(sqRing + params.sq_off.tail);
+        sqMask  = *(ub4*)(sqRing + params.sq_off.ring_mask);
+        sqArray = (ub4*)(sqRing + params.sq_off.array);
+        cqHead  = (ub4*)(cqRing + params.cq_off.head);
+        cqTail  = (ub4*)(cqRing + params.cq_off.tail);
+        cqMask  = *(ub4*)(cqRing + params.cq_off.ring_mask);
+        cqes    = (io_uring_cqe*)(cqRing + params.cq_off.cqes);
+        sqEntries = params.sq_entries;
+        localTail = *sqTail;
+        ringFd = fd;
+        // 注册失败（如RLIMIT_MEMLOCK太小）不影响使用，只是不走固定缓冲区
+        iovec region{buffers.regionAddress(), (size_t)buffers.regionSize()};
+        registered = ::syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &region, 1) == 0;
+    }
+
+    void prepare(const Op& o){
+        // SQ满了先提交；slot数不超过depth，内核消费后总能腾出位置
+        while (localTail - loadAcquire(sqHead) >= sqEntries) enter(0);
+        ub4 index = localTail & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = o.fd;
+        sqe->user_data = o.slot;
+        if (o.barrier) sqe->flags |= IOSQE_IO_DRAIN;
+        if (o.op == kFsync){
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }else{
+            bool fixed = registered && buffers.contains(o.buf) && buffers.contains(o.buf + o.len - 1);
+            if (o.op == kRead) sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            else sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe->addr = (ub8)(uintptr_t)o.buf;
+            sqe->len = o.len;
+            sqe->off = o.offset;
+            sqe->buf_index = 0;
+        }
+        sqArray[index] = index;
+        localTail++;
+    }
+
+    // 提交未提交的SQE，并可选地等待minComplete个完成。返回提交个数。
+    ub4 enter(ub4 minComplete){
+        ub4 toSubmit = localTail - *sqTail;
+        if (!toSubmit && !minComplete) return 0;
+        storeRelease(sqTail, localTail);
+        for (;;){
+            int n = (int)::syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete,
+                minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (n >= 0) return (ub4)n;
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) throw std::runtime_error("io_uring_enter failed");
+            // 完成队列积压时内核拒绝新提交，先收割再重试
+            if (errno != EINTR) harvestUring();
+        }
+    }
+
+    ub4 harvestUring(){
+        ub4 head = *cqHead, n = 0;
+        for (ub4 tail = loadAcquire(cqTail); head != tail; tail = loadAcquire(cqTail)){
+            while (head != tail){
+                io_uring_cqe cqe = cqes[head & cqMask];
+                storeRelease(cqHead, ++head);
+                finish((ub4)cqe.user_data, cqe.res);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    // ---- 线程池 ----
+
+    void startPool(ub4 nthreads){
+        if (!nthreads) nthreads = 1;
+        for (ub4 i = 0; i < nthreads; i++) workers.emplace_back([this]{ workLoop(); });
+    }
+
+    // barrier请求要等前面的请求全部做完，做它的时候后面的请求也等着。
+    void workLoop(){
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;){
+            workCv.wait(guard, [&]{
+                return stopping || (!work.empty() && !barrierRunning && (!work.front().barrier || !running));
+            });
+            if (stopping) return;
+            Op o = work.front();
+            work.pop_front();
+            running++;
+            if (o.barrier) barrierRunning = true;
+            guard.unlock();
+            sb4 result;
+            if (o.op == kRead) result = (sb4)::pread(o.fd, o.buf, o.len, (off_t)o.offset);
+            else if (o.op == kWrite) result = (sb4)::pwrite(o.fd, o.buf, o.len, (off_t)o.offset);
+            else result = ::fdatasync(o.fd);
+            if (result < 0) result = -errno;
+            guard.lock();
+            running--;
+            if (o.barrier) barrierRunning = false;
+            completed.push_back(std::make_pair(o.slot, result));
+            doneCv.notify_one();
+            if (!work.empty()) workCv.notify_all();
+        }
+    }
+
+    void waitPool(ub4 want){
+        std::unique_lock<std::mutex> guard(lock);
+        doneCv.wait(guard, [&]{ return completed.size() >= want; });
+    }
+
+    ub4 harvestPool(){
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& c : completed) finish(c.first, c.second);
+        ub4 n = (ub4)completed.size();
+        completed.clear();
+        return n;
+    }
+
+    BuddySystem         buffers;
+    std::vector<Slot>   slots;
+    std::vector<ub4>    freeSlots;
+    std::deque<Done>    ready;        // 已完成、回调未执行
+    bool                dispatching = false;
+
+    // io_uring
+    int             ringFd = -1;
+    bool            registered = false;
+    char*           sqRing = nullptr;
+    char*           cqRing = nullptr;
+    size_t          sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    io_uring_sqe*   sqes = nullptr;
+    io_uring_cqe*   cqes = nullptr;
+    ub4*            sqHead = nullptr;
+    ub4*            sqTail = nullptr;
+    ub4*            sqArray = nullptr;
+    ub4*            cqHead = nullptr;
+    ub4*            cqTail = nullptr;
+    ub4             sqMask = 0, cqMask = 0, sqEntries = 0;
+    ub4             localTail = 0; // 已填写但未必已提交的SQE尾部
+
+    // 线程池
+    std::vector<Op>          queued; // 尚未submit
+    std::mutex               lock;
+    std::condition_variable  workCv, doneCv;
+    std::deque<Op>           work;
+    std::vector<std::pair<ub4, sb4>> completed;
+    ub4                      running = 0;
+    bool                     barrierRunning = false;
+    bool                     stopping = false;
+    std::vector<std::thread> workers;
+};
+
+}
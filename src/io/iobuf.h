@@ -0,0 +1,437 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+#include "alloc/buddy.h"
+
+#include <algorithm>
+#include <sys/uio.h>
+
+namespace wjp{
+
+// 段内存的来源：alloc至少给size字节，实际可用量写回capacity；free归还alloc给出的指针。
+typedef char* (*SegmentAlloc)(void* ctx, ub4 size, ub4* capacity);
+typedef void  (*SegmentFree)(void* ctx, char* mem);
+
+struct SegmentSource{
+    SegmentAlloc alloc;
+    SegmentFree  free;
+    void*        ctx;
+};
+
+static inline char* heapSegmentAlloc(void*, ub4 size, ub4* capacity){
+    *capacity = size;
+    return malloc64(size);
+}
+
+static inline void heapSegmentFree(void*, char* mem){
+    std::free(mem);
+}
+
+// 按cache line对齐的堆内存。
+static inline SegmentSource heapSegments(){
+    return SegmentSource{heapSegmentAlloc, heapSegmentFree, nullptr};
+}
+
+// BuddySystem按2的幂页分配，多出来的部分都算进capacity，
+// alloc的块头占8字节，这里一并扣掉。BuddySystem非线程安全，
+// 段的最后一个引用须在持有BuddySystem的线程上释放。
+static inline char* buddySegmentAlloc(void* ctx, ub4 size, ub4* capacity){
+    ub4 pages = (size + 8 + kPageSize - 1) >> kPageSizeOrder;
+    ub4 rounded = 1;
+    while (rounded < pages) rounded <<= 1;
+    *capacity = (rounded << kPageSizeOrder) - 8;
+    return ((BuddySystem*)ctx)->alloc(*capacity);
+}
+
+static inline void buddySegmentFree(void* ctx, char* mem){
+    ((BuddySystem*)ctx)->free(mem);
+}
+
+static inline SegmentSource buddySegments(BuddySystem& buddy){
+    return SegmentSource{buddySegmentAlloc, buddySegmentFree, &buddy};
+}
+
+// Arena、UserBufferArena没有free，段随Arena一起回收，Arena须比所有引用它的IOBuf活得久。
+// 配合UserBufferArena时，头几个段直接落在调用方给的栈缓冲区里。
+template < typename A >
+static inline char* arenaSegmentAlloc(void* ctx, ub4 size, ub4* capacity){
+    *capacity = (ub4)ALIGN(size);
+    return ((A*)ctx)->alloc(size);
+}
+
+static inline void arenaSegmentFree(void*, char*){}
+
+template < typename A >
+static inline SegmentSource arenaSegments(A& arena){
+    return SegmentSource{arenaSegmentAlloc<A>, arenaSegmentFree, &arena};
+}
+
+
+// 链式缓冲区，收发、序列化、转发消息时不做中间拷贝。
+// 1. 数据分散在若干段里，每段引用一个带引用计数的块；slice、clone、appendRef
+//    只增加引用计数，不复制字节。块的最后一个引用消失时归还给来源。
+// 2. 块只被一个IOBuf引用时才可写：append先填最后一段的尾部空间，
+//    prepend先用第一段前面的headroom，不够才新开段。共享的块一律只读。
+// 3. append(IOBuf&&)与appendExternal把别人的段、用户自己的内存直接挂到链尾，
+//    不复制；fillIovec导出iovec数组交给writev/sendmsg。
+// 引用计数是原子的，段可以跨线程共享；单个IOBuf对象本身非线程安全。
+class IOBuf{
+public:
+    // 段的分配尺寸，含块头；再加上BuddySystem的8字节块头正好一页。
+    static const ub4 kDefaultSegmentSize = kPageSize - 8;
+    static const ub4 kDefaultHeadroom = 64;
+
+    // 块的外部释放回调，appendExternal用。
+    typedef void (*ExternalRelease)(void* ctx, char* data);
+
+    explicit IOBuf(SegmentSource source = heapSegments(), ub4 segmentSize = kDefaultSegmentSize, ub4 headroom = kDefaultHeadroom)
+        : source(source), segmentSize(segmentSize), headroom(headroom){}
+
+    IOBuf(IOBuf&& rhs) : source(rhs.source), segmentSize(rhs.segmentSize), headroom(rhs.headroom),
+        segments(std::move(rhs.segments)), total(rhs.total)
+    {
+        rhs.segments.clear();
+        rhs.total = 0;
+    }
+
+    IOBuf& operator=(IOBuf&& rhs){
+        if (this != &rhs){
+            clear();
+            source = rhs.source;
+            segmentSize = rhs.segmentSize;
+            headroom = rhs.headroom;
+            segments = std::move(rhs.segments);
+            total = rhs.total;
+            rhs.segments.clear();
+            rhs.total = 0;
+        }
+        return *this;
+    }
+
+    ~IOBuf(){
+        clear();
+    }
+
+    ub8 length() const { return total; }
+
+    bool empty() const { return total == 0; }
+
+    ub4 segmentCount() const { return (ub4)segments.size(); }
+
+    // 释放全部段的引用。
+    void clear(){
+        for (auto& seg : segments) unref(seg.block);
+        segments.clear();
+        total = 0;
+    }
+
+    // ---- 追加 ----
+
+    // 复制data到链尾，先填最后一段的尾部空间。
+    void append(const void* data, ub4 len){
+        const char* p = (const char*)data;
+        while (len){
+            ub4 n = 0;
+            char* dst = tailroom(&n);
+            if (!n) dst = newTailSegment(len, &n);
+            if (n > len) n = len;
+            std::memcpy(dst, p, n);
+            commit(n);
+            p += n;
+            len -= n;
+        }
+    }
+
+    // 链尾连续n字节的可写空间，不够就新开一段；写完后用commit确认实际写入的字节数。
+    // 序列化时直接往这里写，省掉一次先写临时缓冲再append的复制。
+    char* writableTail(ub4 n){
+        ub4 room = 0;
+        char* dst = tailroom(&room);
+        if (room >= n) return dst;
+        return newTailSegment(n, &room);
+    }
+
+    void commit(ub4 n){
+        assert(!segments.empty());
+        Segment& last = segments.back();
+        assert(last.data + last.len + n <= last.block->data + last.block->capacity);
+        last.len += n;
+        total += n;
+    }
+
+    // 把other的段整体接到链尾，other清空，不复制字节。
+    void append(IOBuf&& other){
+        if (segments.empty()) segments = std::move(other.segments);
+        else segments.insert(segments.end(), other.segments.begin(), other.segments.end());
+        total += other.total;
+        other.segments.clear();
+        other.total = 0;
+    }
+
+    // 共享other的段接到链尾，两边的段此后都只读。
+    void appendRef(const IOBuf& other){
+        segments.reserve(segments.size() + other.segments.size());
+        for (auto& seg : other.segments){
+            ref(seg.block);
+            segments.push_back(seg);
+        }
+        total += other.total;
+    }
+
+    // 用户自己的内存直接成段，最后一个引用消失时调用release(ctx, data)；release可为空。
+    // 这样的段永远只读。
+    void appendExternal(const void* data, ub4 len, ExternalRelease release = nullptr, void* ctx = nullptr){
+        if (!len) return;
+        Block* block = (Block*)std::malloc(sizeof(Block));
+        if (!block) throw std::runtime_error("malloc error");
+        new(block) Block;
+        block->data = (char*)data;
+        block->capacity = len;
+        block->external = 1;
+        block->release = (void*)release;
+        block->ctx = ctx;
+        segments.push_back(Segment{block, (char*)data, len});
+        total += len;
+    }
+
+    // ---- 前插 ----
+
+    // 链头前面n字节的可写空间，用第一段的headroom，不够就在前面新开一段，
+    // 新段的数据放在块的末尾，给以后的前插留出空间。写入后数据即生效，不需commit。
+    char* writableHead(ub4 n){
+        if (!segments.empty()){
+            Segment& head = segments.front();
+            if (exclusive(head.block) && (ub8)(head.data - head.block->data) >= n){
+                head.data -= n;
+                head.len += n;
+                total += n;
+                return head.data;
+            }
+        }
+        ub4 capacity = 0;
+        Block* block = newBlock(n + headroom, &capacity);
+        char* p = block->data + capacity - n;
+        segments.insert(segments.begin(), Segment{block, p, n});
+        total += n;
+        return p;
+    }
+
+    void prepend(const void* data, ub4 len){
+        std::memcpy(writableHead(len), data, len);
+    }
+
+    // ---- 裁剪与切片 ----
+
+    // 丢掉开头n字节，writev部分写出后用它消费已发送的数据。
+    void trimStart(ub8 n){
+        if (n > total) n = total;
+        total -= n;
+        size_t drop = 0;
+        while (n){
+            Segment& seg = segments[drop];
+            if (n >= seg.len){
+                n -= seg.len;
+                unref(seg.block);
+                drop++;
+            }else{
+                seg.data += n;
+                seg.len -= (ub4)n;
+                n = 0;
+            }
+        }
+        segments.erase(segments.begin(), segments.begin() + drop);
+    }
+
+    void trimEnd(ub8 n){
+        if (n > total) n = total;
+        total -= n;
+        while (n){
+            Segment& seg = segments.back();
+            if (n >= seg.len){
+                n -= seg.len;
+                unref(seg.block);
+                segments.pop_back();
+            }else{
+                seg.len -= (ub4)n;
+                n = 0;
+            }
+        }
+    }
+
+    // [offset, offset + len)的只读视图，引用原来的块，不复制。
+    IOBuf slice(ub8 offset, ub8 len) const {
+        IOBuf out(source, segmentSize, headroom);
+        if (offset >= total) return out;
+        if (len > total - offset) len = total - offset;
+        out.segments.reserve(segments.size());
+        for (auto& seg : segments){
+            if (!len) break;
+            if (offset >= seg.len){
+                offset -= seg.len;
+                continue;
+            }
+            ub4 n = (ub4)std::min<ub8>(seg.len - offset, len);
+            ref(seg.block);
+            out.segments.push_back(Segment{seg.block, seg.data + offset, n});
+            out.total += n;
+            len -= n;
+            offset = 0;
+        }
+        return out;
+    }
+
+    IOBuf clone() const {
+        return slice(0, total);
+    }
+
+    // ---- 导出 ----
+
+    // 填入至多max个iovec，返回填入的个数；段数超过max时分批writev，配合trimStart。
+    ub4 fillIovec(struct iovec* iov, ub4 max) const {
+        ub4 n = 0;
+        for (auto& seg : segments){
+            if (n == max) break;
+            iov[n].iov_base = seg.data;
+            iov[n].iov_len = seg.len;
+            n++;
+        }
+        return n;
+    }
+
+    // 复制[offset, offset + len)到dst，返回实际复制的字节数。
+    ub8 copyTo(char* dst, ub8 offset, ub8 len) const {
+        ub8 copied = 0;
+        for (auto& seg : segments){
+            if (copied == len) break;
+            if (offset >= seg.len){
+                offset -= seg.len;
+                continue;
+            }
+            ub8 n = std::min<ub8>(seg.len - offset, len - copied);
+            std::memcpy(dst + copied, seg.data + offset, n);
+            copied += n;
+            offset = 0;
+        }
+        return copied;
+    }
+
+    std::string toString() const {
+        std::string s(total, '\0');
+        copyTo(&s[0], 0, total);
+        return s;
+    }
+
+    // 依次以fn(const char* data, ub4 len)访问每一段。
+    template < typename Fn >
+    void forEachSegment(Fn&& fn) const {
+        for (auto& seg : segments) fn((const char*)seg.data, seg.len);
+    }
+
+    // 把整条链合并成一段，便于交给只认连续内存的接口；返回首字节。
+    char* coalesce(){
+        if (segments.size() == 1) return segments[0].data;
+        if (segments.empty()) return nullptr;
+        if (total > 0xffffffffull - headroom) throw std::runtime_error("iobuf: too large to coalesce");
+        ub4 capacity = 0;
+        Block* block = newBlock((ub4)total + headroom, &capacity);
+        char* p = block->data + headroom;
+        copyTo(p, 0, total);
+        ub8 len = total;
+        clear();
+        segments.push_back(Segment{block, p, (ub4)len});
+        total = len;
+        return p;
+    }
+
+private:
+    IOBuf(const IOBuf&) = delete;
+    IOBuf& operator=(const IOBuf&) = delete;
+
+    // 块头放在段内存的开头，数据紧随其后；external块的头单独malloc，数据是用户的。
+    struct Block{
+        std::atomic<ub4> refs{1};
+        ub4              capacity = 0;
+        char*            data = nullptr;
+        ub4              external = 0;
+        void*            release = nullptr; // external时为ExternalRelease，否则为SegmentFree
+        void*            ctx = nullptr;
+    };
+
+    static const ub4 kBlockHeader = ALIGN(sizeof(Block));
+
+    struct Segment{
+        Block* block;
+        char*  data;
+        ub4    len;
+    };
+
+    static inline void ref(Block* block){
+        block->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 看到计数为1说明只有自己持有，别人也无从再加引用，省掉一次原子减。
+    static inline void unref(Block* block){
+        if (block->refs.load(std::memory_order_acquire) != 1 &&
+            block->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        if (block->external){
+            if (block->release) ((ExternalRelease)block->release)(block->ctx, block->data);
+            block->~Block();
+            std::free(block);
+        }else{
+            auto release = (SegmentFree)block->release;
+            void* ctx = block->ctx;
+            block->~Block();
+            release(ctx, (char*)block);
+        }
+    }
+
+    // 用户的内存不归我们写，即使只有一个引用。
+    static inline bool exclusive(Block* block){
+        return !block->external && block->refs.load(std::memory_order_acquire) == 1;
+    }
+
+    Block* newBlock(ub4 size, ub4* capacity){
+        ub4 got = 0;
+        char* mem = source.alloc(source.ctx, kBlockHeader + size, &got);
+        if (!mem) throw std::runtime_error("iobuf: segment alloc error");
+        Block* block = new(mem) Block;
+        block->data = mem + kBlockHeader;
+        block->capacity = got - kBlockHeader;
+        block->release = (void*)source.free;
+        block->ctx = source.ctx;
+        *capacity = block->capacity;
+        return block;
+    }
+
+    // 最后一段尾部可写的空间，块被共享时为0。
+    char* tailroom(ub4* room){
+        *room = 0;
+        if (segments.empty()) return nullptr;
+        Segment& last = segments.back();
+        if (!exclusive(last.block)) return nullptr;
+        char* end = last.data + last.len;
+        *room = (ub4)(last.block->data + last.block->capacity - end);
+        return end;
+    }
+
+    // 新开一段接在链尾，至少能写n字节；第一段留出headroom给以后的前插。
+    char* newTailSegment(ub4 n, ub4* room){
+        ub4 front = segments.empty() ? headroom : 0;
+        ub4 capacity = 0;
+        ub4 payload = segmentSize > kBlockHeader ? segmentSize - kBlockHeader : 0;
+        Block* block = newBlock(std::max(n + front, payload), &capacity);
+        char* p = block->data + front;
+        segments.push_back(Segment{block, p, 0});
+        *room = capacity - front;
+        return p;
+    }
+
+    SegmentSource        source;
+    ub4                  segmentSize;
+    ub4                  headroom;
+    std::vector<Segment> segments;
+    ub8                  total = 0;
+};
+
+}
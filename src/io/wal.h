@@ -0,0 +1,426 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace wjp{
+
+struct WalOptions{
+    ub8 segmentSize      = 64 << 20; // 段文件大小，创建时整段预分配
+    ub4 groupBytes       = 1 << 20;  // 攒够这么多字节立即刷盘
+    ub4 groupDelayMicros = 0;        // 批次中第一条记录最多等待这么久；0表示刷盘线程空闲就写
+};
+
+// 分段的追加写日志（write-ahead log），带组提交。
+// 1. 记录格式：{ub4 长度, ub4 crc32c, ub8 LSN} + 载荷，按8字节对齐；crc覆盖LSN与载荷，
+//    crc32c走cpuKernels()，SSE4.2可用时用硬件指令。
+// 2. append只在锁内把记录复制进当前批次的Arena并登记iovec，不做I/O；
+//    后台刷盘线程攒够groupBytes或等满groupDelayMicros后，把整批用pwritev写出并
+//    fdatasync一次，多个生产者的追加共享一次落盘。刷盘期间新的追加进入下一批，
+//    所以即使不设延迟，并发的提交也会自然成组。
+// 3. 段文件按segmentSize用posix_fallocate预分配。刷盘线程切到某段时通知预建线程
+//    建好下一段，滚动时直接接手，分配和目录fsync不在组提交的路径上。记录不跨段。
+// 4. 恢复：按序mmap各段顺序扫描，段内遇到全零记录头即转入下一段；校验失败或
+//    LSN不连续视为日志尾部，其后的内容与更晚的段全部丢弃，写入从尾部接着进行。
+class Wal{
+public:
+    // 恢复时对每条有效记录调用replay(lsn, data, len)。
+    typedef std::function<void(ub8 lsn, const char* data, ub4 len)> ReplayFn;
+
+    static const ub4 kHeaderSize = 16;
+
+    explicit Wal(const std::string& dir, const WalOptions& options = WalOptions(), const ReplayFn& replay = ReplayFn())
+        : dir(dir), options(options)
+    {
+        if (options.segmentSize < 2 * kPageSize) throw std::invalid_argument("wal segment too small");
+        if (::mkdir(dir.c_str(), 0755) && errno != EEXIST) throw std::runtime_error("wal: mkdir " + dir + " failed");
+        recover(replay);
+        staged.reset(new Batch);
+        preallocator = std::thread([this]{ prepareLoop(); });
+        requestSegment(tailSegment);
+        flusher = std::thread([this]{ flushLoop(); });
+    }
+
+    // 析构前把已追加的记录全部落盘。
+    ~Wal(){
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        flushCv.notify_one();
+        flusher.join();
+        {
+            std::lock_guard<std::mutex> guard(prepLock);
+            prepStopping = true;
+        }
+        prepCv.notify_all();
+        preallocator.join();
+        if (current >= 0) ::close(current);
+        if (prepared >= 0) ::close(prepared);
+    }
+
+    // 追加一条记录，返回其LSN。记录此时只在内存里，需要持久化时调用waitDurable。
+    ub8 append(const void* data, ub4 len){
+        ub4 size = ALIGN(kHeaderSize + len);
+        if (size > options.segmentSize) throw std::invalid_argument("wal record larger than a segment");
+        std::unique_lock<std::mutex> guard(lock);
+        if (failed) throw std::runtime_error("wal: " + error);
+        Batch& b = *staged;
+        char* p = b.arena.alloc(size);
+        if (!p) throw std::runtime_error("wal: arena alloc error");
+        ub8 lsn = ++nextLsn;
+        Header h{len, 0, lsn};
+        std::memcpy(p, &h, kHeaderSize);
+        std::memcpy(p + kHeaderSize, data, len);
+        if (size > kHeaderSize + len) std::memset(p + kHeaderSize + len, 0, size - kHeaderSize - len);
+        h.crc = checksum(p + 8, 8 + len);
+        std::memcpy(p, &h, 8);
+        place(b, p, size);
+        b.lastLsn = lsn;
+        // 批次的第一条记录启动延迟计时，攒满则提前唤醒
+        bool first = b.bytes == size;
+        if (first) b.firstAppend = std::chrono::steady_clock::now();
+        bool wake = first || b.bytes >= options.groupBytes;
+        guard.unlock();
+        if (wake) flushCv.notify_one();
+        return lsn;
+    }
+
+    // 阻塞直到lsn及之前的记录都已fdatasync。
+    void waitDurable(ub8 lsn){
+        std::unique_lock<std::mutex> guard(lock);
+        durableCv.wait(guard, [&]{ return durableLsn >= lsn || failed; });
+        if (durableLsn < lsn) throw std::runtime_error("wal: " + error);
+    }
+
+    ub8 appendDurable(const void* data, ub4 len){
+        ub8 lsn = append(data, len);
+        waitDurable(lsn);
+        return lsn;
+    }
+
+    ub8 lastLsn(){
+        std::lock_guard<std::mutex> guard(lock);
+        return nextLsn;
+    }
+
+    ub8 durable(){
+        std::lock_guard<std::mutex> guard(lock);
+        return durableLsn;
+    }
+
+private:
+    Wal(const Wal&) = delete;
+    Wal& operator=(const Wal&) = delete;
+
+    struct Header{
+        ub4 len;
+        ub4 crc;
+        ub8 lsn;
+    };
+
+    // 同一段内连续的一串记录，对应一次pwritev。
+    struct Run{
+        ub8 segment;
+        ub8 offset;
+        std::vector<iovec> iov;
+    };
+
+    struct Batch{
+        Arena arena{64 * kPageSize};
+        std::vector<Run> runs;
+        ub8 bytes = 0;
+        ub8 lastLsn = 0;
+        std::chrono::steady_clock::time_point firstAppend;
+    };
+
+    static inline ub4 checksum(const char* data, size_t len){
+        return cpuKernels().crc32c(0, data, len);
+    }
+
+    // 为记录确定落盘位置：放不下就滚到下一段。与前一条在内存和文件中都相邻时合并iovec。
+    void place(Batch& b, char* p, ub4 size){
+        if (tailOffset + size > options.segmentSize){
+            tailSegment++;
+            tailOffset = 0;
+        }
+        if (b.runs.empty() || b.runs.back().segment != tailSegment){
+            b.runs.push_back(Run{tailSegment, tailOffset, std::vector<iovec>()});
+        }
+        auto& iov = b.runs.back().iov;
+        if (!iov.empty() && (char*)iov.back().iov_base + iov.back().iov_len == p) iov.back().iov_len += size;
+        else iov.push_back(iovec{p, size});
+        tailOffset += size;
+        b.bytes += size;
+    }
+
+    std::string segmentPath(ub8 segment){
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.wal", (unsigned long long)segment);
+        return dir + "/" + name;
+    }
+
+    std::vector<ub8> listSegments(){
+        std::vector<ub8> segments;
+        DIR* d = ::opendir(dir.c_str());
+        if (!d) throw std::runtime_error("wal: opendir " + dir + " failed");
+        while (dirent* e = ::readdir(d)){
+            unsigned long long no;
+            char tail[8];
+            if (std::sscanf(e->d_name, "%16llx.%3s", &no, tail) == 2 && !std::strcmp(tail, "wal")) segments.push_back(no);
+        }
+        ::closedir(d);
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    // 顺序扫描各段，重放有效记录，定位写入尾部，丢弃尾部之后的一切。
+    void recover(const ReplayFn& replay){
+        auto segments = listSegments();
+        bool ended = false;
+        tailSegment = segments.empty() ? 0 : segments.front();
+        tailOffset = 0;
+        for (size_t i = 0; i < segments.size(); i++){
+            std::string path = segmentPath(segments[i]);
+            if (ended || (i > 0 && segments[i] != segments[i - 1] + 1)){
+                ended = true;
+                ::unlink(path.c_str());
+                continue;
+            }
+            ub8 end = scanSegment(path, replay, &ended);
+            if (end || i == 0){
+                tailSegment = segments[i];
+                tailOffset = end;
+            }else{
+                ended = true;
+                ::unlink(path.c_str());
+            }
+        }
+        // 截掉尾部之后的残留，免得新记录写完后旧的残片恰好接上LSN被当成有效记录
+        if (!segments.empty()){
+            std::string path = segmentPath(tailSegment);
+            int fd = ::open(path.c_str(), O_WRONLY);
+            if (fd < 0 || ::ftruncate(fd, (off_t)tailOffset) || ::fdatasync(fd)){
+                if (fd >= 0) ::close(fd);
+                throw std::runtime_error("wal: truncate " + path + " failed");
+            }
+            ::close(fd);
+        }
+        durableLsn = nextLsn;
+    }
+
+    // 返回有效数据的结尾偏移，ended置位表示在段中间遇到了尾部。
+    ub8 scanSegment(const std::string& path, const ReplayFn& replay, bool* ended){
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("wal: open " + path + " failed");
+        struct stat st;
+        if (::fstat(fd, &st)){
+            ::close(fd);
+            throw std::runtime_error("wal: stat " + path + " failed");
+        }
+        ub8 size = (ub8)st.st_size, offset = 0;
+        if (size){
+            char* base = (char*)::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED){
+                ::close(fd);
+                throw std::runtime_error("wal: mmap " + path + " failed");
+            }
+            ::madvise(base, size, MADV_SEQUENTIAL);
+            while (offset + kHeaderSize <= size){
+                Header h;
+                std::memcpy(&h, base + offset, kHeaderSize);
+                ub8 recsize = ALIGN((ub8)kHeaderSize + h.len);
+                if (!h.len && !h.lsn) break;
+                if (h.lsn != nextLsn + 1 || offset + recsize > size || checksum(base + offset + 8, 8 + h.len) != h.crc){
+                    *ended = true;
+                    break;
+                }
+                if (replay) replay(h.lsn, base + offset + kHeaderSize, h.len);
+                nextLsn = h.lsn;
+                offset += recsize;
+            }
+            ::munmap(base, size);
+        }
+        ::close(fd);
+        return offset;
+    }
+
+    int openSegment(ub8 segment){
+        std::string path = segmentPath(segment);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) throw std::runtime_error("wal: open " + path + " failed");
+        int err = ::posix_fallocate(fd, 0, (off_t)options.segmentSize);
+        if (err && err != EOPNOTSUPP && err != EINVAL){
+            ::close(fd);
+            throw std::runtime_error("wal: fallocate " + path + " failed");
+        }
+        int dirfd = ::open(dir.c_str(), O_RDONLY);
+        if (dirfd >= 0){
+            ::fsync(dirfd);
+            ::close(dirfd);
+        }
+        return fd;
+    }
+
+    // 取segment的写句柄，并让预建线程开始准备下一段。
+    int segmentFd(ub8 segment){
+        if (current >= 0 && currentSegment == segment) return current;
+        if (current >= 0) ::close(current);
+        current = takeSegment(segment);
+        // 预建失败或没有预建过这一段，就地打开；出错由这里抛给批次
+        if (current < 0) current = openSegment(segment);
+        currentSegment = segment;
+        requestSegment(segment + 1);
+        return current;
+    }
+
+    // ---- 预建线程 ----
+
+    void requestSegment(ub8 segment){
+        {
+            std::lock_guard<std::mutex> guard(prepLock);
+            if (prepared >= 0) ::close(prepared);
+            prepared = -1;
+            preparedSegment = segment;
+            prepPending = true;
+        }
+        prepCv.notify_all();
+    }
+
+    // 取走预建好的segment；预建线程正在做这一段就等它做完。没有则返回-1。
+    int takeSegment(ub8 segment){
+        std::unique_lock<std::mutex> guard(prepLock);
+        if (preparedSegment != segment) return -1;
+        prepCv.wait(guard, [&]{ return !prepPending; });
+        int fd = prepared;
+        prepared = -1;
+        return fd;
+    }
+
+    void prepareLoop(){
+        std::unique_lock<std::mutex> guard(prepLock);
+        for (;;){
+            prepCv.wait(guard, [&]{ return prepStopping || prepPending; });
+            if (prepStopping) return;
+            ub8 segment = preparedSegment;
+            guard.unlock();
+            int fd = -1;
+            try{
+                fd = openSegment(segment);
+            }catch(const std::exception&){
+                fd = -1;
+            }
+            guard.lock();
+            // 做的过程中请求换成了别的段，作废重来
+            if (preparedSegment != segment || !prepPending){
+                if (fd >= 0) ::close(fd);
+                continue;
+            }
+            prepared = fd;
+            prepPending = false;
+            prepCv.notify_all();
+        }
+    }
+
+    void writeBatch(Batch& b){
+        for (auto& run : b.runs){
+            int fd = segmentFd(run.segment);
+            ub8 offset = run.offset;
+            size_t i = 0;
+            while (i < run.iov.size()){
+                int cnt = (int)std::min<size_t>(run.iov.size() - i, IOV_MAX);
+                ssize_t n = ::pwritev(fd, &run.iov[i], cnt, (off_t)offset);
+                if (n < 0){
+                    if (errno == EINTR) continue;
+                    throw std::runtime_error("wal: pwritev failed");
+                }
+                offset += n;
+                // 跳过已写完的iovec，部分写入的调整起点
+                while (n > 0){
+                    if ((size_t)n >= run.iov[i].iov_len){
+                        n -= run.iov[i].iov_len;
+                        i++;
+                    }else{
+                        run.iov[i].iov_base = (char*)run.iov[i].iov_base + n;
+                        run.iov[i].iov_len -= n;
+                        n = 0;
+                    }
+                }
+            }
+            if (::fdatasync(fd)) throw std::runtime_error("wal: fdatasync failed");
+        }
+    }
+
+    void flushLoop(){
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;){
+            flushCv.wait(guard, [&]{ return stopping || staged->bytes > 0; });
+            if (!staged->bytes && stopping) return;
+            auto deadline = staged->firstAppend + std::chrono::microseconds(options.groupDelayMicros);
+            flushCv.wait_until(guard, deadline, [&]{ return stopping || staged->bytes >= options.groupBytes; });
+            std::unique_ptr<Batch> batch(new Batch);
+            batch.swap(staged);
+            guard.unlock();
+            std::string failure;
+            try{
+                writeBatch(*batch);
+            }catch(const std::exception& e){
+                failure = e.what();
+            }
+            ub8 written = batch->lastLsn;
+            batch.reset();
+            guard.lock();
+            if (failure.empty()){
+                durableLsn = written;
+            }else{
+                failed = true;
+                error = failure;
+            }
+            durableCv.notify_all();
+            if (failed) return;
+        }
+    }
+
+    std::string dir;
+    WalOptions  options;
+
+    std::mutex              lock;
+    std::condition_variable flushCv;   // 唤醒刷盘线程
+    std::condition_variable durableCv; // 唤醒等待持久化的追加者
+    std::unique_ptr<Batch>  staged;
+    ub8  nextLsn = 0;                  // 最后分配的LSN
+    ub8  durableLsn = 0;
+    ub8  tailSegment = 0, tailOffset = 0; // 下一条记录的落盘位置
+    bool stopping = false;
+    bool failed = false;
+    std::string error;
+
+    // 以下只由刷盘线程访问
+    int  current = -1;
+    ub8  currentSegment = 0;
+    std::thread flusher;
+
+    // 预建线程与刷盘线程之间的交接，受prepLock保护
+    std::mutex              prepLock;
+    std::condition_variable prepCv;
+    int  prepared = -1;                // 预建好的下一段，-1表示还没好或失败
+    ub8  preparedSegment = 0;          // 请求预建的段号
+    bool prepPending = false;
+    bool prepStopping = false;
+    std::thread preallocator;
+};
+
+}
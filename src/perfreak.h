@@ -1,5 +1,19 @@
 #pragma once
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WJP_X86_DISPATCH 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 // 64位机器，默认8字节对齐。
 #define ALIGN(x) (((x)+(ub8)(7u)) & ~ (ub8)(7u))
 
@@ -27,6 +41,13 @@ static inline char* malloc16(ub4 size){
     else return nullptr;
 }
 
+// 页对齐，用于O_DIRECT等要求缓冲区按页对齐的场合。此处kPageSize尚未定义，直接写4096。
+static inline char* mallocPage(ub8 size){
+    void* p;
+    if (!posix_memalign(&p, 4096, size)) return (char*)p;
+    else return nullptr;
+}
+
 // 如果认定99%可能为true，再用likely，否则不见得比默认分支预测强。
 static inline bool likely(bool x){
 #if defined(__GNUC__) || defined(__clang__) 
@@ -45,9 +66,17 @@ static inline bool unlikely(bool x){
 }
 
 // 下面是一组利用64位系统虚拟地址前16位必然为空的操作，把这16位用作额外存储。
+// 前提是地址不超过48位：5级页表（57位虚拟地址）的机器上进程可能拿到更高的地址，
+// 调用方须用fitsIn48检查，更通用的打包见下方TaggedPtr。
+template < typename T >
+static inline bool fitsIn48(T* ptr){
+    return ((ub8)ptr >> 48) == 0;
+}
+
 // 高16位（原本为空）赋值为value。
 template < typename T >
 static inline T* assign16(T* ptr, ub2 value){
+    assert(fitsIn48(ptr));
     return (T*) ((ub8)ptr | ( (ub8)(value) << 48));
 }
 
@@ -69,5 +98,711 @@ static inline ub2 get16(T* ptr){
     return (ub2) ((ub8)(ptr) >> 48);
 }
 
+// CPU支持的虚拟地址位数：4级页表为48，5级页表为57。
+inline ub4 cpuVirtualAddressBits(){
+#ifdef WJP_X86_DISPATCH
+    ub4 eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000008, &eax, &ebx, &ecx, &edx)) return (eax >> 8) & 0xff;
+#endif
+    return 48;
+}
+
+// 内核实际使用的用户态地址宽度。CPU支持57位时，还要看内核是否开启了5级页表：
+// 开启后带高地址提示的mmap会返回48位以上的地址，据此探测。
+inline ub4 userVirtualAddressBits(){
+    ub4 bits = cpuVirtualAddressBits();
+    if (bits <= 48) return 48;
+#ifdef __linux__
+    void* hint = (void*)((ub8)1 << 52);
+    void* p = mmap(hint, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return bits;
+    munmap(p, 4096);
+    return ((ub8)p >> 48) ? bits : 48;
+#else
+    return bits;
+#endif
+}
+
+// 指针高位中可以安全占用的位数，只探测一次。
+inline ub4 freeHighPointerBits(){
+    static const ub4 bits = 64 - userVirtualAddressBits();
+    return bits;
+}
+
+// 启动检查：需要占用highBits个高位的打包方式在本机不安全时直接抛异常，
+// 而不是等到拿到一个高地址时悄悄写坏指针。
+inline bool checkHighPointerBits(ub4 highBits){
+    if (highBits > freeHighPointerBits()){
+        throw std::runtime_error("pointer tagging needs " + std::to_string(highBits) +
+            " high bits, but this CPU only leaves " + std::to_string(freeHighPointerBits()));
+    }
+    return true;
+}
+
+constexpr ub4 log2Floor(ub8 x){
+    return x <= 1 ? 0 : 1 + log2Floor(x >> 1);
+}
+
+// 把Bits位的tag和一个T*打包进64位：先用对齐留下的低AlignBits位，不够再借高位。
+// 用到高位的实例化在程序启动时检查虚拟地址宽度，5级页表的机器上最多只能借7位。
+template < typename T, int Bits, int AlignBits = log2Floor(alignof(T)) >
+class TaggedPtr{
+public:
+    static const int kLowBits  = Bits < AlignBits ? Bits : AlignBits;
+    static const int kHighBits = Bits - kLowBits;
+    static_assert(Bits > 0 && kHighBits <= 16, "at most 16 high bits are ever free");
+
+    static const ub8 kLowMask  = ((ub8)1 << kLowBits) - 1;
+    static const ub8 kHighMask = kHighBits ? ~(~(ub8)0 >> kHighBits) : 0;
+    static const ub8 kPtrMask  = ~(kLowMask | kHighMask);
+
+    TaggedPtr() : raw(0){}
+
+    TaggedPtr(T* ptr, ub8 tag = 0){
+        (void)kVerified;
+        assert(((ub8)ptr & ~kPtrMask) == 0); // 未对齐或地址超出可用宽度
+        raw = (ub8)ptr | pack(tag);
+    }
+
+    static TaggedPtr fromRaw(ub8 raw){
+        TaggedPtr t;
+        t.raw = raw;
+        return t;
+    }
+
+    inline T* get() const { return (T*)(raw & kPtrMask); }
+
+    inline T* operator->() const { return get(); }
+
+    inline ub8 tag() const {
+        ub8 low = raw & kLowMask;
+        return kHighBits ? low | ((raw >> (64 - kHighBits)) << kLowBits) : low;
+    }
+
+    inline TaggedPtr withTag(ub8 tag) const { return TaggedPtr(get(), tag); }
+
+    inline ub8 value() const { return raw; }
+
+    inline bool operator==(const TaggedPtr& rhs) const { return raw == rhs.raw; }
+
+    inline bool operator!=(const TaggedPtr& rhs) const { return raw != rhs.raw; }
+
+private:
+    static inline ub8 pack(ub8 tag){
+        tag &= Bits == 64 ? ~(ub8)0 : ((ub8)1 << Bits) - 1;
+        ub8 low = tag & kLowMask;
+        return kHighBits ? low | ((tag >> kLowBits) << (64 - kHighBits)) : low;
+    }
+
+    static const bool kVerified;
+
+    ub8 raw;
+};
+
+template < typename T, int Bits, int AlignBits >
+const bool TaggedPtr<T, Bits, AlignBits>::kVerified = checkHighPointerBits(TaggedPtr<T, Bits, AlignBits>::kHighBits);
+
+// 带16位代数计数的指针，用于无锁CAS防ABA：每次替换时代数加一，
+// 同一地址被释放又重新入栈后，旧的快照也无法CAS成功。64位单字即可，无需128位CAS。
+template < typename T, int AlignBits = log2Floor(alignof(T)) >
+class AtomicVersionedPtr{
+public:
+    typedef TaggedPtr<T, 16, AlignBits> Versioned;
+
+    AtomicVersionedPtr(T* ptr = nullptr) : word(Versioned(ptr, 0).value()){}
+
+    inline Versioned load(std::memory_order order = std::memory_order_acquire) const {
+        return Versioned::fromRaw(word.load(order));
+    }
+
+    // expected须为之前load的结果，成功时新值代数为expected代数加一；失败时expected被刷新。
+    inline bool compareExchange(Versioned& expected, T* desired,
+                                std::memory_order order = std::memory_order_acq_rel){
+        ub8 old = expected.value();
+        ub8 next = Versioned(desired, expected.tag() + 1).value();
+        if (word.compare_exchange_weak(old, next, order, std::memory_order_acquire)) return true;
+        expected = Versioned::fromRaw(old);
+        return false;
+    }
+
+private:
+    std::atomic<ub8> word;
+};
+
+// 基于AtomicVersionedPtr的无锁侵入式栈（Treiber栈），T需含T* next成员。
+// 弹出时会读取可能已被其他线程弹出的节点的next，所以节点内存只能回到分配器的
+// 空闲链表，不能交还操作系统——这正是分配器内部空闲链表的情形。
+template < typename T, int AlignBits = log2Floor(alignof(T)) >
+class TaggedStack{
+public:
+    void push(T* node){
+        auto top = head.load(std::memory_order_relaxed);
+        do{
+            __atomic_store_n(&node->next, top.get(), __ATOMIC_RELAXED);
+        }while (!head.compareExchange(top, node, std::memory_order_release));
+    }
+
+    T* pop(){
+        auto top = head.load();
+        while (top.get()){
+            T* next = __atomic_load_n(&top->next, __ATOMIC_RELAXED); // 可能已被他人弹出，读到旧值则CAS失败
+            if (head.compareExchange(top, next)) return top.get();
+        }
+        return nullptr;
+    }
+
+    bool empty() const { return head.load().get() == nullptr; }
+
+private:
+    AtomicVersionedPtr<T, AlignBits> head;
+};
+
+
+}
+
+// ---------------------------------------------------------------------------
+// 性能测量：周期计时、硬件计数器、每线程延迟直方图。
+// 直方图埋点只通过WJP_PROFILE_SCOPE宏使用，未定义WJP_PROFILE时宏展开为空，
+// 热路径上不留下任何指令。
+// ---------------------------------------------------------------------------
+
+namespace wjp{
+
+// rdtsc不保序，前加lfence防止被测代码之前的指令被推迟到计时之后。
+static inline ub8 rdtsc(){
+#if defined(__x86_64__) || defined(__i386__)
+    ub4 lo, hi;
+    asm volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return (ub8)hi << 32 | lo;
+#else
+    return (ub8)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// rdtscp等此前所有指令执行完才读时钟，适合做区间的结束点。
+static inline ub8 rdtscp(){
+#if defined(__x86_64__) || defined(__i386__)
+    ub4 lo, hi, aux;
+    asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+    return (ub8)hi << 32 | lo;
+#else
+    return rdtsc();
+#endif
+}
+
+// 作用域计时，析构时把经过的周期数累加到cycles。
+class CycleTimer{
+public:
+    explicit CycleTimer(ub8& cycles) : cycles(cycles), start(rdtsc()){}
+    ~CycleTimer(){ cycles += rdtscp() - start; }
+private:
+    CycleTimer(const CycleTimer&) = delete;
+    CycleTimer& operator=(const CycleTimer&) = delete;
+    ub8& cycles;
+    ub8  start;
+};
+
+// HDR风格的对数-线性直方图：按最高位分段，每段再等分2^kSubBucketBits个桶，
+// 相对误差不超过1/2^kSubBucketBits，记录一次只需一条clz和一次自增。
+class LatencyHistogram{
+public:
+    static const int kSubBucketBits = 5;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    LatencyHistogram(){ clear(); }
+
+    inline void record(ub8 value){
+        counts[bucketOf(value)]++;
+        total++;
+        if (value > maxValue) maxValue = value;
+    }
+
+    void merge(const LatencyHistogram& rhs){
+        for (int i = 0; i < kBuckets; i++) counts[i] += rhs.counts[i];
+        total += rhs.total;
+        if (rhs.maxValue > maxValue) maxValue = rhs.maxValue;
+    }
+
+    void clear(){
+        std::memset(counts, 0, sizeof(counts));
+        total = 0;
+        maxValue = 0;
+    }
+
+    ub8 count() const { return total; }
+
+    ub8 max() const { return maxValue; }
+
+    // p取[0, 100]，返回所在桶的下界。
+    ub8 percentile(double p) const {
+        if (!total) return 0;
+        ub8 rank = (ub8)(p / 100.0 * total);
+        if (rank >= total) rank = total - 1;
+        ub8 seen = 0;
+        for (int i = 0; i < kBuckets; i++){
+            seen += counts[i];
+            if (seen > rank) return lowerBound(i);
+        }
+        return maxValue;
+    }
+
+    static inline int bucketOf(ub8 value){
+        if (value < (ub8)kSubBuckets) return (int)value;
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBucketBits;
+        return ((shift + 1) << kSubBucketBits) + (int)((value >> shift) & (kSubBuckets - 1));
+    }
+
+    static inline ub8 lowerBound(int bucket){
+        if (bucket < kSubBuckets) return (ub8)bucket;
+        int shift = (bucket >> kSubBucketBits) - 1;
+        return ((ub8)kSubBuckets | (bucket & (kSubBuckets - 1))) << shift;
+    }
+
+private:
+    ub8 counts[kBuckets];
+    ub8 total;
+    ub8 maxValue;
+};
+
+// 一个埋点位置。每个线程首次经过时登记自己的直方图，此后只写自己的，无需同步；
+// 线程退出后直方图保留，报告时统一合并。
+class ProfileSite{
+public:
+    explicit ProfileSite(const char* name) : name(name){
+        std::lock_guard<std::mutex> guard(registryLock());
+        sites().push_back(this);
+    }
+
+    LatencyHistogram* attach(){
+        auto h = new LatencyHistogram;
+        std::lock_guard<std::mutex> guard(lock);
+        perThread.push_back(h);
+        return h;
+    }
+
+    // 合并各线程数据。读取时各线程可能仍在写，结果是近似快照。
+    LatencyHistogram collect(){
+        LatencyHistogram all;
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto h : perThread) all.merge(*h);
+        return all;
+    }
+
+    const char* siteName() const { return name; }
+
+    static std::vector<ProfileSite*>& sites(){
+        static std::vector<ProfileSite*> all;
+        return all;
+    }
+
+    static std::mutex& registryLock(){
+        static std::mutex mu;
+        return mu;
+    }
+
+private:
+    const char* name;
+    std::mutex  lock;
+    std::vector<LatencyHistogram*> perThread;
+};
+
+class ProfileScope{
+public:
+    explicit ProfileScope(LatencyHistogram* h) : h(h), start(rdtsc()){}
+    ~ProfileScope(){ h->record(rdtscp() - start); }
+private:
+    LatencyHistogram* h;
+    ub8 start;
+};
+
+// 打印所有埋点的周期数分位值。
+static inline void profileReport(FILE* out = stderr){
+    std::lock_guard<std::mutex> guard(ProfileSite::registryLock());
+    for (auto site : ProfileSite::sites()){
+        auto h = site->collect();
+        std::fprintf(out, "%s count=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu cycles\n",
+            site->siteName(), (unsigned long long)h.count(),
+            (unsigned long long)h.percentile(50), (unsigned long long)h.percentile(90),
+            (unsigned long long)h.percentile(99), (unsigned long long)h.percentile(99.9),
+            (unsigned long long)h.max());
+    }
+}
+
+#define WJP_PROFILE_CAT2(a, b) a##b
+#define WJP_PROFILE_CAT(a, b) WJP_PROFILE_CAT2(a, b)
+
+#ifdef WJP_PROFILE
+#define WJP_PROFILE_SCOPE(name) \
+    static ::wjp::ProfileSite WJP_PROFILE_CAT(wjpProfileSite, __LINE__)(name); \
+    static thread_local ::wjp::LatencyHistogram* WJP_PROFILE_CAT(wjpProfileHist, __LINE__) = \
+        WJP_PROFILE_CAT(wjpProfileSite, __LINE__).attach(); \
+    ::wjp::ProfileScope WJP_PROFILE_CAT(wjpProfileScope, __LINE__)(WJP_PROFILE_CAT(wjpProfileHist, __LINE__))
+#else
+#define WJP_PROFILE_SCOPE(name) do{}while(0)
+#endif
+
+#ifdef __linux__
+// perf_event_open的薄封装：一组计数器（周期、指令、cache miss、分支预测失败）
+// 同时开关，读数按多路复用的实际运行时间折算。
+// 内核禁止（perf_event_paranoid、容器seccomp）时available()为false，读数恒为0。
+class PerfCounters{
+public:
+    enum Event{ kCycles, kInstructions, kCacheMisses, kBranchMisses, kNrEvents };
+
+    PerfCounters(){
+        static const ub8 configs[kNrEvents] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (int i = 0; i < kNrEvents; i++){
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0){
+                close();
+                return;
+            }
+        }
+        std::memset(values, 0, sizeof(values));
+    }
+
+    ~PerfCounters(){ close(); }
+
+    bool available() const { return fds[0] >= 0; }
+
+    void start(){
+        if (!available()) return;
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    void stop(){
+        if (!available()) return;
+        ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        ub8 buf[3 + kNrEvents];
+        if (::read(fds[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) return;
+        double scale = buf[2] ? (double)buf[1] / buf[2] : 1.0;
+        for (int i = 0; i < kNrEvents; i++) values[i] = (ub8)(buf[3 + i] * scale);
+    }
+
+    ub8 value(Event e) const { return values[e]; }
+
+private:
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void close(){
+        for (int i = 0; i < kNrEvents; i++){
+            if (fds[i] >= 0) ::close(fds[i]);
+            fds[i] = -1;
+        }
+        std::memset(values, 0, sizeof(values));
+    }
+
+    int fds[kNrEvents] = {-1, -1, -1, -1};
+    ub8 values[kNrEvents];
+};
+
+// 作用域内的代码区间计数：{ PerfScope scope(counters); ... } 之后读counters.value()。
+class PerfScope{
+public:
+    explicit PerfScope(PerfCounters& counters) : counters(counters){ counters.start(); }
+    ~PerfScope(){ counters.stop(); }
+private:
+    PerfCounters& counters;
+};
+#endif
+
+}
+
+
+// ---------------------------------------------------------------------------
+// 运行时CPU特性分派：基础构建不带-march，同一个二进制在老机器上也能跑；
+// 启动后首次使用时用cpuid探测一次特性，把内核函数指针绑到当前机器最快的实现上。
+// 各实现的结果逐位一致（crc32c等会被持久化），只有速度不同。
+// 设置环境变量WJP_NO_SIMD可强制走标量实现，便于对照和排查。
+// ---------------------------------------------------------------------------
+
+namespace wjp{
+
+struct CpuFeatures{
+    bool sse42    = false;
+    bool avx2     = false;
+    bool ssse3    = false;
+};
+
+inline CpuFeatures detectCpuFeatures(){
+    CpuFeatures f;
+#ifdef WJP_X86_DISPATCH
+    if (std::getenv("WJP_NO_SIMD")) return f;
+    __builtin_cpu_init();
+    f.sse42    = __builtin_cpu_supports("sse4.2");
+    f.avx2     = __builtin_cpu_supports("avx2");
+    f.ssse3    = __builtin_cpu_supports("ssse3");
+#endif
+    return f;
+}
+
+inline const CpuFeatures& cpuFeatures(){
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
+
+// ---- crc32c（Castagnoli），供校验和与快速哈希使用 ----
+
+inline const ub4* crc32cTable(){
+    static const std::vector<ub4> table = []{
+        std::vector<ub4> t(256);
+        for (ub4 i = 0; i < 256; i++){
+            ub4 c = i;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82f63b78u & (0u - (c & 1)));
+            t[i] = c;
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+inline ub4 crc32cScalar(ub4 crc, const void* data, size_t len){
+    const ub4* table = crc32cTable();
+    const ub1* p = (const ub1*)data;
+    crc = ~crc;
+    while (len--) crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// ---- 复制，Arena::grow搬迁旧数据时使用 ----
+
+inline void copyScalar(void* dst, const void* src, size_t len){
+    std::memcpy(dst, src, len);
+}
+
+// ---- 有序查找：keys[0, n)中小于key的个数，即有序数组上的lower_bound，B+树节点内查找使用 ----
+// 节点内只有十几个键，分支预测失败比多比几次更贵，这里整段比较后计数，不提前退出。
+
+inline ub4 countLess64Scalar(const ub8* keys, ub4 n, ub8 key){
+    ub4 count = 0;
+    for (ub4 i = 0; i < n; i++) count += keys[i] < key;
+    return count;
+}
+
+// ---- 逐字节取大：dst[i] = max(dst[i], src[i])，HyperLogLog寄存器合并使用 ----
+
+inline void maxBytesScalar(ub1* dst, const ub1* src, size_t n){
+    for (size_t i = 0; i < n; i++) dst[i] = dst[i] < src[i] ? src[i] : dst[i];
+}
+
+// ---- Stream VByte解码，util/codec.h使用 ----
+// 每个控制字节描述4个值，每值2位：字节数减1。数据区按值依次存放小端的有效字节。
+// 调用方保证[data, end)恰好是这n个值的数据；SIMD实现一次读16字节，不足16字节的尾部走标量。
+
+struct StreamVByteTables{
+    ub1 shuffle[256][16]; // 控制字节 -> pshufb掩码，把变长字节摊开成4个ub4
+    ub1 length[256];      // 控制字节 -> 4个值共占的数据字节数
+};
+
+inline const StreamVByteTables& streamVByteTables(){
+    static const StreamVByteTables tables = []{
+        StreamVByteTables t;
+        for (ub4 c = 0; c < 256; c++){
+            ub1 offset = 0;
+            for (ub4 i = 0; i < 4; i++){
+                ub1 len = (ub1)(((c >> (2 * i)) & 3) + 1);
+                for (ub1 j = 0; j < 4; j++) t.shuffle[c][4 * i + j] = j < len ? (ub1)(offset + j) : 0x80;
+                offset += len;
+            }
+            t.length[c] = offset;
+        }
+        return t;
+    }();
+    return tables;
+}
+
+inline void streamVByteDecodeScalar(const ub1* control, const ub1* data, const ub1*, ub4* out, size_t n){
+    for (size_t i = 0; i < n; i++){
+        ub4 len = ((control[i >> 2] >> (2 * (i & 3))) & 3) + 1;
+        ub4 v = 0;
+        std::memcpy(&v, data, len);
+        data += len;
+        out[i] = v;
+    }
+}
+
+// 解码出的是相邻差，out[i] = prev + 前i+1个差之和。
+inline void streamVByteDecodeDeltaScalar(const ub1* control, const ub1* data, const ub1*, ub8* out, size_t n, ub8 prev){
+    for (size_t i = 0; i < n; i++){
+        ub4 len = ((control[i >> 2] >> (2 * (i & 3))) & 3) + 1;
+        ub4 v = 0;
+        std::memcpy(&v, data, len);
+        data += len;
+        out[i] = prev += v;
+    }
+}
+
+#ifdef WJP_X86_DISPATCH
+__attribute__((target("ssse3")))
+inline void streamVByteDecodeSsse3(const ub1* control, const ub1* data, const ub1* end, ub4* out, size_t n){
+    const StreamVByteTables& t = streamVByteTables();
+    size_t i = 0;
+    for (; i + 4 <= n && end - data >= 16; i += 4){
+        ub1 c = control[i >> 2];
+        __m128i v = _mm_loadu_si128((const __m128i*)data);
+        v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i*)t.shuffle[c]));
+        _mm_storeu_si128((__m128i*)(out + i), v);
+        data += t.length[c];
+    }
+    streamVByteDecodeScalar(control + (i >> 2), data, end, out + i, n - i);
+}
+
+// 4个差先摊开成ub4，再补零扩成两组各2个ub8做前缀和，差之和超过32位也不会溢出。
+__attribute__((target("ssse3")))
+inline void streamVByteDecodeDeltaSsse3(const ub1* control, const ub1* data, const ub1* end, ub8* out, size_t n, ub8 prev){
+    const StreamVByteTables& t = streamVByteTables();
+    const __m128i zero = _mm_setzero_si128();
+    __m128i base = _mm_set1_epi64x((sb8)prev);
+    size_t i = 0;
+    for (; i + 4 <= n && end - data >= 16; i += 4){
+        ub1 c = control[i >> 2];
+        __m128i v = _mm_loadu_si128((const __m128i*)data);
+        v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i*)t.shuffle[c]));
+        __m128i lo = _mm_unpacklo_epi32(v, zero);
+        __m128i hi = _mm_unpackhi_epi32(v, zero);
+        lo = _mm_add_epi64(lo, _mm_slli_si128(lo, 8));
+        hi = _mm_add_epi64(hi, _mm_slli_si128(hi, 8));
+        lo = _mm_add_epi64(lo, base);
+        hi = _mm_add_epi64(hi, _mm_unpackhi_epi64(lo, lo));
+        _mm_storeu_si128((__m128i*)(out + i), lo);
+        _mm_storeu_si128((__m128i*)(out + i + 2), hi);
+        base = _mm_unpackhi_epi64(hi, hi);
+        data += t.length[c];
+    }
+    if (i) prev = out[i - 1];
+    streamVByteDecodeDeltaScalar(control + (i >> 2), data, end, out + i, n - i, prev);
+}
+
+__attribute__((target("sse4.2")))
+inline ub4 crc32cSse42(ub4 crc, const void* data, size_t len){
+    const ub1* p = (const ub1*)data;
+    ub8 c = ~crc;
+    for (; len >= 8; len -= 8, p += 8){
+        ub8 word;
+        std::memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    ub4 c4 = (ub4)c;
+    while (len--) c4 = _mm_crc32_u8(c4, *p++);
+    return ~c4;
+}
+
+__attribute__((target("avx2")))
+inline void copyAvx2(void* dst, const void* src, size_t len){
+    char* d = (char*)dst;
+    const char* s = (const char*)src;
+    for (; len >= 128; len -= 128, d += 128, s += 128){
+        __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i*)(s + 96));
+        _mm256_storeu_si256((__m256i*)d, a);
+        _mm256_storeu_si256((__m256i*)(d + 32), b);
+        _mm256_storeu_si256((__m256i*)(d + 64), c);
+        _mm256_storeu_si256((__m256i*)(d + 96), e);
+    }
+    for (; len >= 32; len -= 32, d += 32, s += 32){
+        _mm256_storeu_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+    }
+    if (len) std::memcpy(d, s, len);
+}
+
+// AVX2只有有符号64位比较，两边都翻转最高位后等价于无符号比较。
+__attribute__((target("avx2,popcnt")))
+inline ub4 countLess64Avx2(const ub8* keys, ub4 n, ub8 key){
+    const __m256i bias = _mm256_set1_epi64x((sb8)UB8(0x80000000, 0));
+    __m256i k = _mm256_xor_si256(_mm256_set1_epi64x((sb8)key), bias);
+    ub4 count = 0, i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), bias);
+        count += _mm_popcnt_u32((ub4)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(k, v))));
+    }
+    for (; i < n; i++) count += keys[i] < key;
+    return count;
+}
+
+// 无符号字节max在SSE2里就有，属于基线。
+inline void maxBytesSse2(ub1* dst, const ub1* src, size_t n){
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_max_epu8(a, b));
+    }
+    maxBytesScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void maxBytesAvx2(ub1* dst, const ub1* src, size_t n){
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64){
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(dst + i + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_max_epu8(a0, b0));
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_max_epu8(a1, b1));
+    }
+    maxBytesScalar(dst + i, src + i, n - i);
+}
+#endif
+
+// 分派表，进程内只绑定一次。调用方取一次引用后直接调函数指针。
+struct CpuKernels{
+    ub4  (*crc32c)(ub4 crc, const void* data, size_t len);
+    void (*copy)(void* dst, const void* src, size_t len);
+    ub4  (*countLess64)(const ub8* keys, ub4 n, ub8 key);
+    void (*maxBytes)(ub1* dst, const ub1* src, size_t n);
+    void (*streamVByteDecode)(const ub1* control, const ub1* data, const ub1* end, ub4* out, size_t n);
+    void (*streamVByteDecodeDelta)(const ub1* control, const ub1* data, const ub1* end, ub8* out, size_t n, ub8 prev);
+};
+
+inline CpuKernels bindCpuKernels(const CpuFeatures& f){
+    CpuKernels k;
+    k.crc32c      = crc32cScalar;
+    k.copy        = copyScalar;
+    k.countLess64 = countLess64Scalar;
+    k.maxBytes    = maxBytesScalar;
+    k.streamVByteDecode      = streamVByteDecodeScalar;
+    k.streamVByteDecodeDelta = streamVByteDecodeDeltaScalar;
+#ifdef WJP_X86_DISPATCH
+    if (!std::getenv("WJP_NO_SIMD")) k.maxBytes = maxBytesSse2;
+    if (f.sse42) k.crc32c = crc32cSse42;
+    if (f.ssse3){
+        k.streamVByteDecode      = streamVByteDecodeSsse3;
+        k.streamVByteDecodeDelta = streamVByteDecodeDeltaSsse3;
+    }
+    if (f.avx2){
+#ifndef __GLIBC__
+        k.copy = copyAvx2; // glibc的memcpy本身已按ifunc分派，实测不慢于此，仅在其他libc上替换
+#endif
+        k.countLess64 = countLess64Avx2;
+        k.maxBytes    = maxBytesAvx2;
+    }
+#endif
+    return k;
+}
+
+inline const CpuKernels& cpuKernels(){
+    static const CpuKernels kernels = bindCpuKernels(cpuFeatures());
+    return kernels;
+}
 
 }
\ No newline at end of file
@@ -0,0 +1,321 @@
+#pragma once
+
+#include "common.h"
+#include "util/hashmap.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace wjp{
+
+// Hashmap状态的增量检查点，处理过程中不停顿。
+// 1. begin()推进map的epoch，此后的写入带新epoch；检查点E只收录版本落在
+//    (上一个检查点, E]之间的条目，即自上次以来改过的条目。首个检查点为全量。
+// 2. step()每次用Hashmap::scan走若干个桶，把符合条件的条目写入缓冲，攒满再写文件；
+//    游标在两次step之间可以经历插入、删除和渐进式rehash。
+// 3. 一致性靠写时复制：检查点进行中，某条目第一次被改写或删除前，经WriteHook把
+//    旧值写进检查点，并把它的版本推到新epoch，扫描到时就会跳过。
+//    因此文件内容恰好是begin()那一刻的状态相对上一个检查点的差量。
+//    经Hashmap::find拿到条目后就地改值的，须在改之前调用Hashmap::touch，
+//    否则钩子存下的是新值。findOrCreateNew和operator[]已在返回前调过。
+// 4. 删除以墓碑记录，写在文件开头，先于同一检查点里的put应用。
+// 5. 文件先写成.tmp，带crc32c尾部，fdatasync后rename。全量检查点完成后，
+//    更早的文件会被删除。restore从最新的全量检查点开始，依次应用其后的增量。
+// 键和值按字节写出，须是trivially copyable类型，与Hashmap按字节哈希键的约定一致。
+template < typename Map >
+class Checkpointer{
+public:
+    typedef typename Map::Entry Entry;
+    typedef typename std::remove_reference<decltype(((Entry*)0)->key)>::type K;
+    typedef typename std::remove_reference<decltype(((Entry*)0)->value)>::type V;
+
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+        "checkpointed keys and values are written as raw bytes");
+
+    struct Stats{
+        ub8 puts = 0;       // 扫描写出的条目
+        ub8 preimages = 0;  // 写时复制写出的旧值
+        ub8 tombstones = 0;
+        ub8 bytes = 0;
+    };
+
+    Checkpointer(Map& map, const std::string& dir) : map(map), dir(dir){
+        if (::mkdir(dir.c_str(), 0755) && errno != EEXIST) throw std::runtime_error("checkpoint: mkdir " + dir + " failed");
+        auto files = listCheckpoints(dir);
+        nextSeq = files.empty() ? 1 : files.back() + 1;
+        typename Map::WriteHook hook;
+        hook.beforeWrite = &Checkpointer::onWrite;
+        hook.beforeErase = &Checkpointer::onErase;
+        hook.ctx = this;
+        map.setWriteHook(hook);
+    }
+
+    // 进行中的检查点被放弃，.tmp文件删除。
+    ~Checkpointer(){
+        map.setWriteHook(typename Map::WriteHook());
+        if (fd >= 0){
+            ::close(fd);
+            ::unlink(tmpPath.c_str());
+        }
+    }
+
+    // 开始一个检查点，返回其序号。full为true或还没有完成过检查点时写全量。
+    ub8 begin(bool full = false){
+        if (inProgress()) throw std::logic_error("checkpoint already in progress");
+        full = full || !lastSeq;
+        seq = nextSeq++;
+        baseSeq = full ? 0 : lastSeq;
+        baseEpoch = full ? 0 : lastEpoch;
+        snapshotEpoch = map.advanceEpoch();
+        cursor = 0;
+        scanned = false;
+        stats = Stats();
+        tmpPath = path(seq) + ".tmp";
+        fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("checkpoint: open " + tmpPath + " failed");
+        crc = 0;
+        Header header{kMagic, (ub4)sizeof(K), seq, baseSeq, (ub4)sizeof(V), 0};
+        append(&header, sizeof(header));
+        // begin之前删除的键；全量检查点不需要墓碑
+        if (!full){
+            for (auto& key : erased) putRecord(kTombstone, key, nullptr);
+            stats.tombstones = erased.size();
+        }
+        erased.clear();
+        return seq;
+    }
+
+    // 推进至多buckets个桶，检查点完成（已落盘）时返回true。
+    bool step(ub4 buckets = 64){
+        if (!inProgress()) return true;
+        for (ub4 i = 0; i < buckets && !scanned; i++){
+            cursor = map.scan(cursor, [this](Entry& entry){
+                if (changed(entry)){
+                    putRecord(kPut, entry.key, &entry.value);
+                    stats.puts++;
+                }
+            });
+            scanned = cursor == 0;
+        }
+        if (scanned) complete();
+        return scanned;
+    }
+
+    void finish(){
+        while (!step(1024)){}
+    }
+
+    bool inProgress() const { return fd >= 0; }
+
+    ub8 lastCheckpoint() const { return lastSeq; }
+
+    const Stats& lastStats() const { return stats; }
+
+    // 从dir里最新的全量检查点开始，依次应用后续增量，返回最后应用的序号（0表示没有）。
+    // 校验失败或链条断开时停在最后一个完好的检查点。
+    static ub8 restore(const std::string& dir, Map& map){
+        auto files = listCheckpoints(dir);
+        std::vector<Header> headers(files.size());
+        ssize_t start = -1;
+        for (size_t i = 0; i < files.size(); i++){
+            if (readHeader(path(dir, files[i]), &headers[i]) && !headers[i].baseSeq) start = (ssize_t)i;
+        }
+        if (start < 0) return 0;
+        ub8 applied = 0;
+        for (size_t i = start; i < files.size(); i++){
+            if (applied && headers[i].baseSeq != applied) break;
+            if (!apply(path(dir, files[i]), map)) break;
+            applied = files[i];
+        }
+        return applied;
+    }
+
+private:
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    static const ub4 kMagic = 0x434b5031; // "CKP1"
+    static const ub1 kPut = 1;
+    static const ub1 kTombstone = 2;
+    static const ub1 kFooter = 0xff;
+    static const size_t kFlushBytes = 1 << 20;
+
+    struct Header{
+        ub4 magic;
+        ub4 keySize;
+        ub8 seq;
+        ub8 baseSeq;   // 0表示全量
+        ub4 valueSize;
+        ub4 reserved;
+    };
+
+    struct Footer{
+        ub8 records;
+        ub4 crc;
+        ub4 reserved;
+    };
+
+    static std::string path(const std::string& dir, ub8 seq){
+        char name[40];
+        std::snprintf(name, sizeof(name), "/ckpt-%016llx.dat", (unsigned long long)seq);
+        return dir + name;
+    }
+
+    std::string path(ub8 seq) const { return path(dir, seq); }
+
+    static std::vector<ub8> listCheckpoints(const std::string& dir){
+        std::vector<ub8> seqs;
+        DIR* d = ::opendir(dir.c_str());
+        if (!d) return seqs;
+        while (dirent* e = ::readdir(d)){
+            unsigned long long seq;
+            char tail[8];
+            // 长度限定排除.tmp文件
+            if (std::strlen(e->d_name) == 25 && std::sscanf(e->d_name, "ckpt-%16llx.%3s", &seq, tail) == 2 &&
+                !std::strcmp(tail, "dat")) seqs.push_back(seq);
+        }
+        ::closedir(d);
+        std::sort(seqs.begin(), seqs.end());
+        return seqs;
+    }
+
+    static bool readHeader(const std::string& file, Header* header){
+        int in = ::open(file.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        bool ok = ::read(in, header, sizeof(*header)) == (ssize_t)sizeof(*header) && header->magic == kMagic &&
+            header->keySize == sizeof(K) && header->valueSize == sizeof(V);
+        ::close(in);
+        return ok;
+    }
+
+    // 整个文件读入后先验crc再应用，半截文件不会留下部分结果。
+    static bool apply(const std::string& file, Map& map){
+        int in = ::open(file.c_str(), O_RDONLY);
+        if (in < 0) return false;
+        struct stat st;
+        std::vector<char> data;
+        if (!::fstat(in, &st)) data.resize(st.st_size);
+        size_t got = 0;
+        while (got < data.size()){
+            ssize_t n = ::read(in, data.data() + got, data.size() - got);
+            if (n <= 0) break;
+            got += n;
+        }
+        ::close(in);
+        if (got != data.size() || data.size() < sizeof(Header) + 1 + sizeof(Footer)) return false;
+        size_t body = data.size() - sizeof(Footer);
+        Footer footer;
+        std::memcpy(&footer, data.data() + body, sizeof(footer));
+        if ((ub1)data[body - 1] != kFooter || cpuKernels().crc32c(0, data.data(), body) != footer.crc) return false;
+        const char* p = data.data() + sizeof(Header);
+        const char* end = data.data() + body - 1;
+        for (ub8 i = 0; i < footer.records; i++){
+            ub1 type = (ub1)*p;
+            size_t len = 1 + sizeof(K) + (type == kPut ? sizeof(V) : 0);
+            if ((type != kPut && type != kTombstone) || (size_t)(end - p) < len) return false;
+            K key;
+            std::memcpy(&key, p + 1, sizeof(K));
+            if (type == kPut) std::memcpy(&map[key], p + 1 + sizeof(K), sizeof(V));
+            else if (Entry* entry = map.erase(key)) std::free(entry);
+            p += len;
+        }
+        return p == end;
+    }
+
+    inline bool changed(const Entry& entry) const {
+        return entry.version > baseEpoch && entry.version <= snapshotEpoch;
+    }
+
+    // 写时复制：条目在本检查点里的旧值还没写出，先写出来。
+    // Hashmap随后把它的版本推到新epoch，扫描时便不会重复写。
+    static void onWrite(void* ctx, const Entry& entry){
+        auto self = (Checkpointer*)ctx;
+        if (self->inProgress() && self->changed(entry)){
+            self->putRecord(kPut, entry.key, &entry.value);
+            self->stats.preimages++;
+        }
+    }
+
+    static void onErase(void* ctx, const Entry& entry){
+        auto self = (Checkpointer*)ctx;
+        onWrite(ctx, entry);
+        if (self->lastSeq || self->inProgress()) self->erased.push_back(entry.key);
+    }
+
+    void putRecord(ub1 type, const K& key, const V* value){
+        size_t at = buffer.size();
+        buffer.resize(at + 1 + sizeof(K) + (value ? sizeof(V) : 0));
+        buffer[at] = (char)type;
+        std::memcpy(&buffer[at + 1], &key, sizeof(K));
+        if (value) std::memcpy(&buffer[at + 1 + sizeof(K)], value, sizeof(V));
+        records++;
+        if (buffer.size() >= kFlushBytes) flush();
+    }
+
+    void append(const void* data, size_t len){
+        buffer.insert(buffer.end(), (const char*)data, (const char*)data + len);
+    }
+
+    void flush(){
+        crc = cpuKernels().crc32c(crc, buffer.data(), buffer.size());
+        size_t done = 0;
+        while (done < buffer.size()){
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n < 0){
+                if (errno == EINTR) continue;
+                throw std::runtime_error("checkpoint: write " + tmpPath + " failed");
+            }
+            done += n;
+        }
+        stats.bytes += buffer.size();
+        buffer.clear();
+    }
+
+    void complete(){
+        buffer.push_back((char)kFooter);
+        flush();
+        Footer footer{records, crc, 0};
+        buffer.assign((const char*)&footer, (const char*)&footer + sizeof(footer));
+        flush();
+        std::string final = path(seq);
+        if (::fdatasync(fd) || ::rename(tmpPath.c_str(), final.c_str())) throw std::runtime_error("checkpoint: commit " + final + " failed");
+        ::close(fd);
+        fd = -1;
+        records = 0;
+        int dirfd = ::open(dir.c_str(), O_RDONLY);
+        if (dirfd >= 0){
+            ::fsync(dirfd);
+            ::close(dirfd);
+        }
+        lastSeq = seq;
+        lastEpoch = snapshotEpoch;
+        // 新的全量检查点落盘后，之前的链条不再需要
+        if (!baseSeq){
+            for (auto old : listCheckpoints(dir)) if (old < seq) ::unlink(path(old).c_str());
+        }
+    }
+
+    Map&        map;
+    std::string dir;
+    std::string tmpPath;
+    int         fd = -1;
+    ub8         nextSeq = 1;
+    ub8         seq = 0, baseSeq = 0;
+    ub8         lastSeq = 0, lastEpoch = 0;  // 最近完成的检查点
+    ub8         snapshotEpoch = 0, baseEpoch = 0;
+    ub8         cursor = 0;
+    bool        scanned = false;
+    ub8         records = 0;
+    ub4         crc = 0;
+    std::vector<char> buffer;
+    std::vector<K>    erased;  // 留给下一个检查点的墓碑
+    Stats       stats;
+};
+
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/slab.h"
+#include "util/hashmap.h"
+
+namespace wjp{
+
+enum DedupResult{
+    kDedupFresh,     // 首次出现，已记录
+    kDedupDuplicate, // 重复投递
+    kDedupTooOld,    // 落在窗口之外，无法判断，按exactly-once语义应当丢弃
+    kDedupUnknown    // producer的状态曾被淘汰，这个序号是否见过已无从判断，由调用方决定（如查持久化的记录）
+};
+
+// 按(producer ID, sequence number)去重的索引。
+// 每个producer只保留一个定长状态：最高序号（high-watermark）以及其下方
+// WindowBits个序号的位图，乱序到达但仍在窗口内的序号照样能判重。
+// 1. producer状态从Slab分配，桶数组在构造时按maxProducers一次分配好，
+//    不随运行增长，内存上限可预先算出。
+// 2. 过期：空闲超过idleTimeout的producer被淘汰；producer数达到maxProducers时
+//    淘汰最久未活动的那个。两者都靠一条按活动时间排序的侵入式链表，O(1)。
+// 3. 淘汰会丢掉位图，保证因此变弱：被淘汰的producer在墓碑表里留下(ID, 最高序号)，
+//    再次出现时不超过该序号的都返回kDedupUnknown，更高的照常判断。墓碑表直接映射、
+//    大小固定，墓碑被别的producer覆盖时，该位置记下被覆盖墓碑中的最高序号；
+//    此后在该位置新建、又找不到自己墓碑的producer，不超过这个序号的也返回kDedupUnknown。
+//    所以不会把见过的序号判为kDedupFresh；未发生淘汰时结果与不限容量的精确去重一致。
+//    evictions()、lostGraves()可供监控。
+// 4. checkAndInsert是一次哈希查找加一次位操作。
+template < int WindowBits = 1024, typename Hash = SipHash >
+class DedupStore{
+public:
+    static_assert(WindowBits > 0 && WindowBits % 64 == 0, "window must be whole words");
+    static const ub4 kWindowWords = WindowBits / 64;
+
+    // idleTimeout为0表示不按时间过期，时间单位由调用方决定，只要与now一致。
+    DedupStore(ub4 maxProducers, ub8 idleTimeout = 0)
+        : maxProducers(maxProducers ? maxProducers : 1), idleTimeout(idleTimeout), slab(sizeof(Producer))
+    {
+        nrbuckets = 1;
+        while (nrbuckets < this->maxProducers) nrbuckets <<= 1;
+        buckets = (Producer**) malloc64(sizeof(Producer*) * nrbuckets);
+        if (!buckets) throw std::runtime_error("malloc64 error");
+        std::memset(buckets, 0, sizeof(Producer*) * nrbuckets);
+        graves = (Grave*) malloc64(sizeof(Grave) * nrbuckets * kGravesPerBucket);
+        if (!graves){
+            std::free(buckets);
+            throw std::runtime_error("malloc64 error");
+        }
+        std::memset(graves, 0, sizeof(Grave) * nrbuckets * kGravesPerBucket);
+    }
+
+    ~DedupStore(){
+        std::free(buckets);
+        std::free(graves);
+    }
+
+    DedupResult checkAndInsert(ub8 producerId, ub8 seq, ub8 now){
+        ub4 id = bucketOf(producerId);
+        Producer* p = lookup(id, producerId);
+        if (!p){
+            // 先取出墓碑：create可能淘汰别的producer，写到同一个位置
+            ub8 floor;
+            bool buried = unearth(producerId, &floor);
+            p = create(id, producerId, now);
+            if (!p) throw std::runtime_error("slab alloc error");
+            if (buried){
+                // 不超过floor的序号可能在淘汰前见过，无从判断
+                p->high = floor;
+                p->unknownBelow = floor + (floor != ~(ub8)0);
+                if (seq <= floor) return kDedupUnknown;
+                advance(p, seq);
+            }else{
+                p->high = seq;
+            }
+            setBit(p, seq);
+            return kDedupFresh;
+        }
+        touch(p, now);
+        if (seq > p->high){
+            advance(p, seq);
+            setBit(p, seq);
+            return kDedupFresh;
+        }
+        if (p->high - seq >= (ub8)WindowBits) return kDedupTooOld;
+        if (testBit(p, seq)) return kDedupDuplicate;
+        if (seq < p->unknownBelow) return kDedupUnknown;
+        setBit(p, seq);
+        return kDedupFresh;
+    }
+
+    // 只查询不记录，也不刷新活动时间。
+    DedupResult check(ub8 producerId, ub8 seq){
+        Producer* p = lookup(bucketOf(producerId), producerId);
+        if (!p){
+            const Grave& g = graveOf(producerId);
+            if (g.used && g.producerId == producerId) return seq <= g.high ? kDedupUnknown : kDedupFresh;
+            return g.lossy && seq <= g.lostHigh ? kDedupUnknown : kDedupFresh;
+        }
+        if (seq > p->high) return kDedupFresh;
+        if (p->high - seq >= (ub8)WindowBits) return kDedupTooOld;
+        if (testBit(p, seq)) return kDedupDuplicate;
+        return seq < p->unknownBelow ? kDedupUnknown : kDedupFresh;
+    }
+
+    // producer见过的最高序号，未知producer返回false。
+    bool highWatermark(ub8 producerId, ub8* high){
+        Producer* p = lookup(bucketOf(producerId), producerId);
+        if (!p) return false;
+        *high = p->high;
+        return true;
+    }
+
+    // 调用方明确不再需要该producer的状态，不留墓碑。
+    bool forget(ub8 producerId){
+        Producer* p = lookup(bucketOf(producerId), producerId);
+        if (!p) return false;
+        destroy(p);
+        return true;
+    }
+
+    // 淘汰空闲超时的producer，返回淘汰个数。链表尾最久未活动，从尾部开始扫。
+    ub4 expire(ub8 now){
+        if (!idleTimeout) return 0;
+        ub4 n = 0;
+        while (oldest && now - oldest->lastSeen > idleTimeout){
+            evict(oldest);
+            n++;
+        }
+        return n;
+    }
+
+    ub4 size() const { return count; }
+
+    // 累计淘汰的producer数（空闲超时与容量不足两种），以及其中墓碑被覆盖丢失的个数。
+    ub8 evictions() const { return evicted; }
+
+    ub8 lostGraves() const { return lost; }
+
+    ub8 memoryUsage() const {
+        return slab.memoryUsage() + (sizeof(Producer*) + sizeof(Grave) * kGravesPerBucket) * nrbuckets;
+    }
+
+private:
+    DedupStore(const DedupStore&) = delete;
+    DedupStore& operator=(const DedupStore&) = delete;
+
+    static const ub4 kGravesPerBucket = 2;
+
+    struct Producer{
+        ub8       producerId;
+        ub8       high;       // 见过的最高序号
+        ub8       unknownBelow; // 低于它的序号状态已随淘汰丢失，0表示没有
+        ub8       lastSeen;
+        Producer* next;       // 桶内链
+        Producer* newer;      // 活动链表
+        Producer* older;
+        ub8       window[kWindowWords]; // 序号s对应第s % WindowBits位
+    };
+
+    struct Grave{
+        ub8 producerId;
+        ub8 high;
+        ub8 lostHigh; // lossy时，在此被覆盖的墓碑中最高的序号
+        ub1 used;
+        ub1 lossy;
+    };
+
+    // 墓碑表比桶数组大kGravesPerBucket倍，取哈希的另一段位，与桶的冲突错开。
+    Grave& graveOf(ub8 producerId){
+        ub8 h = hasher((const ub1*)&producerId, sizeof(producerId));
+        return graves[(h >> 32) & (nrbuckets * kGravesPerBucket - 1)];
+    }
+
+    inline ub4 bucketOf(ub8 producerId){
+        return (ub4)hasher((const ub1*)&producerId, sizeof(producerId)) & (nrbuckets - 1);
+    }
+
+    Producer* lookup(ub4 id, ub8 producerId){
+        for (Producer* p = buckets[id]; p; p = p->next){
+            if (p->producerId == producerId) return p;
+        }
+        return nullptr;
+    }
+
+    Producer* create(ub4 id, ub8 producerId, ub8 now){
+        expire(now);
+        if (count >= maxProducers) evict(oldest);
+        Producer* p = (Producer*) slab.alloc();
+        if (!p) return nullptr;
+        std::memset(p, 0, sizeof(Producer));
+        p->producerId = producerId;
+        p->lastSeen = now;
+        p->next = buckets[id];
+        buckets[id] = p;
+        linkNewest(p);
+        count++;
+        return p;
+    }
+
+    void destroy(Producer* p){
+        Producer** link = &buckets[bucketOf(p->producerId)];
+        while (*link != p) link = &(*link)->next;
+        *link = p->next;
+        unlink(p);
+        slab.free((char*)p);
+        count--;
+    }
+
+    // 淘汰：丢掉状态，留下墓碑。
+    void evict(Producer* p){
+        Grave& g = graveOf(p->producerId);
+        if (g.used){
+            g.lostHigh = g.lossy ? std::max(g.lostHigh, g.high) : g.high;
+            g.lossy = 1;
+            lost++;
+        }
+        g.producerId = p->producerId;
+        g.high = p->high;
+        g.used = 1;
+        evicted++;
+        destroy(p);
+    }
+
+    // 新建producer前查墓碑：找到自己的就取出其最高序号；位置有损时取lostHigh。
+    // 返回false表示可以确定从未见过这个producer。
+    bool unearth(ub8 producerId, ub8* floor){
+        Grave& g = graveOf(producerId);
+        if (g.used && g.producerId == producerId){
+            g.used = 0;
+            *floor = g.high;
+            return true;
+        }
+        *floor = g.lostHigh;
+        return g.lossy;
+    }
+
+    void touch(Producer* p, ub8 now){
+        p->lastSeen = now;
+        if (p != newest){
+            unlink(p);
+            linkNewest(p);
+        }
+    }
+
+    void linkNewest(Producer* p){
+        p->newer = nullptr;
+        p->older = newest;
+        if (newest) newest->newer = p;
+        newest = p;
+        if (!oldest) oldest = p;
+    }
+
+    void unlink(Producer* p){
+        if (p->newer) p->newer->older = p->older;
+        else newest = p->older;
+        if (p->older) p->older->newer = p->newer;
+        else oldest = p->newer;
+    }
+
+    // 窗口上移到seq：清掉(high, seq]在位图中对应的位。
+    void advance(Producer* p, ub8 seq){
+        ub8 distance = seq - p->high;
+        if (distance >= (ub8)WindowBits){
+            std::memset(p->window, 0, sizeof(p->window));
+        }else{
+            for (ub8 s = p->high + 1; s <= seq; s++){
+                ub4 bit = (ub4)(s % WindowBits);
+                if ((bit & 63) == 0 && seq - s >= 63){
+                    p->window[bit >> 6] = 0; // 整字清零
+                    s += 63;
+                }else{
+                    p->window[bit >> 6] &= ~((ub8)1 << (bit & 63));
+                }
+            }
+        }
+        p->high = seq;
+    }
+
+    static inline bool testBit(Producer* p, ub8 seq){
+        ub4 bit = (ub4)(seq % WindowBits);
+        return (p->window[bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    static inline void setBit(Producer* p, ub8 seq){
+        ub4 bit = (ub4)(seq % WindowBits);
+        p->window[bit >> 6] |= (ub8)1 << (bit & 63);
+    }
+
+    ub4        maxProducers;
+    ub8        idleTimeout;
+    Slab       slab;
+    Producer** buckets = nullptr;
+    ub4        nrbuckets;
+    ub4        count = 0;
+    Grave*     graves = nullptr;
+    ub8        evicted = 0;
+    ub8        lost = 0;
+    Producer*  newest = nullptr;
+    Producer*  oldest = nullptr;
+    Hash       hasher;
+};
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+#include "util/skiplist.h"
+
+#include <algorithm>
+
+namespace wjp{
+
+// 写入缓冲：跳表上的有序内存表，写满后按key顺序整体落盘。
+// 每条记录连同键值一次性从ConcurrentArena里分配：
+//   [ub4 keyLen][ub4 valueLen][ub8 seq][key][value]
+// 跳表里只存记录指针。同一个key的多次写入靠seq区分，按key升序、seq降序排列，
+// 查找时遇到的第一条就是最新的；更新不原地修改，旧版本留到落盘时再丢弃。
+// add可多线程并发调用，get与迭代不加锁。
+class Memtable{
+private:
+    struct Header{
+        ub4 keyLen;
+        ub4 valueLen;
+        ub8 seq;
+    };
+
+    static const ub4 kHeaderSize = sizeof(Header);
+
+    struct EntryCompare{
+        int operator()(const char* a, const char* b) const {
+            auto ha = (const Header*)a, hb = (const Header*)b;
+            ub4 n = std::min(ha->keyLen, hb->keyLen);
+            int c = std::memcmp(a + kHeaderSize, b + kHeaderSize, n);
+            if (c) return c;
+            if (ha->keyLen != hb->keyLen) return ha->keyLen < hb->keyLen ? -1 : 1;
+            // seq降序
+            if (ha->seq != hb->seq) return ha->seq > hb->seq ? -1 : 1;
+            return 0;
+        }
+    };
+
+    typedef SkipList<const char*, EntryCompare, ConcurrentArena> List;
+
+public:
+    explicit Memtable(ub4 chunkCapacity = 64*kPageSize) : arena(chunkCapacity), list(EntryCompare(), arena){}
+
+    // 同一(key, seq)重复写入返回false。
+    bool add(ub8 seq, const char* key, ub4 keyLen, const char* value, ub4 valueLen){
+        char* p = arena.alloc(kHeaderSize + keyLen + valueLen);
+        if (!p) throw std::runtime_error("memtable: arena alloc error");
+        auto header = (Header*)p;
+        header->keyLen = keyLen;
+        header->valueLen = valueLen;
+        header->seq = seq;
+        std::memcpy(p + kHeaderSize, key, keyLen);
+        std::memcpy(p + kHeaderSize + keyLen, value, valueLen);
+        return list.insert(p);
+    }
+
+    bool add(ub8 seq, const std::string& key, const std::string& value){
+        return add(seq, key.data(), (ub4)key.size(), value.data(), (ub4)value.size());
+    }
+
+    // 取key的最新值；maxSeq用于读快照，只看seq不大于它的版本。
+    bool get(const char* key, ub4 keyLen, std::string* value, ub8 maxSeq = ~(ub8)0) const {
+        // 查找用的临时记录只需头部和key，放在栈上
+        char stackBuf[256];
+        std::unique_ptr<char[]> heapBuf;
+        char* probe = stackBuf;
+        if (kHeaderSize + keyLen > sizeof(stackBuf)){
+            heapBuf.reset(new char[kHeaderSize + keyLen]);
+            probe = heapBuf.get();
+        }
+        auto header = (Header*)probe;
+        header->keyLen = keyLen;
+        header->valueLen = 0;
+        header->seq = maxSeq;
+        std::memcpy(probe + kHeaderSize, key, keyLen);
+
+        List::Iterator it(&list);
+        it.seek(probe);
+        if (!it.valid()) return false;
+        Entry e(it.key());
+        if (e.keyLen() != keyLen || std::memcmp(e.key(), key, keyLen) != 0) return false;
+        if (value) value->assign(e.value(), e.valueLen());
+        return true;
+    }
+
+    bool get(const std::string& key, std::string* value, ub8 maxSeq = ~(ub8)0) const {
+        return get(key.data(), (ub4)key.size(), value, maxSeq);
+    }
+
+    // 记录条数与占用内存，后者用来决定何时换新表、落盘旧表。
+    ub8 size() const { return list.size(); }
+
+    ub8 memoryUsage() const { return arena.memoryUsage(); }
+
+    // 记录的只读视图，指针在Memtable析构前一直有效。
+    class Entry{
+    public:
+        explicit Entry(const char* p) : p(p){}
+
+        ub4 keyLen() const { return ((const Header*)p)->keyLen; }
+        ub4 valueLen() const { return ((const Header*)p)->valueLen; }
+        ub8 seq() const { return ((const Header*)p)->seq; }
+        const char* key() const { return p + kHeaderSize; }
+        const char* value() const { return p + kHeaderSize + keyLen(); }
+
+    private:
+        const char* p;
+    };
+
+    // 按key升序、同key按seq降序遍历，落盘时逐条写出即是有序文件。
+    class Iterator{
+    public:
+        explicit Iterator(const Memtable* table) : it(&table->list){ it.seekToFirst(); }
+
+        bool valid() const { return it.valid(); }
+
+        void next(){ it.next(); }
+
+        Entry entry() const { return Entry(it.key()); }
+
+    private:
+        List::Iterator it;
+    };
+
+private:
+    Memtable(const Memtable&) = delete;
+    Memtable& operator=(const Memtable&) = delete;
+
+    ConcurrentArena arena;
+    List            list;
+};
+
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+#include "util/hashmap.h"
+
+#include <deque>
+#include <limits>
+#include <type_traits>
+
+namespace wjp{
+
+// 可插拔的聚合器：状态满足结合律，merge把两段的状态合成一段。
+//   Input         add的输入
+//   State         每个key在每个pane上的状态，须可平凡析构（随Arena整体丢弃，不调析构）
+//   Output        窗口结束时交给调用方的结果
+//   init(State&)  单位元
+template < typename T >
+struct SumAggregator{
+    typedef T Input;
+    typedef T State;
+    typedef T Output;
+
+    static void init(State& s){ s = T(); }
+    static void add(State& s, const Input& x){ s += x; }
+    static void merge(State& s, const State& rhs){ s += rhs; }
+    static Output result(const State& s){ return s; }
+};
+
+struct CountAggregator{
+    typedef ub8 Input;
+    typedef ub8 State;
+    typedef ub8 Output;
+
+    static void init(State& s){ s = 0; }
+    static void add(State& s, const Input&){ s++; }
+    static void merge(State& s, const State& rhs){ s += rhs; }
+    static Output result(const State& s){ return s; }
+};
+
+template < typename T >
+struct MinAggregator{
+    typedef T Input;
+    typedef T State;
+    typedef T Output;
+
+    static void init(State& s){ s = std::numeric_limits<T>::max(); }
+    static void add(State& s, const Input& x){ if (x < s) s = x; }
+    static void merge(State& s, const State& rhs){ if (rhs < s) s = rhs; }
+    static Output result(const State& s){ return s; }
+};
+
+template < typename T >
+struct MaxAggregator{
+    typedef T Input;
+    typedef T State;
+    typedef T Output;
+
+    static void init(State& s){ s = std::numeric_limits<T>::lowest(); }
+    static void add(State& s, const Input& x){ if (s < x) s = x; }
+    static void merge(State& s, const State& rhs){ if (s < rhs) s = rhs; }
+    static Output result(const State& s){ return s; }
+};
+
+template < typename T >
+struct MeanAggregator{
+    typedef T Input;
+    struct State{
+        double sum;
+        ub8    count;
+    };
+    typedef double Output;
+
+    static void init(State& s){ s.sum = 0; s.count = 0; }
+    static void add(State& s, const Input& x){ s.sum += x; s.count++; }
+    static void merge(State& s, const State& rhs){ s.sum += rhs.sum; s.count += rhs.count; }
+    static Output result(const State& s){ return s.count ? s.sum / s.count : 0; }
+};
+
+
+// 按key的滚动/滑动窗口聚合（pane切分）。
+// 1. 时间轴按pane = gcd(size, slide)切段，窗口[s, s + size)由size / pane个连续pane组成，
+//    滑动窗口之间共享pane，每个事件只落进一个pane，只更新一份状态。
+// 2. 每个pane一个Arena，pane内的哈希表（桶数组与节点）全部从中分配；
+//    pane不再被任何未输出的窗口需要时整个Arena丢掉，状态不逐个释放。
+// 3. add：算一次哈希、在所属pane的表里探查一次，命中即原地add，未命中新建节点。
+// 4. 输出由水位线驱动：advanceWatermark(wm)把结束时间不晚于wm的窗口按时间顺序输出，
+//    滚动窗口直接遍历其唯一的pane；滑动窗口把各pane的状态merge进一张临时表再输出。
+// 5. 时间早于当前水位线的事件算迟到，丢弃并计数。
+// 时间是ub8，单位由调用方决定（毫秒、事件序号都行），只要与水位线一致。非线程安全。
+template < typename K, typename Agg, typename Hash = SipHash >
+class WindowAggregator{
+public:
+    typedef typename Agg::Input  Input;
+    typedef typename Agg::State  State;
+    typedef typename Agg::Output Output;
+
+    static_assert(std::is_trivially_destructible<State>::value, "pane state is dropped with its arena, no destructors run");
+    static_assert(std::is_trivially_copyable<K>::value, "keys are hashed and stored by bytes");
+
+    // slide为0即滚动窗口（slide == size）；slide须不大于size。
+    // paneChunkBytes为每个pane的Arena的chunk大小；source非空时chunk从它分配（如NumaChunkPool）。
+    WindowAggregator(ub8 size, ub8 slide = 0, ub4 paneChunkBytes = 16*kPageSize, const ChunkSource* source = nullptr)
+        : size(size), slide(slide ? slide : size), chunkBytes(paneChunkBytes), source(source){
+        if (!size || this->slide > size) throw std::invalid_argument("window: need 0 < slide <= size");
+        ub8 a = size, b = this->slide;
+        while (b){
+            ub8 t = a % b;
+            a = b;
+            b = t;
+        }
+        paneSize = a;
+        panesPerWindow = size / paneSize;
+    }
+
+    ~WindowAggregator(){
+        for (Pane* p : panes) delete p;
+    }
+
+    // 记入一个事件，迟到的返回false。
+    bool add(const K& key, ub8 time, const Input& value){
+        if (time < watermark){
+            late++;
+            return false;
+        }
+        ub8 index = time / paneSize;
+        Pane* pane = index == lastIndex && lastPane ? lastPane : paneAt(index);
+        ub8 hash = hasher((const ub1*)&key, sizeof(K));
+        Agg::add(pane->findOrCreate(key, hash), value);
+        return true;
+    }
+
+    // 水位线推进到wm：结束时间不晚于wm的窗口逐个输出，
+    // emit(const K& key, const Output& result, ub8 windowStart, ub8 windowEnd)。
+    // 水位线只进不退，返回输出的窗口数（没有任何key的窗口不计、也不回调）。
+    template < typename Emit >
+    ub8 advanceWatermark(ub8 wm, Emit&& emit){
+        if (wm <= watermark) return 0;
+        watermark = wm;
+        ub8 emitted = 0;
+        while (size <= wm && nextStart <= wm - size){
+            while (!panes.empty() && !panes.front()) dropPanesBefore(firstIndex + 1);
+            if (panes.empty()){
+                // 没有待输出的状态，中间的空窗口一次跳过
+                nextStart = firstStartAfter(wm);
+                break;
+            }
+            // 第一个pane之前、且已在水位线之前结束的窗口都是空的，跳过
+            ub8 firstTime = firstIndex * paneSize;
+            if (nextStart + size <= firstTime){
+                nextStart = firstStartAfter(std::min(firstTime, wm));
+                continue;
+            }
+            emitted += emitWindow(nextStart, emit);
+            nextStart += slide;
+            dropPanesBefore(nextStart / paneSize);
+        }
+        return emitted;
+    }
+
+    // 流结束：输出所有还有状态的窗口。
+    template < typename Emit >
+    ub8 flush(Emit&& emit){
+        return advanceWatermark(std::numeric_limits<ub8>::max(), std::forward<Emit>(emit));
+    }
+
+    ub8 currentWatermark() const { return watermark; }
+
+    ub8 lateEvents() const { return late; }
+
+    ub8 paneLength() const { return paneSize; }
+
+    // 仍在内存中的pane数，以及它们的状态数（同一key在每个pane上各算一个）。
+    ub8 livePanes() const {
+        ub8 n = 0;
+        for (Pane* p : panes) n += p != nullptr;
+        return n;
+    }
+
+    ub8 liveStates() const {
+        ub8 n = 0;
+        for (Pane* p : panes) n += p ? p->size() : 0;
+        return n;
+    }
+
+private:
+    WindowAggregator(const WindowAggregator&) = delete;
+    WindowAggregator& operator=(const WindowAggregator&) = delete;
+
+    struct Node{
+        Node* next;
+        ub8   hash;
+        K     key;
+        State state;
+    };
+
+    // 一个pane（或输出滑动窗口时的临时表）：链式哈希表，桶数组与节点都在arena里。
+    // 扩容时旧桶数组留在arena里作废，总量不超过最终桶数组的大小。
+    class Pane{
+    public:
+        // expected为预计的key数，桶数组一次开到位，免去逐次扩容。
+        Pane(ub4 chunkBytes, const ChunkSource* source, ub8 expected = 0) : arena(chunkBytes, source){
+            ub8 n = kInitialBuckets;
+            while (n < expected) n <<= 1;
+            rehash(n);
+        }
+
+        State& findOrCreate(const K& key, ub8 hash){
+            Node** bucket = &buckets[hash & mask];
+            for (Node* n = *bucket; n; n = n->next){
+                if (n->hash == hash && std::memcmp(&n->key, &key, sizeof(K)) == 0) return n->state;
+            }
+            if (count > mask){
+                rehash((mask + 1) * 2);
+                bucket = &buckets[hash & mask];
+            }
+            auto n = (Node*)arena.alloc(sizeof(Node));
+            if (!n) throw std::runtime_error("window: arena alloc error");
+            n->hash = hash;
+            std::memcpy(&n->key, &key, sizeof(K));
+            Agg::init(n->state);
+            n->next = *bucket;
+            *bucket = n;
+            count++;
+            return n->state;
+        }
+
+        template < typename F >
+        void forEach(F&& f) const {
+            for (ub8 b = 0; b <= mask; b++){
+                for (Node* n = buckets[b]; n; n = n->next) f(*n);
+            }
+        }
+
+        ub8 size() const { return count; }
+
+    private:
+        Pane(const Pane&) = delete;
+        Pane& operator=(const Pane&) = delete;
+
+        static const ub4 kInitialBuckets = 64;
+
+        void rehash(ub8 nbuckets){
+            auto fresh = (Node**)arena.alloc((ub4)(sizeof(Node*) * nbuckets));
+            if (!fresh) throw std::runtime_error("window: arena alloc error");
+            std::memset(fresh, 0, sizeof(Node*) * nbuckets);
+            ub8 m = nbuckets - 1;
+            for (ub8 b = 0; buckets && b <= mask; b++){
+                for (Node* n = buckets[b]; n;){
+                    Node* next = n->next;
+                    n->next = fresh[n->hash & m];
+                    fresh[n->hash & m] = n;
+                    n = next;
+                }
+            }
+            buckets = fresh;
+            mask = m;
+        }
+
+        Arena  arena;
+        Node** buckets = nullptr;
+        ub8    mask = 0;
+        ub8    count = 0;
+    };
+
+    // 取第index个pane，不存在就新建；panes[0]是第firstIndex个pane。
+    Pane* paneAt(ub8 index){
+        if (panes.empty()) firstIndex = index;
+        if (index < firstIndex){
+            // 乱序到达、落在现有pane之前（但不早于水位线）的事件
+            panes.insert(panes.begin(), firstIndex - index, nullptr);
+            firstIndex = index;
+        }
+        while (index - firstIndex >= panes.size()) panes.push_back(nullptr);
+        Pane*& slot = panes[index - firstIndex];
+        if (!slot) slot = new Pane(chunkBytes, source);
+        lastIndex = index;
+        lastPane = slot;
+        return slot;
+    }
+
+    template < typename Emit >
+    ub8 emitWindow(ub8 start, Emit& emit){
+        ub8 first = start / paneSize, last = first + panesPerWindow;
+        ub8 end = start + size;
+        if (panesPerWindow == 1){
+            Pane* pane = find(first);
+            if (!pane || !pane->size()) return 0;
+            pane->forEach([&](const Node& n){ emit(n.key, Agg::result(n.state), start, end); });
+            return 1;
+        }
+        ub8 expected = 0;
+        for (ub8 i = first; i < last; i++){
+            if (Pane* pane = find(i)) expected = std::max(expected, pane->size());
+        }
+        Pane merged(chunkBytes, source, expected);
+        for (ub8 i = first; i < last; i++){
+            Pane* pane = find(i);
+            if (!pane) continue;
+            pane->forEach([&](const Node& n){ Agg::merge(merged.findOrCreate(n.key, n.hash), n.state); });
+        }
+        if (!merged.size()) return 0;
+        merged.forEach([&](const Node& n){ emit(n.key, Agg::result(n.state), start, end); });
+        return 1;
+    }
+
+    // 结束时间晚于time的第一个窗口的起点，窗口起点都是slide的整数倍。
+    ub8 firstStartAfter(ub8 time) const {
+        return time < size ? 0 : ((time - size) / slide + 1) * slide;
+    }
+
+    Pane* find(ub8 index) const {
+        if (index < firstIndex || index - firstIndex >= panes.size()) return nullptr;
+        return panes[index - firstIndex];
+    }
+
+    // 第index个pane之前的都不会再被用到，整块丢弃。
+    void dropPanesBefore(ub8 index){
+        while (!panes.empty() && firstIndex < index){
+            if (panes.front() == lastPane) lastPane = nullptr;
+            delete panes.front();
+            panes.pop_front();
+            firstIndex++;
+        }
+    }
+
+    ub8                 size;
+    ub8                 slide;
+    ub8                 paneSize;
+    ub8                 panesPerWindow;
+    ub4                 chunkBytes;
+    const ChunkSource*  source;
+    std::deque<Pane*>   panes;
+    ub8                 firstIndex = 0;
+    ub8                 lastIndex = 0;
+    Pane*               lastPane = nullptr;
+    ub8                 nextStart = 0;    // 下一个待输出窗口的起点
+    ub8                 watermark = 0;
+    ub8                 late = 0;
+    Hash                hasher;
+};
+
+}
@@ -0,0 +1,483 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <new>
+
+namespace wjp{
+
+// 批量释放：一次交给deleter同一个ctx下的n个指针，便于释放回Slab、BuddySystem等池子时
+// 只取一次锁、只碰一次池子的元数据。
+typedef void (*BatchDeleter)(void* ctx, void** ptrs, ub4 n);
+
+static inline void freeBatch(void*, void** ptrs, ub4 n){
+    for (ub4 i = 0; i < n; i++) std::free(ptrs[i]);
+}
+
+template < typename T >
+static inline void deleteBatch(void*, void** ptrs, ub4 n){
+    for (ub4 i = 0; i < n; i++) delete (T*)ptrs[i];
+}
+
+// 归还给ctx指向的Slab、BuddySystem等提供free(char*)的池子。
+// 回收发生在调用retire的线程上，线程私有的池子可以不加锁；
+// 线程退出后遗留的垃圾会由其他线程回收，这时池子须自己保证线程安全。
+template < typename Pool >
+static inline void poolFreeBatch(void* pool, void** ptrs, ub4 n){
+    for (ub4 i = 0; i < n; i++) ((Pool*)pool)->free((char*)ptrs[i]);
+}
+
+struct RetiredPtr{
+    void*        ptr;
+    BatchDeleter del;
+    void*        ctx;
+};
+
+// 按(deleter, ctx)分组，每组调用一次deleter。
+static inline void reclaimBatch(std::vector<RetiredPtr>& items){
+    if (items.empty()) return;
+    std::sort(items.begin(), items.end(), [](const RetiredPtr& a, const RetiredPtr& b){
+        return a.del != b.del ? (uintptr_t)a.del < (uintptr_t)b.del : (uintptr_t)a.ctx < (uintptr_t)b.ctx;
+    });
+    std::vector<void*> ptrs;
+    ptrs.reserve(items.size());
+    for (size_t i = 0; i < items.size(); ){
+        size_t j = i;
+        ptrs.clear();
+        while (j < items.size() && items[j].del == items[i].del && items[j].ctx == items[i].ctx) ptrs.push_back(items[j++].ptr);
+        items[i].del(items[i].ctx, ptrs.data(), (ub4)ptrs.size());
+        i = j;
+    }
+    items.clear();
+}
+
+// 回收域的公共部分：每个线程首次使用时在域里占一个槽位，线程退出时归还，
+// 槽里没回收完的垃圾转为孤儿，由之后的回收顺带处理。
+// 域可以先于使用过它的线程析构，线程退出时经全局登记表确认域是否还活着。
+class ReclaimDomain{
+protected:
+    typedef void (*ExitHook)(ReclaimDomain* domain, ub4 slot);
+
+    ReclaimDomain(ub4 maxThreads, ExitHook onExit) : maxThreads(maxThreads), onExit(onExit){
+        std::lock_guard<std::mutex> guard(registryLock());
+        id = ++nextDomainId();
+        liveDomains().push_back(std::make_pair(this, id));
+        claimed.reset(new std::atomic<bool>[maxThreads]);
+        for (ub4 i = 0; i < maxThreads; i++) claimed[i].store(false, std::memory_order_relaxed);
+    }
+
+    ~ReclaimDomain(){
+        unregister();
+    }
+
+    // 派生类析构一开始就要调用，之后退出的线程不会再碰这个域。
+    void unregister(){
+        std::lock_guard<std::mutex> guard(registryLock());
+        auto& live = liveDomains();
+        for (size_t i = 0; i < live.size(); i++){
+            if (live[i].second == id){
+                live.erase(live.begin() + i);
+                break;
+            }
+        }
+    }
+
+    // 当前线程的槽位号，首次调用时登记。
+    ub4 slot(){
+        Membership& last = lastMembership();
+        if (last.domain == this && last.id == id) return last.slot;
+        for (auto& m : memberships().list){
+            if (m.domain == this && m.id == id){
+                last = m;
+                return m.slot;
+            }
+        }
+        for (ub4 i = 0; i < maxThreads; i++){
+            bool expected = false;
+            if (!claimed[i].load(std::memory_order_relaxed) && claimed[i].compare_exchange_strong(expected, true)){
+                ub4 hw = highWater.load(std::memory_order_relaxed);
+                while (hw < i + 1 && !highWater.compare_exchange_weak(hw, i + 1)){}
+                Membership m{this, id, i};
+                memberships().list.push_back(m);
+                last = m;
+                return i;
+            }
+        }
+        throw std::runtime_error("reclaim domain: too many threads");
+    }
+
+    // 曾经登记过的最大槽位号加一，扫描时只看这么多。
+    ub4 slots() const { return highWater.load(std::memory_order_acquire); }
+
+    // 孤儿垃圾：退出线程留下的，谁回收时谁顺带处理。
+    void adopt(std::vector<RetiredPtr>& items){
+        if (items.empty()) return;
+        std::lock_guard<std::mutex> guard(orphanLock);
+        orphanCount.fetch_add(items.size(), std::memory_order_relaxed);
+        orphans.insert(orphans.end(), items.begin(), items.end());
+        items.clear();
+    }
+
+    void releaseSlot(ub4 i){
+        claimed[i].store(false, std::memory_order_release);
+    }
+
+    std::mutex              orphanLock;
+    std::vector<RetiredPtr> orphans;
+    std::atomic<ub8>        orphanCount{0}; // 尚未释放的孤儿数，免锁判断有没有孤儿要处理
+
+private:
+    ReclaimDomain(const ReclaimDomain&) = delete;
+    ReclaimDomain& operator=(const ReclaimDomain&) = delete;
+
+    struct Membership{
+        ReclaimDomain* domain;
+        ub8            id;
+        ub4            slot;
+    };
+
+    // 线程退出时逐个归还槽位；域已析构的跳过。
+    struct Memberships{
+        std::vector<Membership> list;
+
+        ~Memberships(){
+            std::lock_guard<std::mutex> guard(registryLock());
+            for (auto& m : list){
+                for (auto& live : liveDomains()){
+                    if (live.first == m.domain && live.second == m.id){
+                        m.domain->onExit(m.domain, m.slot);
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    static Memberships& memberships(){
+        static thread_local Memberships m;
+        return m;
+    }
+
+    static Membership& lastMembership(){
+        static thread_local Membership m{nullptr, 0, 0};
+        return m;
+    }
+
+    static std::mutex& registryLock(){
+        static std::mutex lock;
+        return lock;
+    }
+
+    static std::vector<std::pair<ReclaimDomain*, ub8>>& liveDomains(){
+        static std::vector<std::pair<ReclaimDomain*, ub8>> live;
+        return live;
+    }
+
+    static ub8& nextDomainId(){
+        static ub8 next = 0;
+        return next;
+    }
+
+    ub4 maxThreads;
+    ExitHook onExit;
+    ub8 id;
+    std::unique_ptr<std::atomic<bool>[]> claimed;
+    std::atomic<ub4> highWater{0};
+};
+
+
+// 基于epoch的回收（EBR）。
+// 1. 读者用pin()得到Guard，期间读到的节点不会被释放；Guard可嵌套，开销是一次
+//    本线程cache line上的写加一个fence，没有共享写。
+// 2. 写者摘下节点后retire，节点按retire时的全局epoch进本线程的三个桶之一。
+//    全局epoch只在所有活跃线程都已观察到当前epoch时才前进，前进两次之后，
+//    桶里的节点不可能再被任何读者持有。
+// 3. 每retire batch个节点尝试推进一次epoch并回收，回收按deleter分组批量进行。
+// 不足：一个线程停在临界区里会卡住epoch，垃圾无上限增长；stalledThreads()可以
+// 发现这种情况。需要上界的场合用下面的HazardDomain。
+class EpochDomain : public ReclaimDomain{
+public:
+    class Guard{
+    public:
+        Guard(EpochDomain* domain, ub4 slot) : domain(domain), slot(slot){}
+
+        Guard(Guard&& rhs) : domain(rhs.domain), slot(rhs.slot){ rhs.domain = nullptr; }
+
+        ~Guard(){ if (domain) domain->leave(slot); }
+
+    private:
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        EpochDomain* domain;
+        ub4          slot;
+    };
+
+    explicit EpochDomain(ub4 maxThreads = 256, ub4 batch = 64)
+        : ReclaimDomain(maxThreads, &EpochDomain::threadExit), batch(batch ? batch : 1), nrecords(maxThreads)
+    {
+        records = (Record*) malloc64(sizeof(Record) * maxThreads);
+        if (!records) throw std::runtime_error("malloc64 error");
+        for (ub4 i = 0; i < maxThreads; i++) new(&records[i]) Record;
+    }
+
+    // 析构时不应再有线程在用；剩余垃圾全部释放。
+    ~EpochDomain(){
+        unregister();
+        for (ub4 i = 0; i < nrecords; i++){
+            for (auto& bucket : records[i].limbo) reclaimBatch(bucket.items);
+            records[i].~Record();
+        }
+        std::free(records);
+        reclaimBatch(orphanReady);
+        reclaimBatch(orphans);
+    }
+
+    Guard pin(){
+        ub4 s = slot();
+        enter(s);
+        return Guard(this, s);
+    }
+
+    // ptr须已从共享结构上摘下，之后新来的读者不可能再读到它。
+    void retire(void* ptr, BatchDeleter del, void* ctx = nullptr){
+        ub4 s = slot();
+        Record& r = records[s];
+        ub8 e = global.load(std::memory_order_acquire);
+        Limbo& bucket = r.limbo[e % 3];
+        // 桶里是e-3及更早的节点，已经安全
+        if (bucket.epoch != e){
+            reclaimBatch(bucket.items);
+            bucket.epoch = e;
+        }
+        bucket.items.push_back(RetiredPtr{ptr, del, ctx});
+        if (++r.sinceCollect >= batch){
+            r.sinceCollect = 0;
+            collect(r);
+        }
+    }
+
+    // 尝试推进epoch并回收本线程可回收的垃圾。
+    void flush(){
+        collect(records[slot()]);
+    }
+
+    // 本线程尚未回收的节点数。
+    ub8 pending(){
+        Record& r = records[slot()];
+        ub8 n = 0;
+        for (auto& bucket : r.limbo) n += bucket.items.size();
+        return n;
+    }
+
+    ub8 epoch() const { return global.load(std::memory_order_relaxed); }
+
+    // 停在旧epoch上、阻碍推进的活跃线程数。
+    ub4 stalledThreads(){
+        ub8 e = global.load(std::memory_order_acquire);
+        ub4 n = 0;
+        for (ub4 i = 0; i < slots(); i++){
+            ub8 st = records[i].state.load(std::memory_order_acquire);
+            if ((st & 1) && (st >> 1) != e) n++;
+        }
+        return n;
+    }
+
+private:
+    struct Limbo{
+        ub8 epoch = 0;
+        std::vector<RetiredPtr> items;
+    };
+
+    // 每线程一条，独占cache line。state为(epoch << 1) | 活跃位。
+    struct alignas(kCacheLineSize) Record{
+        std::atomic<ub8> state{0};
+        ub4              nesting = 0;
+        ub4              sinceCollect = 0;
+        Limbo            limbo[3];
+    };
+
+    inline void enter(ub4 s){
+        Record& r = records[s];
+        if (r.nesting++ == 0){
+            r.state.store(global.load(std::memory_order_relaxed) << 1 | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    inline void leave(ub4 s){
+        Record& r = records[s];
+        if (--r.nesting == 0) r.state.store(r.state.load(std::memory_order_relaxed) & ~(ub8)1, std::memory_order_release);
+    }
+
+    // 所有活跃线程都在当前epoch上时才能推进。
+    bool tryAdvance(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ub8 e = global.load(std::memory_order_relaxed);
+        for (ub4 i = 0; i < slots(); i++){
+            ub8 st = records[i].state.load(std::memory_order_acquire);
+            if ((st & 1) && (st >> 1) != e) return false;
+        }
+        return global.compare_exchange_strong(e, e + 1);
+    }
+
+    void collect(Record& r){
+        tryAdvance();
+        ub8 e = global.load(std::memory_order_acquire);
+        for (auto& bucket : r.limbo){
+            if (!bucket.items.empty() && bucket.epoch + 2 <= e) reclaimBatch(bucket.items);
+        }
+        // 孤儿在被adopt时已经摘下，按最保守的办法处理：推进两次之后再释放
+        if (orphanCount.load(std::memory_order_relaxed) && orphanLock.try_lock()){
+            std::vector<RetiredPtr> ready;
+            if (orphanEpoch + 2 <= e){
+                ready.swap(orphanReady);
+                orphanReady.swap(orphans);
+                orphanEpoch = e;
+                orphanCount.fetch_sub(ready.size(), std::memory_order_relaxed);
+            }
+            orphanLock.unlock();
+            reclaimBatch(ready);
+        }
+    }
+
+    static void threadExit(ReclaimDomain* base, ub4 s){
+        auto self = (EpochDomain*)base;
+        Record& r = self->records[s];
+        r.state.store(0, std::memory_order_release);
+        r.nesting = 0;
+        std::vector<RetiredPtr> left;
+        for (auto& bucket : r.limbo){
+            left.insert(left.end(), bucket.items.begin(), bucket.items.end());
+            bucket.items.clear();
+            bucket.epoch = 0;
+        }
+        self->adopt(left);
+        self->releaseSlot(s);
+    }
+
+    std::atomic<ub8>        global{1};
+    ub4                     batch;
+    ub4                     nrecords;
+    Record*                 records;
+    std::vector<RetiredPtr> orphanReady; // 上一轮转过来的孤儿，再过两个epoch释放
+    ub8                     orphanEpoch = 0;
+};
+
+
+// 危险指针（hazard pointer）回收，垃圾有上界。
+// 1. 读者用protect把要访问的指针登记在本线程的槽里，再确认源指针未变；
+//    每线程kSlotsPerThread个槽，用完clear。
+// 2. retire的节点先攒在本线程，超过阈值R = max(batch, 2 * 槽总数)时扫描一次所有槽，
+//    未被登记的批量释放。即使有线程停住，它最多钉住自己登记的那几个节点，
+//    每线程积压不超过R加上槽总数。
+// 3. 读路径每次访问都要一次seq_cst写，比EBR贵，换来的是上界。
+class HazardDomain : public ReclaimDomain{
+public:
+    static const ub4 kSlotsPerThread = 4;
+
+    explicit HazardDomain(ub4 maxThreads = 256, ub4 batch = 64)
+        : ReclaimDomain(maxThreads, &HazardDomain::threadExit), batch(batch ? batch : 1), nrecords(maxThreads)
+    {
+        records = (Record*) malloc64(sizeof(Record) * maxThreads);
+        if (!records) throw std::runtime_error("malloc64 error");
+        for (ub4 i = 0; i < maxThreads; i++) new(&records[i]) Record;
+    }
+
+    ~HazardDomain(){
+        unregister();
+        for (ub4 i = 0; i < nrecords; i++){
+            reclaimBatch(records[i].retired);
+            records[i].~Record();
+        }
+        std::free(records);
+        reclaimBatch(orphans);
+    }
+
+    // 读取src并登记到第i个槽，返回的指针在clear(i)之前不会被释放。
+    template < typename T >
+    T* protect(ub4 i, const std::atomic<T*>& src){
+        auto& hazard = records[slot()].hazards[i];
+        T* p = src.load(std::memory_order_relaxed);
+        for (;;){
+            hazard.store(p, std::memory_order_seq_cst);
+            T* q = src.load(std::memory_order_acquire);
+            if (q == p) return p;
+            p = q;
+        }
+    }
+
+    void clear(ub4 i){
+        records[slot()].hazards[i].store(nullptr, std::memory_order_release);
+    }
+
+    void retire(void* ptr, BatchDeleter del, void* ctx = nullptr){
+        Record& r = records[slot()];
+        r.retired.push_back(RetiredPtr{ptr, del, ctx});
+        if (r.retired.size() >= threshold()) scan(r);
+    }
+
+    void flush(){
+        scan(records[slot()]);
+    }
+
+    ub8 pending(){
+        return records[slot()].retired.size();
+    }
+
+private:
+    struct alignas(kCacheLineSize) Record{
+        std::atomic<void*>      hazards[kSlotsPerThread];
+        std::vector<RetiredPtr> retired;
+
+        Record(){
+            for (auto& h : hazards) h.store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+    size_t threshold(){
+        return std::max<size_t>(batch, 2 * kSlotsPerThread * slots());
+    }
+
+    void scan(Record& r){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<void*> hazards;
+        hazards.reserve(slots() * kSlotsPerThread);
+        for (ub4 i = 0; i < slots(); i++){
+            for (auto& h : records[i].hazards){
+                if (void* p = h.load(std::memory_order_acquire)) hazards.push_back(p);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+        // 孤儿一并参与扫描
+        if (orphanCount.load(std::memory_order_relaxed) && orphanLock.try_lock()){
+            r.retired.insert(r.retired.end(), orphans.begin(), orphans.end());
+            orphanCount.fetch_sub(orphans.size(), std::memory_order_relaxed);
+            orphans.clear();
+            orphanLock.unlock();
+        }
+        std::vector<RetiredPtr> ready;
+        size_t kept = 0;
+        for (auto& item : r.retired){
+            if (std::binary_search(hazards.begin(), hazards.end(), item.ptr)) r.retired[kept++] = item;
+            else ready.push_back(item);
+        }
+        r.retired.resize(kept);
+        reclaimBatch(ready);
+    }
+
+    static void threadExit(ReclaimDomain* base, ub4 s){
+        auto self = (HazardDomain*)base;
+        Record& r = self->records[s];
+        for (auto& h : r.hazards) h.store(nullptr, std::memory_order_release);
+        self->adopt(r.retired);
+        self->releaseSlot(s);
+    }
+
+    ub4     batch;
+    ub4     nrecords;
+    Record* records;
+};
+
+}
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/slab.h"
+#include "util/ringbuffer.h"
+
+#include <condition_variable>
+#include <thread>
+#include <new>
+#include <utility>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace wjp{
+
+// Chase-Lev工作窃取双端队列（按Lê等人针对弱内存模型的版本）。
+// 所有者在bottom端push/take，其他线程在top端steal；数组满时倍增，
+// 旧数组可能仍被窃取者读着，留到析构时统一释放。
+template < typename T >
+class WorkDeque{
+public:
+    explicit WorkDeque(ub4 capacity = 256){
+        array.store(newArray(roundUpPowerOf2(capacity < 2 ? 2 : capacity)), std::memory_order_relaxed);
+    }
+
+    ~WorkDeque(){
+        std::free(array.load(std::memory_order_relaxed));
+        for (auto old : retired) std::free(old);
+    }
+
+    // 仅所有者调用。
+    void push(T* item){
+        sb8 b = bottom.load(std::memory_order_relaxed);
+        sb8 t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > (sb8)a->mask) a = grow(a, t, b);
+        a->slots[b & a->mask].store(item, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // 仅所有者调用，后进先出。
+    T* take(){
+        sb8 b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        sb8 t = top.load(std::memory_order_relaxed);
+        if (t > b){
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = a->slots[b & a->mask].load(std::memory_order_relaxed);
+        if (t == b){
+            // 只剩最后一个，与窃取者竞争
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用，先进先出；竞争失败返回nullptr。
+    T* steal(){
+        sb8 t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        sb8 b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        Array* a = array.load(std::memory_order_acquire);
+        T* item = a->slots[t & a->mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+        return item;
+    }
+
+    bool empty() const {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+private:
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    struct Array{
+        ub8 mask;
+        std::atomic<T*> slots[1];
+    };
+
+    static Array* newArray(ub8 cap){
+        auto a = (Array*) malloc64(sizeof(Array) + sizeof(std::atomic<T*>) * (cap - 1));
+        if (!a) throw std::runtime_error("malloc64 error");
+        a->mask = cap - 1;
+        return a;
+    }
+
+    Array* grow(Array* a, sb8 t, sb8 b){
+        Array* bigger = newArray((a->mask + 1) * 2);
+        for (sb8 i = t; i < b; i++) bigger->slots[i & bigger->mask].store(a->slots[i & a->mask].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        retired.push_back(a);
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    // top被窃取者争抢，与所有者独占的bottom分处不同cache line
+    std::atomic<sb8>    top{0};
+    char                pad0[kCacheLineSize - sizeof(std::atomic<sb8>)];
+    std::atomic<sb8>    bottom{0};
+    std::atomic<Array*> array;
+    std::vector<Array*> retired;
+};
+
+// 一组任务的完成计数，wait在它归零时返回。
+struct TaskGroup{
+    std::atomic<ub8> pending{0};
+};
+
+// 工作窃取调度器。
+// 1. 每个worker一个WorkDeque，自己派生的任务压在本地，空闲时随机挑别的worker窃取，
+//    再看外部线程投递的注入队列（MpmcRing），都没有才睡眠。
+// 2. 任务对象定长64字节，闭包就地存放，由每个worker自己的Slab分配；
+//    在别的线程执行完的任务挂到原主的远程释放链表上，原主下次分配时收回。
+// 3. wait不阻塞：等待的线程会顺手执行任务，嵌套的parallelFor不会死锁。
+// 4. 可选把worker绑到各个CPU上。
+class Scheduler{
+public:
+    static const ub4 kTaskStorage = 40; // 闭包大小上限，捕获大对象时请按引用捕获
+
+    explicit Scheduler(ub4 nthreads = 0, bool pinThreads = false){
+        if (!nthreads) nthreads = std::thread::hardware_concurrency();
+        if (!nthreads) nthreads = 1;
+        workers.reserve(nthreads);
+        for (ub4 i = 0; i < nthreads; i++) workers.push_back(std::unique_ptr<Worker>(new Worker(this, i)));
+        for (ub4 i = 0; i < nthreads; i++){
+            workers[i]->thread = std::thread([this, i]{ run(*workers[i]); });
+            if (pinThreads) pin(workers[i]->thread, i);
+        }
+    }
+
+    ~Scheduler(){
+        stopping.store(true);
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            sleepCv.notify_all();
+        }
+        for (auto& w : workers) w->thread.join();
+    }
+
+    ub4 size() const { return (ub4)workers.size(); }
+
+    // 派生一个任务，计入group。可在worker内外调用。
+    template < typename F >
+    void spawn(TaskGroup& group, F&& f){
+        typedef typename std::decay<F>::type Fn;
+        static_assert(sizeof(Fn) <= kTaskStorage, "task closure too large, capture by reference");
+        static_assert(alignof(Fn) <= 8, "task closure over-aligned");
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Worker* self = currentWorker();
+        Task* task = allocTask(self);
+        new(task->storage) Fn(std::forward<F>(f));
+        task->invoke = &invokeTask<Fn>;
+        task->group = &group;
+        if (self) self->deque.push(task);
+        else if (!injected.push(task)){
+            execute(task, nullptr); // 注入队列满了就地执行
+            return;
+        }
+        wakeOne();
+    }
+
+    // 等group里的任务全部完成，期间帮忙执行任务。
+    void wait(TaskGroup& group){
+        Worker* self = currentWorker();
+        ub4 idle = 0;
+        while (group.pending.load(std::memory_order_acquire)){
+            if (Task* task = findTask(self)){
+                execute(task, self);
+                idle = 0;
+            }else if (++idle > 64){
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // 对[begin, end)按grain二分切块并行执行body(lo, hi)，返回时全部完成。
+    template < typename Body >
+    void parallelFor(ub8 begin, ub8 end, ub8 grain, const Body& body){
+        if (begin >= end) return;
+        if (!grain) grain = 1;
+        TaskGroup group;
+        ForContext<Body> ctx{&group, grain, &body};
+        splitFor(&ctx, begin, end);
+        wait(group);
+    }
+
+    // 每块用map(lo, hi)求出部分结果，再按块的顺序用reduce(T, T)合并，结果与线程数无关。
+    template < typename T, typename Map, typename Reduce >
+    T parallelReduce(ub8 begin, ub8 end, ub8 grain, T identity, const Map& map, const Reduce& reduce){
+        if (begin >= end) return identity;
+        if (!grain) grain = 1;
+        ub8 nchunks = (end - begin + grain - 1) / grain;
+        std::vector<Padded<T>> partial(nchunks);
+        parallelFor(0, nchunks, 1, [&](ub8 lo, ub8 hi){
+            for (ub8 c = lo; c < hi; c++){
+                ub8 from = begin + c * grain;
+                partial[c].value = map(from, std::min(from + grain, end));
+            }
+        });
+        T result = identity;
+        for (auto& p : partial) result = reduce(result, p.value);
+        return result;
+    }
+
+    // 当前线程若是本调度器的worker，返回其编号，否则返回-1。
+    int workerIndex(){
+        Worker* self = currentWorker();
+        return self ? (int)self->index : -1;
+    }
+
+private:
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    static const ub4 kExternal = ~0u;
+    static const ub4 kSpinsBeforeSleep = 256;
+
+    struct Task{
+        void       (*invoke)(Task*);
+        TaskGroup* group;
+        ub4        owner;     // 分配它的worker，kExternal表示外部线程
+        ub4        reserved;
+        union{
+            alignas(8) char storage[kTaskStorage];
+            Task* nextFree;   // 执行完后挂远程释放链表用
+        };
+    };
+    static_assert(sizeof(Task) == 64, "task should fill exactly one cache line");
+
+    // 各块的部分结果分开放，避免伪共享
+    template < typename T >
+    struct Padded{
+        T    value;
+        char pad[kCacheLineSize];
+    };
+
+    template < typename Body >
+    struct ForContext{
+        TaskGroup*  group;
+        ub8         grain;
+        const Body* body;
+    };
+
+    struct Worker{
+        Worker(Scheduler* sched, ub4 index) : sched(sched), index(index), tasks(sizeof(Task)),
+            rnd(UB8(0x9e3779b9, 0x7f4a7c15) * (index + 1)){}
+
+        Scheduler*       sched;
+        ub4              index;
+        WorkDeque<Task>  deque;
+        Slab             tasks;
+        char             pad[kCacheLineSize];
+        std::atomic<Task*> remoteFree{nullptr};
+        ub8              rnd;
+        std::thread      thread;
+    };
+
+    template < typename Fn >
+    static void invokeTask(Task* task){
+        Fn* fn = (Fn*)task->storage;
+        (*fn)();
+        fn->~Fn();
+    }
+
+    template < typename Body >
+    void splitFor(ForContext<Body>* ctx, ub8 lo, ub8 hi){
+        // 右半边派生出去，左半边继续切，直到不超过grain
+        while (hi - lo > ctx->grain){
+            ub8 mid = lo + (hi - lo) / 2;
+            spawn(*ctx->group, [this, ctx, mid, hi]{ splitFor(ctx, mid, hi); });
+            hi = mid;
+        }
+        (*ctx->body)(lo, hi);
+    }
+
+    static Worker*& currentWorkerSlot(){
+        static thread_local Worker* worker = nullptr;
+        return worker;
+    }
+
+    Worker* currentWorker(){
+        Worker* w = currentWorkerSlot();
+        return w && w->sched == this ? w : nullptr;
+    }
+
+    Task* allocTask(Worker* self){
+        char* p;
+        if (self){
+            // 先收回别的线程替我们释放的任务
+            if (self->remoteFree.load(std::memory_order_relaxed)){
+                Task* t = self->remoteFree.exchange(nullptr, std::memory_order_acquire);
+                while (t){
+                    Task* next = t->nextFree;
+                    self->tasks.free((char*)t);
+                    t = next;
+                }
+            }
+            p = self->tasks.alloc();
+        }else{
+            std::lock_guard<std::mutex> guard(externalLock);
+            p = externalTasks.alloc();
+        }
+        if (!p) throw std::runtime_error("slab alloc error");
+        Task* task = (Task*)p;
+        task->owner = self ? self->index : kExternal;
+        return task;
+    }
+
+    void freeTask(Task* task, Worker* self){
+        if (task->owner == kExternal){
+            std::lock_guard<std::mutex> guard(externalLock);
+            externalTasks.free((char*)task);
+        }else if (self && self->index == task->owner){
+            self->tasks.free((char*)task);
+        }else{
+            auto& head = workers[task->owner]->remoteFree;
+            Task* old = head.load(std::memory_order_relaxed);
+            do{
+                task->nextFree = old;
+            }while (!head.compare_exchange_weak(old, task, std::memory_order_release, std::memory_order_relaxed));
+        }
+    }
+
+    void execute(Task* task, Worker* self){
+        TaskGroup* group = task->group;
+        task->invoke(task);
+        freeTask(task, self);
+        group->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    Task* findTask(Worker* self){
+        if (self){
+            if (Task* task = self->deque.take()) return task;
+        }
+        ub4 n = size();
+        ub8 r = self ? nextRandom(self->rnd) : (ub8)std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (ub4 i = 0; i < n; i++){
+            Worker* victim = workers[(r + i) % n].get();
+            if (victim == self) continue;
+            if (Task* task = victim->deque.steal()) return task;
+        }
+        Task* task;
+        if (injected.pop(task)) return task;
+        return nullptr;
+    }
+
+    bool anyWork(){
+        if (!injected.empty()) return true;
+        for (auto& w : workers) if (!w->deque.empty()) return true;
+        return false;
+    }
+
+    static inline ub8 nextRandom(ub8& state){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    void run(Worker& self){
+        currentWorkerSlot() = &self;
+        ub4 idle = 0;
+        while (!stopping.load(std::memory_order_relaxed)){
+            if (Task* task = findTask(&self)){
+                execute(task, &self);
+                idle = 0;
+                continue;
+            }
+            if (++idle < kSpinsBeforeSleep){
+                std::this_thread::yield();
+                continue;
+            }
+            // 登记为睡眠者后再查一遍，与wakeOne的“先发布任务再看睡眠者”配对，不丢唤醒
+            std::unique_lock<std::mutex> guard(sleepLock);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!anyWork() && !stopping.load()) sleepCv.wait_for(guard, std::chrono::milliseconds(10));
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+            idle = 0;
+        }
+        currentWorkerSlot() = nullptr;
+    }
+
+    void wakeOne(){
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed)){
+            std::lock_guard<std::mutex> guard(sleepLock);
+            sleepCv.notify_one();
+        }
+    }
+
+    static void pin(std::thread& t, ub4 index){
+        ub4 ncpus = std::thread::hardware_concurrency();
+        if (!ncpus) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(index % ncpus, &set);
+        pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    MpmcRing<Task*>          injected{1024};
+    std::mutex               externalLock;
+    Slab                     externalTasks{sizeof(Task)};
+    std::mutex               sleepLock;
+    std::condition_variable  sleepCv;
+    std::atomic<ub4>         sleepers{0};
+    std::atomic<bool>        stopping{false};
+};
+
+}
@@ -0,0 +1,446 @@
+// 重放工具本身不记录轨迹
+#undef WJP_ALLOC_TRACE
+
+#include "alloc/arena.h"
+#include "alloc/buddy.h"
+#include "alloc/slab.h"
+#include "util/hashmap.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace wjp;
+
+// 用法：alloc_replay 轨迹文件 [--allocator=malloc,arena,buddy,slab] [--buddy-pages=N] [--no-touch]
+// 把WJP_ALLOC_TRACE记录下的轨迹按时间顺序单线程重放到各个分配器上，每个分配器
+// 在单独fork出的子进程里跑，RSS互不干扰。每个分配器输出一行JSON：
+//   ns_per_op      含写入新分配内存在内的每个事件平均耗时
+//   peak_rss_mb    重放期间RSS相对起点的峰值，每kRssInterval个事件采样一次
+//   peak_live_mb   轨迹本身同时存活的请求字节数峰值，与分配器无关
+//   fragmentation  peak_rss / peak_live，越接近1越好
+// 各分配器对轨迹语义的映射：
+//   malloc  每次分配一个malloc；Arena析构时逐个free它名下的对象。
+//   arena   每个轨迹里的Arena/BuddySystem对应一个Arena（带用户缓冲区的对应
+//           UserBufferArena）；单个对象的free忽略，内存到Arena析构才回收。
+//   buddy   所有分配共用一个BuddySystem，超过最大块的退给malloc并计入fallback。
+//   slab    16B到4KB按2的幂分级，每级一个Slab；更大的退给malloc并计入fallback。
+// grow原地延长在arena上重放为一次alloc，在其余分配器上不产生操作。
+struct Options{
+    std::string              path;
+    std::vector<std::string> allocators{"malloc", "arena", "buddy", "slab"};
+    ub4                      buddyPages = 1 << 18;
+    bool                     touch = true;
+};
+
+static const ub4 kRssInterval = 4096;
+
+enum StepOp : ub1{ kNewOwner, kDropOwner, kAlloc, kFree, kExtend };
+
+// 轨迹编译成的重放步骤：owner、对象都换成了从0开始的编号。
+// 所属Arena/BuddySystem析构时名下还存活的对象，编译成一串kFree跟在kDropOwner前面。
+struct Step{
+    ub1 op;
+    ub1 pages;   // 对象来自allocPages
+    ub2 reserved;
+    ub4 owner;
+    ub4 object;
+    ub4 size;    // kNewOwner时为chunkCapacity，其余为字节数
+    ub4 extra;   // kNewOwner时为用户缓冲区字节数
+};
+
+struct Program{
+    std::vector<Step> steps;
+    ub4               owners = 0;
+    ub4               objects = 0;
+    ub8               peakLive = 0;
+    ub8               unmatchedFrees = 0;
+    ub8               failedAllocs = 0;
+};
+
+static bool startsWith(const char* arg, const char* prefix, const char** value){
+    size_t len = std::strlen(prefix);
+    if (std::strncmp(arg, prefix, len)) return false;
+    *value = arg + len;
+    return true;
+}
+
+static Options parse(int argc, char** argv){
+    Options opt;
+    for (int i = 1; i < argc; i++){
+        const char* v;
+        if (startsWith(argv[i], "--allocator=", &v)){
+            opt.allocators.clear();
+            std::string list(v);
+            size_t begin = 0;
+            while (begin <= list.size()){
+                size_t end = list.find(',', begin);
+                if (end == std::string::npos) end = list.size();
+                if (end > begin) opt.allocators.push_back(list.substr(begin, end - begin));
+                begin = end + 1;
+            }
+        }
+        else if (startsWith(argv[i], "--buddy-pages=", &v)) opt.buddyPages = (ub4)std::atol(v);
+        else if (!std::strcmp(argv[i], "--no-touch")) opt.touch = false;
+        else if (argv[i][0] != '-' && opt.path.empty()) opt.path = argv[i];
+        else throw std::invalid_argument(std::string("unknown option ") + argv[i]);
+    }
+    if (opt.path.empty()) throw std::invalid_argument("usage: alloc_replay trace [--allocator=malloc,arena,buddy,slab] "
+                                                      "[--buddy-pages=N] [--no-touch]");
+    for (auto& a : opt.allocators){
+        if (a != "malloc" && a != "arena" && a != "buddy" && a != "slab") throw std::invalid_argument("unknown allocator " + a);
+    }
+    return opt;
+}
+
+// 按时间排序后逐个事件翻译。地址在free之后可能被复用，所以对象表按“当前存活”维护，
+// owner表在Create时覆盖旧映射。
+static Program compile(std::vector<AllocEvent>& events){
+    std::stable_sort(events.begin(), events.end(), [](const AllocEvent& a, const AllocEvent& b){
+        return a.time < b.time;
+    });
+    Program prog;
+    Hashmap<ub8, ub4> owners;              // 分配器地址 -> owner编号
+    Hashmap<ub8, ub4> live;                // 存活对象地址 -> 对象编号
+    std::vector<std::vector<ub4>> owned;   // owner名下分配过的对象
+    std::vector<Step> allocs;              // 对象编号 -> 分配它的步骤
+    std::vector<ub8> addresses;            // 对象编号 -> 原地址
+    std::vector<ub1> freed;
+    std::vector<ub8> extended;             // owner名下grow原地延长的字节数，随owner析构回收
+    ub8 liveBytes = 0;
+
+    auto addOwner = [&](ub8 addr, ub4 chunkCapacity) -> ub4 {
+        ub4 id = prog.owners++;
+        owners[addr] = id;
+        owned.emplace_back();
+        extended.push_back(0);
+        prog.steps.push_back(Step{kNewOwner, 0, 0, id, 0, chunkCapacity, 0});
+        return id;
+    };
+    // 轨迹开始之前就已构造的分配器，补一个缺省尺寸的owner
+    auto ownerOf = [&](ub8 addr) -> ub4 {
+        auto e = owners.find(addr);
+        return e ? e->value : addOwner(addr, 4 * kPageSize);
+    };
+    auto release = [&](ub4 object){
+        Step s = allocs[object];
+        s.op = kFree;
+        prog.steps.push_back(s);
+        freed[object] = 1;
+        liveBytes -= s.size;
+        auto l = live.find(addresses[object]);
+        if (l && l->value == object) std::free(live.erase(addresses[object]));
+    };
+    auto dropOwner = [&](ub8 addr){
+        auto e = owners.find(addr);
+        if (!e) return;
+        ub4 id = e->value;
+        for (ub4 object : owned[id]){
+            if (!freed[object]) release(object);
+        }
+        owned[id].clear();
+        liveBytes -= extended[id];
+        extended[id] = 0;
+        prog.steps.push_back(Step{kDropOwner, 0, 0, id, 0, 0, 0});
+        std::free(owners.erase(addr));
+    };
+
+    for (auto& e : events){
+        switch ((AllocOp)e.op){
+        case AllocOp::kArenaCreate:
+            dropOwner(e.owner);
+            addOwner(e.owner, e.size);
+            break;
+        case AllocOp::kBuddyCreate:
+            dropOwner(e.owner);
+            addOwner(e.owner, 4 * kPageSize);
+            break;
+        case AllocOp::kArenaUserBuffer:{
+            // 紧跟在Create之后，回头改写那一步
+            ub4 id = ownerOf(e.owner);
+            for (auto it = prog.steps.rbegin(); it != prog.steps.rend(); ++it){
+                if (it->op == kNewOwner && it->owner == id){
+                    it->extra = e.size;
+                    break;
+                }
+            }
+            break;
+        }
+        case AllocOp::kArenaDestroy:
+        case AllocOp::kBuddyDestroy:
+            dropOwner(e.owner);
+            break;
+        case AllocOp::kArenaAlloc:
+        case AllocOp::kBuddyAlloc:
+        case AllocOp::kBuddyAllocPages:{
+            if (!e.ptr){
+                prog.failedAllocs++;
+                break;
+            }
+            ub4 owner = ownerOf(e.owner);
+            ub4 object = prog.objects++;
+            Step s{kAlloc, (ub1)((AllocOp)e.op == AllocOp::kBuddyAllocPages), 0, owner, object, e.size, 0};
+            prog.steps.push_back(s);
+            allocs.push_back(s);
+            addresses.push_back(e.ptr);
+            freed.push_back(0);
+            owned[owner].push_back(object);
+            live[e.ptr] = object;
+            liveBytes += e.size;
+            prog.peakLive = std::max(prog.peakLive, liveBytes);
+            break;
+        }
+        case AllocOp::kBuddyFree:
+        case AllocOp::kBuddyFreePages:{
+            auto l = live.find(e.ptr);
+            if (!l){
+                prog.unmatchedFrees++;
+                break;
+            }
+            release(l->value);
+            break;
+        }
+        case AllocOp::kArenaExtend:{
+            ub4 owner = ownerOf(e.owner);
+            prog.steps.push_back(Step{kExtend, 0, 0, owner, 0, e.size, 0});
+            extended[owner] += e.size;
+            liveBytes += e.size;
+            prog.peakLive = std::max(prog.peakLive, liveBytes);
+            break;
+        }
+        }
+    }
+    return prog;
+}
+
+// 当前RSS字节数，读/proc/self/statm第二列。
+static ub8 residentBytes(int fd){
+    char buf[128];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = 0;
+    unsigned long long size = 0, resident = 0;
+    if (std::sscanf(buf, "%llu %llu", &size, &resident) != 2) return 0;
+    return resident * (ub8)sysconf(_SC_PAGESIZE);
+}
+
+// 每种分配器实现同一组回调，run按步骤驱动。
+class Replayer{
+public:
+    virtual ~Replayer(){}
+    virtual void newOwner(ub4 owner, ub4 chunkCapacity, ub4 userBuffer){ (void)owner; (void)chunkCapacity; (void)userBuffer; }
+    virtual void dropOwner(ub4 owner){ (void)owner; }
+    virtual char* alloc(const Step& s) = 0;
+    virtual void free(const Step& s, char* p) = 0;
+    virtual char* extend(const Step& s){ (void)s; return nullptr; }
+    ub8 fallbacks = 0;
+};
+
+class MallocReplayer : public Replayer{
+public:
+    char* alloc(const Step& s) override { return (char*)std::malloc(s.size ? s.size : 1); }
+    void free(const Step& s, char* p) override { (void)s; std::free(p); }
+};
+
+class ArenaReplayer : public Replayer{
+public:
+    ~ArenaReplayer(){
+        for (size_t i = 0; i < arenas.size(); i++) dropOwner((ub4)i);
+    }
+
+    void newOwner(ub4 owner, ub4 chunkCapacity, ub4 userBuffer) override {
+        if (owner >= arenas.size()){
+            arenas.resize(owner + 1);
+            buffers.resize(owner + 1);
+        }
+        if (userBuffer){
+            buffers[owner].reset(new char[userBuffer]);
+            arenas[owner].user = new UserBufferArena(buffers[owner].get(), (ub2)userBuffer, chunkCapacity);
+        }else{
+            arenas[owner].plain = new Arena(chunkCapacity);
+        }
+    }
+
+    void dropOwner(ub4 owner) override {
+        delete arenas[owner].plain;
+        delete arenas[owner].user;
+        arenas[owner] = Slot();
+        buffers[owner].reset();
+    }
+
+    char* alloc(const Step& s) override {
+        auto& a = arenas[s.owner];
+        return a.plain ? a.plain->alloc(s.size) : a.user->alloc(s.size);
+    }
+
+    void free(const Step& s, char* p) override { (void)s; (void)p; }
+
+    char* extend(const Step& s) override { return alloc(s); }
+
+private:
+    struct Slot{
+        Arena*           plain = nullptr;
+        UserBufferArena* user = nullptr;
+    };
+
+    std::vector<Slot>                    arenas;
+    std::vector<std::unique_ptr<char[]>> buffers;
+};
+
+class BuddyReplayer : public Replayer{
+public:
+    explicit BuddyReplayer(ub4 pages) : buddy(pages){}
+
+    char* alloc(const Step& s) override {
+        char* p = s.pages ? buddy.allocPages(s.size) : buddy.alloc(s.size);
+        if (p) return p;
+        fallbacks++;
+        return (char*)std::malloc(s.size ? s.size : 1);
+    }
+
+    void free(const Step& s, char* p) override {
+        if (!buddy.contains(p)) std::free(p);
+        else if (s.pages) buddy.freePages(p);
+        else buddy.free(p);
+    }
+
+private:
+    BuddySystem buddy;
+};
+
+class SlabReplayer : public Replayer{
+public:
+    static const ub4 kMinShift = 4;
+    static const ub4 kMaxShift = 12;
+
+    SlabReplayer(){
+        for (ub4 shift = kMinShift; shift <= kMaxShift; shift++) slabs.emplace_back(new Slab(1u << shift));
+    }
+
+    char* alloc(const Step& s) override {
+        if (s.size > (1u << kMaxShift)){
+            fallbacks++;
+            return (char*)std::malloc(s.size);
+        }
+        return slabs[classOf(s.size)]->alloc();
+    }
+
+    void free(const Step& s, char* p) override {
+        if (s.size > (1u << kMaxShift)) std::free(p);
+        else slabs[classOf(s.size)]->free(p);
+    }
+
+private:
+    static ub4 classOf(ub4 size){
+        ub4 shift = kMinShift;
+        while ((1u << shift) < size) shift++;
+        return shift - kMinShift;
+    }
+
+    std::vector<std::unique_ptr<Slab>> slabs;
+};
+
+static std::unique_ptr<Replayer> makeReplayer(const std::string& name, const Options& opt){
+    if (name == "malloc") return std::unique_ptr<Replayer>(new MallocReplayer);
+    if (name == "arena") return std::unique_ptr<Replayer>(new ArenaReplayer);
+    if (name == "buddy") return std::unique_ptr<Replayer>(new BuddyReplayer(opt.buddyPages));
+    return std::unique_ptr<Replayer>(new SlabReplayer);
+}
+
+// 新分配的内存每页写一个字节，让RSS反映分配器实际用到的页。
+static inline void touch(char* p, ub4 size){
+    for (ub4 off = 0; off < size; off += kPageSize) p[off] = 1;
+    if (size) p[size - 1] = 1;
+}
+
+static void run(const std::string& name, const Program& prog, const Options& opt){
+    int statm = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    std::vector<char*> objects(prog.objects, nullptr);
+    auto replayer = makeReplayer(name, opt);
+    ub8 baseline = residentBytes(statm), peak = 0, failed = 0;
+    ub8 start = (ub8)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    for (size_t i = 0; i < prog.steps.size(); i++){
+        const Step& s = prog.steps[i];
+        switch (s.op){
+        case kNewOwner:
+            replayer->newOwner(s.owner, s.size, s.extra);
+            break;
+        case kDropOwner:
+            replayer->dropOwner(s.owner);
+            break;
+        case kAlloc:{
+            char* p = replayer->alloc(s);
+            if (!p) failed++;
+            else if (opt.touch) touch(p, s.size);
+            objects[s.object] = p;
+            break;
+        }
+        case kFree:
+            if (objects[s.object]) replayer->free(s, objects[s.object]);
+            objects[s.object] = nullptr;
+            break;
+        case kExtend:
+            if (char* p = replayer->extend(s)){
+                if (opt.touch) touch(p, s.size);
+            }
+            break;
+        }
+        if (i % kRssInterval == 0) peak = std::max(peak, residentBytes(statm));
+    }
+    peak = std::max(peak, residentBytes(statm));
+    ub8 elapsed = (ub8)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() - start;
+    ub8 rss = peak > baseline ? peak - baseline : 0;
+    double nsPerOp = prog.steps.empty() ? 0 : (double)elapsed / prog.steps.size();
+    std::printf("{\"trace\":\"%s\",\"allocator\":\"%s\",\"steps\":%llu,\"ns_per_op\":%.3f,\"mops\":%.3f,"
+        "\"peak_rss_mb\":%.2f,\"peak_live_mb\":%.2f,\"fragmentation\":%.3f,\"failed\":%llu,\"fallback\":%llu}\n",
+        opt.path.c_str(), name.c_str(), (unsigned long long)prog.steps.size(), nsPerOp,
+        nsPerOp > 0 ? 1e3 / nsPerOp : 0, rss / 1048576.0, prog.peakLive / 1048576.0,
+        prog.peakLive ? (double)rss / prog.peakLive : 0, (unsigned long long)failed,
+        (unsigned long long)replayer->fallbacks);
+    std::fflush(stdout);
+    ::close(statm);
+}
+
+int main(int argc, char** argv){
+    Options opt;
+    Program prog;
+    try{
+        opt = parse(argc, argv);
+        auto events = AllocTrace::load(opt.path);
+        prog = compile(events);
+    }catch(const std::exception& e){
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::fprintf(stderr, "%s: %llu steps, %u owners, %u objects, %llu failed allocs and %llu unmatched frees skipped\n",
+        opt.path.c_str(), (unsigned long long)prog.steps.size(), prog.owners, prog.objects,
+        (unsigned long long)prog.failedAllocs, (unsigned long long)prog.unmatchedFrees);
+    // 载入与编译时的临时内存还给系统，否则子进程里的malloc会先用这些已驻留的页，RSS偏低
+    malloc_trim(0);
+    int status = 0;
+    for (auto& name : opt.allocators){
+        std::fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0){
+            std::fprintf(stderr, "fork error\n");
+            return 1;
+        }
+        if (pid == 0){
+            try{
+                run(name, prog, opt);
+            }catch(const std::exception& e){
+                std::fprintf(stderr, "%s: %s\n", name.c_str(), e.what());
+                _exit(1);
+            }
+            _exit(0);
+        }
+        int child;
+        waitpid(pid, &child, 0);
+        if (!WIFEXITED(child) || WEXITSTATUS(child)) status = 1;
+    }
+    return status;
+}
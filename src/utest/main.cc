@@ -1,12 +1,384 @@
 #include "common.h"
 
 #include "alloc/arena.h"
+#include "alloc/buddy.h"
+#include "io/aio.h"
+#include "io/wal.h"
+#include "stream/checkpoint.h"
+#include "util/hashmap.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace wjp;
 
+static void check(bool ok, const char* what){
+    if (ok) return;
+    fprintf(stderr, "utest failed: %s\n", what);
+    exit(1);
+}
+
+struct Live{
+    ub8 offset;
+    ub4 size;
+    bool pages;
+};
+
+// 持久buddy在非正常关闭后重新打开：活着的块原样保留、不会再分出去，
+// 释放掉的空间在恢复时重新合并回大块。
+static void testBuddyRecovery(){
+    const ub4 kPages = 256;
+    std::string path = "/tmp/wjp_utest_buddy." + std::to_string(getpid());
+    unlink(path.c_str());
+
+    std::vector<Live> live;
+    {
+        BuddySystem buddy(path, kPages);
+        std::vector<Live> all;
+        for (ub4 i = 0; i < 48; i++){
+            Live b;
+            b.pages = i % 8 == 7;
+            b.size = b.pages ? (1 + i % 3) * kPageSize : 100 + i * 173;
+            char* p = b.pages ? buddy.allocPages(b.size) : buddy.alloc(b.size);
+            check(p != nullptr, "buddy: alloc before crash");
+            b.offset = buddy.toOffset(p);
+            memset(p, (int)(b.offset >> 3), b.size);
+            all.push_back(b);
+        }
+        for (ub4 i = 0; i < all.size(); i++){
+            char* p = buddy.fromOffset(all[i].offset);
+            if (i % 2 == 0) live.push_back(all[i]);
+            else if (all[i].pages) buddy.freePages(p);
+            else buddy.free(p);
+        }
+        buddy.sync();
+    }
+    // sync之后崩溃：正常析构写下的链表头作废，重开必须按块头重建
+    BuddySystem::markUnclean(path);
+
+    BuddySystem buddy(path, 0);
+    for (auto& b : live){
+        const char* p = buddy.fromOffset(b.offset);
+        bool intact = true;
+        for (ub4 j = 0; j < b.size; j++) intact &= p[j] == (char)(b.offset >> 3);
+        check(intact, "buddy: live block corrupted by recovery");
+    }
+
+    // 把剩下的空间分光，新块一个都不能压到活块上
+    std::vector<Live> fresh;
+    for (ub4 size = kPageSize * 8; size >= 32; size /= 2){
+        while (char* p = buddy.alloc(size)){
+            Live b{buddy.toOffset(p), size, false};
+            for (auto& l : live) check(b.offset + b.size <= l.offset || l.offset + l.size <= b.offset, "buddy: live block handed out again");
+            fresh.push_back(b);
+        }
+    }
+    check(!fresh.empty(), "buddy: freed space lost by recovery");
+
+    // 全部还回去之后，整个区域应当合并成一个最大阶的块
+    for (auto& b : fresh) buddy.free(buddy.fromOffset(b.offset));
+    for (auto& b : live){
+        char* p = buddy.fromOffset(b.offset);
+        if (b.pages) buddy.freePages(p);
+        else buddy.free(p);
+    }
+    check(buddy.allocPages((ub8)kPages * kPageSize) != nullptr, "buddy: freed space not merged after recovery");
+    unlink(path.c_str());
+}
+
+struct AioChain{
+    AioEngine*       io;
+    int              fd;
+    char*            buf;
+    ub4              roots;
+    ub4              issued;
+    std::vector<ub4> fired;
+    std::vector<std::pair<AioChain*, ub4>> ctx;
+};
+
+static void aioChainRead(AioChain* c);
+
+static void aioChainDone(void* ctx, sb4 result){
+    auto* r = (std::pair<AioChain*, ub4>*)ctx;
+    AioChain* c = r->first;
+    check(result == (sb4)kPageSize, "aio: read failed");
+    c->fired[r->second]++;
+    // 第一代的每个回调再提交两个：槽位刚腾出一个，第二个一定要在回调里等槽位
+    if (r->second < c->roots){
+        aioChainRead(c);
+        aioChainRead(c);
+    }
+}
+
+static void aioChainRead(AioChain* c){
+    ub4 id = c->issued++;
+    c->ctx[id] = std::make_pair(c, id);
+    c->io->read(c->fd, c->buf, kPageSize, 0, aioChainDone, &c->ctx[id]);
+}
+
+// 回调里把在途请求打满：每个请求的回调恰好执行一次，槽位全部归还。
+static void testAioCallbackSaturation(bool useUring){
+    const ub4 kDepth = 4;
+    std::string path = "/tmp/wjp_utest_aio." + std::to_string(getpid());
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    check(fd >= 0, "aio: open test file");
+    std::vector<char> page(kPageSize, 'a');
+    check(pwrite(fd, page.data(), kPageSize, 0) == kPageSize, "aio: prepare test file");
+
+    AioEngine io(kDepth, 16, useUring);
+    AioChain c;
+    c.io = &io;
+    c.fd = fd;
+    c.buf = io.allocBuffer(kPageSize);
+    c.roots = kDepth;
+    c.issued = 0;
+    c.fired.assign(kDepth * 3, 0);
+    c.ctx.resize(kDepth * 3);
+    for (ub4 i = 0; i < kDepth; i++) aioChainRead(&c);
+    io.drain();
+
+    check(c.issued == kDepth * 3, "aio: chained requests not issued");
+    for (ub4 n : c.fired) check(n == 1, "aio: callback not run exactly once");
+    check(io.inflight() == 0, "aio: slots leaked");
+    io.freeBuffer(c.buf);
+    ::close(fd);
+    unlink(path.c_str());
+}
+
+typedef Hashmap<ub8, ub8> CkptMap;
+typedef Checkpointer<CkptMap> CkptWriter;
+
+static std::map<ub8, ub8> ckptState(CkptMap& map){
+    std::map<ub8, ub8> state;
+    for (auto& e : map) state[e.key] = e.value;
+    return state;
+}
+
+static bool ckptRestoresTo(const std::string& dir, ub8 seq, const std::map<ub8, ub8>& want){
+    CkptMap restored;
+    return CkptWriter::restore(dir, restored) == seq && ckptState(restored) == want;
+}
+
+static void removeDir(const std::string& dir){
+    if (DIR* d = ::opendir(dir.c_str())){
+        while (dirent* e = ::readdir(d)){
+            if (e->d_name[0] != '.') unlink((dir + "/" + e->d_name).c_str());
+        }
+        ::closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+// 一边扫描一边改写、删除、插入（插入引发渐进式rehash），检查点恢复出来的
+// 必须恰好是begin()那一刻的状态：扫描前改写的靠写时复制的旧值，begin前删除的靠墓碑。
+static void testCheckpointRestore(){
+    std::string dir = "/tmp/wjp_utest_ckpt." + std::to_string(getpid());
+    removeDir(dir);
+    CkptMap map;
+    CkptWriter cp(map, dir);
+    ub8 next = 0;
+    for (; next < 1000; next++) map[next] = next * 7;
+
+    // 全量检查点：扫描途中改写一部分，经find改的先touch；删一部分，再插入新键
+    std::map<ub8, ub8> full = ckptState(map);
+    ub8 fullSeq = cp.begin();
+    for (ub8 round = 0; !cp.step(2); round++){
+        ub8 k = round * 37 % 1000;
+        map[k] = k + 1000000;
+        if (auto e = map.find((k + 500) % 1000)){
+            map.touch(e);
+            e->value++;
+        }
+        if (auto e = map.erase((k + 250) % 1000)) std::free(e);
+        map[next++] = 1;
+    }
+    check(cp.lastCheckpoint() == fullSeq, "checkpoint: full checkpoint not completed");
+    check(cp.lastStats().preimages > 0, "checkpoint: no pre-image written during the scan");
+    check(ckptRestoresTo(dir, fullSeq, full), "checkpoint: full restore differs from state at begin()");
+
+    // 增量链：begin前删掉又插回的键，墓碑必须先于put应用
+    for (ub8 k = 0; k < 200; k++){
+        if (auto e = map.erase(k)) std::free(e);
+        if (k % 2) map[k] = k + 2000000;
+    }
+    map[next - 1] = 42;
+    std::map<ub8, ub8> incr = ckptState(map);
+    ub8 incrSeq = cp.begin();
+    while (!cp.step(4)){
+        map[next++] = 2;
+        if (auto e = map.erase(next / 2)) std::free(e);
+        map[next / 3] = 3;
+    }
+    check(ckptRestoresTo(dir, incrSeq, incr), "checkpoint: incremental restore differs from state at begin()");
+
+    for (ub8 k = 300; k < 400; k++) map[k] = 7;
+    std::map<ub8, ub8> last = ckptState(map);
+    ub8 lastSeq = cp.begin();
+    cp.finish();
+    check(ckptRestoresTo(dir, lastSeq, last), "checkpoint: chained restore differs from state at begin()");
+
+    // 最后一个增量损坏（正文翻一个字节、尾部截断），恢复停在前一个检查点
+    char name[40];
+    std::snprintf(name, sizeof(name), "/ckpt-%016llx.dat", (unsigned long long)lastSeq);
+    std::string file = dir + name;
+    int fd = ::open(file.c_str(), O_RDWR);
+    check(fd >= 0, "checkpoint: open last checkpoint");
+    struct stat st;
+    check(!::fstat(fd, &st), "checkpoint: stat last checkpoint");
+    char byte;
+    check(pread(fd, &byte, 1, 40) == 1, "checkpoint: read last checkpoint");
+    byte ^= 0x5a;
+    check(pwrite(fd, &byte, 1, 40) == 1, "checkpoint: corrupt last checkpoint");
+    check(ckptRestoresTo(dir, incrSeq, incr), "checkpoint: crc mismatch not rejected");
+    byte ^= 0x5a;
+    check(pwrite(fd, &byte, 1, 40) == 1, "checkpoint: repair last checkpoint");
+    check(ckptRestoresTo(dir, lastSeq, last), "checkpoint: repaired checkpoint rejected");
+    check(!::ftruncate(fd, st.st_size - 4), "checkpoint: truncate last checkpoint");
+    check(ckptRestoresTo(dir, incrSeq, incr), "checkpoint: truncated footer not rejected");
+    ::close(fd);
+    removeDir(dir);
+}
+
+static const ub8 kWalSegment = 2 * kPageSize;
+static const ub8 kWalRecords = 240;
+
+static ub4 walRecordLen(ub8 lsn){ return 1 + (ub4)(lsn * 37 % 700); }
+
+static char walRecordByte(ub8 lsn, ub4 j){ return (char)(lsn * 7 + j); }
+
+// 按Wal的放置规则算出每条记录所在的段和段内区间：记录8字节对齐、不跨段。
+struct WalPlace{
+    ub8 segment;
+    ub8 begin, end;
+};
+
+static std::vector<WalPlace> walLayout(){
+    std::vector<WalPlace> layout(kWalRecords + 1);
+    ub8 segment = 0, offset = 0;
+    for (ub8 lsn = 1; lsn <= kWalRecords; lsn++){
+        ub8 size = ALIGN(Wal::kHeaderSize + walRecordLen(lsn));
+        if (offset + size > kWalSegment){
+            segment++;
+            offset = 0;
+        }
+        layout[lsn] = WalPlace{segment, offset, offset + size};
+        offset += size;
+    }
+    return layout;
+}
+
+static std::string walSegmentPath(const std::string& dir, ub8 segment){
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.wal", (unsigned long long)segment);
+    return dir + name;
+}
+
+// 分批写满kWalRecords条并逐批等持久化，正常关闭。
+static void walWrite(const std::string& dir){
+    removeDir(dir);
+    WalOptions options;
+    options.segmentSize = kWalSegment;
+    Wal wal(dir, options);
+    std::vector<char> data;
+    for (ub8 lsn = 1; lsn <= kWalRecords; lsn++){
+        data.resize(walRecordLen(lsn));
+        for (ub4 j = 0; j < data.size(); j++) data[j] = walRecordByte(lsn, j);
+        check(wal.append(data.data(), (ub4)data.size()) == lsn, "wal: unexpected lsn");
+        if (lsn % 16 == 0) wal.waitDurable(lsn);
+    }
+}
+
+// 重新打开，重放出来的必须恰好是LSN 1..expect且内容完好；之后接着写的记录LSN连续并能再次恢复。
+static void walExpect(const std::string& dir, ub8 expect, const char* what){
+    WalOptions options;
+    options.segmentSize = kWalSegment;
+    ub8 replayed = 0;
+    bool intact = true;
+    {
+        Wal wal(dir, options, [&](ub8 lsn, const char* data, ub4 len){
+            intact &= lsn == replayed + 1 && len == walRecordLen(lsn);
+            for (ub4 j = 0; intact && j < len; j++) intact &= data[j] == walRecordByte(lsn, j);
+            replayed = lsn;
+        });
+        check(intact && replayed == expect, what);
+        check(wal.appendDurable("tail", 4) == expect + 1, "wal: append after recovery does not continue the lsn");
+    }
+    ub8 last = 0;
+    Wal wal(dir, options, [&](ub8 lsn, const char*, ub4){ last = lsn; });
+    check(last == expect + 1, "wal: record appended after recovery lost");
+}
+
+static void walTruncate(const std::string& path, ub8 size){
+    check(!::truncate(path.c_str(), (off_t)size), "wal: truncate segment");
+}
+
+static void walFlip(const std::string& path, ub8 offset){
+    int fd = ::open(path.c_str(), O_RDWR);
+    char byte;
+    check(fd >= 0 && pread(fd, &byte, 1, (off_t)offset) == 1, "wal: read segment");
+    byte ^= 0x20;
+    check(pwrite(fd, &byte, 1, (off_t)offset) == 1, "wal: corrupt segment");
+    ::close(fd);
+}
+
+// 崩溃后的各种尾部：撕裂的记录头、写了一半的载荷、段中间的crc错、预分配留下的全零尾部。
+// 每种情形都只能恢复出损坏点之前的已提交前缀，更晚的段整体作废。
+static void testWalRecovery(){
+    std::string dir = "/tmp/wjp_utest_wal." + std::to_string(getpid());
+    auto layout = walLayout();
+    const WalPlace& last = layout[kWalRecords];
+    std::string lastPath = walSegmentPath(dir, last.segment);
+    ub8 mid = kWalRecords;
+    while (layout[mid - 1].segment == last.segment) mid--;
+    mid += (kWalRecords - mid) / 2; // 最后一段中间的一条
+
+    walWrite(dir);
+    walExpect(dir, kWalRecords, "wal: clean reopen over a preallocated zero tail");
+
+    walWrite(dir);
+    walTruncate(lastPath, last.end);
+    walExpect(dir, kWalRecords, "wal: segment ending exactly at the last record");
+
+    const ub8 cuts[] = {1, 7, Wal::kHeaderSize, Wal::kHeaderSize + 1};
+    for (ub8 cut : cuts){
+        walWrite(dir);
+        walTruncate(lastPath, last.begin + cut);
+        walExpect(dir, kWalRecords - 1, "wal: torn tail record not dropped");
+    }
+    walWrite(dir);
+    walTruncate(lastPath, last.end - 1);
+    walExpect(dir, kWalRecords - 1, "wal: partial tail payload not dropped");
+
+    walWrite(dir);
+    walFlip(lastPath, layout[mid].begin + Wal::kHeaderSize);
+    walExpect(dir, mid - 1, "wal: crc mismatch mid-segment not treated as the tail");
+
+    // 前面某段出错，其后所有段都要丢弃
+    walWrite(dir);
+    walFlip(walSegmentPath(dir, layout[40].segment), layout[40].begin + Wal::kHeaderSize);
+    walExpect(dir, 39, "wal: segments after a corrupt one not discarded");
+
+    // 崩溃时段已fallocate但记录没写到：尾部是全零
+    walWrite(dir);
+    walTruncate(lastPath, layout[mid].begin);
+    walTruncate(lastPath, kWalSegment);
+    walExpect(dir, mid - 1, "wal: zero tail after a crash not treated as the end");
+    removeDir(dir);
+}
+
 int main(){
     UserBufferArena arena;
     arena.alloc(1000);
 
+    testBuddyRecovery();
+    testAioCallbackSaturation(true);
+    testAioCallbackSaturation(false);
+    testCheckpointRestore();
+    testWalRecovery();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "common.h"
+#include "util/hashmap.h"
+
+#include <cmath>
+
+namespace wjp{
+
+// 分块布隆过滤器：每个key的全部k个位都落在同一个64字节块（一个cache line）内，
+// 一次查询只碰一个cache line；块内测试先拼出8个字的掩码再整体比较，编译器可向量化。
+// 块号与块内位置都由一次哈希（默认siphash）的64位结果派生：
+// 高32位定块，低32位与再乘一次得到的h2做双重哈希 g_i = h1 + i * h2 定位。
+template < typename Hash = SipHash >
+class BloomFilter{
+public:
+    static const ub4 kBlockBits = 512;
+    static const ub4 kBlockWords = kBlockBits / 64;
+    static const ub4 kMaxHashes = 16;
+
+    // 按预计元素数和目标误判率定尺寸。分块会使误判率略高于经典布隆，
+    // 这里多给约20%的位作补偿。
+    BloomFilter(ub8 expectedKeys, double targetFpr){
+        if (!(targetFpr > 0 && targetFpr < 1)) throw std::invalid_argument("fpr must be in (0, 1)");
+        if (!expectedKeys) expectedKeys = 1;
+        double bitsPerKey = -std::log(targetFpr) / (std::log(2.0) * std::log(2.0)) * 1.2;
+        k = (ub4)std::lround(bitsPerKey / 1.2 * std::log(2.0));
+        if (k < 1) k = 1;
+        if (k > kMaxHashes) k = kMaxHashes;
+        ub8 n = (ub8)std::ceil(expectedKeys * bitsPerKey / kBlockBits);
+        init(n ? n : 1);
+    }
+
+    ~BloomFilter(){
+        std::free(blocks);
+    }
+
+    BloomFilter(BloomFilter&& rhs) : blocks(rhs.blocks), nrblocks(rhs.nrblocks), k(rhs.k){
+        rhs.blocks = nullptr;
+        rhs.nrblocks = 0;
+    }
+
+    inline ub8 hash(const void* data, ub4 len){ return hasher((const ub1*)data, len); }
+
+    void add(const void* data, ub4 len){ addHash(hash(data, len)); }
+
+    bool contains(const void* data, ub4 len){ return containsHash(hash(data, len)); }
+
+    void addHash(ub8 h){
+        ub8* block = blockOf(h);
+        ub8 mask[kBlockWords];
+        makeMask(h, mask);
+        for (ub4 w = 0; w < kBlockWords; w++) block[w] |= mask[w];
+    }
+
+    bool containsHash(ub8 h) const {
+        const ub8* block = blockOf(h);
+        ub8 mask[kBlockWords];
+        makeMask(h, mask);
+        ub8 miss = 0;
+        for (ub4 w = 0; w < kBlockWords; w++) miss |= mask[w] & ~block[w];
+        return miss == 0;
+    }
+
+    // 批量查询：先把所有块预取，再逐个测试，访存延迟互相重叠。
+    void containsBatch(const ub8* hashes, ub4 n, bool* out) const {
+        static const ub4 kLookahead = 16;
+        for (ub4 i = 0; i < n && i < kLookahead; i++) __builtin_prefetch(blockOf(hashes[i]));
+        for (ub4 i = 0; i < n; i++){
+            if (i + kLookahead < n) __builtin_prefetch(blockOf(hashes[i + kLookahead]));
+            out[i] = containsHash(hashes[i]);
+        }
+    }
+
+    void addBatch(const ub8* hashes, ub4 n){
+        for (ub4 i = 0; i < n; i++) addHash(hashes[i]);
+    }
+
+    ub8 memoryUsage() const { return nrblocks * kBlockBits / 8; }
+
+    ub4 nrhashes() const { return k; }
+
+    // 序列化格式：magic、k、块数，随后为原始块数据（主机字节序）。
+    std::vector<char> serialize() const {
+        Header header{kMagic, k, nrblocks};
+        std::vector<char> out(sizeof(header) + memoryUsage());
+        std::memcpy(out.data(), &header, sizeof(header));
+        std::memcpy(out.data() + sizeof(header), blocks, memoryUsage());
+        return out;
+    }
+
+    static BloomFilter deserialize(const char* data, size_t len){
+        Header header;
+        if (len < sizeof(header)) throw std::runtime_error("bloom filter: truncated header");
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != kMagic || !header.nrblocks || !header.k || header.k > kMaxHashes)
+            throw std::runtime_error("bloom filter: bad header");
+        BloomFilter filter(Raw(), header.nrblocks, header.k);
+        if (len != sizeof(header) + filter.memoryUsage()) throw std::runtime_error("bloom filter: bad length");
+        std::memcpy(filter.blocks, data + sizeof(header), filter.memoryUsage());
+        return filter;
+    }
+
+private:
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    struct Raw{};
+
+    BloomFilter(Raw, ub8 nrblocks, ub4 k) : k(k){ init(nrblocks); }
+
+    struct Header{
+        ub4 magic;
+        ub4 k;
+        ub8 nrblocks;
+    };
+
+    static const ub4 kMagic = 0x424c4d31; // "BLM1"
+
+    void init(ub8 n){
+        nrblocks = n;
+        blocks = (ub8*) malloc64(memoryUsage());
+        if (!blocks) throw std::runtime_error("malloc64 error");
+        std::memset(blocks, 0, memoryUsage());
+    }
+
+    // 用高32位把哈希均匀映射到[0, nrblocks)，免去取模。
+    inline ub8* blockOf(ub8 h) const {
+        return blocks + ((h >> 32) * nrblocks >> 32) * kBlockWords;
+    }
+
+    inline void makeMask(ub8 h, ub8* mask) const {
+        for (ub4 w = 0; w < kBlockWords; w++) mask[w] = 0;
+        ub4 h1 = (ub4)h;
+        ub4 h2 = (ub4)((h * UB8(0x9e3779b9, 0x7f4a7c15)) >> 32) | 1;
+        for (ub4 i = 0; i < k; i++){
+            ub4 bit = (h1 + i * h2) & (kBlockBits - 1);
+            mask[bit >> 6] |= (ub8)1 << (bit & 63);
+        }
+    }
+
+    ub8* blocks = nullptr;
+    ub8  nrblocks = 0;
+    ub4  k;
+    Hash hasher;
+};
+
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/slab.h"
+
+#include <type_traits>
+
+namespace wjp{
+
+// 内存B+树，键为ub8，支持点查、有序遍历与范围查询。
+// 1. 节点256字节（4个cache line），从Slab里按cache line对齐分配；键数组放在节点开头，
+//    节点内查找只碰键所在的两个cache line，用cpuKernels().countLess64整段比较计数，
+//    AVX2下每次比较4个键，没有分支。
+// 2. 内部节点keys[i]是children[i]子树的最大键，查找key时走第一个keys[i] >= key的孩子，
+//    即小于key的分隔键个数，正好就是countLess64的结果。
+// 3. 叶子按键序串成单链表，迭代器沿链表前进。
+// 4. 顺序插入（总插在最右叶子末尾）时分裂不对半，左叶子保持满，顺序建树的填充率接近100%；
+//    已有有序数据时用bulkLoad，自底向上直接建满，比逐个插入快得多。
+// 5. erase只从叶子里删除，不合并节点；删空的叶子留在树里，遍历时跳过。
+// Value须可平凡复制。非线程安全。
+template < typename Value >
+class BTree{
+    static_assert(std::is_trivially_copyable<Value>::value, "BTree value must be trivially copyable");
+
+public:
+    static const ub4 kNodeBytes = 4 * kCacheLineSize;
+    static const ub4 kInnerKeys = (kNodeBytes - 8) / 16;                 // 15个分隔键，16个孩子
+    static const ub4 kLeafKeys  = (kNodeBytes - 16) / (8 + sizeof(Value)) >= 4 ?
+                                  (kNodeBytes - 16) / (8 + sizeof(Value)) : 4;
+    static const ub4 kMaxHeight = 16;
+
+private:
+    struct Leaf;
+
+public:
+    BTree() : leafSlab(sizeof(Leaf)), innerSlab(sizeof(Inner)), kernels(cpuKernels()){}
+
+    // 已存在时不覆盖，返回false。
+    bool insert(ub8 key, const Value& value){
+        if (!root){
+            first = newLeaf();
+            root = first;
+        }
+        Inner* path[kMaxHeight];
+        ub4 slots[kMaxHeight];
+        Leaf* leaf = descend(key, path, slots);
+        ub4 pos = kernels.countLess64(leaf->keys, leaf->count, key);
+        if (pos < leaf->count && leaf->keys[pos] == key) return false;
+        count++;
+        if (leaf->count < kLeafKeys){
+            insertAt(leaf, pos, key, value);
+            return true;
+        }
+
+        // 叶子已满：分裂，左边的最大键作为分隔键交给父节点
+        Leaf* right = newLeaf();
+        ub4 mid = (pos == leaf->count && !leaf->next) ? leaf->count : leaf->count / 2;
+        right->count = leaf->count - mid;
+        std::memcpy(right->keys, leaf->keys + mid, right->count * sizeof(ub8));
+        std::memcpy((void*)right->values, (const void*)(leaf->values + mid), right->count * sizeof(Value));
+        leaf->count = mid;
+        right->next = leaf->next;
+        leaf->next = right;
+        if (pos <= mid && mid < kLeafKeys) insertAt(leaf, pos, key, value);
+        else insertAt(right, pos - mid, key, value);
+        insertSeparator(path, slots, leaf->keys[leaf->count - 1], right);
+        return true;
+    }
+
+    // 不存在时返回nullptr；返回的指针在下一次修改前有效。
+    Value* find(ub8 key){
+        if (!root) return nullptr;
+        Leaf* leaf = descend(key, nullptr, nullptr);
+        ub4 pos = kernels.countLess64(leaf->keys, leaf->count, key);
+        return pos < leaf->count && leaf->keys[pos] == key ? &leaf->values[pos] : nullptr;
+    }
+
+    bool erase(ub8 key){
+        if (!root) return false;
+        Leaf* leaf = descend(key, nullptr, nullptr);
+        ub4 pos = kernels.countLess64(leaf->keys, leaf->count, key);
+        if (pos >= leaf->count || leaf->keys[pos] != key) return false;
+        ub4 tail = leaf->count - pos - 1;
+        std::memmove(leaf->keys + pos, leaf->keys + pos + 1, tail * sizeof(ub8));
+        std::memmove((void*)(leaf->values + pos), (const void*)(leaf->values + pos + 1), tail * sizeof(Value));
+        leaf->count--;
+        count--;
+        return true;
+    }
+
+    // 从严格升序的数据整体建树，只能用于空树。leafFill为每个叶子的目标键数，
+    // 之后还要大量插入的可以留些空位，免得一插就分裂。
+    void bulkLoad(const ub8* keys, const Value* values, ub8 n, ub4 leafFill = kLeafKeys){
+        if (root) throw std::runtime_error("btree: bulkLoad on non-empty tree");
+        if (!n) return;
+        if (leafFill < 2 || leafFill > kLeafKeys) leafFill = kLeafKeys;
+        for (ub8 i = 1; i < n; i++){
+            if (keys[i - 1] >= keys[i]) throw std::invalid_argument("btree: bulkLoad input not strictly ascending");
+        }
+
+        // 叶子层：节点数向上取整后均分，避免最后一个节点过空
+        std::vector<std::pair<void*, ub8>> level; // (节点, 子树最大键)
+        ub8 nodes = (n + leafFill - 1) / leafFill;
+        Leaf* prev = nullptr;
+        for (ub8 i = 0, begin = 0; i < nodes; i++){
+            ub8 end = n * (i + 1) / nodes;
+            Leaf* leaf = newLeaf();
+            leaf->count = (ub4)(end - begin);
+            std::memcpy(leaf->keys, keys + begin, leaf->count * sizeof(ub8));
+            std::memcpy((void*)leaf->values, (const void*)(values + begin), leaf->count * sizeof(Value));
+            if (prev) prev->next = leaf;
+            else first = leaf;
+            prev = leaf;
+            level.push_back(std::make_pair((void*)leaf, keys[end - 1]));
+            begin = end;
+        }
+
+        // 内部层：同样均分，每个节点至少两个孩子
+        while (level.size() > 1){
+            if (height + 1 >= kMaxHeight) throw std::runtime_error("btree: too high");
+            std::vector<std::pair<void*, ub8>> upper;
+            ub8 m = level.size();
+            nodes = (m + kInnerKeys) / (kInnerKeys + 1);
+            for (ub8 i = 0, begin = 0; i < nodes; i++){
+                ub8 end = m * (i + 1) / nodes;
+                Inner* inner = newInner();
+                inner->count = (ub4)(end - begin - 1);
+                for (ub8 j = begin; j < end; j++){
+                    inner->children[j - begin] = level[j].first;
+                    if (j + 1 < end) inner->keys[j - begin] = level[j].second;
+                }
+                upper.push_back(std::make_pair((void*)inner, level[end - 1].second));
+                begin = end;
+            }
+            level.swap(upper);
+            height++;
+        }
+        root = level[0].first;
+        count = n;
+    }
+
+    ub8 size() const { return count; }
+
+    // 内部节点的层数，只有一个叶子时为0。
+    ub4 depth() const { return height; }
+
+    class Iterator{
+    public:
+        Iterator(Leaf* leaf, ub4 pos) : leaf(leaf), pos(pos){ skipEmpty(); }
+
+        bool valid() const { return leaf != nullptr; }
+
+        ub8 key() const { return leaf->keys[pos]; }
+
+        Value& value() const { return leaf->values[pos]; }
+
+        void next(){
+            pos++;
+            skipEmpty();
+        }
+
+    private:
+        inline void skipEmpty(){
+            while (leaf && pos >= leaf->count){
+                leaf = leaf->next;
+                pos = 0;
+            }
+        }
+
+        Leaf* leaf;
+        ub4   pos;
+    };
+
+    Iterator begin(){ return Iterator(first, 0); }
+
+    // 第一个不小于key的位置。
+    Iterator lowerBound(ub8 key){
+        if (!root) return Iterator(nullptr, 0);
+        Leaf* leaf = descend(key, nullptr, nullptr);
+        return Iterator(leaf, kernels.countLess64(leaf->keys, leaf->count, key));
+    }
+
+    // 依次对[lo, hi)内的键调用fn(key, value)，返回访问的个数。
+    template < typename Fn >
+    ub8 range(ub8 lo, ub8 hi, Fn&& fn){
+        ub8 n = 0;
+        for (Iterator it = lowerBound(lo); it.valid() && it.key() < hi; it.next(), n++) fn(it.key(), it.value());
+        return n;
+    }
+
+private:
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    struct Inner{
+        ub4   count;               // 分隔键个数，孩子数为count + 1
+        ub4   pad;
+        ub8   keys[kInnerKeys];
+        void* children[kInnerKeys + 1];
+    };
+
+    struct Leaf{
+        ub4   count;
+        ub4   pad;
+        Leaf* next;
+        ub8   keys[kLeafKeys];
+        Value values[kLeafKeys];
+    };
+
+    Leaf* newLeaf(){
+        Leaf* leaf = (Leaf*)leafSlab.alloc();
+        if (!leaf) throw std::runtime_error("btree: slab alloc error");
+        leaf->count = 0;
+        leaf->next = nullptr;
+        return leaf;
+    }
+
+    Inner* newInner(){
+        Inner* inner = (Inner*)innerSlab.alloc();
+        if (!inner) throw std::runtime_error("btree: slab alloc error");
+        inner->count = 0;
+        return inner;
+    }
+
+    // 自根向下找到key所在叶子；path非空时记下沿途的内部节点和走的孩子下标，供分裂回溯。
+    Leaf* descend(ub8 key, Inner** path, ub4* slots){
+        void* node = root;
+        for (ub4 h = 0; h < height; h++){
+            Inner* inner = (Inner*)node;
+            ub4 i = kernels.countLess64(inner->keys, inner->count, key);
+            if (path){
+                path[h] = inner;
+                slots[h] = i;
+            }
+            node = inner->children[i];
+        }
+        return (Leaf*)node;
+    }
+
+    static inline void insertAt(Leaf* leaf, ub4 pos, ub8 key, const Value& value){
+        ub4 tail = leaf->count - pos;
+        std::memmove(leaf->keys + pos + 1, leaf->keys + pos, tail * sizeof(ub8));
+        std::memmove((void*)(leaf->values + pos + 1), (const void*)(leaf->values + pos), tail * sizeof(Value));
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        leaf->count++;
+    }
+
+    // 第h层孩子slots[h]分裂出右兄弟right，分隔键sep插在它后面；父节点满了继续向上分裂。
+    void insertSeparator(Inner** path, ub4* slots, ub8 sep, void* right){
+        for (sb4 h = (sb4)height - 1; h >= 0; h--){
+            Inner* inner = path[h];
+            ub4 i = slots[h];
+            if (inner->count < kInnerKeys){
+                std::memmove(inner->keys + i + 1, inner->keys + i, (inner->count - i) * sizeof(ub8));
+                std::memmove(inner->children + i + 2, inner->children + i + 1, (inner->count - i) * sizeof(void*));
+                inner->keys[i] = sep;
+                inner->children[i + 1] = right;
+                inner->count++;
+                return;
+            }
+            // 满节点：先在临时数组里插好，再对半分，中间的键上提
+            ub8 keys[kInnerKeys + 1];
+            void* children[kInnerKeys + 2];
+            std::memcpy(keys, inner->keys, i * sizeof(ub8));
+            keys[i] = sep;
+            std::memcpy(keys + i + 1, inner->keys + i, (kInnerKeys - i) * sizeof(ub8));
+            std::memcpy(children, inner->children, (i + 1) * sizeof(void*));
+            children[i + 1] = right;
+            std::memcpy(children + i + 2, inner->children + i + 1, (kInnerKeys - i) * sizeof(void*));
+
+            ub4 mid = (kInnerKeys + 1) / 2;
+            Inner* sibling = newInner();
+            inner->count = mid;
+            std::memcpy(inner->keys, keys, mid * sizeof(ub8));
+            std::memcpy(inner->children, children, (mid + 1) * sizeof(void*));
+            sibling->count = kInnerKeys - mid;
+            std::memcpy(sibling->keys, keys + mid + 1, sibling->count * sizeof(ub8));
+            std::memcpy(sibling->children, children + mid + 1, (sibling->count + 1) * sizeof(void*));
+            sep = keys[mid];
+            right = sibling;
+        }
+        // 根分裂，树长高一层
+        if (height + 1 >= kMaxHeight) throw std::runtime_error("btree: too high");
+        Inner* newRoot = newInner();
+        newRoot->count = 1;
+        newRoot->keys[0] = sep;
+        newRoot->children[0] = root;
+        newRoot->children[1] = right;
+        root = newRoot;
+        height++;
+    }
+
+    Slab               leafSlab;
+    Slab               innerSlab;
+    const CpuKernels&  kernels;
+    void*              root = nullptr;
+    Leaf*              first = nullptr;
+    ub4                height = 0;
+    ub8                count = 0;
+};
+
+}
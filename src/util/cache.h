@@ -0,0 +1,395 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/slab.h"
+#include "util/hashmap.h"
+
+#include <algorithm>
+
+namespace wjp{
+
+// 有字节预算的并发缓存，S3-FIFO淘汰：
+// 1. 新键进小队列（约占预算的10%），命中只把entry的2位频次加一，不挪动任何节点。
+// 2. 小队列出队时，期间被访问过的升入主队列，否则淘汰，并在幽灵表里留下哈希标签；
+//    幽灵表命中的键再次插入时直接进主队列。一次性访问的键因此很快被挤出，不污染主队列。
+// 3. 主队列就是CLOCK：出队时频次非0则减一重新入队，为0才淘汰。
+// 4. 按哈希高位分成2^shardBits个分片，每片一把锁、一个Slab、一套队列和索引，预算平分。
+// 每个entry计入charge + sizeof(Entry)字节。K须是POD，按字节哈希、用==比较，与Hashmap一致。
+// 值在锁内拷出，大对象请存指针或用visit。
+template < typename K, typename V, typename Hash = SipHash >
+class S3FifoCache{
+private:
+    struct Entry{
+        Entry* next;    // 索引桶内链表
+        ub8    hash;
+        ub4    charge;
+        ub1    freq;    // 0..3
+        ub1    inMain;
+        ub1    dead;    // 已erase，等队列走到它或整理队列时再回收
+        K      key;
+        V      value;
+    };
+
+public:
+    static const ub1 kMaxFreq = 3;
+    static const ub4 kSmallPercent = 10;
+    static const ub4 kDeadSlack = 64;
+
+    struct Stats{
+        ub8 hits = 0;
+        ub8 misses = 0;
+        ub8 inserts = 0;
+        ub8 evictions = 0;
+        ub8 entries = 0;
+        ub8 usage = 0;   // 已计费字节
+    };
+
+    explicit S3FifoCache(ub8 capacityBytes, ub4 shardBits = 4) : shardBits(shardBits){
+        if (shardBits > 8) throw std::invalid_argument("cache: too many shards");
+        ub4 n = 1u << shardBits;
+        shards = (Shard*) malloc64(sizeof(Shard) * n);
+        if (!shards) throw std::runtime_error("malloc64 error");
+        for (ub4 i = 0; i < n; i++) new(&shards[i]) Shard(capacityBytes / n);
+    }
+
+    ~S3FifoCache(){
+        for (ub4 i = 0; i < (1u << shardBits); i++) shards[i].~Shard();
+        std::free(shards);
+    }
+
+    // 插入或覆盖。单个entry超过分片预算时不缓存，返回false。
+    bool put(const K& key, const V& value, ub4 charge = 0){
+        ub8 h = hasher((const ub1*)&key, sizeof(K));
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> guard(s.lock);
+        return s.insert(key, value, charge, h);
+    }
+
+    bool get(const K& key, V* value){
+        return visit(key, [value](const V& v){ if (value) *value = v; });
+    }
+
+    // 命中时在分片锁内调用fn(const V&)，省去拷贝；fn里不要再访问本缓存。
+    template < typename Fn >
+    bool visit(const K& key, Fn fn){
+        ub8 h = hasher((const ub1*)&key, sizeof(K));
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> guard(s.lock);
+        Entry* e = s.find(key, h);
+        if (!e){
+            s.stats.misses++;
+            return false;
+        }
+        if (e->freq < kMaxFreq) e->freq++;
+        s.stats.hits++;
+        fn((const V&)e->value);
+        return true;
+    }
+
+    bool contains(const K& key){
+        ub8 h = hasher((const ub1*)&key, sizeof(K));
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> guard(s.lock);
+        return s.find(key, h) != nullptr;
+    }
+
+    bool erase(const K& key){
+        ub8 h = hasher((const ub1*)&key, sizeof(K));
+        Shard& s = shardOf(h);
+        std::lock_guard<std::mutex> guard(s.lock);
+        return s.erase(key, h);
+    }
+
+    // 各分片计数之和。
+    Stats stats(){
+        Stats total;
+        for (ub4 i = 0; i < (1u << shardBits); i++){
+            std::lock_guard<std::mutex> guard(shards[i].lock);
+            const Stats& st = shards[i].stats;
+            total.hits += st.hits;
+            total.misses += st.misses;
+            total.inserts += st.inserts;
+            total.evictions += st.evictions;
+            total.entries += shards[i].entries;
+            total.usage += shards[i].usage;
+        }
+        return total;
+    }
+
+    ub8 capacity() const { return shards[0].capacity << shardBits; }
+
+    static ub4 entryOverhead(){ return sizeof(Entry); }
+
+private:
+    S3FifoCache(const S3FifoCache&) = delete;
+    S3FifoCache& operator=(const S3FifoCache&) = delete;
+
+    // 按需翻倍的Entry*环形队列。
+    struct Fifo{
+        ~Fifo(){ std::free(slots); }
+
+        void push(Entry* e){
+            if (tail - head == cap) grow();
+            slots[tail++ & (cap - 1)] = e;
+        }
+
+        Entry* pop(){ return slots[head++ & (cap - 1)]; }
+
+        bool empty() const { return head == tail; }
+
+        // 原地剔除dead的entry并交给fn回收，保持其余entry的先后顺序。
+        template < typename Fn >
+        void purge(Fn fn){
+            ub8 out = head;
+            for (ub8 i = head; i < tail; i++){
+                Entry* e = slots[i & (cap - 1)];
+                if (e->dead) fn(e);
+                else slots[out++ & (cap - 1)] = e;
+            }
+            tail = out;
+        }
+
+        void grow(){
+            ub8 ncap = cap ? cap * 2 : 64;
+            auto n = (Entry**) malloc64(sizeof(Entry*) * ncap);
+            if (!n) throw std::runtime_error("malloc64 error");
+            for (ub8 i = head; i < tail; i++) n[i - head] = slots[i & (cap - 1)];
+            std::free(slots);
+            slots = n;
+            tail -= head;
+            head = 0;
+            cap = ncap;
+        }
+
+        Entry** slots = nullptr;
+        ub8     cap = 0;
+        ub8     head = 0;
+        ub8     tail = 0;
+    };
+
+    struct alignas(kCacheLineSize) Shard{
+        explicit Shard(ub8 capacity) : capacity(capacity), slab(sizeof(Entry)){
+            initBuckets(64);
+            initGhost(64);
+        }
+
+        ~Shard(){
+            while (!small.empty()) release(small.pop());
+            while (!main.empty()) release(main.pop());
+            std::free(buckets);
+            std::free(ghost);
+        }
+
+        Entry* find(const K& key, ub8 h){
+            for (Entry* e = buckets[h & bucketMask]; e; e = e->next){
+                if (e->hash == h && e->key == key) return e;
+            }
+            return nullptr;
+        }
+
+        bool insert(const K& key, const V& value, ub4 charge, ub8 h){
+            ub8 bytes = (ub8)charge + sizeof(Entry);
+            if (bytes > capacity) return false;
+            if (Entry* old = find(key, h)){
+                // 原地覆盖，保留频次与所在队列
+                usage += charge;
+                usage -= old->charge;
+                if (old->inMain) mainBytes = mainBytes + charge - old->charge;
+                else smallBytes = smallBytes + charge - old->charge;
+                old->charge = charge;
+                old->value = value;
+                while (usage > capacity) evict();
+                return true;
+            }
+            while (usage + bytes > capacity) evict();
+            auto e = (Entry*)slab.alloc();
+            if (!e) throw std::runtime_error("cache: slab alloc error");
+            new(&e->key) K(key);
+            new(&e->value) V(value);
+            e->hash = h;
+            e->charge = charge;
+            e->freq = 0;
+            e->dead = 0;
+            e->inMain = ghostContains(h);
+            link(e);
+            if (e->inMain){
+                main.push(e);
+                mainBytes += bytes;
+            }else{
+                small.push(e);
+                smallBytes += bytes;
+            }
+            usage += bytes;
+            stats.inserts++;
+            return true;
+        }
+
+        bool erase(const K& key, ub8 h){
+            Entry* e = find(key, h);
+            if (!e) return false;
+            kill(e);
+            return true;
+        }
+
+        // 摘出索引、退还计费并立即析构值；Entry本身留在队列里，等淘汰走到它时还给Slab。
+        // 只有put/erase交替、从不超预算时淘汰不会运行，所以dead的entry比在册的多出
+        // kDeadSlack个时整理两个队列一次性回收，Slab占用不超过在册entry数的两倍左右。
+        void kill(Entry* e){
+            unlink(e);
+            ub8 bytes = (ub8)e->charge + sizeof(Entry);
+            usage -= bytes;
+            if (e->inMain) mainBytes -= bytes;
+            else smallBytes -= bytes;
+            e->value.~V();
+            e->dead = 1;
+            if (++deadEntries > entries + kDeadSlack){
+                auto reclaim = [this](Entry* d){ release(d); };
+                small.purge(reclaim);
+                main.purge(reclaim);
+            }
+        }
+
+        void release(Entry* e){
+            if (e->dead) deadEntries--;
+            else e->value.~V();
+            e->key.~K();
+            slab.free((char*)e);
+        }
+
+        // 淘汰一个entry；小队列超过份额或主队列为空时从小队列淘汰。
+        void evict(){
+            for (;;){
+                bool fromSmall = !small.empty() && (smallBytes * 100 >= capacity * kSmallPercent || main.empty());
+                if (fromSmall){
+                    Entry* e = small.pop();
+                    if (e->dead){
+                        release(e);
+                        continue;
+                    }
+                    ub8 bytes = (ub8)e->charge + sizeof(Entry);
+                    smallBytes -= bytes;
+                    if (e->freq){
+                        e->freq = 0;
+                        e->inMain = 1;
+                        mainBytes += bytes;
+                        main.push(e);
+                        continue;
+                    }
+                    ghostAdd(e->hash);
+                    drop(e, bytes);
+                    return;
+                }
+                if (main.empty()) return;
+                Entry* e = main.pop();
+                if (e->dead){
+                    release(e);
+                    continue;
+                }
+                if (e->freq){
+                    e->freq--;
+                    main.push(e);
+                    continue;
+                }
+                ub8 bytes = (ub8)e->charge + sizeof(Entry);
+                mainBytes -= bytes;
+                drop(e, bytes);
+                return;
+            }
+        }
+
+        void drop(Entry* e, ub8 bytes){
+            unlink(e);
+            usage -= bytes;
+            release(e);
+            stats.evictions++;
+        }
+
+        void link(Entry* e){
+            if (entries + 1 > bucketMask + 1){
+                rehash((bucketMask + 1) * 2);
+                // 幽灵表跟着entry数走，记住的被淘汰键与在缓存中的键大致一样多
+                initGhost((bucketMask + 1));
+            }
+            Entry** b = &buckets[e->hash & bucketMask];
+            e->next = *b;
+            *b = e;
+            entries++;
+        }
+
+        void unlink(Entry* e){
+            Entry** p = &buckets[e->hash & bucketMask];
+            while (*p != e) p = &(*p)->next;
+            *p = e->next;
+            entries--;
+        }
+
+        void initBuckets(ub8 n){
+            buckets = (Entry**) malloc64(sizeof(Entry*) * n);
+            if (!buckets) throw std::runtime_error("malloc64 error");
+            std::memset(buckets, 0, sizeof(Entry*) * n);
+            bucketMask = n - 1;
+        }
+
+        void rehash(ub8 n){
+            Entry** old = buckets;
+            ub8 oldn = bucketMask + 1;
+            initBuckets(n);
+            for (ub8 i = 0; i < oldn; i++){
+                for (Entry* e = old[i]; e;){
+                    Entry* next = e->next;
+                    Entry** b = &buckets[e->hash & bucketMask];
+                    e->next = *b;
+                    *b = e;
+                    e = next;
+                }
+            }
+            std::free(old);
+        }
+
+        // 幽灵表直接映射：每个位置存一个哈希标签，新来的覆盖旧的，近似一个FIFO。
+        void initGhost(ub8 n){
+            auto g = (ub4*) malloc64(sizeof(ub4) * n);
+            if (!g) throw std::runtime_error("malloc64 error");
+            std::memset(g, 0, sizeof(ub4) * n);
+            std::free(ghost);
+            ghost = g;
+            ghostMask = n - 1;
+        }
+
+        static ub4 ghostTag(ub8 h){ return (ub4)(h >> 24) | 1; }
+
+        void ghostAdd(ub8 h){ ghost[h & ghostMask] = ghostTag(h); }
+
+        bool ghostContains(ub8 h){
+            ub4& g = ghost[h & ghostMask];
+            if (g != ghostTag(h)) return false;
+            g = 0;
+            return true;
+        }
+
+        std::mutex lock;
+        ub8        capacity;
+        ub8        usage = 0;
+        ub8        smallBytes = 0;
+        ub8        mainBytes = 0;
+        ub8        entries = 0;
+        ub8        deadEntries = 0;  // 已kill、尚未还给Slab的entry
+        Slab       slab;
+        Fifo       small;
+        Fifo       main;
+        Entry**    buckets = nullptr;
+        ub8        bucketMask = 0;
+        ub4*       ghost = nullptr;
+        ub8        ghostMask = 0;
+        Stats      stats;
+    };
+
+    // 分片号取哈希最高几位，与分片内按低位选桶错开。
+    inline Shard& shardOf(ub8 h){ return shards[shardBits ? h >> (64 - shardBits) : 0]; }
+
+    Hash   hasher;
+    ub4    shardBits;
+    Shard* shards;
+};
+
+}
@@ -0,0 +1,379 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+
+#include <algorithm>
+
+namespace wjp{
+
+// 整数序列的紧凑编码，落盘的序号、时间戳等大多是小差值，原样存ub8太浪费。
+// 1. zigzag：有符号数映射成无符号，绝对值小的编码也短。
+// 2. LEB128 varint：每字节7位，最高位表示后面还有，与protobuf兼容，适合零散的单个值。
+// 3. Stream VByte：控制字节（每值2位长度）与数据字节分开存放，解码不依赖逐字节的续位，
+//    可以一次pshufb摊开4个值（cpuKernels分派，SSSE3）。delta版编码单调序列的相邻差，
+//    解码时顺带前缀和还原。
+// 4. FOR（frame of reference）：每kForBlock个值一块，块内减去最小值后按相同位宽紧排，
+//    适合取值集中但不单调的序列。
+// 5. encodeSequence在上面几种里选最短的，从Arena一次分配出恰好大小的缓冲区。
+// 解码函数都做边界检查，输入截断或损坏时返回nullptr/false，不越界读。
+// 多字节值均按小端存放。
+
+inline ub8 zigzagEncode(sb8 v){ return ((ub8)v << 1) ^ (ub8)(v >> 63); }
+
+inline sb8 zigzagDecode(ub8 v){ return (sb8)(v >> 1) ^ -(sb8)(v & 1); }
+
+// ---- LEB128 ----
+
+static const ub4 kMaxVarintBytes = 10;
+
+inline ub4 varintSize(ub8 v){
+    ub4 bits = 64 - __builtin_clzll(v | 1);
+    return (bits + 6) / 7;
+}
+
+inline ub1* putVarint(ub1* dst, ub8 v){
+    while (v >= 0x80){
+        *dst++ = (ub1)(v | 0x80);
+        v >>= 7;
+    }
+    *dst++ = (ub1)v;
+    return dst;
+}
+
+// 截断、超过10字节或第10字节溢出64位时返回nullptr。
+inline const ub1* getVarint(const ub1* p, const ub1* end, ub8* v){
+    if (p < end && *p < 0x80){
+        *v = *p;
+        return p + 1;
+    }
+    ub8 result = 0;
+    for (ub4 shift = 0; shift < 64 && p < end; shift += 7){
+        ub1 b = *p++;
+        if (shift == 63 && b > 1) return nullptr;
+        result |= (ub8)(b & 0x7f) << shift;
+        if (b < 0x80){
+            *v = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+inline size_t varintsSize(const ub8* in, size_t n){
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i++) bytes += varintSize(in[i]);
+    return bytes;
+}
+
+inline ub1* putVarints(ub1* dst, const ub8* in, size_t n){
+    for (size_t i = 0; i < n; i++) dst = putVarint(dst, in[i]);
+    return dst;
+}
+
+inline const ub1* getVarints(const ub1* p, const ub1* end, ub8* out, size_t n){
+    for (size_t i = 0; i < n && p; i++) p = getVarint(p, end, &out[i]);
+    return p;
+}
+
+// ---- Stream VByte ----
+// 布局：[(n + 3) / 4个控制字节][数据字节]，控制字节最后一个的空余位为0。
+
+inline ub4 streamVByteCode(ub4 v){
+    return (31 - __builtin_clz(v | 1)) >> 3;
+}
+
+inline size_t streamVByteSize(const ub4* in, size_t n){
+    size_t bytes = (n + 3) / 4 + n;
+    for (size_t i = 0; i < n; i++) bytes += streamVByteCode(in[i]);
+    return bytes;
+}
+
+inline ub1* streamVByteEncode(const ub4* in, size_t n, ub1* out){
+    ub1* control = out;
+    ub1* data = out + (n + 3) / 4;
+    std::memset(control, 0, (n + 3) / 4);
+    for (size_t i = 0; i < n; i++){
+        ub4 code = streamVByteCode(in[i]);
+        control[i >> 2] |= (ub1)(code << (2 * (i & 3)));
+        std::memcpy(data, &in[i], code + 1);
+        data += code + 1;
+    }
+    return data;
+}
+
+// 数据区的字节数，由控制字节算出。
+inline size_t streamVByteDataSize(const ub1* control, size_t n){
+    const StreamVByteTables& t = streamVByteTables();
+    size_t bytes = 0, full = n / 4;
+    for (size_t i = 0; i < full; i++) bytes += t.length[control[i]];
+    for (size_t i = full * 4; i < n; i++) bytes += ((control[full] >> (2 * (i & 3))) & 3) + 1;
+    return bytes;
+}
+
+inline const ub1* streamVByteDecode(const ub1* p, const ub1* end, ub4* out, size_t n){
+    size_t controlBytes = (n + 3) / 4;
+    if ((size_t)(end - p) < controlBytes) return nullptr;
+    size_t dataBytes = streamVByteDataSize(p, n);
+    if ((size_t)(end - p) - controlBytes < dataBytes) return nullptr;
+    const ub1* data = p + controlBytes;
+    cpuKernels().streamVByteDecode(p, data, data + dataBytes, out, n);
+    return data + dataBytes;
+}
+
+// 单调不减、相邻差都在32位以内的序列，存in[0] - prev, in[1] - in[0], ...
+// 不满足时返回0（n为0时也是0，本来就不占空间）。
+inline size_t streamVByteDeltaSize(const ub8* in, size_t n, ub8 prev){
+    size_t bytes = (n + 3) / 4 + n;
+    for (size_t i = 0; i < n; i++){
+        ub8 d = in[i] - prev;
+        if (in[i] < prev || d >> 32) return 0;
+        bytes += streamVByteCode((ub4)d);
+        prev = in[i];
+    }
+    return n ? bytes : 0;
+}
+
+// 须先用streamVByteDeltaSize确认可以编码。
+inline ub1* streamVByteEncodeDelta(const ub8* in, size_t n, ub1* out, ub8 prev){
+    ub1* control = out;
+    ub1* data = out + (n + 3) / 4;
+    std::memset(control, 0, (n + 3) / 4);
+    for (size_t i = 0; i < n; i++){
+        ub4 d = (ub4)(in[i] - prev);
+        ub4 code = streamVByteCode(d);
+        control[i >> 2] |= (ub1)(code << (2 * (i & 3)));
+        std::memcpy(data, &d, code + 1);
+        data += code + 1;
+        prev = in[i];
+    }
+    return data;
+}
+
+inline const ub1* streamVByteDecodeDelta(const ub1* p, const ub1* end, ub8* out, size_t n, ub8 prev){
+    size_t controlBytes = (n + 3) / 4;
+    if ((size_t)(end - p) < controlBytes) return nullptr;
+    size_t dataBytes = streamVByteDataSize(p, n);
+    if ((size_t)(end - p) - controlBytes < dataBytes) return nullptr;
+    const ub1* data = p + controlBytes;
+    cpuKernels().streamVByteDecodeDelta(p, data, data + dataBytes, out, n, prev);
+    return data + dataBytes;
+}
+
+// ---- FOR位压缩 ----
+// 每块：[ub1位宽][varint块内最小值][位宽 * 块内个数 / 8字节，向上取整]，低位在前。
+// 最后一块可以不满kForBlock个。
+
+static const ub4 kForBlock = 128;
+
+namespace codec{
+
+inline ub4 bitWidth(ub8 v){ return v ? 64 - __builtin_clzll(v) : 0; }
+
+inline void blockRange(const ub8* in, ub4 count, ub8* lo, ub8* hi){
+    ub8 mn = in[0], mx = in[0];
+    for (ub4 i = 1; i < count; i++){
+        mn = in[i] < mn ? in[i] : mn;
+        mx = in[i] > mx ? in[i] : mx;
+    }
+    *lo = mn;
+    *hi = mx;
+}
+
+inline size_t forBlockSize(const ub8* in, ub4 count){
+    ub8 lo, hi;
+    blockRange(in, count, &lo, &hi);
+    return 1 + varintSize(lo) + ((size_t)bitWidth(hi - lo) * count + 7) / 8;
+}
+
+inline ub1* forEncodeBlock(const ub8* in, ub4 count, ub1* out){
+    ub8 lo, hi;
+    blockRange(in, count, &lo, &hi);
+    ub4 width = bitWidth(hi - lo);
+    *out++ = (ub1)width;
+    out = putVarint(out, lo);
+    if (!width) return out;
+    unsigned __int128 acc = 0;
+    ub4 bits = 0;
+    for (ub4 i = 0; i < count; i++){
+        acc |= (unsigned __int128)(in[i] - lo) << bits;
+        bits += width;
+        if (bits >= 64){
+            std::memcpy(out, &acc, 8);
+            out += 8;
+            acc >>= 64;
+            bits -= 64;
+        }
+    }
+    ub4 tail = (bits + 7) / 8;
+    std::memcpy(out, &acc, tail);
+    return out + tail;
+}
+
+inline const ub1* forDecodeBlock(const ub1* p, const ub1* end, ub8* out, ub4 count){
+    if (p >= end) return nullptr;
+    ub4 width = *p++;
+    ub8 lo;
+    if (width > 64 || !(p = getVarint(p, end, &lo))) return nullptr;
+    size_t bytes = ((size_t)width * count + 7) / 8;
+    if ((size_t)(end - p) < bytes) return nullptr;
+    if (!width){
+        for (ub4 i = 0; i < count; i++) out[i] = lo;
+        return p;
+    }
+    const ub1* stop = p + bytes;
+    ub8 mask = width == 64 ? ~(ub8)0 : ((ub8)1 << width) - 1;
+    unsigned __int128 acc = 0;
+    ub4 bits = 0;
+    for (ub4 i = 0; i < count; i++){
+        if (bits < width){
+            if (stop - p >= 8){
+                ub8 word;
+                std::memcpy(&word, p, 8);
+                acc |= (unsigned __int128)word << bits;
+                p += 8;
+                bits += 64;
+            }else{
+                while (bits < width){
+                    acc |= (unsigned __int128)*p++ << bits;
+                    bits += 8;
+                }
+            }
+        }
+        out[i] = lo + ((ub8)acc & mask);
+        acc >>= width;
+        bits -= width;
+    }
+    return stop;
+}
+
+}
+
+inline size_t forSize(const ub8* in, size_t n){
+    size_t bytes = 0;
+    for (size_t i = 0; i < n; i += kForBlock) bytes += codec::forBlockSize(in + i, (ub4)std::min<size_t>(kForBlock, n - i));
+    return bytes;
+}
+
+inline ub1* forEncode(const ub8* in, size_t n, ub1* out){
+    for (size_t i = 0; i < n; i += kForBlock) out = codec::forEncodeBlock(in + i, (ub4)std::min<size_t>(kForBlock, n - i), out);
+    return out;
+}
+
+inline const ub1* forDecode(const ub1* p, const ub1* end, ub8* out, size_t n){
+    for (size_t i = 0; i < n && p; i += kForBlock) p = codec::forDecodeBlock(p, end, out + i, (ub4)std::min<size_t>(kForBlock, n - i));
+    return p;
+}
+
+// ---- 整段序列 ----
+// 布局：[ub1编码方式][varint个数][varint首项][其余n - 1项]
+//   kSeqDelta      单调序列，Stream VByte存相邻差
+//   kSeqForDelta   近似有序，相邻差zigzag后FOR
+//   kSeqFor        直接FOR
+// 编码时三种各算一遍大小，取最短的。
+
+enum SequenceEncoding{
+    kSeqDelta = 1,
+    kSeqForDelta,
+    kSeqFor,
+};
+
+struct CodedBlock{
+    const ub1* data;
+    ub4        size;
+};
+
+namespace codec{
+
+// 相邻差zigzag后逐块处理，借块大小的栈上缓冲区，不整段另开数组。
+template < typename F >
+inline void forEachDeltaBlock(const ub8* in, size_t n, F&& f){
+    ub8 block[kForBlock];
+    for (size_t i = 1; i < n; i += kForBlock){
+        ub4 count = (ub4)std::min<size_t>(kForBlock, n - i);
+        for (ub4 j = 0; j < count; j++) block[j] = zigzagEncode((sb8)(in[i + j] - in[i + j - 1]));
+        f(block, count);
+    }
+}
+
+}
+
+inline CodedBlock encodeSequence(Arena& arena, const ub8* in, ub4 n){
+    size_t head = 1 + varintSize(n) + (n ? varintSize(in[0]) : 0);
+    size_t best = n > 1 ? forSize(in + 1, n - 1) : 0;
+    SequenceEncoding how = kSeqFor;
+    if (n > 1){
+        if (size_t bytes = streamVByteDeltaSize(in + 1, n - 1, in[0])){
+            if (bytes <= best){
+                best = bytes;
+                how = kSeqDelta;
+            }
+        }
+        size_t bytes = 0;
+        codec::forEachDeltaBlock(in, n, [&](const ub8* block, ub4 count){ bytes += codec::forBlockSize(block, count); });
+        if (bytes < best){
+            best = bytes;
+            how = kSeqForDelta;
+        }
+    }
+    if (head + best > 0xffffffffu) throw std::invalid_argument("codec: sequence too large");
+    ub4 size = (ub4)(head + best);
+    auto out = (ub1*)arena.alloc(size);
+    if (!out) throw std::runtime_error("codec: arena alloc error");
+    ub1* p = out;
+    *p++ = (ub1)how;
+    p = putVarint(p, n);
+    if (n) p = putVarint(p, in[0]);
+    if (n > 1){
+        switch (how){
+        case kSeqDelta:
+            p = streamVByteEncodeDelta(in + 1, n - 1, p, in[0]);
+            break;
+        case kSeqForDelta:
+            codec::forEachDeltaBlock(in, n, [&](const ub8* block, ub4 count){ p = codec::forEncodeBlock(block, count, p); });
+            break;
+        case kSeqFor:
+            p = forEncode(in + 1, n - 1, p);
+            break;
+        }
+    }
+    assert(p == out + size);
+    return CodedBlock{out, size};
+}
+
+// 读出序列长度，供调用方准备输出空间。
+inline bool sequenceLength(const ub1* data, ub4 size, ub4* n){
+    ub8 v;
+    if (size < 2 || !getVarint(data + 1, data + size, &v) || v > 0xffffffffu) return false;
+    *n = (ub4)v;
+    return true;
+}
+
+// out须能容下sequenceLength个值。数据须恰好用完，否则视为损坏。
+inline bool decodeSequence(const ub1* data, ub4 size, ub8* out){
+    const ub1* end = data + size;
+    ub8 n, first;
+    if (size < 2) return false;
+    ub1 how = data[0];
+    if (how < kSeqDelta || how > kSeqFor) return false;
+    const ub1* p = getVarint(data + 1, end, &n);
+    if (!p || n > 0xffffffffu) return false;
+    if (!n) return p == end;
+    if (!(p = getVarint(p, end, &first))) return false;
+    out[0] = first;
+    switch (how){
+    case kSeqDelta:
+        p = streamVByteDecodeDelta(p, end, out + 1, n - 1, first);
+        break;
+    case kSeqForDelta:
+        p = forDecode(p, end, out + 1, n - 1);
+        for (ub8 i = 1; p && i < n; i++) out[i] = out[i - 1] + (ub8)zigzagDecode(out[i]);
+        break;
+    case kSeqFor:
+        p = forDecode(p, end, out + 1, n - 1);
+        break;
+    }
+    return p == end;
+}
+
+}
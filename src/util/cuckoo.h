@@ -0,0 +1,309 @@
+#pragma once
+
+#include "common.h"
+#include "util/hashmap.h"
+
+#include <cmath>
+
+namespace wjp{
+
+// 布谷鸟过滤器：每桶4个指纹，支持删除。
+// 一次哈希（默认siphash）的64位结果同时给出指纹（高f位）与主桶号（低位），
+// 备用桶 i2 = i1 ^ hash(fingerprint)，由任一桶和指纹即可互推，踢出时无需原key。
+// 误判率约为 2 * 4 / 2^f。f按目标误判率取8、12、16或32中够用的最小值，桶相应为4、6、8、16字节；
+// 12位的桶按一个48位整数整体读写，其余宽度每个槽就是一个整数。容量按95%装载率预留。
+template < typename Hash = SipHash >
+class CuckooFilter{
+public:
+    static const ub4 kSlotsPerBucket = 4;
+    static const ub4 kMaxKicks = 500;
+
+    static double falsePositiveRate(ub4 fpBits){ return 2.0 * kSlotsPerBucket / std::ldexp(1.0, fpBits); }
+
+    // 满足targetFpr的最短指纹；32位也不够时报错，而不是静默给出更差的结果。
+    CuckooFilter(ub8 expectedKeys, double targetFpr = falsePositiveRate(16)){
+        if (!(targetFpr > 0 && targetFpr < 1)) throw std::invalid_argument("fpr must be in (0, 1)");
+        ub4 bits = 8;
+        while (falsePositiveRate(bits) > targetFpr){
+            if (bits == 32) throw std::invalid_argument("fpr below what 32-bit fingerprints give");
+            bits = bits == 8 ? 12 : bits == 12 ? 16 : 32;
+        }
+        ub8 need = (ub8)(expectedKeys / (kSlotsPerBucket * 0.95)) + 1;
+        ub8 n = 1;
+        while (n < need) n <<= 1;
+        init(n, bits);
+    }
+
+    ~CuckooFilter(){
+        std::free(buckets);
+    }
+
+    CuckooFilter(CuckooFilter&& rhs) : buckets(rhs.buckets), nrbuckets(rhs.nrbuckets), count(rhs.count),
+        fpBits(rhs.fpBits), victim(rhs.victim), rnd(rhs.rnd){
+        rhs.buckets = nullptr;
+        rhs.nrbuckets = 0;
+    }
+
+    inline ub8 hash(const void* data, ub4 len){ return hasher((const ub1*)data, len); }
+
+    bool add(const void* data, ub4 len){ return addHash(hash(data, len)); }
+
+    bool contains(const void* data, ub4 len){ return containsHash(hash(data, len)); }
+
+    bool erase(const void* data, ub4 len){ return eraseHash(hash(data, len)); }
+
+    // 满时返回false。此时最后被踢出的指纹暂存在victim里，不会丢失已有元素。
+    bool addHash(ub8 h){
+        if (victim.used) return false;
+        ub4 fp = fingerprint(h);
+        ub8 i1 = h & (nrbuckets - 1);
+        ub8 i2 = altIndex(i1, fp);
+        if (insertAt(i1, fp) || insertAt(i2, fp)){
+            count++;
+            return true;
+        }
+        ub8 i = (rnd.next() & 1) ? i1 : i2;
+        for (ub4 kick = 0; kick < kMaxKicks; kick++){
+            ub4 slot = (ub4)(rnd.next() & (kSlotsPerBucket - 1));
+            ub4 old = slotAt(i, slot);
+            setSlot(i, slot, fp);
+            fp = old;
+            i = altIndex(i, fp);
+            if (insertAt(i, fp)){
+                count++;
+                return true;
+            }
+        }
+        victim.used = true;
+        victim.index = i;
+        victim.fp = fp;
+        count++;
+        return true;
+    }
+
+    bool containsHash(ub8 h) const {
+        ub4 fp = fingerprint(h);
+        ub8 i1 = h & (nrbuckets - 1);
+        ub8 i2 = altIndex(i1, fp);
+        if (victim.used && victim.fp == fp && (victim.index == i1 || victim.index == i2)) return true;
+        return hasFingerprint(i1, fp) || hasFingerprint(i2, fp);
+    }
+
+    bool eraseHash(ub8 h){
+        ub4 fp = fingerprint(h);
+        ub8 i1 = h & (nrbuckets - 1);
+        ub8 i2 = altIndex(i1, fp);
+        if (removeAt(i1, fp) || removeAt(i2, fp)){
+            count--;
+            // 腾出了位置，尝试把victim放回表中
+            if (victim.used){
+                victim.used = false;
+                count--;
+                addHash(victimHash());
+            }
+            return true;
+        }
+        if (victim.used && victim.fp == fp && (victim.index == i1 || victim.index == i2)){
+            victim.used = false;
+            count--;
+            return true;
+        }
+        return false;
+    }
+
+    // 批量查询：先预取两个候选桶，再逐个测试。
+    void containsBatch(const ub8* hashes, ub4 n, bool* out) const {
+        static const ub4 kLookahead = 16;
+        for (ub4 i = 0; i < n; i++){
+            if (i + kLookahead < n){
+                ub8 h = hashes[i + kLookahead];
+                ub8 i1 = h & (nrbuckets - 1);
+                __builtin_prefetch(bucketAt(i1));
+                __builtin_prefetch(bucketAt(altIndex(i1, fingerprint(h))));
+            }
+            out[i] = containsHash(hashes[i]);
+        }
+    }
+
+    ub8 size() const { return count; }
+
+    ub8 memoryUsage() const { return nrbuckets * bucketBytes(); }
+
+    ub4 fingerprintBits() const { return fpBits; }
+
+    double falsePositiveRate() const { return falsePositiveRate(fpBits); }
+
+    double loadFactor() const { return (double)count / (nrbuckets * kSlotsPerBucket); }
+
+    // 序列化格式：magic、指纹位数、桶数、元素数、victim，随后为原始桶数据（主机字节序）。
+    std::vector<char> serialize() const {
+        Header header{kMagic, victim.fp, (ub2)fpBits, victim.used ? (ub2)1 : (ub2)0, 0, nrbuckets, count, victim.index};
+        std::vector<char> out(sizeof(header) + memoryUsage());
+        std::memcpy(out.data(), &header, sizeof(header));
+        std::memcpy(out.data() + sizeof(header), buckets, memoryUsage());
+        return out;
+    }
+
+    static CuckooFilter deserialize(const char* data, size_t len){
+        Header header;
+        if (len < sizeof(header)) throw std::runtime_error("cuckoo filter: truncated header");
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != kMagic || !header.nrbuckets || (header.nrbuckets & (header.nrbuckets - 1)) ||
+            (header.fpBits != 8 && header.fpBits != 12 && header.fpBits != 16 && header.fpBits != 32))
+            throw std::runtime_error("cuckoo filter: bad header");
+        CuckooFilter filter(Raw(), header.nrbuckets, header.fpBits);
+        if (len != sizeof(header) + filter.memoryUsage()) throw std::runtime_error("cuckoo filter: bad length");
+        std::memcpy(filter.buckets, data + sizeof(header), filter.memoryUsage());
+        filter.count = header.count;
+        filter.victim.used = header.victimUsed != 0;
+        filter.victim.fp = header.victimFp;
+        filter.victim.index = header.victimIndex & (header.nrbuckets - 1);
+        return filter;
+    }
+
+private:
+    CuckooFilter(const CuckooFilter&) = delete;
+    CuckooFilter& operator=(const CuckooFilter&) = delete;
+
+    struct Raw{};
+
+    CuckooFilter(Raw, ub8 nrbuckets, ub4 fpBits){ init(nrbuckets, fpBits); }
+
+    struct Victim{
+        bool used = false;
+        ub4  fp = 0;
+        ub8  index = 0;
+    };
+
+    struct Header{
+        ub4 magic;
+        ub4 victimFp;
+        ub2 fpBits;
+        ub2 victimUsed;
+        ub4 reserved;
+        ub8 nrbuckets;
+        ub8 count;
+        ub8 victimIndex;
+    };
+
+    static const ub4 kMagic = 0x434b4f32; // "CKO2"
+
+    struct Random{
+        ub8 state = UB8(0x2545f491, 0x4f6cdd1d);
+        inline ub8 next(){
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+    };
+
+    void init(ub8 n, ub4 bits){
+        nrbuckets = n;
+        fpBits = bits;
+        buckets = (ub1*) malloc64(memoryUsage());
+        if (!buckets) throw std::runtime_error("malloc64 error");
+        std::memset(buckets, 0, memoryUsage());
+    }
+
+    inline ub4 bucketBytes() const { return kSlotsPerBucket * fpBits / 8; }
+
+    inline ub1* bucketAt(ub8 i) const { return buckets + i * bucketBytes(); }
+
+    static const ub4 kPackedBytes = 6; // 12位指纹的桶
+    static const ub8 kPackedMask = 0xfff;
+
+    inline static ub8 loadPacked(const ub1* b){
+        ub8 word = 0;
+        std::memcpy(&word, b, kPackedBytes);
+        return word;
+    }
+
+    // 槽按指纹位数存为ub1/12位/ub2/ub4，0表示空槽。
+    inline ub4 slotAt(ub8 i, ub4 s) const {
+        const ub1* b = bucketAt(i);
+        if (fpBits == 8) return b[s];
+        if (fpBits == 12) return (ub4)(loadPacked(b) >> (12 * s) & kPackedMask);
+        if (fpBits == 16) return ((const ub2*)b)[s];
+        return ((const ub4*)b)[s];
+    }
+
+    inline void setSlot(ub8 i, ub4 s, ub4 fp){
+        ub1* b = bucketAt(i);
+        if (fpBits == 8) b[s] = (ub1)fp;
+        else if (fpBits == 12){
+            ub8 word = loadPacked(b) & ~(kPackedMask << (12 * s));
+            word |= (ub8)fp << (12 * s);
+            std::memcpy(b, &word, kPackedBytes);
+        }else if (fpBits == 16) ((ub2*)b)[s] = (ub2)fp;
+        else ((ub4*)b)[s] = fp;
+    }
+
+    inline ub4 fingerprint(ub8 h) const {
+        ub4 fp = (ub4)(h >> (64 - fpBits));
+        return fp ? fp : 1;
+    }
+
+    inline ub8 altIndex(ub8 index, ub4 fp) const {
+        return (index ^ ((ub8)fp * 0x5bd1e995)) & (nrbuckets - 1);
+    }
+
+    // 由victim的桶号和指纹拼出一个能落回原两个候选桶的哈希值。
+    ub8 victimHash() const {
+        return (ub8)victim.fp << (64 - fpBits) | (victim.index & (nrbuckets - 1));
+    }
+
+    // 8、12、16位指纹一次比较整桶：异或后某一格为0即命中（SWAR零字节检测）；32位逐个比。
+    inline bool hasFingerprint(ub8 i, ub4 fp) const {
+        const ub1* b = bucketAt(i);
+        if (fpBits == 8){
+            ub4 word;
+            std::memcpy(&word, b, sizeof(word));
+            ub4 x = word ^ (fp * 0x01010101u);
+            return ((x - 0x01010101u) & ~x & 0x80808080u) != 0;
+        }
+        if (fpBits == 12){
+            static const ub8 kLow = UB8(0x00000010, 0x01001001), kHigh = kLow << 11;
+            ub8 x = loadPacked(b) ^ (fp * kLow);
+            return ((x - kLow) & ~x & kHigh) != 0;
+        }
+        if (fpBits == 16){
+            ub8 word;
+            std::memcpy(&word, b, sizeof(word));
+            ub8 x = word ^ (fp * UB8(0x00010001, 0x00010001));
+            return ((x - UB8(0x00010001, 0x00010001)) & ~x & UB8(0x80008000, 0x80008000)) != 0;
+        }
+        const ub4* w = (const ub4*)b;
+        return (w[0] == fp) | (w[1] == fp) | (w[2] == fp) | (w[3] == fp);
+    }
+
+    inline bool insertAt(ub8 i, ub4 fp){
+        for (ub4 s = 0; s < kSlotsPerBucket; s++){
+            if (!slotAt(i, s)){
+                setSlot(i, s, fp);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline bool removeAt(ub8 i, ub4 fp){
+        for (ub4 s = 0; s < kSlotsPerBucket; s++){
+            if (slotAt(i, s) == fp){
+                setSlot(i, s, 0);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ub1*    buckets = nullptr;
+    ub8     nrbuckets = 0;
+    ub8     count = 0;
+    ub4     fpBits = 16;
+    Victim  victim;
+    Random  rnd;
+    Hash    hasher;
+};
+
+}
@@ -20,6 +20,15 @@ public:
         K key;
         V value;
         Entry* next;
+        ub8 version; // epoch of the last write, see touch()
+    };
+
+    // Called right before an entry is overwritten or erased, so that a
+    // checkpoint in progress can save the old value (copy-on-write).
+    struct WriteHook{
+        void (*beforeWrite)(void* ctx, const Entry& entry) = nullptr;
+        void (*beforeErase)(void* ctx, const Entry& entry) = nullptr;
+        void* ctx = nullptr;
     };
 
     struct Table{
@@ -34,6 +43,21 @@ public:
         ~Table(){
             if (buckets) free(buckets);
         }
+
+        // free every entry chained in this table, buckets are kept
+        void freeEntries(){
+            if (!bucketsInited()) return;
+            for (ub4 i = 0; i < capacity(); i++){
+                Entry* entry = buckets[i];
+                while (entry){
+                    Entry* next = entry->next;
+                    free(entry);
+                    entry = next;
+                }
+                buckets[i] = nullptr;
+            }
+            used = 0;
+        }
         
         bool bucketsInited(){
             return buckets != nullptr;
@@ -46,7 +70,6 @@ public:
         }
         
         Entry* removeAt(int id, const K& key, Hashmap* hmap){
-            //todo
             if (!bucketsInited()) return nullptr;
             Entry* entry = buckets[id];
             Entry* prev = nullptr;
@@ -55,10 +78,11 @@ public:
                     // now we find the entry, unlink it
                     if (prev) prev->next = entry->next;
                     else buckets[id] = entry->next;
+                    used--;
                     return entry;
                 }
-                entry = entry->next;
                 prev = entry;
+                entry = entry->next;
             }
             return nullptr;
         }
@@ -104,10 +128,22 @@ public:
             hmap->nriters++;
         }
 
+        Iterator(const Iterator& rhs) : hmap(rhs.hmap), cur(rhs.cur), index(rhs.index), future(rhs.future){
+            hmap->nriters++;
+        }
+
         ~Iterator(){
             hmap->nriters--;
         }
 
+        bool operator==(const Iterator& rhs) const {
+            return cur == rhs.cur;
+        }
+
+        bool operator!=(const Iterator& rhs) const {
+            return cur != rhs.cur;
+        }
+
         Entry& operator*() const {
             return *cur;
         }
@@ -137,21 +173,27 @@ public:
                 cur = cur->next;
                 return;
             }
-            if ((ub4)index < hmap->tables[future].capacity()){
-                index++;
-            }else if(future == 0 && hmap->isRehashing()){
-                future = 1;
-                index = 0;
-            }else{
-                future = 0;
-                index = -1;
+            // walk forward to the next non-empty bucket, possibly in tables[1]
+            for (;;){
+                if ((ub4)(index + 1) < hmap->tables[future].capacity()){
+                    index++;
+                }else if(future == 0 && hmap->isRehashing()){
+                    future = 1;
+                    index = 0;
+                }else{
+                    future = 0;
+                    index = -1;
+                    cur = nullptr;
+                    return;
+                }
+                cur = currentBucketBegins();
+                if (cur) return;
             }
-            cur = currentBucketBegins();
         }
 
         Hashmap* hmap;
         Entry* cur = nullptr;
-        int index = -1
+        int index = -1;
         int future = 0; // 0 or 1
     };
 
@@ -159,6 +201,11 @@ public:
         tables[0].initBuckets(); // rehash table must remain uninited
     }
 
+    ~Hashmap(){
+        tables[0].freeEntries();
+        tables[1].freeEntries();
+    }
+
     Iterator begin(){
         Iterator iter(this);
         iter++;
@@ -174,10 +221,11 @@ public:
     }
 
     bool exists(const K& key){
-        return !find(key);
+        return find(key) != nullptr;
     }
 
     Entry* find(const K& key){
+        WJP_PROFILE_SCOPE("Hashmap::find");
         if (empty()) return nullptr;
         rehashOnEveryOperation();
         ub8 hash = hasher((const ub1*)&key, sizeof(K));
@@ -190,22 +238,26 @@ public:
     // Find key, but if it does not exist, place and return a new entry,
     // which has its key set. Caller should set its value immediately.
     Entry* findOrCreateNew(const K& key, bool* existing = nullptr){
+        WJP_PROFILE_SCOPE("Hashmap::findOrCreateNew");
         rehashOnEveryOperation();
         if (existing) *existing = true;
         ub8 hash = hasher((const ub1*)&key, sizeof(K));
         ub4 index = tables[0].mask() & hash;
         Entry* entry = tables[0].searchAt(index, key, this);
-        if (entry) return entry;
-        if (isRehashing()){
+        if (!entry && isRehashing()){
             index = tables[1].mask() & hash;
-            Entry* entry = tables[1].searchAt(index, key, this);
-            if (entry) return entry;
+            entry = tables[1].searchAt(index, key, this);
+        }
+        if (entry){
+            touch(entry);
+            return entry;
         }
         // search failed, now we insert new entry
         if (existing) *existing = false;
         Table& which = isRehashing() ? tables[1] : tables[0];
         auto newEntry =  which.createNewEntryAt(index);
         newEntry->key = key;
+        newEntry->version = epoch;
         return newEntry;
     }
 
@@ -220,28 +272,98 @@ public:
     }
 
     ub4 nrbuckets(){ 
-        return tables[0].capacity() + tables[0].capacity();
+        return tables[0].capacity() + (isRehashing() ? tables[1].capacity() : 0);
     }
 
+    // Unlink the entry of key and hand it back, caller owns it and must free() it.
     Entry* erase(const K& key){
+        WJP_PROFILE_SCOPE("Hashmap::erase");
         rehashOnEveryOperation();
         ub8 hash = hasher((const ub1*)&key, sizeof(K));
         ub4 index = tables[0].mask() & hash;
         Entry* entry = tables[0].removeAt(index, key, this);
-        if (entry) return entry;
-        if (isRehashing()){
+        if (!entry && isRehashing()){
             index = tables[1].mask() & hash;
-            Entry* entry = tables[1].removeAt(index, key, this);
-            if (entry) return entry;
+            entry = tables[1].removeAt(index, key, this);
         }
-        return nullptr; // key not found
+        if (entry && hook.beforeErase) hook.beforeErase(hook.ctx, *entry);
+        return entry; // nullptr if key not found
+    }
+
+    // Stamp entry with the current epoch. findOrCreateNew and operator[] do it
+    // for you; call it before modifying a value obtained through find(), since
+    // the write hook saves the value the entry holds at that moment.
+    void touch(Entry* entry){
+        if (entry->version == epoch) return;
+        if (hook.beforeWrite) hook.beforeWrite(hook.ctx, *entry);
+        entry->version = epoch;
+    }
+
+    // Writes from now on are stamped with a new epoch; returns the old one.
+    ub8 advanceEpoch(){ return epoch++; }
+
+    ub8 currentEpoch(){ return epoch; }
+
+    void setWriteHook(const WriteHook& h){ hook = h; }
+
+    // Redis-style SCAN: visit one bucket (plus the buckets it expands to in
+    // tables[1] while rehashing), call fn(Entry&) on its entries and return the
+    // cursor for the next call; 0 means done. Start with cursor 0.
+    // The cursor increments its bits from the high end, so buckets already
+    // visited stay visited when the table doubles in between calls: every
+    // entry present for the whole scan is reported at least once, possibly
+    // twice. fn must not insert or erase; between calls anything goes.
+    template < typename Fn >
+    ub8 scan(ub8 cursor, Fn fn){
+        if (empty()) return 0;
+        nriters++;
+        if (!isRehashing()){
+            ub8 m0 = tables[0].mask();
+            visitBucket(tables[0].buckets[cursor & m0], fn);
+            cursor = nextCursor(cursor, m0);
+        }else{
+            // tables only grow, so tables[0] is the smaller one
+            ub8 m0 = tables[0].mask(), m1 = tables[1].mask();
+            visitBucket(tables[0].buckets[cursor & m0], fn);
+            do{
+                visitBucket(tables[1].buckets[cursor & m1], fn);
+                cursor = nextCursor(cursor, m1);
+            }while (cursor & (m0 ^ m1));
+        }
+        nriters--;
+        return cursor;
     }
     
 private:
     static const int kRehashRatio = 100;
 
-    void rehash(int n = 1){
-        if (nriters || isRehashing()) return false;
+    template < typename Fn >
+    static void visitBucket(Entry* entry, Fn& fn){
+        while (entry){
+            Entry* next = entry->next;
+            fn(*entry);
+            entry = next;
+        }
+    }
+
+    static ub8 reverseBits(ub8 v){
+        v = __builtin_bswap64(v);
+        v = ((v >> 4) & UB8(0x0f0f0f0f, 0x0f0f0f0f)) | ((v & UB8(0x0f0f0f0f, 0x0f0f0f0f)) << 4);
+        v = ((v >> 2) & UB8(0x33333333, 0x33333333)) | ((v & UB8(0x33333333, 0x33333333)) << 2);
+        v = ((v >> 1) & UB8(0x55555555, 0x55555555)) | ((v & UB8(0x55555555, 0x55555555)) << 1);
+        return v;
+    }
+
+    // add one to the masked bits of the cursor, counting from the high end
+    static ub8 nextCursor(ub8 cursor, ub8 mask){
+        cursor |= ~mask;
+        cursor = reverseBits(cursor);
+        cursor++;
+        return reverseBits(cursor);
+    }
+
+    bool rehash(int n = 1){
+        if (nriters || !isRehashing()) return false;
         int empty_visits = n << 5; // at most 32 empty visits
         for (; n != 0 && tables[0].used != 0; n--){
             assert(tables[0].capacity() > (ub4)rehashid);
@@ -252,7 +374,7 @@ private:
             auto entry = tables[0].buckets[rehashid];
             while (entry){
                 auto next = entry->next;
-                ub8 hash = hasher((const ub1*)&key, sizeof(K));
+                ub8 hash = hasher((const ub1*)&entry->key, sizeof(K));
                 ub4 hashid = hash & tables[1].mask();
                 tables[1].add(entry, hashid);
                 tables[0].used--;
@@ -262,8 +384,12 @@ private:
             rehashid++;
         }
         if (tables[0].used == 0){ // rehash finished
+            // hand tables[1]'s buckets over to tables[0] without double free
             free(tables[0].buckets);
-            tables[0] = tables[1];
+            tables[0].buckets = tables[1].buckets;
+            tables[0].used = tables[1].used;
+            tables[0].order = tables[1].order;
+            tables[1].buckets = nullptr;
             tables[1].reset();
             rehashid = -1;
         }
@@ -306,6 +432,8 @@ private:
     Table tables[2];
     int rehashid = -1; // next id in tables[0].buckets to rehash
     ub4 nriters = 0;
+    ub8 epoch = 1;
+    WriteHook hook;
 };
 
 
@@ -0,0 +1,353 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+#include "util/hashmap.h"
+
+#include <algorithm>
+
+namespace wjp{
+
+// 字符串驻留池：相同内容的字符串只存一份，换成一个32位的符号号。
+// 之后比较相等就是比较整数，哈希直接取存下来的值，不必再碰字节。
+// 1. 字节连同哈希值、长度一起从Arena分配：[ub8 hash][ub4 len][bytes]['\0']，永不单独释放。
+// 2. 去重表开放寻址、线性探测，每个槽8字节：哈希高32位作标签，加上符号号+1（0表示空槽）。
+//    探测时先比标签，标签相等才去Arena里比字节；扩容按存下的哈希重排，不重算siphash。
+// 3. 符号号按驻留顺序从0连续分配。符号号到记录的映射是分块目录，块和旧目录都不移动，
+//    所以data/length/hashOf不加锁也能与intern并发，前提是拿到符号号本身有happens-before。
+// 单线程使用；多线程见ConcurrentInterner。
+template < typename Hash = SipHash >
+class StringInterner{
+public:
+    typedef ub4 Symbol;
+    static const Symbol kNoSymbol = ~(ub4)0;
+    static const ub4 kBlockShift = 10; // 目录每块1024个符号
+
+    explicit StringInterner(ub4 expectedSymbols = 1024, ub4 chunkCapacity = 16*kPageSize) : arena(chunkCapacity){
+        ub4 cap = 16;
+        while (cap < expectedSymbols * 2) cap <<= 1;
+        initTable(cap);
+        newDirectory(4);
+    }
+
+    ~StringInterner(){
+        std::free(slots);
+    }
+
+    inline ub8 hash(const char* s, ub4 len) const { return hasher((const ub1*)s, len); }
+
+    Symbol intern(const char* s, ub4 len){ return internHashed(s, len, hash(s, len)); }
+
+    Symbol intern(const std::string& s){ return intern(s.data(), (ub4)s.size()); }
+
+    // 调用方已算好哈希（如ConcurrentInterner选分片时）就不必再算一遍。
+    Symbol internHashed(const char* s, ub4 len, ub8 h){
+        ub4 i = (ub4)h & mask;
+        ub4 tag = (ub4)(h >> 32);
+        for (;; i = (i + 1) & mask){
+            Slot& slot = slots[i];
+            if (!slot.sym1) break;
+            if (slot.tag == tag && equal(slot.sym1 - 1, s, len)) return slot.sym1 - 1;
+        }
+        if ((count + 1) * 2 > mask + 1){
+            grow();
+            return insertNew(s, len, h);
+        }
+        Symbol sym = append(s, len, h);
+        slots[i].tag = tag;
+        slots[i].sym1 = sym + 1;
+        return sym;
+    }
+
+    // 只查不插，不存在返回kNoSymbol。
+    Symbol find(const char* s, ub4 len) const { return findHashed(s, len, hash(s, len)); }
+
+    Symbol find(const std::string& s) const { return find(s.data(), (ub4)s.size()); }
+
+    Symbol findHashed(const char* s, ub4 len, ub8 h) const {
+        ub4 tag = (ub4)(h >> 32);
+        for (ub4 i = (ub4)h & mask;; i = (i + 1) & mask){
+            const Slot& slot = slots[i];
+            if (!slot.sym1) return kNoSymbol;
+            if (slot.tag == tag && equal(slot.sym1 - 1, s, len)) return slot.sym1 - 1;
+        }
+    }
+
+    // 批量驻留：先把一批的哈希全部算完并预取各自的槽，再逐个探测，
+    // 让槽的cache miss与siphash的计算重叠。结果写入out[0..n)。
+    void internBulk(const char* const* strs, const ub4* lens, ub4 n, Symbol* out){
+        static const ub4 kBatch = 16;
+        ub8 hashes[kBatch];
+        for (ub4 base = 0; base < n; base += kBatch){
+            ub4 m = std::min(kBatch, n - base);
+            for (ub4 j = 0; j < m; j++){
+                hashes[j] = hash(strs[base + j], lens[base + j]);
+                __builtin_prefetch(&slots[(ub4)hashes[j] & mask]);
+            }
+            for (ub4 j = 0; j < m; j++) out[base + j] = internHashed(strs[base + j], lens[base + j], hashes[j]);
+        }
+    }
+
+    // 以下按符号号取回内容，符号号必须来自本池。data以'\0'结尾，可当C字符串用。
+    const char* data(Symbol sym) const { return record(sym) + kRecordHeader; }
+
+    ub4 length(Symbol sym) const { return *(const ub4*)(record(sym) + sizeof(ub8)); }
+
+    ub8 hashOf(Symbol sym) const { return *(const ub8*)record(sym); }
+
+    std::string str(Symbol sym) const { return std::string(data(sym), length(sym)); }
+
+    ub4 size() const { return count; }
+
+    // Arena里的字节加上去重表。
+    ub8 memoryUsage() const { return arenaBytes + (ub8)(mask + 1) * sizeof(Slot); }
+
+private:
+    StringInterner(const StringInterner&) = delete;
+    StringInterner& operator=(const StringInterner&) = delete;
+
+    static const ub4 kRecordHeader = sizeof(ub8) + sizeof(ub4);
+    static const ub4 kBlockSize = 1 << kBlockShift;
+
+    struct Slot{
+        ub4 tag;
+        ub4 sym1; // 符号号+1，0为空槽
+    };
+
+    // 目录按块数翻倍重建，旧目录留在Arena里，并发读者手里的旧目录依然有效。
+    struct Directory{
+        ub4          capacity;
+        const char** blocks[1];
+    };
+
+    void initTable(ub4 cap){
+        slots = (Slot*)malloc64(sizeof(Slot) * cap);
+        if (!slots) throw std::runtime_error("interner: table alloc error");
+        std::memset(slots, 0, sizeof(Slot) * cap);
+        mask = cap - 1;
+    }
+
+    void grow(){
+        Slot* old = slots;
+        ub4 oldCap = mask + 1;
+        if (oldCap >= (1u << 31)) throw std::runtime_error("interner: too many symbols");
+        initTable(oldCap * 2);
+        for (ub4 i = 0; i < oldCap; i++){
+            if (!old[i].sym1) continue;
+            ub8 h = hashOf(old[i].sym1 - 1);
+            ub4 j = (ub4)h & mask;
+            while (slots[j].sym1) j = (j + 1) & mask;
+            slots[j] = old[i];
+        }
+        std::free(old);
+    }
+
+    // 已确认不存在且容量足够时插入。
+    Symbol insertNew(const char* s, ub4 len, ub8 h){
+        ub4 i = (ub4)h & mask;
+        while (slots[i].sym1) i = (i + 1) & mask;
+        Symbol sym = append(s, len, h);
+        slots[i].tag = (ub4)(h >> 32);
+        slots[i].sym1 = sym + 1;
+        return sym;
+    }
+
+    char* arenaAlloc(ub4 size){
+        char* p = arena.alloc(size);
+        if (!p) throw std::runtime_error("interner: arena alloc error");
+        arenaBytes += ALIGN(size);
+        return p;
+    }
+
+    Symbol append(const char* s, ub4 len, ub8 h){
+        if (count == kNoSymbol) throw std::runtime_error("interner: too many symbols");
+        char* p = arenaAlloc(kRecordHeader + len + 1);
+        *(ub8*)p = h;
+        *(ub4*)(p + sizeof(ub8)) = len;
+        std::memcpy(p + kRecordHeader, s, len);
+        p[kRecordHeader + len] = '\0';
+
+        Symbol sym = count;
+        ub4 b = sym >> kBlockShift;
+        Directory* d = dir.load(std::memory_order_relaxed);
+        if ((sym & (kBlockSize - 1)) == 0){
+            if (b == d->capacity) d = newDirectory(d->capacity * 2);
+            d->blocks[b] = (const char**)arenaAlloc(sizeof(const char*) * kBlockSize);
+        }
+        d->blocks[b][sym & (kBlockSize - 1)] = p;
+        count++;
+        return sym;
+    }
+
+    Directory* newDirectory(ub4 capacity){
+        auto d = (Directory*)arenaAlloc(sizeof(Directory) + sizeof(const char**) * (capacity - 1));
+        d->capacity = capacity;
+        Directory* old = dir.load(std::memory_order_relaxed);
+        for (ub4 i = 0; i < capacity; i++) d->blocks[i] = old && i < old->capacity ? old->blocks[i] : nullptr;
+        dir.store(d, std::memory_order_release);
+        return d;
+    }
+
+    const char* record(Symbol sym) const {
+        Directory* d = dir.load(std::memory_order_acquire);
+        return d->blocks[sym >> kBlockShift][sym & (kBlockSize - 1)];
+    }
+
+    bool equal(Symbol sym, const char* s, ub4 len) const {
+        const char* p = record(sym);
+        return *(const ub4*)(p + sizeof(ub8)) == len && std::memcmp(p + kRecordHeader, s, len) == 0;
+    }
+
+    mutable Hash            hasher;
+    Arena                   arena;
+    Slot*                   slots = nullptr;
+    ub4                     mask = 0;
+    ub4                     count = 0;
+    std::atomic<Directory*> dir{nullptr};
+    ub8                     arenaBytes = 0;
+};
+
+
+// 供摄入线程共用的驻留池：按哈希高位分成2^shardBits个分片，每片一把锁和一个StringInterner。
+// 全局符号号 = 分片内符号号 << shardBits | 分片号，所以仍是32位，但不再连续。
+// data/length/hashOf不加锁；批量驻留先按分片分组，每个分片只加一次锁。
+template < typename Hash = SipHash >
+class ConcurrentInterner{
+public:
+    typedef ub4 Symbol;
+    static const Symbol kNoSymbol = ~(ub4)0;
+
+    explicit ConcurrentInterner(ub4 shardBits = 4, ub4 expectedSymbols = 1024) : shardBits(shardBits){
+        if (shardBits > 8) throw std::invalid_argument("interner: too many shards");
+        ub4 n = 1u << shardBits;
+        ub4 perShard = std::max<ub4>(expectedSymbols >> shardBits, 16);
+        shards = (Shard*) malloc64(sizeof(Shard) * n);
+        if (!shards) throw std::runtime_error("malloc64 error");
+        for (ub4 i = 0; i < n; i++){
+            new(&shards[i]) Shard;
+            shards[i].interner.reset(new StringInterner<Hash>(perShard));
+        }
+    }
+
+    ~ConcurrentInterner(){
+        for (ub4 i = 0; i < (1u << shardBits); i++) shards[i].~Shard();
+        std::free(shards);
+    }
+
+    inline ub8 hash(const char* s, ub4 len) const { return hasher((const ub1*)s, len); }
+
+    Symbol intern(const char* s, ub4 len){
+        ub8 h = hash(s, len);
+        ub4 sh = shardOf(h);
+        ub4 local;
+        {
+            std::lock_guard<std::mutex> guard(shards[sh].lock);
+            local = shards[sh].interner->internHashed(s, len, h);
+        }
+        return compose(local, sh);
+    }
+
+    Symbol intern(const std::string& s){ return intern(s.data(), (ub4)s.size()); }
+
+    Symbol find(const char* s, ub4 len) const {
+        ub8 h = hash(s, len);
+        ub4 sh = shardOf(h);
+        ub4 local;
+        {
+            std::lock_guard<std::mutex> guard(shards[sh].lock);
+            local = shards[sh].interner->findHashed(s, len, h);
+        }
+        return local == kNoSymbol ? kNoSymbol : compose(local, sh);
+    }
+
+    Symbol find(const std::string& s) const { return find(s.data(), (ub4)s.size()); }
+
+    void internBulk(const char* const* strs, const ub4* lens, ub4 n, Symbol* out){
+        ub4 nshards = 1u << shardBits;
+        std::vector<ub8> hashes(n);
+        std::vector<ub4> starts(nshards + 1, 0);
+        std::vector<ub4> order(n);
+        for (ub4 i = 0; i < n; i++){
+            hashes[i] = hash(strs[i], lens[i]);
+            starts[shardOf(hashes[i]) + 1]++;
+        }
+        for (ub4 s = 0; s < nshards; s++) starts[s + 1] += starts[s];
+        std::vector<ub4> fill(starts.begin(), starts.end() - 1);
+        for (ub4 i = 0; i < n; i++) order[fill[shardOf(hashes[i])]++] = i;
+        for (ub4 s = 0; s < nshards; s++){
+            if (starts[s] == starts[s + 1]) continue;
+            std::lock_guard<std::mutex> guard(shards[s].lock);
+            StringInterner<Hash>& in = *shards[s].interner;
+            for (ub4 k = starts[s]; k < starts[s + 1]; k++){
+                ub4 i = order[k];
+                out[i] = compose(in.internHashed(strs[i], lens[i], hashes[i]), s);
+            }
+        }
+    }
+
+    const char* data(Symbol sym) const { return shard(sym).data(local(sym)); }
+
+    ub4 length(Symbol sym) const { return shard(sym).length(local(sym)); }
+
+    ub8 hashOf(Symbol sym) const { return shard(sym).hashOf(local(sym)); }
+
+    std::string str(Symbol sym) const { return std::string(data(sym), length(sym)); }
+
+    // 各分片之和，并发驻留时是近似值。
+    ub4 size() const {
+        ub4 n = 0;
+        for (ub4 s = 0; s < (1u << shardBits); s++){
+            std::lock_guard<std::mutex> guard(shards[s].lock);
+            n += shards[s].interner->size();
+        }
+        return n;
+    }
+
+    ub8 memoryUsage() const {
+        ub8 n = 0;
+        for (ub4 s = 0; s < (1u << shardBits); s++){
+            std::lock_guard<std::mutex> guard(shards[s].lock);
+            n += shards[s].interner->memoryUsage();
+        }
+        return n;
+    }
+
+private:
+    ConcurrentInterner(const ConcurrentInterner&) = delete;
+    ConcurrentInterner& operator=(const ConcurrentInterner&) = delete;
+
+    // 各分片的锁各占一条cache line，免得伪共享。
+    struct alignas(kCacheLineSize) Shard{
+        mutable std::mutex                    lock;
+        std::unique_ptr<StringInterner<Hash>> interner;
+    };
+
+    // 分片号取哈希最高几位，与StringInterner内部取的低位槽号错开。
+    inline ub4 shardOf(ub8 h) const { return shardBits ? (ub4)(h >> (64 - shardBits)) : 0; }
+
+    inline Symbol compose(ub4 local, ub4 sh) const {
+        if ((shardBits && (local >> (32 - shardBits))) || (local << shardBits | sh) == kNoSymbol) throw std::runtime_error("interner: too many symbols");
+        return local << shardBits | sh;
+    }
+
+    inline ub4 local(Symbol sym) const { return sym >> shardBits; }
+
+    inline const StringInterner<Hash>& shard(Symbol sym) const { return *shards[sym & ((1u << shardBits) - 1)].interner; }
+
+    mutable Hash             hasher;
+    ub4                      shardBits;
+    Shard*                   shards;
+};
+
+
+// 以符号号为键的Hashmap用的哈希：符号号本身已经唯一，乘一个奇数常量打散低位即可，不必再跑siphash。
+//   Hashmap<StringInterner<>::Symbol, V, std::less<ub4>, SymbolHash>
+struct SymbolHash{
+    ub8 operator()(const ub1* in, const ub4 len){
+        ub4 sym;
+        std::memcpy(&sym, in, sizeof(sym));
+        return ((ub8)sym + 1) * UB8(0x9e3779b9, 0x7f4a7c15);
+    }
+};
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+
+#include <array>
+#include <string_view>
+
+namespace wjp{
+
+// 静态键集合的最小完美哈希（PTHash风格）：n个键一一映射到[0, n)，没有冲突也没有空槽。
+// 1. 键先哈希成64位h，高位经乘法取范围选桶，平均每桶kKeysPerBucket个键。
+// 2. 每个桶有一个pilot，键的位置为 mulhi((h ^ pilot) * kMul, n)。
+//    构造时按桶从大到小依次尝试pilot，直到桶内各键都落在未被占的不同位置上。
+// 3. 查找：算h、读一个pilot、一次乘法加一次乘高位取位置、比较一次键，没有探测链。
+// 键集合固定，查找总是O(1)，不怕冲突攻击，所以字符串哈希用比siphash快的乘法混合，
+// 并且是constexpr的，编译期与运行期算出相同的值。
+// 编译期用makePerfectHash，运行期（启动时加载的集合）用PerfectHash，两者共用构造算法。
+namespace perfecthash{
+
+static const ub4 kKeysPerBucket = 4;
+static const ub4 kMaxBucketSize = 64;  // 超过就换种子重来
+static const ub4 kMaxSeeds = 64;
+static const ub8 kMul = UB8(0x9e3779b9, 0x7f4a7c15);
+
+constexpr ub8 mix(ub8 x){
+    x ^= x >> 33;
+    x *= UB8(0xff51afd7, 0xed558ccd);
+    x ^= x >> 33;
+    x *= UB8(0xc4ceb9fe, 0x1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+constexpr ub8 mulhi(ub8 a, ub8 b){
+    return (ub8)(((unsigned __int128)a * b) >> 64);
+}
+
+// 8字节一组按小端拼成整数再混合；运行期编译器会把逐字节拼装合并成一次读。
+constexpr ub8 hashBytes(const char* s, size_t len, ub8 seed){
+    ub8 h = seed ^ (len * kMul);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8){
+        ub8 w = 0;
+        for (ub4 j = 0; j < 8; j++) w |= (ub8)(ub1)s[i + j] << (8 * j);
+        h = (h ^ mix(w)) * kMul;
+    }
+    ub8 w = 0;
+    for (ub4 j = 0; i + j < len; j++) w |= (ub8)(ub1)s[i + j] << (8 * j);
+    return mix(h ^ w);
+}
+
+constexpr ub4 bucketsFor(size_t n){ return (ub4)(n / kKeysPerBucket + 1); }
+
+constexpr ub4 bucketOf(ub8 h, ub4 nbuckets){ return (ub4)mulhi(h, nbuckets); }
+
+constexpr ub4 positionOf(ub8 h, ub8 pilot, size_t n){ return (ub4)mulhi((h ^ pilot) * kMul, n); }
+
+constexpr ub8 pilotValue(ub8 seed, ub8 attempt){ return mix(seed + attempt * kMul); }
+
+// 构造算法本体，编译期与运行期共用，所有存储由调用方给出：
+//   hashes[n]输入；pilots[nbuckets]与slots[n]（每个键的位置）输出；
+//   其余为工作区：offsets[nbuckets + 1]、members[n]、order[nbuckets]、taken[n]。
+// 某个桶过大、桶内哈希相同（多半是重复键）或pilot试满上限时返回false，调用方换种子重来。
+constexpr bool build(const ub8* hashes, ub4 n, ub8 seed, ub8* pilots, ub4 nbuckets, ub4* slots,
+                     ub4* offsets, ub4* members, ub4* order, ub1* taken){
+    // 按桶做计数排序：members[offsets[b], offsets[b + 1])是桶b里的键
+    for (ub4 b = 0; b <= nbuckets; b++) offsets[b] = 0;
+    for (ub4 i = 0; i < n; i++) offsets[bucketOf(hashes[i], nbuckets) + 1]++;
+    ub4 maxSize = 0;
+    for (ub4 b = 0; b < nbuckets; b++){
+        if (offsets[b + 1] > maxSize) maxSize = offsets[b + 1];
+        offsets[b + 1] += offsets[b];
+    }
+    if (maxSize > kMaxBucketSize) return false;
+    // order此时还没用上，先借来当每桶的填充计数
+    for (ub4 b = 0; b < nbuckets; b++) order[b] = 0;
+    for (ub4 i = 0; i < n; i++){
+        ub4 b = bucketOf(hashes[i], nbuckets);
+        members[offsets[b] + order[b]++] = i;
+    }
+    for (ub4 i = 0; i < n; i++) taken[i] = 0;
+
+    // 大桶先放：此时空位多，容易找到pilot
+    ub4 nordered = 0;
+    for (ub4 size = maxSize; size >= 1; size--){
+        for (ub4 b = 0; b < nbuckets; b++){
+            if (offsets[b + 1] - offsets[b] == size) order[nordered++] = b;
+        }
+    }
+    for (ub4 b = 0; b < nbuckets; b++) pilots[b] = 0;
+
+    ub8 maxAttempts = (ub8)n * 16 + 1024;
+    ub4 pos[kMaxBucketSize] = {};
+    for (ub4 k = 0; k < nordered; k++){
+        ub4 b = order[k];
+        ub4 begin = offsets[b], end = offsets[b + 1];
+        for (ub4 x = begin; x < end; x++){
+            for (ub4 y = begin; y < x; y++){
+                if (hashes[members[x]] == hashes[members[y]]) return false;
+            }
+        }
+        bool placed = false;
+        for (ub8 attempt = 0; attempt < maxAttempts && !placed; attempt++){
+            ub8 pilot = pilotValue(seed, attempt);
+            bool ok = true;
+            for (ub4 x = begin; x < end && ok; x++){
+                ub4 p = positionOf(hashes[members[x]], pilot, n);
+                if (taken[p]) ok = false;
+                for (ub4 y = begin; y < x && ok; y++){
+                    if (pos[y - begin] == p) ok = false;
+                }
+                pos[x - begin] = p;
+            }
+            if (!ok) continue;
+            for (ub4 x = begin; x < end; x++){
+                taken[pos[x - begin]] = 1;
+                slots[members[x]] = pos[x - begin];
+            }
+            pilots[b] = pilot;
+            placed = true;
+        }
+        if (!placed) return false;
+    }
+    return true;
+}
+
+}
+
+
+// 编译期构造的完美哈希表，键为字符串字面量，find返回键在原列表中的下标，不存在返回-1。
+//   static constexpr auto kCommands = makePerfectHash({"get", "set", "del"});
+//   switch (kCommands.find(name)){ case 0: ... }
+// 键重复时构造失败，常量求值中抛异常即为编译错误。
+template < size_t N >
+struct StaticPerfectHash{
+    static constexpr ub4 kBuckets = perfecthash::bucketsFor(N);
+
+    ub8                            seed = 0;
+    std::array<ub8, kBuckets>      pilots = {};
+    std::array<std::string_view, N> keys = {};   // 按位置排列
+    std::array<ub4, N>             ids = {};    // 位置上的键在原列表中的下标
+
+    constexpr sb4 find(std::string_view key) const {
+        if (!N) return -1;
+        ub8 h = perfecthash::hashBytes(key.data(), key.size(), seed);
+        ub4 pos = perfecthash::positionOf(h, pilots[perfecthash::bucketOf(h, kBuckets)], N);
+        return keys[pos] == key ? (sb4)ids[pos] : -1;
+    }
+
+    constexpr size_t size() const { return N; }
+};
+
+template < size_t N >
+constexpr StaticPerfectHash<N> makePerfectHash(const std::string_view (&keys)[N]){
+    StaticPerfectHash<N> table;
+    if (!N) return table;
+    constexpr ub4 nb = StaticPerfectHash<N>::kBuckets;
+    std::array<ub8, N> hashes = {};
+    std::array<ub4, N> slots = {};
+    std::array<ub4, nb + 1> offsets = {};
+    std::array<ub4, N> members = {};
+    std::array<ub4, nb> order = {};
+    std::array<ub1, N> taken = {};
+    for (ub4 s = 0; s < perfecthash::kMaxSeeds; s++){
+        ub8 seed = perfecthash::mix(s + 1);
+        for (ub4 i = 0; i < N; i++) hashes[i] = perfecthash::hashBytes(keys[i].data(), keys[i].size(), seed);
+        if (!perfecthash::build(hashes.data(), N, seed, table.pilots.data(), nb, slots.data(),
+                                offsets.data(), members.data(), order.data(), taken.data())) continue;
+        table.seed = seed;
+        for (ub4 i = 0; i < N; i++){
+            table.keys[slots[i]] = keys[i];
+            table.ids[slots[i]] = i;
+        }
+        return table;
+    }
+    throw std::invalid_argument("perfect hash: duplicate keys");
+}
+
+
+// 运行期构造，供启动时才加载的键集合。键的字节复制进Arena，构造后只读，可多线程并发find。
+class PerfectHash{
+public:
+    PerfectHash(const char* const* keys, const ub4* lens, ub4 n){ init(keys, lens, n); }
+
+    explicit PerfectHash(const std::vector<std::string>& keys){
+        std::vector<const char*> ptrs(keys.size());
+        std::vector<ub4> lens(keys.size());
+        for (size_t i = 0; i < keys.size(); i++){
+            ptrs[i] = keys[i].data();
+            lens[i] = (ub4)keys[i].size();
+        }
+        init(ptrs.data(), lens.data(), (ub4)keys.size());
+    }
+
+    // 返回键在构造时列表中的下标，不存在返回-1。
+    sb4 find(const char* key, ub4 len) const {
+        if (!n) return -1;
+        ub8 h = perfecthash::hashBytes(key, len, seed);
+        const Slot& slot = slots[perfecthash::positionOf(h, pilots[perfecthash::bucketOf(h, nbuckets)], n)];
+        return slot.len == len && (!len || std::memcmp(slot.key, key, len) == 0) ? (sb4)slot.id : -1;
+    }
+
+    sb4 find(std::string_view key) const { return find(key.data(), (ub4)key.size()); }
+
+    ub4 size() const { return n; }
+
+    // pilot与槽位表，不含Arena里的键字节。
+    ub8 memoryUsage() const { return pilots.size() * sizeof(ub8) + slots.size() * sizeof(Slot); }
+
+private:
+    PerfectHash(const PerfectHash&) = delete;
+    PerfectHash& operator=(const PerfectHash&) = delete;
+
+    struct Slot{
+        const char* key;
+        ub4         len;
+        ub4         id;
+    };
+
+    void init(const char* const* keys, const ub4* lens, ub4 count){
+        n = count;
+        if (!n) return;
+        nbuckets = perfecthash::bucketsFor(n);
+        pilots.resize(nbuckets);
+        slots.resize(n);
+        std::vector<ub8> hashes(n);
+        std::vector<ub4> pos(n), offsets(nbuckets + 1), members(n), order(nbuckets);
+        std::vector<ub1> taken(n);
+        for (ub4 s = 0; s < perfecthash::kMaxSeeds; s++){
+            seed = perfecthash::mix(s + 1);
+            for (ub4 i = 0; i < n; i++) hashes[i] = perfecthash::hashBytes(keys[i], lens[i], seed);
+            if (!perfecthash::build(hashes.data(), n, seed, pilots.data(), nbuckets, pos.data(),
+                                    offsets.data(), members.data(), order.data(), taken.data())) continue;
+            for (ub4 i = 0; i < n; i++){
+                char* p = lens[i] ? arena.alloc(lens[i]) : nullptr;
+                if (lens[i] && !p) throw std::runtime_error("perfect hash: arena alloc error");
+                if (lens[i]) std::memcpy(p, keys[i], lens[i]);
+                slots[pos[i]] = Slot{p, lens[i], i};
+            }
+            return;
+        }
+        throw std::invalid_argument("perfect hash: duplicate keys");
+    }
+
+    ub8               seed = 0;
+    ub4               n = 0;
+    ub4               nbuckets = 0;
+    std::vector<ub8>  pilots;
+    std::vector<Slot> slots;
+    Arena             arena;
+};
+
+}
@@ -26,9 +26,10 @@ public:
 
     void heapify(int index = 0){
         int root = index;
-        if (left(index) >= arr.size()) return;
+        int n = (int)arr.size();
+        if (left(index) >= n) return;
         if (less(left(index), root)) root = left(index);
-        if (less(right(index), root)) root = right(index);
+        if (right(index) < n && less(right(index), root)) root = right(index);
         if (root != index){
             swaparr(index, root);
             heapify(root);
@@ -40,6 +41,11 @@ public:
         insert(arr.size()-1, 0, value);
     }
 
+    const ValueType& top(){
+        if (arr.size() == 0) throw std::runtime_error("heap empty");
+        return arr[0];
+    }
+
     ValueType pop(){
         if (arr.size() == 0) throw std::runtime_error("heap empty");
         auto duh = arr[0];
@@ -84,6 +90,15 @@ public:
     inline bool empty() { return arr.empty(); }
 
 private:
+    // sift value at index up, but never above top
+    void insert(int index, int top, const ValueType& value){
+        while (index > top && lessPredicate(value, arr[parent(index)])){
+            arr[index] = arr[parent(index)];
+            index = parent(index);
+        }
+        arr[index] = value;
+    }
+
     static inline int left(int i) { return (i << 1) + 1; }
     static inline int right(int i) { return (i << 1) + 2; }
     static inline int parent(int i) { return (i - 1) >> 1; }
@@ -0,0 +1,423 @@
+#pragma once
+
+#include "common.h"
+#include "util/hashmap.h"
+#include "thread/scheduler.h"
+
+#include <algorithm>
+#include <type_traits>
+
+namespace wjp{
+
+// 定宽键的基数排序与哈希分区，三者共用同一个按桶分发（scatter）的趟：
+// 1. 输入按线程数切块，各块并行统计每个桶的计数；按“桶优先、块其次”求前缀和，
+//    得到每块在每个桶里的起始位置，结果与线程数无关，排序是稳定的。
+// 2. 各块并行分发，每块每个桶配一条cache line大小的写合并缓冲（malloc64，64字节对齐），
+//    攒满一整条line才写到目标，写出的cache line不会先被读进来；数据量超过
+//    kNonTemporalBytes时改用非临时写（movntdq）绕过cache，免得把cache冲掉。
+//    元素大小不能整除64，或目标没有按元素大小对齐时，退回逐个直接写。
+// 3. 某一趟所有元素落在同一个桶（如高位全为0）时跳过，不做搬运。
+// Scheduler为空或元素少于kParallelMin时单线程执行。元素须可平凡复制。
+namespace radix{
+
+static const ub4    kMaxBits = 10;            // 一趟最多2^10个桶，写合并缓冲每线程64KB
+static const size_t kParallelMin = 1 << 16;
+static const ub8    kNonTemporalBytes = 4 << 20;
+static const size_t kSmallSort = 64;          // 不到这么多个元素直接插入排序
+
+// 一整条cache line从写合并缓冲写到目标，dst与src都按64字节对齐。
+static inline void storeLine(void* dst, const void* src, bool nonTemporal){
+#ifdef WJP_X86_DISPATCH
+    if (nonTemporal){
+        auto d = (__m128i*)dst;
+        auto s = (const __m128i*)src;
+        _mm_stream_si128(d, _mm_load_si128(s));
+        _mm_stream_si128(d + 1, _mm_load_si128(s + 1));
+        _mm_stream_si128(d + 2, _mm_load_si128(s + 2));
+        _mm_stream_si128(d + 3, _mm_load_si128(s + 3));
+        return;
+    }
+#else
+    (void)nonTemporal;
+#endif
+    std::memcpy(dst, src, kCacheLineSize);
+}
+
+// 非临时写是弱序的，交给别的线程读之前要有sfence。
+static inline void storeFence(){
+#ifdef WJP_X86_DISPATCH
+    _mm_sfence();
+#endif
+}
+
+template < typename T >
+class Scatter{
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "radix scatter needs trivially copyable elements");
+
+    static const bool kCombine = kCacheLineSize % sizeof(T) == 0;
+    static const ub4  kPerLine = kCombine ? kCacheLineSize / sizeof(T) : 1;
+
+    explicit Scatter(Scheduler* sched) : sched(sched), nthreads(sched ? sched->size() : 1){}
+
+    ~Scatter(){ std::free(lines); }
+
+    // 把src[0, n)按digit(i)（src[i]所在的桶，小于2^bits）稳定地分发到dst，
+    // starts[b]为桶b在dst中的起点，starts[2^bits] == n。
+    // skipTrivial时若全部元素同桶则不搬运、返回false。
+    template < typename Digit >
+    bool pass(const T* src, T* dst, size_t n, ub4 bits, const Digit& digit, ub8* starts, bool skipTrivial){
+        const ub4 buckets = 1u << bits;
+        ub4 parts = sched && n >= kParallelMin ? nthreads : 1;
+        reserve(parts, buckets);
+        auto bounds = [n, parts](ub4 t){ return (size_t)((unsigned __int128)n * t / parts); };
+
+        run(parts, [&](ub4 t){
+            ub8* h = counts.data() + (size_t)t * 2 * buckets;
+            std::fill(h, h + buckets, 0);
+            for (size_t i = bounds(t), end = bounds(t + 1); i < end; i++) h[digit(i)]++;
+        });
+        ub8 pos = 0;
+        for (ub4 b = 0; b < buckets; b++){
+            starts[b] = pos;
+            if (skipTrivial){
+                ub8 total = 0;
+                for (ub4 t = 0; t < parts; t++) total += counts[(size_t)t * 2 * buckets + b];
+                if (total == n){
+                    for (ub4 r = b + 1; r <= buckets; r++) starts[r] = n;
+                    return false;
+                }
+            }
+            for (ub4 t = 0; t < parts; t++){
+                ub8* h = counts.data() + (size_t)t * 2 * buckets;
+                ub8 c = h[b];
+                h[b] = pos;              // 这一块在桶b里的起点
+                h[buckets + b] = pos;    // 这一块在桶b里的下一个写入位置
+                pos += c;
+            }
+        }
+        starts[buckets] = n;
+
+        bool combine = kCombine && ((uintptr_t)dst % sizeof(T)) == 0;
+        bool nonTemporal = (ub8)n * sizeof(T) >= kNonTemporalBytes;
+        run(parts, [&](ub4 t){
+            ub8* h = counts.data() + (size_t)t * 2 * buckets;
+            if (combine) scatterCombined(src, bounds(t), bounds(t + 1), dst, digit, h, h + buckets, buckets,
+                                         (T*)(lines + (size_t)t * buckets * kCacheLineSize), nonTemporal);
+            else scatterDirect(src, bounds(t), bounds(t + 1), dst, digit, h + buckets);
+        });
+        return true;
+    }
+
+    // 按块并行执行f(t)，t取[0, parts)。
+    template < typename F >
+    void run(ub4 parts, const F& f){
+        if (parts == 1) f(0);
+        else sched->parallelFor(0, parts, 1, [&](ub8 lo, ub8 hi){
+            for (ub8 t = lo; t < hi; t++) f((ub4)t);
+        });
+    }
+
+    ub4 threads() const { return nthreads; }
+
+private:
+    Scatter(const Scatter&) = delete;
+    Scatter& operator=(const Scatter&) = delete;
+
+    void reserve(ub4 parts, ub4 buckets){
+        counts.resize((size_t)parts * 2 * buckets);
+        ub8 bytes = (ub8)parts * buckets * kCacheLineSize;
+        if (bytes > lineBytes){
+            std::free(lines);
+            lines = malloc64((ub4)bytes);
+            if (!lines) throw std::runtime_error("malloc64 error");
+            lineBytes = bytes;
+        }
+    }
+
+    // 元素在它所在cache line里的序号。
+    static inline ub4 slotOf(const T* p){ return (ub4)(((uintptr_t)p & (kCacheLineSize - 1)) / sizeof(T)); }
+
+    // first[b]是本块在桶b的起点，next[b]是下一个写入位置；line的第slotOf(dst + k)格暂存位置k。
+    // 整条line都归本块时一次写出，桶的第一条、最后一条line可能与别的桶或别的块共用，只写自己那几格。
+    template < typename Digit >
+    static void scatterCombined(const T* src, size_t lo, size_t hi, T* dst, const Digit& digit,
+                                const ub8* first, ub8* next, ub4 buckets, T* lines, bool nonTemporal){
+        for (size_t i = lo; i < hi; i++){
+            ub4 b = digit(i);
+            ub8 k = next[b]++;
+            T* line = lines + (size_t)b * kPerLine;
+            ub4 slot = slotOf(dst + k);
+            line[slot] = src[i];
+            if (slot != kPerLine - 1) continue;
+            ub8 lineBegin = k + 1 - kPerLine;
+            if (k + 1 >= kPerLine && lineBegin >= first[b]) storeLine(dst + lineBegin, line, nonTemporal);
+            else for (ub8 j = first[b]; j <= k; j++) dst[j] = line[slotOf(dst + j)];
+        }
+        for (ub4 b = 0; b < buckets; b++){
+            ub8 k = next[b];
+            ub4 pending = slotOf(dst + k);
+            if (k == first[b] || !pending) continue;
+            ub8 from = k >= first[b] + pending ? k - pending : first[b];
+            T* line = lines + (size_t)b * kPerLine;
+            for (ub8 j = from; j < k; j++) dst[j] = line[slotOf(dst + j)];
+        }
+        if (nonTemporal) storeFence();
+    }
+
+    template < typename Digit >
+    static void scatterDirect(const T* src, size_t lo, size_t hi, T* dst, const Digit& digit, ub8* next){
+        for (size_t i = lo; i < hi; i++) dst[next[digit(i)]++] = src[i];
+    }
+
+    Scheduler*       sched;
+    ub4              nthreads;
+    std::vector<ub8> counts;       // 每块2 * buckets个：起点与下一个写入位置
+    char*            lines = nullptr;
+    ub8              lineBytes = 0;
+};
+
+// 大块的临时数组，页对齐，只增不减。
+template < typename T >
+class Scratch{
+public:
+    Scratch() = default;
+
+    ~Scratch(){ std::free(data); }
+
+    T* reserve(size_t n){
+        if (n > capacity){
+            std::free(data);
+            data = (T*)mallocPage((ub8)n * sizeof(T));
+            if (!data) throw std::runtime_error("mallocPage error");
+            capacity = n;
+        }
+        return data;
+    }
+
+private:
+    Scratch(const Scratch&) = delete;
+    Scratch& operator=(const Scratch&) = delete;
+
+    T*     data = nullptr;
+    size_t capacity = 0;
+};
+
+}
+
+
+// 整数键：无符号数就是自身，有符号数翻转符号位后按无符号比较，顺序不变。
+template < typename T >
+struct RadixKey{
+    typedef typename std::make_unsigned<T>::type Key;
+
+    Key operator()(const T& x) const {
+        return std::is_signed<T>::value ? (Key)((Key)x ^ ((Key)1 << (8 * sizeof(T) - 1))) : (Key)x;
+    }
+};
+
+// LSD基数排序，稳定，每趟8位，从低字节到高字节。KeyOf(const T&)返回无符号整数键，
+// 可以是记录里的一个字段：
+//   struct Row{ ub8 key; ub8 value; };
+//   RadixSorter<Row, RowKey> sorter(&scheduler);
+//   sorter.sort(rows, n);
+// 临时数组与写合并缓冲在sorter里复用，流水线里反复排序同样大小的批次不再分配。
+// 同一时刻只能有一个线程调用sort。
+template < typename T, typename KeyOf = RadixKey<T> >
+class RadixSorter{
+public:
+    typedef typename std::decay<decltype(std::declval<KeyOf>()(std::declval<const T&>()))>::type Key;
+    static_assert(std::is_unsigned<Key>::value, "radix key must be an unsigned integer");
+
+    explicit RadixSorter(Scheduler* sched = nullptr, KeyOf keyOf = KeyOf()) : keyOf(keyOf), scatter(sched){}
+
+    void sort(T* data, size_t n){
+        if (n <= radix::kSmallSort){
+            insertionSort(data, n);
+            return;
+        }
+        T* src = data;
+        T* dst = scratch.reserve(n);
+        ub8 starts[256 + 1];
+        for (ub4 shift = 0; shift < 8 * sizeof(Key); shift += 8){
+            const T* in = src;
+            auto digit = [in, shift, this](size_t i){ return (ub4)(keyOf(in[i]) >> shift) & 0xff; };
+            if (scatter.pass(src, dst, n, 8, digit, starts, true)) std::swap(src, dst);
+        }
+        if (src != data){
+            ub4 parts = n >= radix::kParallelMin ? scatter.threads() : 1;
+            scatter.run(parts, [&](ub4 t){
+                size_t lo = n * t / parts, hi = n * (t + 1) / parts;
+                cpuKernels().copy(data + lo, src + lo, (hi - lo) * sizeof(T));
+            });
+        }
+    }
+
+private:
+    RadixSorter(const RadixSorter&) = delete;
+    RadixSorter& operator=(const RadixSorter&) = delete;
+
+    void insertionSort(T* data, size_t n){
+        for (size_t i = 1; i < n; i++){
+            T x = data[i];
+            Key k = keyOf(x);
+            size_t j = i;
+            for (; j > 0 && keyOf(data[j - 1]) > k; j--) data[j] = data[j - 1];
+            data[j] = x;
+        }
+    }
+
+    KeyOf                keyOf;
+    radix::Scatter<T>    scatter;
+    radix::Scratch<T>    scratch;
+};
+
+// 定长字节键的MSD基数排序，按键字节的字典序（memcmp序），稳定。
+// 键是每个记录里[keyOffset, keyOffset + keyLen)这段字节，如定长的字符串主键、大端编码的复合键。
+// 最高字节一趟并行分发，之后256个桶作为独立任务交给Scheduler，各自单线程递归，
+// 每层在数据与临时数组之间来回搬；桶小于kSmallSort时改用插入排序。
+template < typename T >
+class ByteRadixSorter{
+public:
+    ByteRadixSorter(ub4 keyOffset, ub4 keyLen, Scheduler* sched = nullptr)
+        : keyOffset(keyOffset), keyLen(keyLen), sched(sched), scatter(sched){
+        if (keyOffset + keyLen > sizeof(T)) throw std::invalid_argument("radix: key exceeds the record");
+    }
+
+    void sort(T* data, size_t n){
+        if (n <= radix::kSmallSort){
+            insertionSort(data, 0, n, 0);
+            return;
+        }
+        tmp = scratch.reserve(n);
+        ub8 starts[256 + 1];
+        ub4 depth = 0;
+        for (; depth < keyLen; depth++){
+            auto digit = [data, depth, this](size_t i){ return (ub4)byteAt(data[i], depth); };
+            if (scatter.pass(data, tmp, n, 8, digit, starts, true)) break;
+        }
+        if (depth == keyLen) return; // 键全部相同
+        auto bucket = [&](ub8 b){ sortRange(tmp, data, starts[b], starts[b + 1], depth + 1); };
+        if (sched && n >= radix::kParallelMin){
+            sched->parallelFor(0, 256, 1, [&](ub8 lo, ub8 hi){ for (ub8 b = lo; b < hi; b++) bucket(b); });
+        }else{
+            for (ub4 b = 0; b < 256; b++) bucket(b);
+        }
+    }
+
+private:
+    ByteRadixSorter(const ByteRadixSorter&) = delete;
+    ByteRadixSorter& operator=(const ByteRadixSorter&) = delete;
+
+    inline ub1 byteAt(const T& x, ub4 depth) const { return ((const ub1*)&x)[keyOffset + depth]; }
+
+    inline int compareFrom(const T& a, const T& b, ub4 depth) const {
+        return std::memcmp((const ub1*)&a + keyOffset + depth, (const ub1*)&b + keyOffset + depth, keyLen - depth);
+    }
+
+    void insertionSort(T* data, size_t lo, size_t hi, ub4 depth){
+        if (depth >= keyLen) return;
+        for (size_t i = lo + 1; i < hi; i++){
+            T x = data[i];
+            size_t j = i;
+            for (; j > lo && compareFrom(data[j - 1], x, depth) > 0; j--) data[j] = data[j - 1];
+            data[j] = x;
+        }
+    }
+
+    // [lo, hi)目前在cur里，前depth个字节已有序；排好后须落在out（原数组）里。
+    // cur与other在两个数组之间交替，other不是out时，下一层的结果还会再搬回来。
+    void sortRange(T* cur, T* out, size_t lo, size_t hi, ub4 depth){
+        if (lo == hi) return;
+        if (hi - lo <= radix::kSmallSort || depth >= keyLen){
+            if (cur != out) std::memcpy(out + lo, cur + lo, (hi - lo) * sizeof(T));
+            insertionSort(out, lo, hi, depth);
+            return;
+        }
+        ub8 counts[256] = {};
+        for (size_t i = lo; i < hi; i++) counts[byteAt(cur[i], depth)]++;
+        for (ub4 b = 0; b < 256; b++){
+            if (counts[b] == hi - lo){
+                sortRange(cur, out, lo, hi, depth + 1);
+                return;
+            }
+        }
+        T* other = cur == out ? tmp : out;
+        ub8 next[256], pos = lo;
+        for (ub4 b = 0; b < 256; b++){
+            next[b] = pos;
+            pos += counts[b];
+        }
+        for (size_t i = lo; i < hi; i++) other[next[byteAt(cur[i], depth)]++] = cur[i];
+        pos = lo;
+        for (ub4 b = 0; b < 256; b++){
+            sortRange(other, out, pos, pos + counts[b], depth + 1);
+            pos += counts[b];
+        }
+    }
+
+    ub4                 keyOffset;
+    ub4                 keyLen;
+    Scheduler*          sched;
+    radix::Scatter<T>   scatter;
+    radix::Scratch<T>   scratch;
+    T*                  tmp = nullptr;  // 本次sort的临时数组
+};
+
+// 键的哈希分区：按哈希的高位把记录分到2^bits个分区，每个分区小到能放进cache，
+// 之后各分区可以并行、各自在cache里建哈希表（如每个分区一个Hashmap），彼此不用同步。
+// 分区用哈希高位，Hashmap取桶用低位，两者互不相关，分区内部的桶分布仍然均匀。
+// 哈希默认是Hashmap同款的siphash，对键的字节求值；KeyOf(const T&)返回参与哈希的键。
+// 每个记录的哈希只算一次，只把分区号（2字节）存在内部数组里，统计与分发时直接取用。
+template < typename T, typename KeyOf = RadixKey<T>, typename Hash = SipHash >
+class HashPartitioner{
+public:
+    explicit HashPartitioner(Scheduler* sched = nullptr, KeyOf keyOf = KeyOf(), Hash hash = Hash())
+        : keyOf(keyOf), hash(hash), scatter(sched){}
+
+    // 让每个分区大约targetBytes（默认按L2取256KB）所需的位数，不超过radix::kMaxBits。
+    static ub4 bitsFor(size_t n, ub8 targetBytes = 256 << 10){
+        ub4 bits = 0;
+        while (bits < radix::kMaxBits && ((ub8)n * sizeof(T) >> bits) > targetBytes) bits++;
+        return bits;
+    }
+
+    // src[0, n)分区写到dst；返回的offsets有2^bits + 1项，分区p为dst[offsets[p], offsets[p + 1])。
+    // 分区内保持src中的相对顺序。bits为0时按bitsFor(n)选。
+    const std::vector<ub8>& partition(const T* src, size_t n, T* dst, ub4 bits = 0){
+        if (!bits) bits = bitsFor(n);
+        if (bits > radix::kMaxBits) throw std::invalid_argument("radix: too many partition bits");
+        offsets.assign(((size_t)1 << bits) + 1, 0);
+        if (!n) return offsets;
+        if (!bits){
+            std::memcpy(dst, src, n * sizeof(T));
+            offsets[1] = n;
+            return offsets;
+        }
+        ub2* digits = partitionOf.reserve(n);
+        ub4 shift = 64 - bits;
+        ub4 parts = n >= radix::kParallelMin ? scatter.threads() : 1;
+        scatter.run(parts, [&](ub4 t){
+            for (size_t i = n * t / parts, end = n * (t + 1) / parts; i < end; i++){
+                auto key = keyOf(src[i]);
+                digits[i] = (ub2)(hash((const ub1*)&key, sizeof(key)) >> shift);
+            }
+        });
+        scatter.pass(src, dst, n, bits, [digits](size_t i){ return (ub4)digits[i]; }, offsets.data(), false);
+        return offsets;
+    }
+
+    const std::vector<ub8>& lastOffsets() const { return offsets; }
+
+private:
+    HashPartitioner(const HashPartitioner&) = delete;
+    HashPartitioner& operator=(const HashPartitioner&) = delete;
+
+    KeyOf                 keyOf;
+    Hash                  hash;
+    radix::Scatter<T>     scatter;
+    radix::Scratch<ub2>   partitionOf;
+    std::vector<ub8>      offsets;
+};
+
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "common.h"
+
+#include <new>
+#include <utility>
+
+namespace wjp{
+
+// 单生产者单消费者有界环形队列。
+// 1. head只由消费者写，tail只由生产者写，各占一个cache line，互不干扰。
+// 2. 双方各自缓存对方的位置，只在看起来满/空时才去读对方的cache line。
+// 3. push_n/pop_n一次发布一批，整批只有一次release写。
+template < typename T >
+class SpscRing{
+public:
+    explicit SpscRing(ub4 capacity){
+        cap = roundUpPowerOf2(capacity < 2 ? 2 : capacity);
+        mask = cap - 1;
+        slots = (T*) malloc64(sizeof(T) * cap);
+        if (!slots) throw std::runtime_error("malloc64 error");
+    }
+
+    ~SpscRing(){
+        ub8 t = tail.value.load(std::memory_order_relaxed);
+        for (ub8 h = head.value.load(std::memory_order_relaxed); h != t; h++) slots[h & mask].~T();
+        std::free(slots);
+    }
+
+    template < typename U >
+    bool push(U&& value){
+        ub8 t = tail.value.load(std::memory_order_relaxed);
+        if (t - tail.cachedOther >= cap){
+            tail.cachedOther = head.value.load(std::memory_order_acquire);
+            if (t - tail.cachedOther >= cap) return false;
+        }
+        new(&slots[t & mask]) T(std::forward<U>(value));
+        tail.value.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& out){
+        ub8 h = head.value.load(std::memory_order_relaxed);
+        if (h == head.cachedOther){
+            head.cachedOther = tail.value.load(std::memory_order_acquire);
+            if (h == head.cachedOther) return false;
+        }
+        T* slot = &slots[h & mask];
+        out = std::move(*slot);
+        slot->~T();
+        head.value.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 尽量压入n个，返回实际压入数。
+    ub4 push_n(const T* items, ub4 n){
+        ub8 t = tail.value.load(std::memory_order_relaxed);
+        ub8 room = cap - (t - tail.cachedOther);
+        if (room < n){
+            tail.cachedOther = head.value.load(std::memory_order_acquire);
+            room = cap - (t - tail.cachedOther);
+        }
+        if (n > room) n = (ub4)room;
+        for (ub4 i = 0; i < n; i++) new(&slots[(t + i) & mask]) T(items[i]);
+        if (n) tail.value.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // 尽量弹出n个，返回实际弹出数。
+    ub4 pop_n(T* out, ub4 n){
+        ub8 h = head.value.load(std::memory_order_relaxed);
+        ub8 avail = head.cachedOther - h;
+        if (avail < n){
+            head.cachedOther = tail.value.load(std::memory_order_acquire);
+            avail = head.cachedOther - h;
+        }
+        if (n > avail) n = (ub4)avail;
+        for (ub4 i = 0; i < n; i++){
+            T* slot = &slots[(h + i) & mask];
+            out[i] = std::move(*slot);
+            slot->~T();
+        }
+        if (n) head.value.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    ub4 capacity() const { return cap; }
+
+    // 并发时只是近似值。
+    ub4 size() const {
+        return (ub4)(tail.value.load(std::memory_order_acquire) - head.value.load(std::memory_order_acquire));
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    struct alignas(kCacheLineSize) Cursor{
+        std::atomic<ub8> value{0};
+        ub8 cachedOther = 0; // 本方缓存的对方位置
+    };
+
+    Cursor head; // 消费者
+    Cursor tail; // 生产者
+    T*     slots;
+    ub4    cap;
+    ub4    mask;
+};
+
+// 多生产者多消费者有界环形队列（Vyukov）。
+// 每个槽带序号seq：seq == pos表示可写，seq == pos + 1表示可读，
+// 生产者与消费者各自CAS抢占位置，之后只与自己抢到的槽打交道。
+// 槽按cache line对齐，相邻槽上的并发读写不会伪共享。
+template < typename T >
+class MpmcRing{
+public:
+    explicit MpmcRing(ub4 capacity){
+        cap = roundUpPowerOf2(capacity < 2 ? 2 : capacity);
+        mask = cap - 1;
+        slots = (Slot*) malloc64(sizeof(Slot) * cap);
+        if (!slots) throw std::runtime_error("malloc64 error");
+        for (ub4 i = 0; i < cap; i++) new(&slots[i].seq) std::atomic<ub8>(i);
+    }
+
+    // 析构时不应再有并发访问，剩余元素原地析构。
+    ~MpmcRing(){
+        ub8 end = enqueuePos.value.load(std::memory_order_relaxed);
+        for (ub8 pos = dequeuePos.value.load(std::memory_order_relaxed); pos != end; pos++){
+            Slot& slot = slots[pos & mask];
+            if (slot.seq.load(std::memory_order_relaxed) == pos + 1) slot.storage()->~T();
+        }
+        std::free(slots);
+    }
+
+    template < typename U >
+    bool push(U&& value){
+        ub8 pos = enqueuePos.value.load(std::memory_order_relaxed);
+        for (;;){
+            Slot& slot = slots[pos & mask];
+            ub8 seq = slot.seq.load(std::memory_order_acquire);
+            sb8 diff = (sb8)(seq - pos);
+            if (diff == 0){
+                if (enqueuePos.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    new(slot.storage()) T(std::forward<U>(value));
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }else if (diff < 0){
+                return false; // 满
+            }else{
+                pos = enqueuePos.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& out){
+        ub8 pos = dequeuePos.value.load(std::memory_order_relaxed);
+        for (;;){
+            Slot& slot = slots[pos & mask];
+            ub8 seq = slot.seq.load(std::memory_order_acquire);
+            sb8 diff = (sb8)(seq - (pos + 1));
+            if (diff == 0){
+                if (dequeuePos.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    T* value = slot.storage();
+                    out = std::move(*value);
+                    value->~T();
+                    slot.seq.store(pos + cap, std::memory_order_release);
+                    return true;
+                }
+            }else if (diff < 0){
+                return false; // 空
+            }else{
+                pos = dequeuePos.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 一次CAS抢占连续k个可写槽，k为从pos起连续可写的槽数与n的较小值。
+    ub4 push_n(const T* items, ub4 n){
+        ub8 pos = enqueuePos.value.load(std::memory_order_relaxed);
+        for (;;){
+            ub4 k = 0;
+            while (k < n && slots[(pos + k) & mask].seq.load(std::memory_order_acquire) == pos + k) k++;
+            if (k == 0){
+                ub8 seq = slots[pos & mask].seq.load(std::memory_order_acquire);
+                if ((sb8)(seq - pos) < 0 || n == 0) return 0;
+                pos = enqueuePos.value.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (enqueuePos.value.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)){
+                for (ub4 i = 0; i < k; i++){
+                    Slot& slot = slots[(pos + i) & mask];
+                    new(slot.storage()) T(items[i]);
+                    slot.seq.store(pos + i + 1, std::memory_order_release);
+                }
+                return k;
+            }
+        }
+    }
+
+    ub4 pop_n(T* out, ub4 n){
+        ub8 pos = dequeuePos.value.load(std::memory_order_relaxed);
+        for (;;){
+            ub4 k = 0;
+            while (k < n && slots[(pos + k) & mask].seq.load(std::memory_order_acquire) == pos + k + 1) k++;
+            if (k == 0){
+                ub8 seq = slots[pos & mask].seq.load(std::memory_order_acquire);
+                if ((sb8)(seq - (pos + 1)) < 0 || n == 0) return 0;
+                pos = dequeuePos.value.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (dequeuePos.value.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)){
+                for (ub4 i = 0; i < k; i++){
+                    Slot& slot = slots[(pos + i) & mask];
+                    T* value = slot.storage();
+                    out[i] = std::move(*value);
+                    value->~T();
+                    slot.seq.store(pos + i + cap, std::memory_order_release);
+                }
+                return k;
+            }
+        }
+    }
+
+    ub4 capacity() const { return cap; }
+
+    // 并发时只是近似值。
+    ub4 size() const {
+        ub8 e = enqueuePos.value.load(std::memory_order_acquire);
+        ub8 d = dequeuePos.value.load(std::memory_order_acquire);
+        return e > d ? (ub4)(e - d) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    MpmcRing(const MpmcRing&) = delete;
+    MpmcRing& operator=(const MpmcRing&) = delete;
+
+    struct alignas(kCacheLineSize) Slot{
+        std::atomic<ub8> seq;
+        alignas(T) char data[sizeof(T)];
+        inline T* storage(){ return (T*)data; }
+    };
+
+    struct alignas(kCacheLineSize) Cursor{
+        std::atomic<ub8> value{0};
+    };
+
+    Cursor enqueuePos;
+    Cursor dequeuePos;
+    Slot*  slots;
+    ub4    cap;
+    ub4    mask;
+};
+
+}
@@ -0,0 +1,498 @@
+#pragma once
+
+#include "common.h"
+#include "util/hashmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace wjp{
+
+// 流式概要：用固定的几KB内存近似回答"有多少个不同的key"和"某个key出现了多少次"，
+// 代替按key精确计数的Hashmap。三者都只需每个元素一次64位哈希（默认siphash），
+// 已有哈希值（如StringInterner::hashOf）时可直接走addHash，不再碰字节。
+// 同参数的概要可以merge，序列化格式为头部加原始数据（主机字节序），供各worker汇总。
+
+// HyperLogLog：2^p个6位寄存器（每个占一字节），标准误差约1.04/sqrt(2^p)。
+// 1. 哈希高p位选寄存器，其余位的前导零数+1为rho，寄存器保留最大的rho。
+// 2. 基数小时用稀疏表示：(寄存器号 << 6 | rho)的有序ub4数组，新元素先进未排序缓冲，
+//    攒够一批再排序归并；稀疏数组超过稠密大小的一半就转成稠密。
+// 3. 估计：稀疏时用线性计数；稠密时用调和平均，小基数（E <= 2.5m且有空寄存器）回退到线性计数。
+//    64位哈希不需要大基数修正。
+// 4. 稠密合并是逐字节取max，走分派表的maxBytes。
+template < typename Hash = SipHash >
+class HyperLogLog{
+public:
+    static const ub4 kMinPrecision = 4;
+    static const ub4 kMaxPrecision = 18;
+
+    explicit HyperLogLog(ub4 precision = 14) : p(precision){
+        if (p < kMinPrecision || p > kMaxPrecision) throw std::invalid_argument("hyperloglog: precision must be in [4, 18]");
+    }
+
+    ~HyperLogLog(){
+        std::free(registers);
+    }
+
+    HyperLogLog(HyperLogLog&& rhs) : p(rhs.p), registers(rhs.registers), sparse(std::move(rhs.sparse)), pending(std::move(rhs.pending)){
+        rhs.registers = nullptr;
+    }
+
+    inline ub8 hash(const void* data, ub4 len){ return hasher((const ub1*)data, len); }
+
+    void add(const void* data, ub4 len){ addHash(hash(data, len)); }
+
+    void addHash(ub8 h){
+        ub4 index = (ub4)(h >> (64 - p));
+        ub1 rho = rhoOf(h);
+        if (registers){
+            if (registers[index] < rho) registers[index] = rho;
+            return;
+        }
+        pending.push_back(index << 6 | rho);
+        if (pending.size() >= pendingLimit()) flush();
+    }
+
+    void addBatch(const ub8* hashes, ub4 n){
+        for (ub4 i = 0; i < n; i++) addHash(hashes[i]);
+    }
+
+    // 精度须相同。
+    void merge(const HyperLogLog& other){
+        if (other.p != p) throw std::invalid_argument("hyperloglog: precision mismatch");
+        if (!other.registers){
+            for (ub4 e : other.sparse) addEncoded(e);
+            for (ub4 e : other.pending) addEncoded(e);
+            return;
+        }
+        if (!registers) toDense();
+        cpuKernels().maxBytes(registers, other.registers, nrregisters());
+    }
+
+    double estimate(){
+        double m = nrregisters();
+        if (!registers) flush(); // 可能转成稠密
+        if (!registers) return m * std::log(m / (m - sparse.size()));
+        double sum = 0;
+        ub4 zeros = 0;
+        for (ub4 i = 0; i < nrregisters(); i++){
+            sum += std::ldexp(1.0, -registers[i]);
+            zeros += registers[i] == 0;
+        }
+        double e = alpha() * m * m / sum;
+        if (e <= 2.5 * m && zeros) return m * std::log(m / zeros);
+        return e;
+    }
+
+    bool isSparse() const { return registers == nullptr; }
+
+    ub4 precision() const { return p; }
+
+    ub8 memoryUsage() const {
+        return registers ? nrregisters() : (sparse.capacity() + pending.capacity()) * sizeof(ub4);
+    }
+
+    // 序列化格式：magic、精度、是否稀疏、稀疏项数，随后为稀疏项或全部寄存器。
+    std::vector<char> serialize(){
+        if (!registers) flush();
+        Header header{kMagic, p, registers ? 0u : 1u, registers ? 0u : (ub4)sparse.size()};
+        size_t body = registers ? nrregisters() : sparse.size() * sizeof(ub4);
+        std::vector<char> out(sizeof(header) + body);
+        std::memcpy(out.data(), &header, sizeof(header));
+        if (body) std::memcpy(out.data() + sizeof(header), registers ? (const void*)registers : (const void*)sparse.data(), body);
+        return out;
+    }
+
+    static HyperLogLog deserialize(const char* data, size_t len){
+        Header header;
+        if (len < sizeof(header)) throw std::runtime_error("hyperloglog: truncated header");
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != kMagic || header.p < kMinPrecision || header.p > kMaxPrecision || header.sparse > 1)
+            throw std::runtime_error("hyperloglog: bad header");
+        HyperLogLog hll(header.p);
+        data += sizeof(header);
+        len -= sizeof(header);
+        if (header.sparse){
+            if (len != (size_t)header.count * sizeof(ub4)) throw std::runtime_error("hyperloglog: bad length");
+            hll.sparse.resize(header.count);
+            if (len) std::memcpy(hll.sparse.data(), data, len);
+            for (ub4 i = 0; i < header.count; i++){
+                if ((hll.sparse[i] >> 6) >= hll.nrregisters() || (i && hll.sparse[i] <= hll.sparse[i - 1]))
+                    throw std::runtime_error("hyperloglog: bad sparse entry");
+            }
+        }else{
+            if (len != hll.nrregisters()) throw std::runtime_error("hyperloglog: bad length");
+            hll.toDense();
+            std::memcpy(hll.registers, data, len);
+        }
+        return hll;
+    }
+
+private:
+    HyperLogLog(const HyperLogLog&) = delete;
+    HyperLogLog& operator=(const HyperLogLog&) = delete;
+
+    struct Header{
+        ub4 magic;
+        ub4 p;
+        ub4 sparse;
+        ub4 count;
+    };
+
+    static const ub4 kMagic = 0x484c4c31; // "HLL1"
+
+    inline ub4 nrregisters() const { return 1u << p; }
+
+    inline ub4 pendingLimit() const { return std::max<ub4>(nrregisters() >> 5, 16); }
+
+    // 低64-p位的前导零数+1；补一个哨兵位，全零时rho为64-p+1。
+    inline ub1 rhoOf(ub8 h) const {
+        ub8 w = (h << p) | ((ub8)1 << (p - 1));
+        return (ub1)(__builtin_clzll(w) + 1);
+    }
+
+    void addEncoded(ub4 e){
+        if (registers){
+            ub4 index = e >> 6;
+            ub1 rho = e & 63;
+            if (registers[index] < rho) registers[index] = rho;
+            return;
+        }
+        pending.push_back(e);
+        if (pending.size() >= pendingLimit()) flush();
+    }
+
+    // 把缓冲排序后并入稀疏数组，同一寄存器只留最大的rho；太大则转稠密。
+    void flush(){
+        if (pending.empty()) return;
+        std::sort(pending.begin(), pending.end());
+        std::vector<ub4> merged;
+        merged.reserve(sparse.size() + pending.size());
+        std::merge(sparse.begin(), sparse.end(), pending.begin(), pending.end(), std::back_inserter(merged));
+        pending.clear();
+        // 有序后同一寄存器的项相邻且rho递增，保留每段的最后一个
+        ub4 out = 0;
+        for (ub4 i = 0; i < merged.size(); i++){
+            if (out && (merged[out - 1] >> 6) == (merged[i] >> 6)) merged[out - 1] = merged[i];
+            else merged[out++] = merged[i];
+        }
+        merged.resize(out);
+        sparse.swap(merged);
+        if (sparse.size() * sizeof(ub4) > nrregisters() / 2) toDense();
+    }
+
+    void toDense(){
+        registers = (ub1*) malloc64(nrregisters());
+        if (!registers) throw std::runtime_error("malloc64 error");
+        std::memset(registers, 0, nrregisters());
+        std::vector<ub4> entries;
+        entries.swap(sparse);
+        entries.insert(entries.end(), pending.begin(), pending.end());
+        std::vector<ub4>().swap(pending);
+        for (ub4 e : entries) addEncoded(e);
+    }
+
+    double alpha() const {
+        switch (p){
+        case 4: return 0.673;
+        case 5: return 0.697;
+        case 6: return 0.709;
+        default: return 0.7213 / (1 + 1.079 / nrregisters());
+        }
+    }
+
+    ub4              p;
+    ub1*             registers = nullptr; // 稠密时非空
+    std::vector<ub4> sparse;              // 有序、每个寄存器至多一项
+    std::vector<ub4> pending;             // 未排序的新项
+    Hash             hasher;
+};
+
+
+// 概要的行下标：一次64位哈希经双重哈希派生出第row行的64位值，高位作列号，再低一位作符号。
+static inline ub8 sketchRowHash(ub8 h, ub4 row){
+    ub8 h2 = (h >> 32 | h << 32) | 1;
+    return (h + row * h2) * UB8(0x9e3779b9, 0x7f4a7c15);
+}
+
+
+// Count-Min：depth行、每行width个ub4计数器（width取2的幂），估计值只会偏大，
+// 误差不超过总计数的e/width，概率至少1 - e^-depth。
+// 保守更新（默认开启）时只把d个计数器里不足min+count的抬到min+count，偏大显著减少，
+// 但此后只能加不能减。addHash返回加完后的估计，便于调用方顺手判断重点项（heavy hitter）。
+// 计数器饱和在2^32-1。
+template < typename Hash = SipHash >
+class CountMinSketch{
+public:
+    static const ub4 kMaxDepth = 16;
+
+    CountMinSketch(ub4 width, ub4 depth, bool conservative = true) : depth(depth), conservative(conservative){
+        if (!depth || depth > kMaxDepth) throw std::invalid_argument("count-min: depth must be in [1, 16]");
+        init(roundUpPowerOf2(width < 16 ? 16 : width));
+    }
+
+    // 按误差定尺寸：估计值超出真值epsilon*总数的概率不超过delta。
+    static CountMinSketch withError(double epsilon, double delta, bool conservative = true){
+        if (!(epsilon > 0 && epsilon < 1) || !(delta > 0 && delta < 1)) throw std::invalid_argument("count-min: bad error bounds");
+        ub4 width = (ub4)std::ceil(std::exp(1.0) / epsilon);
+        ub4 depth = (ub4)std::ceil(std::log(1 / delta));
+        return CountMinSketch(width, std::min<ub4>(std::max<ub4>(depth, 1), +kMaxDepth), conservative);
+    }
+
+    ~CountMinSketch(){
+        std::free(counters);
+    }
+
+    CountMinSketch(CountMinSketch&& rhs) : counters(rhs.counters), widthShift(rhs.widthShift), depth(rhs.depth),
+                                           conservative(rhs.conservative), total(rhs.total){
+        rhs.counters = nullptr;
+    }
+
+    inline ub8 hash(const void* data, ub4 len){ return hasher((const ub1*)data, len); }
+
+    ub4 add(const void* data, ub4 len, ub4 count = 1){ return addHash(hash(data, len), count); }
+
+    ub4 addHash(ub8 h, ub4 count = 1){
+        ub4* cells[kMaxDepth];
+        total += count;
+        ub4 min = ~(ub4)0;
+        for (ub4 r = 0; r < depth; r++){
+            cells[r] = cell(h, r);
+            min = std::min(min, *cells[r]);
+        }
+        ub4 target = saturatingAdd(min, count);
+        for (ub4 r = 0; r < depth; r++){
+            if (conservative){
+                if (*cells[r] < target) *cells[r] = target;
+            }else *cells[r] = saturatingAdd(*cells[r], count);
+        }
+        return target;
+    }
+
+    ub4 estimate(const void* data, ub4 len){ return estimateHash(hash(data, len)); }
+
+    ub4 estimateHash(ub8 h) const {
+        ub4 min = ~(ub4)0;
+        for (ub4 r = 0; r < depth; r++) min = std::min(min, *cell(h, r));
+        return min;
+    }
+
+    // 批量更新：先预取后面第kLookahead个元素的各行计数器，访存延迟互相重叠。
+    void addBatch(const ub8* hashes, ub4 n, ub4 count = 1){
+        static const ub4 kLookahead = 8;
+        for (ub4 i = 0; i < n; i++){
+            if (i + kLookahead < n){
+                for (ub4 r = 0; r < depth; r++) __builtin_prefetch(cell(hashes[i + kLookahead], r));
+            }
+            addHash(hashes[i], count);
+        }
+    }
+
+    void estimateBatch(const ub8* hashes, ub4 n, ub4* out) const {
+        static const ub4 kLookahead = 8;
+        for (ub4 i = 0; i < n; i++){
+            if (i + kLookahead < n){
+                for (ub4 r = 0; r < depth; r++) __builtin_prefetch(cell(hashes[i + kLookahead], r));
+            }
+            out[i] = estimateHash(hashes[i]);
+        }
+    }
+
+    // 逐格相加。两边都是保守更新时结果仍是真值的上界，只是不再"保守"。
+    void merge(const CountMinSketch& other){
+        if (other.widthShift != widthShift || other.depth != depth) throw std::invalid_argument("count-min: shape mismatch");
+        ub8 n = (ub8)depth << widthShift;
+        for (ub8 i = 0; i < n; i++) counters[i] = saturatingAdd(counters[i], other.counters[i]);
+        total += other.total;
+    }
+
+    // 已加入的总计数，用于按比例判断重点项。
+    ub8 totalCount() const { return total; }
+
+    ub4 width() const { return 1u << widthShift; }
+
+    ub4 nrrows() const { return depth; }
+
+    ub8 memoryUsage() const { return ((ub8)depth << widthShift) * sizeof(ub4); }
+
+    // 序列化格式：magic、列数的对数、行数、是否保守、总计数，随后为原始计数器。
+    std::vector<char> serialize() const {
+        Header header{kMagic, widthShift, depth, conservative ? 1u : 0u, total};
+        std::vector<char> out(sizeof(header) + memoryUsage());
+        std::memcpy(out.data(), &header, sizeof(header));
+        std::memcpy(out.data() + sizeof(header), counters, memoryUsage());
+        return out;
+    }
+
+    static CountMinSketch deserialize(const char* data, size_t len){
+        Header header;
+        if (len < sizeof(header)) throw std::runtime_error("count-min: truncated header");
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != kMagic || header.widthShift < 4 || header.widthShift > 30 || !header.depth || header.depth > kMaxDepth)
+            throw std::runtime_error("count-min: bad header");
+        CountMinSketch cms(1u << header.widthShift, header.depth, header.conservative != 0);
+        if (len != sizeof(header) + cms.memoryUsage()) throw std::runtime_error("count-min: bad length");
+        std::memcpy(cms.counters, data + sizeof(header), cms.memoryUsage());
+        cms.total = header.total;
+        return cms;
+    }
+
+private:
+    CountMinSketch(const CountMinSketch&) = delete;
+    CountMinSketch& operator=(const CountMinSketch&) = delete;
+
+    struct Header{
+        ub4 magic;
+        ub4 widthShift;
+        ub4 depth;
+        ub4 conservative;
+        ub8 total;
+    };
+
+    static const ub4 kMagic = 0x434d5331; // "CMS1"
+
+    void init(ub4 width){
+        widthShift = __builtin_ctz(width);
+        counters = (ub4*) malloc64(memoryUsage());
+        if (!counters) throw std::runtime_error("malloc64 error");
+        std::memset(counters, 0, memoryUsage());
+    }
+
+    static inline ub4 saturatingAdd(ub4 a, ub4 b){
+        ub4 c = a + b;
+        return c < a ? ~(ub4)0 : c;
+    }
+
+    inline ub4* cell(ub8 h, ub4 row) const {
+        return counters + ((ub8)row << widthShift) + (sketchRowHash(h, row) >> (64 - widthShift));
+    }
+
+    ub4* counters = nullptr;
+    ub4  widthShift = 0;
+    ub4  depth;
+    bool conservative;
+    ub8  total = 0;
+    Hash hasher;
+};
+
+
+// Count-Sketch：与Count-Min同形，但每行按哈希的一位决定加还是减，估计取各行的中位数。
+// 估计无偏、可正可负，误差与计数的二范数成正比，长尾分布下对中等频次的项比Count-Min准；
+// 支持负的增量（撤销）。计数器为sb4，不做饱和。
+template < typename Hash = SipHash >
+class CountSketch{
+public:
+    static const ub4 kMaxDepth = 15;
+
+    // depth取奇数，中位数才唯一。
+    CountSketch(ub4 width, ub4 depth = 5) : depth(depth | 1){
+        if (this->depth > kMaxDepth) throw std::invalid_argument("count sketch: depth must be at most 15");
+        init(roundUpPowerOf2(width < 16 ? 16 : width));
+    }
+
+    ~CountSketch(){
+        std::free(counters);
+    }
+
+    CountSketch(CountSketch&& rhs) : counters(rhs.counters), widthShift(rhs.widthShift), depth(rhs.depth){
+        rhs.counters = nullptr;
+    }
+
+    inline ub8 hash(const void* data, ub4 len){ return hasher((const ub1*)data, len); }
+
+    void add(const void* data, ub4 len, sb4 count = 1){ addHash(hash(data, len), count); }
+
+    void addHash(ub8 h, sb4 count = 1){
+        for (ub4 r = 0; r < depth; r++){
+            ub8 g = sketchRowHash(h, r);
+            counters[((ub8)r << widthShift) + (g >> (64 - widthShift))] += sign(g) * count;
+        }
+    }
+
+    void addBatch(const ub8* hashes, ub4 n, sb4 count = 1){
+        static const ub4 kLookahead = 8;
+        for (ub4 i = 0; i < n; i++){
+            if (i + kLookahead < n){
+                for (ub4 r = 0; r < depth; r++){
+                    __builtin_prefetch(counters + ((ub8)r << widthShift) + (sketchRowHash(hashes[i + kLookahead], r) >> (64 - widthShift)));
+                }
+            }
+            addHash(hashes[i], count);
+        }
+    }
+
+    sb4 estimate(const void* data, ub4 len){ return estimateHash(hash(data, len)); }
+
+    sb4 estimateHash(ub8 h) const {
+        sb4 v[kMaxDepth];
+        for (ub4 r = 0; r < depth; r++){
+            ub8 g = sketchRowHash(h, r);
+            v[r] = counters[((ub8)r << widthShift) + (g >> (64 - widthShift))] * sign(g);
+        }
+        std::nth_element(v, v + depth / 2, v + depth);
+        return v[depth / 2];
+    }
+
+    void merge(const CountSketch& other){
+        if (other.widthShift != widthShift || other.depth != depth) throw std::invalid_argument("count sketch: shape mismatch");
+        ub8 n = (ub8)depth << widthShift;
+        for (ub8 i = 0; i < n; i++) counters[i] += other.counters[i];
+    }
+
+    ub4 width() const { return 1u << widthShift; }
+
+    ub4 nrrows() const { return depth; }
+
+    ub8 memoryUsage() const { return ((ub8)depth << widthShift) * sizeof(sb4); }
+
+    // 序列化格式：magic、列数的对数、行数，随后为原始计数器。
+    std::vector<char> serialize() const {
+        Header header{kMagic, widthShift, depth};
+        std::vector<char> out(sizeof(header) + memoryUsage());
+        std::memcpy(out.data(), &header, sizeof(header));
+        std::memcpy(out.data() + sizeof(header), counters, memoryUsage());
+        return out;
+    }
+
+    static CountSketch deserialize(const char* data, size_t len){
+        Header header;
+        if (len < sizeof(header)) throw std::runtime_error("count sketch: truncated header");
+        std::memcpy(&header, data, sizeof(header));
+        if (header.magic != kMagic || header.widthShift < 4 || header.widthShift > 30 || !(header.depth & 1) || header.depth > kMaxDepth)
+            throw std::runtime_error("count sketch: bad header");
+        CountSketch cs(1u << header.widthShift, header.depth);
+        if (len != sizeof(header) + cs.memoryUsage()) throw std::runtime_error("count sketch: bad length");
+        std::memcpy(cs.counters, data + sizeof(header), cs.memoryUsage());
+        return cs;
+    }
+
+private:
+    CountSketch(const CountSketch&) = delete;
+    CountSketch& operator=(const CountSketch&) = delete;
+
+    struct Header{
+        ub4 magic;
+        ub4 widthShift;
+        ub4 depth;
+    };
+
+    static const ub4 kMagic = 0x43534b31; // "CSK1"
+
+    void init(ub4 width){
+        widthShift = __builtin_ctz(width);
+        counters = (sb4*) malloc64(memoryUsage());
+        if (!counters) throw std::runtime_error("malloc64 error");
+        std::memset(counters, 0, memoryUsage());
+    }
+
+    // 列号用了最高widthShift位（不超过30），符号取第32位，两者不重叠。
+    static inline sb4 sign(ub8 g){ return (g >> 32 & 1) ? 1 : -1; }
+
+    sb4* counters = nullptr;
+    ub4  widthShift = 0;
+    ub4  depth;
+    Hash hasher;
+};
+
+}
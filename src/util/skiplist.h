@@ -0,0 +1,157 @@
+#pragma once
+
+#include "common.h"
+#include "alloc/arena.h"
+
+namespace wjp{
+
+// 只增不删的有序跳表，节点从Arena里按实际高度一次分配，永不单独释放。
+// 1. 插入无锁：每层先把新节点的next指向后继，再对前驱的next做CAS；
+//    CAS失败说明有别的线程在同一位置插入，从原前驱出发重新定位这一层再试。
+//    自底向上逐层链入，节点一旦出现在第0层就对读者可见。
+// 2. 读者不加锁，只依赖next指针的acquire读；插入与读、插入与插入都可以并发。
+// 3. 键相等视为重复，insert返回false。
+// 4. Key不会被析构，应是指针或POD，变长的键值本身也放在同一个Arena里。
+// Alloc须提供线程安全的alloc(ub4)；只有单线程写入时可以用Arena。
+// Compare为int operator()(const Key&, const Key&)，语义同memcmp。
+template < typename Key, typename Compare, typename Alloc = ConcurrentArena >
+class SkipList{
+public:
+    static const ub4 kMaxHeight = 12;
+    static const ub4 kBranching = 4; // 每层约有1/kBranching的节点升入上一层
+
+private:
+    struct Node;
+
+public:
+    SkipList(Compare compare, Alloc& arena) : compare(compare), arena(arena){
+        head = newNode(Key(), kMaxHeight);
+        for (ub4 i = 0; i < kMaxHeight; i++) head->next[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    bool insert(const Key& key){
+        Node* prev[kMaxHeight];
+        Node* next[kMaxHeight];
+        ub4 height = randomHeight();
+        ub4 maxHeight = currentHeight.load(std::memory_order_relaxed);
+        while (height > maxHeight){
+            if (currentHeight.compare_exchange_weak(maxHeight, height)) break;
+        }
+        // 从当前最高层往下定位，把每层的前驱后继都记下来；上面已保证它不低于height
+        Node* x = head;
+        for (sb4 level = currentHeight.load(std::memory_order_relaxed) - 1; level >= 0; level--){
+            findSplice(key, x, level, &prev[level], &next[level]);
+            x = prev[level];
+            if (level == 0 && next[0] && compare(next[0]->key, key) == 0) return false;
+        }
+        Node* node = newNode(key, height);
+        for (ub4 level = 0; level < height; level++){
+            for (;;){
+                node->next[level].store(next[level], std::memory_order_relaxed);
+                if (prev[level]->next[level].compare_exchange_strong(next[level], node, std::memory_order_release)) break;
+                // 同一位置有人抢先，从原前驱重新定位这一层
+                findSplice(key, prev[level], level, &prev[level], &next[level]);
+                if (level == 0 && next[0] && compare(next[0]->key, key) == 0) return false;
+            }
+        }
+        count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool contains(const Key& key) const {
+        Node* x = findGreaterOrEqual(key);
+        return x && compare(x->key, key) == 0;
+    }
+
+    // 已插入的键数，并发插入时是近似值。
+    ub8 size() const { return count.load(std::memory_order_relaxed); }
+
+    // 单向迭代器，供有序扫描与落盘。迭代期间并发插入的键可能看得到也可能看不到，
+    // 但已经看到的顺序一定正确。
+    class Iterator{
+    public:
+        explicit Iterator(const SkipList* list) : list(list), node(nullptr){}
+
+        bool valid() const { return node != nullptr; }
+
+        const Key& key() const { return node->key; }
+
+        void next(){ node = node->next[0].load(std::memory_order_acquire); }
+
+        void seekToFirst(){ node = list->head->next[0].load(std::memory_order_acquire); }
+
+        // 定位到第一个不小于target的键。
+        void seek(const Key& target){ node = list->findGreaterOrEqual(target); }
+
+    private:
+        const SkipList* list;
+        Node*           node;
+    };
+
+private:
+    SkipList(const SkipList&) = delete;
+    SkipList& operator=(const SkipList&) = delete;
+
+    // next按实际高度变长，分配时只给height个指针的空间。
+    struct Node{
+        Key               key;
+        std::atomic<Node*> next[1];
+    };
+
+    Node* newNode(const Key& key, ub4 height){
+        char* p = arena.alloc(sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1));
+        if (!p) throw std::runtime_error("skiplist: arena alloc error");
+        Node* node = (Node*)p;
+        new(&node->key) Key(key);
+        for (ub4 i = 0; i < height; i++) new(&node->next[i]) std::atomic<Node*>(nullptr);
+        return node;
+    }
+
+    // 在level层上从start出发，找到key的前驱与后继：prev < key <= next。
+    void findSplice(const Key& key, Node* start, ub4 level, Node** prev, Node** next) const {
+        Node* x = start;
+        for (;;){
+            Node* n = x->next[level].load(std::memory_order_acquire);
+            if (n && compare(n->key, key) < 0) x = n;
+            else{
+                *prev = x;
+                *next = n;
+                return;
+            }
+        }
+    }
+
+    Node* findGreaterOrEqual(const Key& key) const {
+        Node* x = head;
+        Node* n = nullptr;
+        for (sb4 level = currentHeight.load(std::memory_order_relaxed) - 1; level >= 0; level--){
+            for (;;){
+                n = x->next[level].load(std::memory_order_acquire);
+                if (n && compare(n->key, key) < 0) x = n;
+                else break;
+            }
+        }
+        return n;
+    }
+
+    // 每线程一个xorshift状态，免得并发插入争抢同一个随机数发生器。
+    static ub4 randomHeight(){
+        static thread_local ub8 state = (ub8)(uintptr_t)&state | 1;
+        ub4 height = 1;
+        for (;;){
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            if (height < kMaxHeight && (state % kBranching) == 0) height++;
+            else return height;
+        }
+    }
+
+    Compare             compare;
+    Alloc&              arena;
+    Node*               head;
+    std::atomic<ub4>    currentHeight{1};
+    std::atomic<ub8>    count{0};
+};
+
+}